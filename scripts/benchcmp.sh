@@ -0,0 +1,45 @@
+#!/bin/sh
+# Compare the BENCH lines of two `make bench` logs, by default the i386 and
+# x86_64 builds `make bench-compare` runs: median cycles of each benchmark
+# in both and the second as a percentage of the first.
+# Usage: scripts/benchcmp.sh build/bench.log build/x86_64/bench.log
+if [ $# -ne 2 ]; then
+    echo "usage: $0 <base bench.log> <other bench.log>" >&2
+    exit 2
+fi
+awk '
+function field(key,    i) {
+    for (i = 2; i <= NF; i++)
+        if (index($i, key "=") == 1)
+            return substr($i, length(key) + 2)
+    return ""
+}
+{ sub(/\r$/, "") }
+$1 == "BENCH_INFO" {
+    arch[FILENAME == ARGV[1] ? 1 : 2] = field("arch")
+}
+$1 == "BENCH" {
+    name = field("name")
+    if (FILENAME == ARGV[1]) {
+        if (!(name in base))
+            order[n++] = name
+        base[name] = field("median")
+    } else {
+        other[name] = field("median")
+    }
+}
+END {
+    printf "%-18s %12s %12s %8s\n", "median cycles", arch[1], arch[2], "ratio"
+    for (i = 0; i < n; i++) {
+        name = order[i]
+        if (!(name in other)) {
+            printf "%-18s %12s %12s %8s\n", name, base[name], "-", "-"
+            continue
+        }
+        ratio = base[name] > 0 ? sprintf("%.0f%%", 100 * other[name] / base[name]) : "-"
+        printf "%-18s %12s %12s %8s\n", name, base[name], other[name], ratio
+    }
+    for (name in other)
+        if (!(name in base))
+            printf "%-18s %12s %12s %8s\n", name, "-", other[name], "-"
+}' "$1" "$2"
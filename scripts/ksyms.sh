@@ -0,0 +1,38 @@
+#!/bin/sh
+# Turn `nm -n` output of the first kernel link into build/ksyms.c, the
+# sorted function table the profiler attributes samples with.
+# Usage: nm -n dexiscore.pass1 | scripts/ksyms.sh > ksyms.c
+awk '
+BEGIN {
+    n = 0
+    print "/* Generated by scripts/ksyms.sh from the first link, do not edit */"
+    print "#include <stdint.h>"
+    print ""
+    print "#define KSYMS __attribute__((used, section(\".ksyms\")))"
+    print ""
+}
+# Code symbols only, the first name wins where two share an address
+NF == 3 && ($2 == "T" || $2 == "t") && $1 != last {
+    addr[n] = $1
+    name[n] = $3
+    last = $1
+    n++
+}
+END {
+    printf "KSYMS const uint32_t ksym_table_count = %d;\n\n", n
+    print "KSYMS const uint32_t ksym_table_addrs[] = {"
+    for (i = 0; i < n; i++)
+        printf "    0x%s,\n", addr[i]
+    print "    0\n};\n"
+    print "KSYMS const uint32_t ksym_table_names[] = {"
+    offset = 0
+    for (i = 0; i < n; i++) {
+        printf "    %d,\n", offset
+        offset += length(name[i]) + 1
+    }
+    print "    0\n};\n"
+    print "KSYMS const char ksym_table_strings[] ="
+    for (i = 0; i < n; i++)
+        printf "    \"%s\\0\"\n", name[i]
+    print "    \"\";"
+}'
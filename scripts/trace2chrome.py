@@ -0,0 +1,74 @@
+#!/usr/bin/env python3
+"""Turn the output of the dsh `trace serial` command into a Chrome trace.
+
+Usage: trace2chrome.py [serial.log] > trace.json
+
+The log may hold anything else the kernel printed, only the lines between
+TRACE_BEGIN and TRACE_END are used (the last such block if there are
+several). Open the result in chrome://tracing or https://ui.perfetto.dev.
+"""
+import json
+import sys
+
+
+def fields(line):
+    """Split "TRACE a=1 b=x" into a dict, values may not contain spaces."""
+    out = {}
+    for word in line.split()[1:]:
+        key, _, value = word.partition("=")
+        out[key] = value
+    return out
+
+
+def parse(lines):
+    header, records, block = None, [], None
+    for line in lines:
+        line = line.strip()
+        if line.startswith("TRACE_BEGIN"):
+            header, block = fields(line), []
+        elif line.startswith("TRACE_END"):
+            if block is not None:
+                records = block
+            block = None
+        elif line.startswith("TRACE ") and block is not None:
+            block.append(fields(line))
+    if header is None:
+        sys.exit("no TRACE_BEGIN block found")
+    return header, records
+
+
+def convert(header, records):
+    khz = int(header.get("tsc_khz", "0"))
+    if not khz:
+        sys.exit("tsc_khz=0, the kernel could not calibrate the TSC")
+    base = min((int(r["tsc"]) for r in records), default=0)
+    events = []
+    for r in records:
+        arg = r.get("arg", "")
+        # Spans named by a string (boot stage, command) get their own name
+        name = r["name"] if arg.isdigit() or not arg else "%s:%s" % (r["name"], arg)
+        event = {
+            "name": name,
+            "ph": r["ph"],
+            # TSC cycles to microseconds
+            "ts": (int(r["tsc"]) - base) * 1000.0 / khz,
+            "pid": 0,
+            "tid": int(r["cpu"]),
+            "args": {"arg": arg},
+        }
+        if r["ph"] == "i":
+            event["s"] = "t"
+        events.append(event)
+    return {"traceEvents": events, "displayTimeUnit": "ns"}
+
+
+def main():
+    source = open(sys.argv[1], errors="replace") if len(sys.argv) > 1 else sys.stdin
+    with source:
+        header, records = parse(source)
+    json.dump(convert(header, records), sys.stdout, indent=1)
+    sys.stdout.write("\n")
+
+
+if __name__ == "__main__":
+    main()
@@ -5,6 +5,22 @@ header_start:
     dd 0                   ; Arch: 0 = x86
     dd header_end - header_start ; Header length
     dd 0x100000000 - (0xe85250d6 + 0 + (header_end - header_start)) ; Control sum
+    ; Information request tag: the kernel can not run without a memory map,
+    ; the command line selects the batch modes
+    dw 1                   ; Type = 1 (information request)
+    dw 0                   ; Flags = 0 (required)
+    dd 16                  ; Size = 16
+    dd 6                   ; Memory map
+    dd 1                   ; Boot command line
+    ; Framebuffer tag: ask for a 1024x768 32 bpp linear framebuffer for the
+    ; console. Optional, with gfxpayload=text GRUB stays in VGA text mode
+    dw 5                   ; Type = 5 (framebuffer)
+    dw 1                   ; Flags = 1 (optional)
+    dd 20                  ; Size = 20
+    dd 1024                ; Width
+    dd 768                 ; Height
+    dd 32                  ; Depth
+    dd 0                   ; Padding, tags are 8-byte aligned
     ; Тег конца (END tag)
     dw 0                   ; Type = 0 (end)
     dw 0                   ; Flags = 0
@@ -18,7 +34,9 @@ _start:
     ; Sett up stack (Simplified)
     mov esp, stack_top
 
-    ; Calling C code
+    ; Calling C code: kmain(magic, multiboot info address)
+    push ebx
+    push eax
     extern kmain
     call kmain
 
@@ -0,0 +1,167 @@
+; Multiboot2 header and long-mode entry for the x86_64 kernel. GRUB starts
+; us the same way as the i386 kernel, in 32-bit protected mode with paging
+; off; this identity maps the first 4 GiB with 2 MiB pages, turns on long
+; mode and calls kmain with the multiboot magic and info address.
+; paging_init() replaces these tables later.
+
+; Multiboot2 header for GRUB, the same requests as boot.asm
+section .multiboot
+header_start:
+    dd 0xe85250d6          ; Magic number (Multiboot2)
+    dd 0                   ; Arch: 0 = x86, GRUB enters 32-bit code either way
+    dd header_end - header_start ; Header length
+    dd 0x100000000 - (0xe85250d6 + 0 + (header_end - header_start)) ; Control sum
+    ; Information request tag: the memory map and the command line
+    dw 1                   ; Type = 1 (information request)
+    dw 0                   ; Flags = 0 (required)
+    dd 16                  ; Size = 16
+    dd 6                   ; Memory map
+    dd 1                   ; Boot command line
+    ; Framebuffer tag, optional as in boot.asm
+    dw 5                   ; Type = 5 (framebuffer)
+    dw 1                   ; Flags = 1 (optional)
+    dd 20                  ; Size = 20
+    dd 1024                ; Width
+    dd 768                 ; Height
+    dd 32                  ; Depth
+    dd 0                   ; Padding, tags are 8-byte aligned
+    dw 0                   ; Type = 0 (end)
+    dw 0                   ; Flags = 0
+    dd 8                   ; Size = 8
+header_end:
+
+PAGE_PRESENT_WRITE equ 0x003
+PAGE_LARGE equ 0x080       ; 2 MiB page in a page directory entry
+CR4_PAE equ 1 << 5
+CR0_PG equ 1 << 31
+MSR_EFER equ 0xC0000080
+EFER_LME equ 1 << 8
+CPUID_LONG_MODE equ 1 << 29 ; Leaf 0x80000001 EDX
+
+section .text
+bits 32
+global _start
+_start:
+    cld                    ; Multiboot2 does not say which way string ops go
+    mov esp, stack_top
+    ; kmain's arguments, in the registers the 64-bit calling convention
+    ; passes them in. cpuid below leaves esi and edi alone.
+    mov edi, eax
+    mov esi, ebx
+
+    mov eax, 0x80000000
+    cpuid
+    cmp eax, 0x80000001
+    jb no_long_mode
+    mov eax, 0x80000001
+    cpuid
+    test edx, CPUID_LONG_MODE
+    jz no_long_mode
+
+    ; PML4[0] -> PDPT, PDPT[0-3] -> the four page directories. GRUB
+    ; cleared .bss, so the upper halves and other entries are zero.
+    mov dword [boot_pml4], boot_pdpt + PAGE_PRESENT_WRITE
+    xor ecx, ecx
+.pdpt:
+    mov eax, ecx
+    shl eax, 12
+    add eax, boot_pd + PAGE_PRESENT_WRITE
+    mov [boot_pdpt + ecx * 8], eax
+    inc ecx
+    cmp ecx, 4
+    jb .pdpt
+
+    ; Entry i of the 2048 maps i * 2 MiB, which stays below 4 GiB
+    xor ecx, ecx
+.pd:
+    mov eax, ecx
+    shl eax, 21
+    or eax, PAGE_PRESENT_WRITE | PAGE_LARGE
+    mov [boot_pd + ecx * 8], eax
+    inc ecx
+    cmp ecx, 2048
+    jb .pd
+
+    mov eax, boot_pml4
+    mov cr3, eax
+    mov eax, cr4
+    or eax, CR4_PAE
+    mov cr4, eax
+    mov ecx, MSR_EFER
+    rdmsr
+    or eax, EFER_LME
+    wrmsr
+    mov eax, cr0
+    or eax, CR0_PG         ; With LME set this enters long mode
+    mov cr0, eax
+
+    lgdt [boot_gdtr]
+    jmp 0x08:long_mode
+
+; Say so on the VGA text screen and stop, there is no 32-bit fallback
+no_long_mode:
+    mov esi, no_long_mode_msg
+    mov edi, 0xB8000
+.print:
+    lodsb
+    test al, al
+    jz halt32
+    mov ah, 0x4F           ; White on red
+    stosw
+    jmp .print
+halt32:
+    cli
+    hlt
+    jmp halt32
+
+bits 64
+long_mode:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov ss, ax
+    xor ax, ax
+    mov fs, ax
+    mov gs, ax
+    mov rsp, stack_top
+    ; The upper halves of the registers are undefined after the switch
+    mov edi, edi
+    mov esi, esi
+
+    ; kmain(magic, multiboot info address)
+    extern kmain
+    call kmain
+
+    ; If kmain returns — halt
+halt:
+    cli
+    hlt
+    jmp halt
+
+section .rodata
+no_long_mode_msg:
+    db "DexisCore x86_64 needs a 64-bit CPU, boot the i386 build instead", 0
+
+; Flat code (64-bit) and data at the selectors the kernel uses, until
+; gdt_init() loads the kernel's own GDT
+align 8
+boot_gdt:
+    dq 0
+    dq 0x00AF9A000000FFFF
+    dq 0x00CF92000000FFFF
+boot_gdtr:
+    dw boot_gdtr - boot_gdt - 1
+    dd boot_gdt
+
+section .bss
+align 4096
+boot_pml4:
+    resb 4096
+boot_pdpt:
+    resb 4096
+boot_pd:
+    resb 4 * 4096
+align 16
+stack_bottom:
+    resb 16384            ; 16 KiB stack
+stack_top:
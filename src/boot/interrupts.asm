@@ -0,0 +1,67 @@
+; GDT/IDT loading and interrupt entry stubs
+bits 32
+
+section .text
+
+; void gdt_flush(const struct gdt_ptr* ptr)
+global gdt_flush
+gdt_flush:
+    mov eax, [esp + 4]
+    lgdt [eax]
+    mov ax, 0x10           ; Kernel data selector
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+    jmp 0x08:.reload_cs    ; Kernel code selector
+.reload_cs:
+    ret
+
+; void idt_load(const struct idt_ptr* ptr)
+global idt_load
+idt_load:
+    mov eax, [esp + 4]
+    lidt [eax]
+    ret
+
+; One stub per vector. CPU exceptions 8, 10-14, 17, 21, 29 and 30 push an
+; error code themselves, the rest push a dummy 0 so the frame looks the same.
+%assign vec 0
+%rep 256
+isr_stub_ %+ vec:
+%if vec != 8 && (vec < 10 || vec > 14) && vec != 17 && vec != 21 && vec != 29 && vec != 30
+    push dword 0
+%endif
+    push dword vec
+    jmp isr_common
+%assign vec vec + 1
+%endrep
+
+; Builds struct interrupt_frame (see idt.h) and calls isr_dispatch
+extern isr_dispatch
+isr_common:
+    pusha
+    push ds
+    push es
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    cld
+    push esp               ; struct interrupt_frame*
+    call isr_dispatch
+    add esp, 4
+    pop es
+    pop ds
+    popa
+    add esp, 8             ; Drop vector number and error code
+    iret
+
+section .rodata
+global isr_stub_table
+isr_stub_table:
+%assign vec 0
+%rep 256
+    dd isr_stub_ %+ vec
+%assign vec vec + 1
+%endrep
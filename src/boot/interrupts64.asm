@@ -0,0 +1,90 @@
+; GDT/IDT loading and interrupt entry stubs for x86_64, see interrupts.asm
+bits 64
+
+section .text
+
+; void gdt_flush(const struct gdt_ptr* ptr)
+global gdt_flush
+gdt_flush:
+    lgdt [rdi]
+    mov ax, 0x10           ; Kernel data selector
+    mov ds, ax
+    mov es, ax
+    mov ss, ax
+    ; fs and gs stay as they are: loading a selector would clear the GS
+    ; base gdt_load_cpu_segment() points at the CPU's struct cpu
+    pop rdi                ; Return address
+    push qword 0x08        ; Kernel code selector
+    push rdi
+    o64 retf
+
+; void idt_load(const struct idt_ptr* ptr)
+global idt_load
+idt_load:
+    lidt [rdi]
+    ret
+
+; One stub per vector. CPU exceptions 8, 10-14, 17, 21, 29 and 30 push an
+; error code themselves, the rest push a dummy 0 so the frame looks the same.
+%assign vec 0
+%rep 256
+isr_stub_ %+ vec:
+%if vec != 8 && (vec < 10 || vec > 14) && vec != 17 && vec != 21 && vec != 29 && vec != 30
+    push qword 0
+%endif
+    push qword vec
+    jmp isr_common
+%assign vec vec + 1
+%endrep
+
+; Builds struct interrupt_frame (see idt.h) and calls isr_dispatch. Long
+; mode has no pusha and ignores ds/es, so it is the general registers only.
+extern isr_dispatch
+isr_common:
+    push rax
+    push rbx
+    push rcx
+    push rdx
+    push rsi
+    push rdi
+    push rbp
+    push r8
+    push r9
+    push r10
+    push r11
+    push r12
+    push r13
+    push r14
+    push r15
+    cld
+    mov rdi, rsp           ; struct interrupt_frame*
+    mov rbx, rsp           ; Callee-saved, survives the call
+    and rsp, ~15           ; The ABI wants a 16-byte aligned stack at the call
+    call isr_dispatch
+    mov rsp, rbx
+    pop r15
+    pop r14
+    pop r13
+    pop r12
+    pop r11
+    pop r10
+    pop r9
+    pop r8
+    pop rbp
+    pop rdi
+    pop rsi
+    pop rdx
+    pop rcx
+    pop rbx
+    pop rax
+    add rsp, 16            ; Drop vector number and error code
+    iretq
+
+section .rodata
+global isr_stub_table
+isr_stub_table:
+%assign vec 0
+%rep 256
+    dq isr_stub_ %+ vec
+%assign vec vec + 1
+%endrep
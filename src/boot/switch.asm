@@ -0,0 +1,24 @@
+; Kernel thread context switch, see sched.c
+bits 32
+
+section .text
+
+; void switch_context(uint32_t* save_esp, uint32_t load_esp)
+; Everything else the C calling convention lets a callee clobber, and the
+; interrupt flag, is the caller's business: sched.c switches with
+; interrupts off and each thread restores its own flags afterwards.
+global switch_context
+switch_context:
+    mov eax, [esp + 4]     ; save_esp
+    mov edx, [esp + 8]     ; load_esp
+    push ebp
+    push ebx
+    push esi
+    push edi
+    mov [eax], esp
+    mov esp, edx
+    pop edi
+    pop esi
+    pop ebx
+    pop ebp
+    ret                    ; Into the next thread's schedule(), or thread_bootstrap() the first time
@@ -0,0 +1,25 @@
+; Kernel thread context switch for x86_64, see switch.asm and sched.c
+bits 64
+
+section .text
+
+; void switch_context(uintptr_t* save_sp, uintptr_t load_sp)
+; Saves the registers the System V ABI makes callee-saved; the stack
+; sched.c builds for a new thread has SWITCH_SAVED_REGS slots for them.
+global switch_context
+switch_context:
+    push rbp
+    push rbx
+    push r12
+    push r13
+    push r14
+    push r15
+    mov [rdi], rsp
+    mov rsp, rsi
+    pop r15
+    pop r14
+    pop r13
+    pop r12
+    pop rbx
+    pop rbp
+    ret                    ; Into the next thread's schedule(), or thread_bootstrap() the first time
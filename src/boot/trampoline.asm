@@ -0,0 +1,67 @@
+; Startup code for the other CPUs. smp.c copies everything between
+; trampoline_start and trampoline_end to SMP_TRAMPOLINE_BASE and sends the
+; startup IPI for that page: the CPU begins here in real mode with
+; CS = base >> 4, IP = 0. It switches to flat protected mode and calls
+; trampoline_entry(trampoline_arg) on trampoline_stack, which smp.c fills
+; in (in the copy) before each start.
+bits 16
+
+TRAMPOLINE_BASE equ 0x8000 ; SMP_TRAMPOLINE_BASE in smp.h
+
+; Address of a trampoline label in the copy
+%define REL(label) (TRAMPOLINE_BASE + (label) - trampoline_start)
+
+section .rodata
+global trampoline_start
+global trampoline_end
+global trampoline_params
+
+trampoline_start:
+    cli
+    cld
+    xor ax, ax
+    mov ds, ax
+    o32 lgdt [REL(trampoline_gdtr)]
+    mov eax, cr0
+    or eax, 1              ; PE
+    mov cr0, eax
+    jmp dword 0x08:REL(trampoline_32)
+
+bits 32
+trampoline_32:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov fs, ax
+    mov gs, ax
+    mov ss, ax
+    mov esp, [REL(trampoline_stack)]
+    push dword [REL(trampoline_arg)]
+    mov eax, [REL(trampoline_entry)]
+    call eax               ; Does not return
+.hang:
+    cli
+    hlt
+    jmp .hang
+
+; Flat code and data at the selectors the kernel uses, until the CPU
+; loads the kernel's own GDT
+align 8
+trampoline_gdt:
+    dq 0
+    dq 0x00CF9A000000FFFF
+    dq 0x00CF92000000FFFF
+trampoline_gdtr:
+    dw trampoline_gdtr - trampoline_gdt - 1
+    dd REL(trampoline_gdt)
+
+; struct trampoline_params in smp.c
+align 4
+trampoline_params:
+trampoline_stack:
+    dd 0
+trampoline_entry:
+    dd 0
+trampoline_arg:
+    dd 0
+trampoline_end:
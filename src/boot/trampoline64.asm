@@ -0,0 +1,95 @@
+; Startup code for the other CPUs on x86_64, see trampoline.asm. The CPU
+; still starts in real mode; this goes through protected mode to long mode
+; on the page tables the bootstrap CPU uses (trampoline_cr3) and calls
+; trampoline_entry(trampoline_arg) on trampoline_stack.
+bits 16
+
+TRAMPOLINE_BASE equ 0x8000 ; SMP_TRAMPOLINE_BASE in smp.h
+
+CR4_PAE equ 1 << 5
+CR0_PG equ 1 << 31
+MSR_EFER equ 0xC0000080
+EFER_LME equ 1 << 8
+
+; Address of a trampoline label in the copy
+%define REL(label) (TRAMPOLINE_BASE + (label) - trampoline_start)
+
+section .rodata
+global trampoline_start
+global trampoline_end
+global trampoline_params
+
+trampoline_start:
+    cli
+    cld
+    xor ax, ax
+    mov ds, ax
+    o32 lgdt [REL(trampoline_gdtr)]
+    mov eax, cr0
+    or eax, 1              ; PE
+    mov cr0, eax
+    jmp dword 0x08:REL(trampoline_32)
+
+bits 32
+trampoline_32:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov ss, ax
+    mov eax, cr4
+    or eax, CR4_PAE
+    mov cr4, eax
+    mov eax, [REL(trampoline_cr3)]
+    mov cr3, eax
+    mov ecx, MSR_EFER
+    rdmsr
+    or eax, EFER_LME
+    wrmsr
+    mov eax, cr0
+    or eax, CR0_PG         ; With LME set this enters long mode
+    mov cr0, eax
+    jmp 0x18:REL(trampoline_64)
+
+bits 64
+trampoline_64:
+    mov ax, 0x10
+    mov ds, ax
+    mov es, ax
+    mov ss, ax
+    xor ax, ax
+    mov fs, ax
+    mov gs, ax
+    mov rsp, [REL(trampoline_stack)]
+    mov rdi, [REL(trampoline_arg)]
+    mov rax, [REL(trampoline_entry)]
+    call rax               ; Does not return
+.hang:
+    cli
+    hlt
+    jmp .hang
+
+; Flat 32-bit code and data, and the 64-bit code segment to jump to, until
+; the CPU loads the kernel's own GDT
+align 8
+trampoline_gdt:
+    dq 0
+    dq 0x00CF9A000000FFFF
+    dq 0x00CF92000000FFFF
+    dq 0x00AF9A000000FFFF
+trampoline_gdtr:
+    dw trampoline_gdtr - trampoline_gdt - 1
+    dd REL(trampoline_gdt)
+
+; struct trampoline_params in smp.c
+align 8
+trampoline_params:
+trampoline_stack:
+    dq 0
+trampoline_entry:
+    dq 0
+trampoline_arg:
+    dq 0
+trampoline_cr3:
+    dd 0
+    dd 0                   ; Padding, the struct is a multiple of 8 bytes
+trampoline_end:
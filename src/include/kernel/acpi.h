@@ -0,0 +1,31 @@
+#ifndef KERNEL_ACPI_H
+#define KERNEL_ACPI_H
+
+#include <stdint.h>
+#include <kernel/smp.h>
+
+#define ACPI_ISA_IRQS 16
+
+/* MADT interrupt source override flags (MPS INTI flags) */
+#define ACPI_POLARITY_MASK 0x3
+#define ACPI_POLARITY_LOW 0x3
+#define ACPI_TRIGGER_MASK 0xC
+#define ACPI_TRIGGER_LEVEL 0xC
+
+/* What the kernel needs from the MADT ("APIC" table) */
+struct acpi_madt_info {
+    uint32_t lapic_address;
+    uint32_t cpu_count;                  // Enabled CPUs, at most SMP_MAX_CPUS are kept
+    uint8_t cpu_apic_ids[SMP_MAX_CPUS];
+    uint32_t ioapic_address;             // First IOAPIC, 0 if there is none
+    uint32_t ioapic_gsi_base;
+    uint32_t isa_gsi[ACPI_ISA_IRQS];     // Where each ISA IRQ arrives on the IOAPIC
+    uint16_t isa_flags[ACPI_ISA_IRQS];   // Its polarity and trigger mode, 0 = ISA default
+    int has_8259;                        // Legacy PICs present (PCAT_COMPAT)
+};
+
+// Find the RSDP (from the multiboot2 ACPI tags, or by scanning the BIOS
+// areas) and parse the MADT. Returns 0 if there is no usable MADT.
+int acpi_parse_madt(struct acpi_madt_info* out);
+
+#endif // KERNEL_ACPI_H
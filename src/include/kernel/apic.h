@@ -0,0 +1,37 @@
+#ifndef KERNEL_APIC_H
+#define KERNEL_APIC_H
+
+#include <stdint.h>
+#include <kernel/acpi.h>
+
+/* Vectors above the ISA IRQs (32-47) */
+#define APIC_TIMER_VECTOR 0x40
+#define APIC_RESCHEDULE_VECTOR 0x41  // IPI: another CPU queued a thread for us
+#define APIC_SPURIOUS_VECTOR 0xFF
+
+// Enable the boot CPU's local APIC and move the ISA IRQs from the 8259s
+// to the IOAPIC, keeping the ones that were unmasked. With interrupts
+// disabled. Returns 0 (and changes nothing) if the MADT has no IOAPIC.
+int apic_init(const struct acpi_madt_info* madt);
+
+// Enable the local APIC of the CPU this runs on (the other CPUs)
+void apic_init_ap(void);
+
+// Nonzero once apic_init() succeeded: IRQs come through the IOAPIC and
+// are acknowledged with lapic_eoi()
+int apic_enabled(void);
+
+uint32_t lapic_id(void);
+void lapic_eoi(void);
+void lapic_send_ipi(uint32_t apic_id, uint8_t vector);
+void lapic_send_init(uint32_t apic_id);
+void lapic_send_startup(uint32_t apic_id, uint32_t page_address);
+
+// Periodic local timer on APIC_TIMER_VECTOR, measured against the TSC the
+// first time. The handler must be installed by the caller.
+void lapic_timer_start(uint32_t hz);
+
+void ioapic_mask_irq(uint8_t irq);
+void ioapic_unmask_irq(uint8_t irq);
+
+#endif // KERNEL_APIC_H
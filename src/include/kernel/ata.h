@@ -0,0 +1,27 @@
+#ifndef KERNEL_ATA_H
+#define KERNEL_ATA_H
+
+#include <stdint.h>
+
+#define ATA_MAX_DRIVES 4
+
+struct ata_info {
+    char name[8];            // hda, hdb (primary) hdc, hdd (secondary)
+    char model[41];
+    uint64_t sectors;
+    int lba48;
+    int dma;                 // 0 once DMA failed and the drive fell back to PIO
+};
+
+/*
+ * Find the IDE controller on the PCI bus, identify the drives on both
+ * channels and register them as block devices (see blk.h). Transfers use
+ * bus-master DMA completed by the channel's IRQ when the controller and
+ * the drive can do it, PIO otherwise.
+ */
+void ata_init(void);
+
+// Returns 0 past the last drive
+int ata_get_info(uint32_t index, struct ata_info* out);
+
+#endif // KERNEL_ATA_H
@@ -0,0 +1,35 @@
+#ifndef KERNEL_ATOMIC_H
+#define KERNEL_ATOMIC_H
+
+#include <stdint.h>
+
+/*
+ * Locked read-modify-write on a 32-bit word, safe against other CPUs and
+ * interrupts. All of them are full barriers on x86, for the compiler too.
+ */
+
+// Store desired if *p equals expected. Returns the old value, so the
+// swap happened if that equals expected.
+static inline uint32_t atomic_cmpxchg(volatile uint32_t* p, uint32_t expected, uint32_t desired) {
+    __asm__ volatile ("lock cmpxchgl %2, %1" : "+a"(expected), "+m"(*p) : "r"(desired) : "memory");
+    return expected;
+}
+
+// Add value and return what was there before
+static inline uint32_t atomic_fetch_add(volatile uint32_t* p, uint32_t value) {
+    __asm__ volatile ("lock xaddl %0, %1" : "+r"(value), "+m"(*p) : : "memory");
+    return value;
+}
+
+static inline void atomic_inc(volatile uint32_t* p) {
+    __asm__ volatile ("lock incl %0" : "+m"(*p) : : "memory");
+}
+
+// Keep the compiler from moving memory accesses across this point. x86
+// keeps loads and stores in order otherwise, except a store followed by
+// a load from another address.
+static inline void barrier(void) {
+    __asm__ volatile ("" : : : "memory");
+}
+
+#endif // KERNEL_ATOMIC_H
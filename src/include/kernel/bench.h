@@ -0,0 +1,51 @@
+#ifndef KERNEL_BENCH_H
+#define KERNEL_BENCH_H
+
+#include <stdint.h>
+
+/*
+ * A microbenchmark: run() is timed with rdtsc once per sample. setup()
+ * and teardown() are optional and run outside the timing, a nonzero
+ * return from setup() skips the benchmark.
+ */
+struct bench {
+    const char* name;
+    void (*run)(void);
+    int (*setup)(void);
+    void (*teardown)(void);
+    uint32_t samples;
+};
+
+/*
+ * Register a benchmark next to the code it measures. Entries go to the
+ * .benches section, the linker script collects them between
+ * __benches_start and __benches_end.
+ */
+#define BENCH(bench_name, bench_run, bench_setup, bench_teardown, bench_samples) \
+    static const struct bench bench_entry_##bench_name \
+    __attribute__((used, section(".benches"), aligned(sizeof(void*)))) = { \
+        #bench_name, bench_run, bench_setup, bench_teardown, bench_samples \
+    }
+
+// Cycles per call, rdtsc overhead already taken off
+struct bench_result {
+    uint32_t min;
+    uint32_t median;
+    uint32_t p99;
+    uint32_t samples;
+};
+
+// Walk the registered benchmarks (NULL starts the walk)
+const struct bench* bench_next(const struct bench* prev);
+
+// Returns 0 if setup failed or there was no memory for the samples.
+// Runs are serialized, a thread calling it while another benchmark runs
+// sleeps until that one is done
+int bench_run(const struct bench* b, struct bench_result* out);
+
+// Run every benchmark whose name starts with filter ("" for all), print a
+// table on the console and one "BENCH name=... min=... median=... p99=..."
+// line per benchmark on the serial port. Returns how many ran
+int bench_run_all(const char* filter);
+
+#endif // KERNEL_BENCH_H
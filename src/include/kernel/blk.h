@@ -0,0 +1,143 @@
+#ifndef KERNEL_BLK_H
+#define KERNEL_BLK_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <kernel/sched.h>
+
+#define BLK_SECTOR_SIZE 512
+#define BLK_BLOCK_SIZE 4096                                   // Cache block
+#define BLK_SECTORS_PER_BLOCK (BLK_BLOCK_SIZE / BLK_SECTOR_SIZE)
+#define BLK_MAX_SEGMENTS 32                                   // Requests merged into one transfer
+#define BLK_MAX_DEVICES 4
+#define BLK_NAME_LEN 8
+
+/* One piece of a transfer: whole sectors at buffer */
+struct blk_segment {
+    void* buffer;
+    uint32_t sectors;
+};
+
+/*
+ * A read or write of whole sectors. Submitted requests are kept sorted by
+ * lba; when the device is free the queue is dispatched from the front,
+ * merging requests in the same direction whose sectors follow on from
+ * each other into one transfer (up to max_sectors and BLK_MAX_SEGMENTS).
+ */
+struct blk_request {
+    uint64_t lba;
+    uint32_t count;
+    void* buffer;
+    int write;
+    volatile int done;
+    int error;
+    struct blk_request* next;
+};
+
+struct blk_stats {
+    uint32_t requests;       // Submitted
+    uint32_t transfers;      // Issued to the driver, after merging
+    uint32_t merged;         // Requests that joined another one's transfer
+    uint32_t errors;
+    uint64_t sectors_read;
+    uint64_t sectors_written;
+};
+
+struct blk_device {
+    char name[BLK_NAME_LEN];
+    uint64_t sectors;
+    uint32_t max_sectors;    // Per transfer
+    // Move sectors starting at lba, segments in order. Runs in thread
+    // context and may sleep, one call at a time per device. 0 on success
+    int (*transfer)(struct blk_device* dev, uint64_t lba, const struct blk_segment* segments,
+                    uint32_t count, int write);
+    int (*flush)(struct blk_device* dev);  // Drain the drive's write cache, optional
+    void* driver;
+    const char* mode;        // For lsblk: "dma", "pio" ...
+
+    /* Request queue, under queue.lock (see sched.h for the pattern) */
+    struct wait_queue queue;  // Also where waiters for completions sleep
+    struct blk_request* pending;
+    int busy;                 // A thread is dispatching
+    int plugged;              // Hold dispatch while a batch is queued
+    struct blk_stats stats;
+};
+
+// Make a device known to lsblk, blk_find() and sync. Returns 0 when full.
+int blk_register(struct blk_device* dev);
+struct blk_device* blk_get(uint32_t index);
+struct blk_device* blk_find(const char* name);
+
+// Queue a request; it is dispatched right away unless the device is
+// plugged. blk_wait() sleeps until it is done and returns its error.
+void blk_submit(struct blk_device* dev, struct blk_request* req);
+int blk_wait(struct blk_device* dev, struct blk_request* req);
+
+// Between plug and unplug, submitted requests only queue up, so a batch
+// is sorted and merged as a whole
+void blk_plug(struct blk_device* dev);
+void blk_unplug(struct blk_device* dev);
+
+// Synchronous read or write through the queue, bypassing the cache
+int blk_rw(struct blk_device* dev, uint64_t lba, uint32_t count, void* buffer, int write);
+
+/*
+ * Buffer cache: BLK_BLOCK_SIZE blocks, found through a hash table and
+ * recycled least recently used first. Writes stay in the cache (write
+ * back) until blk_sync() or until the block is evicted.
+ *
+ *     struct blk_buf* b = blk_bread(dev, block);
+ *     ... read or change b->data, blk_mark_dirty(b) after a change ...
+ *     blk_brelse(b);
+ */
+struct blk_buf {
+    struct blk_device* dev;
+    uint32_t block;
+    uint8_t* data;
+    uint32_t flags;          // BLK_BUF_*
+    uint32_t refs;
+    struct blk_buf* hash_next;
+    struct blk_buf* lru_prev;  // Most recently used first
+    struct blk_buf* lru_next;
+};
+
+#define BLK_BUF_VALID 0x1
+#define BLK_BUF_DIRTY 0x2
+#define BLK_BUF_BUSY 0x4     // Being read or written
+
+struct blk_cache_stats {
+    uint32_t hits;
+    uint32_t misses;
+    uint32_t readahead;      // Blocks read ahead of a sequential reader
+    uint32_t evictions;
+    uint32_t writebacks;     // Dirty blocks written to disk
+    uint32_t blocks;         // In use
+    uint32_t dirty;
+};
+
+// Returns the block with valid data and a reference held, NULL on an I/O
+// error, out of memory or a block past the end of the device
+struct blk_buf* blk_bread(struct blk_device* dev, uint32_t block);
+void blk_mark_dirty(struct blk_buf* buf);
+void blk_brelse(struct blk_buf* buf);
+
+// Write every dirty block of dev (NULL: of all devices) and flush the
+// drives' caches, returns the number of errors
+int blk_sync(struct blk_device* dev);
+
+// Sync dev, then drop its blocks from the cache, so the next reads go to
+// the disk. Referenced blocks stay.
+int blk_cache_drop(struct blk_device* dev);
+
+void blk_cache_get_stats(struct blk_cache_stats* out);
+uint32_t blk_device_blocks(const struct blk_device* dev);
+
+/*
+ * Read throughput of dev: raw sequential transfers, then sequential and
+ * random block reads through the cache, up to mib MiB (0 = 16). Prints
+ * on the console and one "BLKBENCH ..." line per test on the serial port.
+ * Returns 0 on an I/O error.
+ */
+int blk_bench(struct blk_device* dev, uint32_t mib);
+
+#endif // KERNEL_BLK_H
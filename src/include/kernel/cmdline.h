@@ -0,0 +1,14 @@
+#ifndef KERNEL_CMDLINE_H
+#define KERNEL_CMDLINE_H
+
+#include <stddef.h>
+
+/*
+ * Options on the kernel command line are space separated key=value words,
+ * double quotes keep spaces in a value: dexis.script="bench memcpy".
+ * Copies the value of key into value (at most size - 1 characters,
+ * always terminated) and returns 1, or returns 0 if key is not there.
+ */
+int cmdline_get(const char* key, char* value, size_t size);
+
+#endif // KERNEL_CMDLINE_H
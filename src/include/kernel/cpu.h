@@ -0,0 +1,104 @@
+#ifndef KERNEL_CPU_H
+#define KERNEL_CPU_H
+
+#include <stdint.h>
+
+/* CPUID leaf 1 EDX feature bits */
+#define CPUID_FEAT_TSC (1 << 4)
+#define CPUID_FEAT_MSR (1 << 5)
+#define CPUID_FEAT_PSE (1 << 3)
+#define CPUID_FEAT_APIC (1 << 9)
+#define CPUID_FEAT_PGE (1 << 13)
+#define CPUID_FEAT_PAT (1 << 16)
+#define CPUID_FEAT_FXSR (1 << 24)
+#define CPUID_FEAT_SSE2 (1 << 26)
+
+/* Control register bits */
+#define CR0_MP (1u << 1)
+#define CR0_EM (1u << 2)
+#define CR0_PG (1u << 31)
+#define CR4_PSE (1u << 4)
+#define CR4_PGE (1u << 7)
+#define CR4_OSFXSR (1u << 9)
+#define CR4_OSXMMEXCPT (1u << 10)
+
+#define MSR_IA32_PAT 0x277
+#define MSR_GS_BASE 0xC0000101
+
+// What the kernel was built for, see ARCH in the Makefile
+#ifdef __x86_64__
+#define ARCH_NAME "x86_64"
+#else
+#define ARCH_NAME "i386"
+#endif
+
+static inline void cpuid(uint32_t leaf, uint32_t* eax, uint32_t* ebx, uint32_t* ecx, uint32_t* edx) {
+    __asm__ volatile ("cpuid" : "=a"(*eax), "=b"(*ebx), "=c"(*ecx), "=d"(*edx) : "a"(leaf), "c"(0));
+}
+
+// Feature bits from CPUID leaf 1 EDX
+static inline uint32_t cpuid_features_edx(void) {
+    uint32_t eax, ebx, ecx, edx;
+    cpuid(1, &eax, &ebx, &ecx, &edx);
+    return edx;
+}
+
+// Read the time stamp counter
+static inline uint64_t rdtsc(void) {
+    uint32_t lo, hi;
+    __asm__ volatile ("rdtsc" : "=a"(lo), "=d"(hi));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline uint64_t rdmsr(uint32_t msr) {
+    uint32_t lo, hi;
+    __asm__ volatile ("rdmsr" : "=a"(lo), "=d"(hi) : "c"(msr));
+    return ((uint64_t)hi << 32) | lo;
+}
+
+static inline void wrmsr(uint32_t msr, uint64_t value) {
+    __asm__ volatile ("wrmsr" : : "c"(msr), "a"((uint32_t)value), "d"((uint32_t)(value >> 32)));
+}
+
+/* Control registers are as wide as the general-purpose ones */
+static inline uintptr_t read_cr0(void) {
+    uintptr_t value;
+    __asm__ volatile ("mov %%cr0, %0" : "=r"(value));
+    return value;
+}
+
+static inline void write_cr0(uintptr_t value) {
+    __asm__ volatile ("mov %0, %%cr0" : : "r"(value) : "memory");
+}
+
+static inline uintptr_t read_cr2(void) {
+    uintptr_t value;
+    __asm__ volatile ("mov %%cr2, %0" : "=r"(value));
+    return value;
+}
+
+static inline uintptr_t read_cr3(void) {
+    uintptr_t value;
+    __asm__ volatile ("mov %%cr3, %0" : "=r"(value));
+    return value;
+}
+
+static inline void write_cr3(uintptr_t value) {
+    __asm__ volatile ("mov %0, %%cr3" : : "r"(value) : "memory");
+}
+
+static inline uintptr_t read_cr4(void) {
+    uintptr_t value;
+    __asm__ volatile ("mov %%cr4, %0" : "=r"(value));
+    return value;
+}
+
+static inline void write_cr4(uintptr_t value) {
+    __asm__ volatile ("mov %0, %%cr4" : : "r"(value) : "memory");
+}
+
+static inline void invlpg(uintptr_t addr) {
+    __asm__ volatile ("invlpg (%0)" : : "r"(addr) : "memory");
+}
+
+#endif // KERNEL_CPU_H
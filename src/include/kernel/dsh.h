@@ -1,7 +1,71 @@
 #ifndef KERNEL_DSH_H
 #define KERNEL_DSH_H
 
+#include <stddef.h>
+
+#define DSH_MAX_ARGS 16  // Including the command name
+
+// Command handler, argv[0] is the command name and argv[argc] is NULL
+typedef int (*dsh_handler_t)(int argc, char **argv);
+
+struct dsh_command {
+    const char *name;
+    dsh_handler_t handler;
+    const char *usage;   // Argument synopsis for help, "" if none
+    const char *help;
+    int min_args;        // Allowed argument count, not counting argv[0]
+    int max_args;
+};
+
+/*
+ * Register a builtin. The entry is placed in the .dsh_commands section,
+ * the linker script collects them between __dsh_commands_start and
+ * __dsh_commands_end and the shell builds its lookup trie from that at
+ * start-up. The name must be a plain identifier.
+ */
+#define DSH_COMMAND(cmd_name, cmd_handler, cmd_min, cmd_max, cmd_usage, cmd_help) \
+    static const struct dsh_command dsh_command_##cmd_name \
+    __attribute__((used, section(".dsh_commands"), aligned(sizeof(void*)))) = { \
+        #cmd_name, cmd_handler, cmd_usage, cmd_help, cmd_min, cmd_max \
+    }
+
 // Load basic shell dsh
 void dsh_run(void);
 
+/*
+ * Run one command line: commands separated by ';' run in turn, and
+ * "a | b | c" is a pipeline. Everything a stage writes to the terminal
+ * goes into an in-memory buffer instead, which the next stage reads with
+ * dsh_input(); only the last stage's output reaches the console. '"'
+ * quotes ';' and '|' like spaces. Returns the status of the last command
+ * (a pipeline's is its last stage's), -1 for a line that cannot run.
+ */
+int dsh_execute(const char *line);
+
+// Run a script: one command line per line, empty lines and lines starting
+// with '#' skipped. Returns the status of the last command.
+int dsh_execute_script(const char *text, size_t len);
+
+// What the previous pipeline stage wrote, NULL (and *len 0) when the
+// running command is not on the reading end of a pipe
+const char *dsh_input(size_t *len);
+
+// Nonzero if the running command's output goes into a pipe, not to the
+// console, so it can leave out blank lines that only space out the screen
+int dsh_output_piped(void);
+
+/*
+ * Errors reach the console even from inside a pipeline, instead of the
+ * next stage's input. dsh_error() prints one message, spaced out like
+ * other output; longer ones go between dsh_console_begin() and
+ * dsh_console_end(), which gets what begin returned.
+ */
+struct dsh_stream;
+struct dsh_stream *dsh_console_begin(void);
+void dsh_console_end(struct dsh_stream *out);
+void dsh_error(const char *msg);
+
+// Call fn for every registered command in name order
+void dsh_for_each_command(void (*fn)(const struct dsh_command *cmd, void *ctx), void *ctx);
+
 #endif // KERNEL_DSH_H
@@ -0,0 +1,42 @@
+#ifndef KERNEL_DSH_HISTORY_H
+#define KERNEL_DSH_HISTORY_H
+
+#include <stdint.h>
+
+// Entries kept, must be a power of two (make DSH_HISTORY_SIZE=...)
+#ifndef DSH_HISTORY_SIZE
+#define DSH_HISTORY_SIZE 512
+#endif
+
+#define HISTORY_QUERY_MAX 64  // Longest Ctrl-R search string
+
+/*
+ * Entries are addressed by sequence number: the oldest kept entry is at
+ * or after history_end() - DSH_HISTORY_SIZE and history_end() is one past
+ * the newest. A command that is run again moves to the newest slot and
+ * leaves a hole where its older copy was, history_get() returns NULL there.
+ */
+void history_add(const char* line);
+uint32_t history_end(void);
+const char* history_get(uint32_t seq);
+
+// Step *seq to the previous/next entry, skipping holes. history_prev()
+// returns 0 at the oldest entry, history_next() returns 0 and leaves
+// *seq at history_end() after the newest
+int history_prev(uint32_t* seq);
+int history_next(uint32_t* seq);
+
+/*
+ * Incremental reverse search. Each pushed character narrows the match
+ * list of the previous query instead of scanning the whole history
+ * again, popping goes back to the list kept for the shorter query. The
+ * functions return the current match (newest first) or NULL.
+ */
+void history_search_begin(void);
+const char* history_search_push(char c);
+const char* history_search_pop(void);
+const char* history_search_next(void);  // Step to an older match
+const char* history_search_query(void);
+void history_search_end(void);
+
+#endif // KERNEL_DSH_HISTORY_H
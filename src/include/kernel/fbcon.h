@@ -0,0 +1,13 @@
+#ifndef KERNEL_FBCON_H
+#define KERNEL_FBCON_H
+
+/*
+ * Console on the linear framebuffer GRUB sets up for the multiboot2
+ * framebuffer request (32 bits per pixel), in 8x16 cells. Needs the page
+ * allocator for its back buffer and paging to map the framebuffer
+ * write-combining. Returns 0 and leaves the VGA text console in place if
+ * there is no such framebuffer.
+ */
+int fbcon_init(void);
+
+#endif // KERNEL_FBCON_H
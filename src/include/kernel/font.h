@@ -0,0 +1,21 @@
+#ifndef KERNEL_FONT_H
+#define KERNEL_FONT_H
+
+#include <stdint.h>
+
+#define FONT_WIDTH 8
+#define FONT_HEIGHT 16
+#define FONT_FIRST 0x20    // The font covers printable ASCII
+#define FONT_MISSING 0x7F  // Glyph for everything else, a box
+#define FONT_GLYPHS (FONT_MISSING - FONT_FIRST + 1)
+
+/* 8x16 bitmap font, one byte per row, bit 7 is the leftmost pixel */
+extern const uint8_t font8x16[FONT_GLYPHS][FONT_HEIGHT];
+
+static inline const uint8_t* font_glyph(unsigned char c) {
+    if (c < FONT_FIRST || c > FONT_MISSING)
+        c = FONT_MISSING;
+    return font8x16[c - FONT_FIRST];
+}
+
+#endif // KERNEL_FONT_H
@@ -0,0 +1,42 @@
+#ifndef KERNEL_GAPBUF_H
+#define KERNEL_GAPBUF_H
+
+#include <stddef.h>
+
+/*
+ * Text with a movable gap at the cursor: inserting and deleting at the
+ * cursor is O(1), moving the cursor costs the distance moved. The storage
+ * comes from kmalloc() and doubles when the gap runs out, so appending is
+ * amortized O(1) per character.
+ */
+struct gap_buffer {
+    char* data;
+    size_t size;       // Bytes allocated
+    size_t gap_start;  // Cursor, text before it is data[0, gap_start)
+    size_t gap_end;    // Text after the cursor is data[gap_end, size)
+};
+
+// Returns 0 if the storage could not be allocated
+int gap_buffer_init(struct gap_buffer* gb, size_t size);
+void gap_buffer_release(struct gap_buffer* gb);
+
+static inline size_t gap_buffer_length(const struct gap_buffer* gb) {
+    return gb->size - (gb->gap_end - gb->gap_start);
+}
+
+static inline char gap_buffer_at(const struct gap_buffer* gb, size_t i) {
+    return i < gb->gap_start ? gb->data[i] : gb->data[i + gb->gap_end - gb->gap_start];
+}
+
+// Insert at the cursor, the cursor ends up after the text. Returns 0 when
+// out of memory, nothing is inserted then
+int gap_buffer_insert(struct gap_buffer* gb, const char* text, size_t len);
+void gap_buffer_delete_before(struct gap_buffer* gb, size_t count);
+void gap_buffer_truncate(struct gap_buffer* gb);  // Drop everything after the cursor
+void gap_buffer_move(struct gap_buffer* gb, size_t pos);
+void gap_buffer_clear(struct gap_buffer* gb);
+
+// The whole text, NUL-terminated. Moves the cursor to the end
+const char* gap_buffer_text(struct gap_buffer* gb);
+
+#endif // KERNEL_GAPBUF_H
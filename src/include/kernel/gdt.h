@@ -0,0 +1,37 @@
+#ifndef KERNEL_GDT_H
+#define KERNEL_GDT_H
+
+#include <stdint.h>
+
+/* Segment selectors */
+#define GDT_KERNEL_CODE 0x08
+#define GDT_KERNEL_DATA 0x10
+
+struct gdt_entry {
+    uint16_t limit_low;
+    uint16_t base_low;
+    uint8_t base_mid;
+    uint8_t access;
+    uint8_t granularity;
+    uint8_t base_high;
+} __attribute__((packed));
+
+struct gdt_ptr {
+    uint16_t limit;
+    uintptr_t base;
+} __attribute__((packed));
+
+// Load our own flat GDT (GRUB's one may be anywhere in memory)
+void gdt_init(void);
+
+// Load the same GDT on another CPU
+void gdt_init_ap(void);
+
+// Give this CPU a gs segment covering its per-CPU data (see smp.h). In
+// long mode that is the GS base MSR, segment limits no longer apply.
+void gdt_load_cpu_segment(uint32_t cpu, const void* base, uint32_t size);
+
+/* Implemented in interrupts.asm (interrupts64.asm on x86_64) */
+void gdt_flush(const struct gdt_ptr* ptr);
+
+#endif // KERNEL_GDT_H
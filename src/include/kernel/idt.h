@@ -0,0 +1,80 @@
+#ifndef KERNEL_IDT_H
+#define KERNEL_IDT_H
+
+#include <stdint.h>
+
+#define IDT_ENTRIES 256
+#define IRQ_BASE 32
+
+struct idt_entry {
+    uint16_t base_low;
+    uint16_t selector;
+    uint8_t zero;
+    uint8_t flags;
+    uint16_t base_high;
+#ifdef __x86_64__
+    uint32_t base_upper;     // Long mode gates are 16 bytes, bits 32-63 of the handler
+    uint32_t reserved;
+#endif
+} __attribute__((packed));
+
+struct idt_ptr {
+    uint16_t limit;
+    uintptr_t base;
+} __attribute__((packed));
+
+#ifdef __x86_64__
+/* Register state pushed by isr_common in interrupts64.asm */
+struct interrupt_frame {
+    uint64_t r15, r14, r13, r12, r11, r10, r9, r8;
+    uint64_t rbp, rdi, rsi, rdx, rcx, rbx, rax;
+    uint64_t int_no, err_code;
+    uint64_t rip, cs, rflags, rsp, ss;
+};
+#else
+/* Register state pushed by isr_common in interrupts.asm */
+struct interrupt_frame {
+    uint32_t es, ds;
+    uint32_t edi, esi, ebp, esp, ebx, edx, ecx, eax;
+    uint32_t int_no, err_code;
+    uint32_t eip, cs, eflags;
+};
+#endif
+
+// Where the interrupted code was
+static inline uintptr_t interrupt_frame_ip(const struct interrupt_frame* frame) {
+#ifdef __x86_64__
+    return frame->rip;
+#else
+    return frame->eip;
+#endif
+}
+
+static inline uintptr_t interrupt_frame_flags(const struct interrupt_frame* frame) {
+#ifdef __x86_64__
+    return frame->rflags;
+#else
+    return frame->eflags;
+#endif
+}
+
+typedef void (*interrupt_handler_t)(struct interrupt_frame* frame);
+
+// Install the IDT and remap the PIC (interrupts stay disabled)
+void idt_init(void);
+
+// Load the same IDT on another CPU
+void idt_init_ap(void);
+
+// Route a vector to a C handler
+void idt_set_handler(uint8_t vector, interrupt_handler_t handler);
+
+// Route a hardware IRQ (0-15) to a C handler and unmask it (on the 8259s
+// or, once apic_init() ran, on the IOAPIC)
+void irq_register_handler(uint8_t irq, interrupt_handler_t handler);
+
+/* Implemented in interrupts.asm (interrupts64.asm on x86_64) */
+void idt_load(const struct idt_ptr* ptr);
+extern uintptr_t isr_stub_table[IDT_ENTRIES];
+
+#endif // KERNEL_IDT_H
@@ -0,0 +1,68 @@
+#ifndef KERNEL_INITRD_H
+#define KERNEL_INITRD_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define INITRD_FILE 0
+#define INITRD_DIR 1
+
+/*
+ * A file or directory of the initrd, a ustar archive GRUB loads as a
+ * multiboot2 module. data points into the module itself: nothing is
+ * copied, and it stays valid (and read-only) for as long as the kernel
+ * runs. Paths have no leading or trailing '/', the root is "".
+ */
+struct initrd_file {
+    const char* path;        // Not NUL-terminated, path_len bytes
+    uint32_t path_len;
+    const void* data;
+    uint32_t size;
+    uint32_t mode;           // Permission bits from the archive
+    uint32_t mtime;          // Seconds since 1970
+    uint32_t type;           // INITRD_FILE or INITRD_DIR
+    uint32_t hash;
+    int32_t parent;          // Index of the directory, -1 for the root
+    int32_t first_child;     // Directories: children, in archive order
+    int32_t last_child;
+    int32_t next_sibling;
+};
+
+/*
+ * Every path of an archive, indexed once: the files in archive order
+ * (plus directories the archive only implies) and an open-addressing
+ * hash table of their indices, at most half full, so a lookup costs one
+ * hash of the path and about one probe however many files there are.
+ */
+struct initrd_index {
+    struct initrd_file* files;
+    uint32_t count;
+    uint32_t capacity;
+    int32_t* table;          // -1: empty slot
+    uint32_t table_mask;
+    char* names;             // Paths joined from ustar's prefix and name fields
+    uint32_t archive_size;
+};
+
+// Index the module GRUB loaded with the "initrd" command line (or the
+// only module), prints how many files it holds. No module, no initrd.
+void initrd_init(void);
+
+// Look a path up, with or without leading '/'. NULL if it does not exist
+// or there is no initrd.
+const struct initrd_file* initrd_lookup(const char* path);
+
+// Call fn for each entry of a directory, in archive order
+void initrd_for_each_child(const struct initrd_file* dir, void (*fn)(const struct initrd_file* file, void* ctx),
+                           void* ctx);
+
+// The loaded index, NULL without an initrd
+const struct initrd_index* initrd_get_index(void);
+
+// Index an archive in memory. Returns 0 on a malformed archive or when
+// out of memory; initrd_index_free() gives the memory back.
+int initrd_index_build(struct initrd_index* index, const void* archive, size_t size);
+void initrd_index_free(struct initrd_index* index);
+const struct initrd_file* initrd_index_lookup(const struct initrd_index* index, const char* path, size_t len);
+
+#endif // KERNEL_INITRD_H
@@ -0,0 +1,47 @@
+#ifndef KERNEL_INPUT_H
+#define KERNEL_INPUT_H
+
+#include <stdint.h>
+
+/*
+ * Input events are 16 bits: the high byte tells where the event came from,
+ * the low byte is a raw PS/2 scancode or a character received on the serial
+ * line. Every input device feeds the same queue so the shell only waits in
+ * one place.
+ */
+#define INPUT_SOURCE_MASK 0xFF00
+#define INPUT_KEYBOARD 0x0000
+#define INPUT_SERIAL 0x0100
+
+/* Editing keys shared by all input sources (printable keys are ASCII) */
+#define KEY_LEFT 0x101
+#define KEY_RIGHT 0x102
+#define KEY_UP 0x103
+#define KEY_DOWN 0x104
+#define KEY_HOME 0x105
+#define KEY_END 0x106
+#define KEY_PAGE_UP 0x107
+#define KEY_PAGE_DOWN 0x108
+#define KEY_INSERT 0x109
+#define KEY_DELETE 0x10A
+
+// Queue an event, from IRQ handlers, deferred work or threads on any CPU
+void input_push(uint16_t event);
+
+// Pop one event if available, returns 0 when the queue is empty
+int input_read(uint16_t* event);
+
+// Nonzero if events are queued
+int input_pending(void);
+
+// Block until an event arrives and return it
+uint16_t input_wait(void);
+
+// Like input_wait() but gives up at a ktime_ns() deadline (0 = never),
+// returns 0 on timeout
+int input_wait_until(uint64_t deadline, uint16_t* event);
+
+// Events dropped because the queue was full
+uint32_t input_dropped(void);
+
+#endif // KERNEL_INPUT_H
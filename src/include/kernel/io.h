@@ -15,6 +15,40 @@ static inline void outb(uint16_t port, uint8_t data) {
     __asm__ volatile ("outb %0, %1" : : "a"(data), "Nd"(port));
 }
 
+// Reading a word from a port
+static inline uint16_t inw(uint16_t port) {
+    uint16_t data;
+    __asm__ volatile ("inw %1, %0" : "=a"(data) : "Nd"(port));
+    return data;
+}
+
+// Writing a word to a port
+static inline void outw(uint16_t port, uint16_t data) {
+    __asm__ volatile ("outw %0, %1" : : "a"(data), "Nd"(port));
+}
+
+// Reading a double word from a port
+static inline uint32_t inl(uint16_t port) {
+    uint32_t data;
+    __asm__ volatile ("inl %1, %0" : "=a"(data) : "Nd"(port));
+    return data;
+}
+
+// Writing a double word to a port
+static inline void outl(uint16_t port, uint32_t data) {
+    __asm__ volatile ("outl %0, %1" : : "a"(data), "Nd"(port));
+}
+
+// Reading count words from a port into memory
+static inline void insw(uint16_t port, void* buffer, uint32_t count) {
+    __asm__ volatile ("rep insw" : "+D"(buffer), "+c"(count) : "d"(port) : "memory");
+}
+
+// Writing count words from memory to a port
+static inline void outsw(uint16_t port, const void* buffer, uint32_t count) {
+    __asm__ volatile ("rep outsw" : "+S"(buffer), "+c"(count) : "d"(port) : "memory");
+}
+
 // Forbidden to read from a port
 static inline void cli(void) {
     __asm__ volatile ("cli");
@@ -30,9 +64,28 @@ static inline void io_wait(void) {
     __asm__ volatile ("outb %%al, $0x80" : : "a"(0));
 }
 
-#endif // KERNEL_IO_H
-
 // Halt proccesor requested
 static inline void hlt(void) {
     __asm__ volatile ("hlt");
 }
+
+// Enable interrupts and halt until the next one. The instruction after
+// sti is still executed with IF=0, so no interrupt can slip in between.
+static inline void sti_hlt(void) {
+    __asm__ volatile ("sti; hlt");
+}
+
+// Disable interrupts and return the previous EFLAGS
+static inline uint32_t irq_save(void) {
+    uintptr_t flags;  // pushf pushes RFLAGS in long mode, IF is in the low half
+    __asm__ volatile ("pushf; pop %0; cli" : "=r"(flags) : : "memory");
+    return flags;
+}
+
+// Restore the interrupt flag saved by irq_save()
+static inline void irq_restore(uint32_t flags) {
+    if (flags & (1 << 9))
+        __asm__ volatile ("sti" : : : "memory");
+}
+
+#endif // KERNEL_IO_H
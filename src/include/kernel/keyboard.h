@@ -0,0 +1,8 @@
+#ifndef KERNEL_KEYBOARD_H
+#define KERNEL_KEYBOARD_H
+
+// Install the IRQ1 handler; scancodes go to the input queue through
+// deferred work (see workqueue.h)
+void keyboard_init(void);
+
+#endif // KERNEL_KEYBOARD_H
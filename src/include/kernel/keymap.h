@@ -0,0 +1,91 @@
+#ifndef KERNEL_KEYMAP_H
+#define KERNEL_KEYMAP_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Key codes are PS/2 set 1 make codes, with bit 7 set for the keys that
+ * come after an E0 prefix: 0x48 is keypad 8, 0xC8 the Up arrow. That
+ * makes every key one index into a 256-entry table.
+ */
+#define KBD_E0 0x80
+
+// Modifiers held down
+#define KBD_SHIFT_L 0x01
+#define KBD_SHIFT_R 0x02
+#define KBD_CTRL_L 0x04
+#define KBD_CTRL_R 0x08
+#define KBD_ALT_L 0x10
+#define KBD_ALT_R 0x20
+#define KBD_SHIFT (KBD_SHIFT_L | KBD_SHIFT_R)
+#define KBD_CTRL (KBD_CTRL_L | KBD_CTRL_R)
+
+// Locks, toggled by a press
+#define KBD_CAPS_LOCK 0x01
+#define KBD_NUM_LOCK 0x02
+#define KBD_SCROLL_LOCK 0x04
+
+// A keymap has one table per combination of Shift, Caps Lock, Num Lock
+#define KBD_LAYERS 8
+
+/*
+ * Decoder state for one keyboard: the prefix byte seen so far, the
+ * modifiers and locks, and a bit per key that is down, so a make code
+ * for a key already down is told apart as the keyboard's own repeat.
+ */
+struct kbd_decoder {
+    uint8_t prefix;          // KBD_E0 right after an E0 byte
+    uint8_t skip;            // Bytes left of a Pause (E1) sequence
+    uint8_t mods;
+    uint8_t locks;
+    uint8_t layer;           // Keymap table for the mods and locks above
+    uint32_t down[8];
+};
+
+#define KBD_DECODER_INIT { 0 }
+
+struct kbd_event {
+    uint8_t code;
+    uint8_t pressed;         // 0 on release
+    uint8_t repeat;          // Typematic make code of a key already down
+};
+
+// Feed one byte from the keyboard. Returns 1 and fills in ev when it
+// completes a key press or release; prefixes, Pause and the fake Shift
+// codes keyboards wrap around extended keys return 0.
+int kbd_decode(struct kbd_decoder* dec, uint8_t byte, struct kbd_event* ev);
+
+// What a key types with the decoder's modifiers under the active keymap:
+// a character byte, a control character for Ctrl+letter (by the letter's
+// US position, whatever the layout), one of the KEY_* codes of input.h,
+// or 0 for keys that type nothing.
+int kbd_key(const struct kbd_decoder* dec, uint8_t code);
+
+/*
+ * Keymaps. "us" is built in; others are text files of lines
+ *     <make code> <key> <key with Shift>
+ * where a key is one character or a number (0x prefix for hex), '#'
+ * starts a comment line and anything after the third field is ignored.
+ * Keys the file does not list keep their US meaning; the keypad and E0
+ * keys are the same on every layout. Characters above 0x7F are bytes in
+ * the console's code page.
+ */
+
+// Build the US keymap and switch to the one dexis.keymap= names, if any
+void keymap_init(void);
+
+// Parse a keymap and add it (or replace the one of the same name).
+// Returns 0 on a malformed file or when out of memory.
+int keymap_load(const char* name, const char* text, size_t len);
+
+// Make a keymap active, loading /etc/keymaps/<name>.map from the initrd
+// if it is not loaded yet. Returns 0 if there is no such keymap.
+int keymap_use(const char* name);
+
+// Name of the index-th loaded keymap, NULL past the last one
+const char* keymap_name(uint32_t index);
+
+const char* keymap_active(void);
+
+#endif // KERNEL_KEYMAP_H
@@ -0,0 +1,35 @@
+#ifndef KERNEL_KLIB_H
+#define KERNEL_KLIB_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * Freestanding string and memory routines. They are also what the
+ * compiler calls for struct copies and initializers. Copies and fills use
+ * rep movsd/stosd, large ones go through SSE2 when klib_init() found it.
+ */
+void* memcpy(void* dst, const void* src, size_t n);
+void* memmove(void* dst, const void* src, size_t n);
+void* memset(void* dst, int c, size_t n);
+int memcmp(const void* a, const void* b, size_t n);
+size_t strlen(const char* s);
+int strcmp(const char* a, const char* b);
+int strncmp(const char* a, const char* b, size_t n);
+char* strncpy(char* dst, const char* src, size_t n);
+
+// Fill count 16-bit cells, for VGA text memory and its shadow
+void memsetw(uint16_t* dst, uint16_t value, size_t count);
+
+// Detect SSE2 and enable it in CR0/CR4
+void klib_init(void);
+
+// Enable SSE2 on another CPU if klib_init() found it
+void klib_init_ap(void);
+
+// Whether the SSE2 paths are in use. They can be switched off (to compare
+// against the rep-string paths) and back on if the CPU has SSE2
+int klib_sse2_enabled(void);
+void klib_use_sse2(int enable);
+
+#endif // KERNEL_KLIB_H
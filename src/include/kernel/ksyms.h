@@ -0,0 +1,18 @@
+#ifndef KERNEL_KSYMS_H
+#define KERNEL_KSYMS_H
+
+#include <stdint.h>
+
+/*
+ * Kernel function symbols, embedded by the second link (see the Makefile
+ * and scripts/ksyms.sh). Indexes run in address order.
+ */
+uint32_t ksym_count(void);
+
+// Function containing addr, -1 if addr is outside the kernel code
+int ksym_index(uintptr_t addr);
+
+const char* ksym_name(int index);
+uint32_t ksym_address(int index);
+
+#endif // KERNEL_KSYMS_H
@@ -0,0 +1,95 @@
+#ifndef KERNEL_MULTIBOOT_H
+#define KERNEL_MULTIBOOT_H
+
+#include <stdint.h>
+
+#define MULTIBOOT2_BOOTLOADER_MAGIC 0x36d76289
+
+/* Boot information tag types */
+#define MULTIBOOT_TAG_END 0
+#define MULTIBOOT_TAG_CMDLINE 1
+#define MULTIBOOT_TAG_MODULE 3
+#define MULTIBOOT_TAG_MMAP 6
+#define MULTIBOOT_TAG_FRAMEBUFFER 8
+#define MULTIBOOT_TAG_ACPI_OLD 14
+#define MULTIBOOT_TAG_ACPI_NEW 15
+
+/* Memory map entry types */
+#define MULTIBOOT_MEMORY_AVAILABLE 1
+#define MULTIBOOT_MEMORY_RESERVED 2
+#define MULTIBOOT_MEMORY_ACPI_RECLAIMABLE 3
+#define MULTIBOOT_MEMORY_NVS 4
+#define MULTIBOOT_MEMORY_BADRAM 5
+
+struct multiboot_tag {
+    uint32_t type;
+    uint32_t size;
+};
+
+struct multiboot_tag_string {
+    uint32_t type;
+    uint32_t size;
+    char string[];
+};
+
+struct multiboot_tag_module {
+    uint32_t type;
+    uint32_t size;
+    uint32_t mod_start;
+    uint32_t mod_end;
+    char cmdline[];
+};
+
+struct multiboot_mmap_entry {
+    uint64_t addr;
+    uint64_t len;
+    uint32_t type;
+    uint32_t zero;
+};
+
+#define MULTIBOOT_FRAMEBUFFER_TYPE_INDEXED 0
+#define MULTIBOOT_FRAMEBUFFER_TYPE_RGB 1
+#define MULTIBOOT_FRAMEBUFFER_TYPE_EGA_TEXT 2
+
+struct multiboot_tag_framebuffer {
+    uint32_t type;
+    uint32_t size;
+    uint64_t addr;
+    uint32_t pitch;       // Bytes per line
+    uint32_t width;       // Pixels
+    uint32_t height;
+    uint8_t bpp;
+    uint8_t fb_type;
+    uint16_t reserved;
+    // Direct RGB (MULTIBOOT_FRAMEBUFFER_TYPE_RGB) colour layout
+    uint8_t red_position;
+    uint8_t red_size;
+    uint8_t green_position;
+    uint8_t green_size;
+    uint8_t blue_position;
+    uint8_t blue_size;
+};
+
+struct multiboot_tag_mmap {
+    uint32_t type;
+    uint32_t size;
+    uint32_t entry_size;
+    uint32_t entry_version;
+    struct multiboot_mmap_entry entries[];
+};
+
+// Remember the boot information GRUB handed to _start, returns 0 if the
+// kernel was not loaded by a multiboot2 loader
+int multiboot_init(uint32_t magic, uint32_t info_addr);
+
+// Find the first tag of a type after `prev` (NULL starts at the beginning)
+const struct multiboot_tag* multiboot_find_tag(uint32_t type, const struct multiboot_tag* prev);
+
+// Location of the whole boot information block, so it can be kept reserved
+uint32_t multiboot_info_addr(void);
+uint32_t multiboot_info_size(void);
+
+// Kernel command line from the boot loader, "" if there is none
+const char* multiboot_cmdline(void);
+
+#endif // KERNEL_MULTIBOOT_H
@@ -0,0 +1,45 @@
+#ifndef KERNEL_PAGING_H
+#define KERNEL_PAGING_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/* Page table entry bits */
+#define PAGE_PRESENT 0x001
+#define PAGE_WRITE 0x002
+#define PAGE_PWT 0x008
+#define PAGE_PCD 0x010
+#define PAGE_PSE 0x080        // Large page (page directory entry)
+#define PAGE_PAT_4K 0x080     // PAT index bit in a 4 KiB page table entry
+#define PAGE_GLOBAL 0x100
+#define PAGE_PAT_4M 0x1000    // PAT index bit in a large page directory entry
+
+// 4 MiB with 32-bit entries, 2 MiB with long mode's 64-bit ones
+#ifdef __x86_64__
+#define LARGE_PAGE_SIZE 0x200000
+#else
+#define LARGE_PAGE_SIZE 0x400000
+#endif
+
+/* Memory types we can ask for, see the PAT layout in paging.c */
+enum page_cache {
+    PAGE_CACHE_WB,   // Write-back, normal RAM
+    PAGE_CACHE_WC,   // Write-combining, for frame buffers
+    PAGE_CACHE_UC,   // Uncached, for device registers
+};
+
+// Identity-map the 4 GiB address space and turn paging on. On x86_64
+// paging is on already (boot64.asm), this replaces the boot tables.
+void paging_init(void);
+
+// Turn paging on for another CPU, with the boot CPU's tables
+void paging_init_ap(void);
+
+// Change the memory type of a range. Ranges in the first large page are
+// handled per 4 KiB page, above that per large page.
+void paging_set_cache(uintptr_t addr, size_t size, enum page_cache type);
+
+// 1 if the PAT could be programmed (WC is only real when it could)
+int paging_has_pat(void);
+
+#endif // KERNEL_PAGING_H
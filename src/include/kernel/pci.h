@@ -0,0 +1,53 @@
+#ifndef KERNEL_PCI_H
+#define KERNEL_PCI_H
+
+#include <stdint.h>
+
+/* Configuration space offsets */
+#define PCI_VENDOR_ID 0x00
+#define PCI_DEVICE_ID 0x02
+#define PCI_COMMAND 0x04
+#define PCI_PROG_IF 0x09
+#define PCI_SUBCLASS 0x0A
+#define PCI_CLASS 0x0B
+#define PCI_HEADER_TYPE 0x0E
+#define PCI_BAR0 0x10
+#define PCI_INTERRUPT_LINE 0x3C
+
+#define PCI_COMMAND_IO 0x0001
+#define PCI_COMMAND_MEMORY 0x0002
+#define PCI_COMMAND_BUS_MASTER 0x0004
+
+#define PCI_CLASS_STORAGE 0x01
+#define PCI_SUBCLASS_IDE 0x01
+
+#define PCI_BAR_IO 0x1  // Bit 0 of a BAR: I/O ports, not memory
+
+struct pci_device {
+    uint8_t bus;
+    uint8_t slot;
+    uint8_t function;
+    uint16_t vendor;
+    uint16_t device;
+    uint8_t class_code;
+    uint8_t subclass;
+    uint8_t prog_if;
+};
+
+// Configuration mechanism #1 (ports 0xCF8/0xCFC), offset aligned to the size
+uint32_t pci_read32(const struct pci_device* dev, uint8_t offset);
+uint16_t pci_read16(const struct pci_device* dev, uint8_t offset);
+uint8_t pci_read8(const struct pci_device* dev, uint8_t offset);
+void pci_write32(const struct pci_device* dev, uint8_t offset, uint32_t value);
+void pci_write16(const struct pci_device* dev, uint8_t offset, uint16_t value);
+
+// Call fn for every function on every bus, stop early if it returns nonzero
+void pci_scan(int (*fn)(const struct pci_device* dev, void* ctx), void* ctx);
+
+// First function with this class and subclass, returns 0 if there is none
+int pci_find_class(uint8_t class_code, uint8_t subclass, struct pci_device* out);
+
+// Base address of BAR n without the type bits
+uint32_t pci_bar(const struct pci_device* dev, int n);
+
+#endif // KERNEL_PCI_H
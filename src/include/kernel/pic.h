@@ -0,0 +1,28 @@
+#ifndef KERNEL_PIC_H
+#define KERNEL_PIC_H
+
+#include <stdint.h>
+
+/* 8259 PIC ports */
+#define PIC1_COMMAND 0x20
+#define PIC1_DATA 0x21
+#define PIC2_COMMAND 0xA0
+#define PIC2_DATA 0xA1
+
+/* IRQs 0-15 are remapped to vectors 32-47 so they do not collide with CPU exceptions */
+#define PIC1_OFFSET 0x20
+#define PIC2_OFFSET 0x28
+
+void pic_remap(void);
+void pic_mask_irq(uint8_t irq);
+void pic_unmask_irq(uint8_t irq);
+void pic_send_eoi(uint8_t irq);
+int pic_is_spurious(uint8_t irq);
+
+// Bit n set if IRQ n is masked
+uint16_t pic_get_mask(void);
+
+// Mask every line, when the IOAPIC takes over
+void pic_disable(void);
+
+#endif // KERNEL_PIC_H
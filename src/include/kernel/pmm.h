@@ -0,0 +1,35 @@
+#ifndef KERNEL_PMM_H
+#define KERNEL_PMM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define PAGE_SIZE 4096
+#define PAGE_SHIFT 12
+
+/* Buddy orders: order 0 is one 4 KiB page, PMM_MAX_ORDER is 4 MiB */
+#define PMM_MAX_ORDER 10
+
+struct pmm_stats {
+    uint32_t total_pages;   // Pages handed to the allocator at boot
+    uint32_t free_pages;
+    uint32_t free_blocks[PMM_MAX_ORDER + 1];
+};
+
+// Build the allocator from the multiboot memory map. The kernel image,
+// the boot information, modules and everything below 1 MiB stay reserved.
+void pmm_init(void);
+
+// Allocate 2^order contiguous pages, naturally aligned. Returns the
+// physical address (memory is identity mapped) or 0 when out of memory.
+uintptr_t pmm_alloc(unsigned int order);
+
+// Give back a block from pmm_alloc() with the same order
+void pmm_free(uintptr_t addr, unsigned int order);
+
+// Smallest order whose block holds `size` bytes
+unsigned int pmm_order_for(size_t size);
+
+void pmm_get_stats(struct pmm_stats* out);
+
+#endif // KERNEL_PMM_H
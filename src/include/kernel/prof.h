@@ -0,0 +1,24 @@
+#ifndef KERNEL_PROF_H
+#define KERNEL_PROF_H
+
+#include <stdint.h>
+
+/*
+ * Statistical profiler: while it runs, every timer interrupt (TIMER_HZ)
+ * charges one sample to the kernel function it interrupted.
+ */
+
+// Returns 0 if the histogram could not be allocated. Starting again
+// keeps counting into the same histogram until prof_reset()
+int prof_start(void);
+void prof_stop(void);
+void prof_reset(void);
+int prof_running(void);
+
+// Called from the timer interrupt with the interrupted EIP (RIP)
+void prof_sample(uintptr_t ip);
+
+// Print the top functions by share of the samples
+void prof_report(uint32_t top);
+
+#endif // KERNEL_PROF_H
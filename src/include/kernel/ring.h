@@ -0,0 +1,127 @@
+#ifndef KERNEL_RING_H
+#define KERNEL_RING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <kernel/atomic.h>
+
+/*
+ * Bounded lock-free queues of pointer-sized values over caller-provided
+ * storage, whose size must be a power of two. head and tail count every
+ * value ever pushed and popped and wrap freely, so head - tail is the
+ * fill level; they sit on separate cache lines so producers and the
+ * consumer do not steal each other's line on every operation. Both
+ * rings start out empty when zeroed, so they can be static.
+ */
+
+/*
+ * Single producer, single consumer: no locked instruction at all, x86
+ * keeps the slot store ahead of the head store. The producer may be an
+ * IRQ handler if threads never push to the same ring.
+ */
+struct spsc_ring {
+    volatile uint32_t head __attribute__((aligned(64)));  // Producer only
+    volatile uint32_t tail __attribute__((aligned(64)));  // Consumer only
+    uint32_t mask;
+    uintptr_t* slots;
+};
+
+#define SPSC_RING_INIT(storage) \
+    { 0, 0, sizeof(storage) / sizeof((storage)[0]) - 1, (storage) }
+
+// Returns 0 if the ring is full
+static inline int spsc_push(struct spsc_ring* r, uintptr_t value) {
+    uint32_t head = r->head;
+    if (head - r->tail > r->mask)
+        return 0;
+    r->slots[head & r->mask] = value;
+    barrier();
+    r->head = head + 1;
+    return 1;
+}
+
+// Returns 0 if the ring is empty
+static inline int spsc_pop(struct spsc_ring* r, uintptr_t* value) {
+    uint32_t tail = r->tail;
+    if (tail == r->head)
+        return 0;
+    barrier();
+    *value = r->slots[tail & r->mask];
+    barrier();
+    r->tail = tail + 1;
+    return 1;
+}
+
+static inline int spsc_empty(const struct spsc_ring* r) {
+    return r->tail == r->head;
+}
+
+/*
+ * Multiple producers, single consumer. A producer claims a slot by
+ * moving head forward with lock cmpxchg, fills it, then publishes it
+ * through the slot's sequence word; the consumer only trusts that word,
+ * so a producer interrupted between the claim and the publish holds up
+ * the consumer, never the other producers. Producers may be IRQ
+ * handlers and threads on any CPU.
+ *
+ * The sequence word of the slot for position pos is pos's lap
+ * (pos & ~mask) while the slot is free, lap + 1 once the value is
+ * published, and the next lap after the consumer took it.
+ */
+struct mpsc_slot {
+    volatile uint32_t seq;
+    uintptr_t value;
+};
+
+struct mpsc_ring {
+    volatile uint32_t head __attribute__((aligned(64)));  // Next position producers claim
+    volatile uint32_t tail __attribute__((aligned(64)));  // Consumer only
+    uint32_t mask;
+    struct mpsc_slot* slots;
+};
+
+#define MPSC_RING_INIT(storage) \
+    { 0, 0, sizeof(storage) / sizeof((storage)[0]) - 1, (storage) }
+
+// Returns 0 if the ring is full
+static inline int mpsc_push(struct mpsc_ring* r, uintptr_t value) {
+    uint32_t pos = r->head;
+    while (1) {
+        struct mpsc_slot* slot = &r->slots[pos & r->mask];
+        int32_t diff = (int32_t)(slot->seq - (pos & ~r->mask));
+        if (diff == 0) {
+            uint32_t seen = atomic_cmpxchg(&r->head, pos, pos + 1);
+            if (seen == pos) {
+                slot->value = value;
+                barrier();
+                slot->seq = (pos & ~r->mask) + 1;
+                return 1;
+            }
+            pos = seen; // Another producer got it, try the next one
+        } else if (diff < 0) {
+            return 0;   // Last lap's value is still there
+        } else {
+            pos = r->head;
+        }
+    }
+}
+
+// Returns 0 if the ring is empty or the oldest value is not published yet
+static inline int mpsc_pop(struct mpsc_ring* r, uintptr_t* value) {
+    uint32_t pos = r->tail;
+    struct mpsc_slot* slot = &r->slots[pos & r->mask];
+    if (slot->seq != (pos & ~r->mask) + 1)
+        return 0;
+    barrier();
+    *value = slot->value;
+    barrier();
+    slot->seq = (pos & ~r->mask) + r->mask + 1;
+    r->tail = pos + 1;
+    return 1;
+}
+
+static inline int mpsc_empty(const struct mpsc_ring* r) {
+    return r->tail == r->head;
+}
+
+#endif // KERNEL_RING_H
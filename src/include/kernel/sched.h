@@ -0,0 +1,153 @@
+#ifndef KERNEL_SCHED_H
+#define KERNEL_SCHED_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <kernel/timer.h>
+#include <kernel/spinlock.h>
+#include <kernel/smp.h>
+
+/*
+ * Kernel threads, all in ring 0 and in the one address space. Every CPU
+ * has its own run queues: the timer interrupt preempts the running thread
+ * once its time slice is used up, the highest priority thread that is
+ * ready runs next, threads of equal priority take turns. A CPU with
+ * nothing to run steals from the busiest other CPU, and halts in its idle
+ * thread (the context it booted in) if there is nothing to steal.
+ */
+#define THREAD_NAME_LEN 16
+#define THREAD_STACK_ORDER 2       // 16 KiB stacks from the pmm
+#define THREAD_PRIORITIES 4        // 0 is the highest
+#define THREAD_PRIORITY_SHELL 1
+#define THREAD_PRIORITY_DEFAULT 2
+#define SCHED_SLICE_TICKS 10       // Timer ticks a thread runs before others get a turn
+#define SCHED_ANY_CPU 0xFFFFFFFF   // thread_create_on(): let the scheduler place it
+
+enum thread_state {
+    THREAD_RUNNING,
+    THREAD_READY,
+    THREAD_BLOCKED,
+    THREAD_DEAD,
+};
+
+struct wait_queue;
+
+struct thread {
+    uintptr_t sp;                  // Saved stack pointer, must stay first (switch.asm)
+    uint32_t id;
+    char name[THREAD_NAME_LEN];
+    enum thread_state state;
+    uint32_t priority;
+    uint32_t slice;                // Ticks left in the current time slice
+    uint64_t ticks;                // Timer ticks spent running
+    uint32_t switches;             // Times it was switched in
+    uint32_t cpu;                  // CPU whose run queue it is on, or last ran on
+    int pinned;                    // Never stolen by another CPU
+    volatile int on_cpu;           // Its registers are live on some CPU, not in sp yet
+    volatile int stop;             // Set by thread_stop(), see thread_should_stop()
+    uintptr_t stack;               // pmm block, 0 for the boot thread
+    void (*entry)(void* arg);
+    void* arg;
+    struct wait_queue* waiting_on; // Queue it sleeps on, if any
+    struct ktimer timeout;
+    int timed_out;
+    struct thread* next;           // Run queue or wait queue link
+    struct thread* all_next;       // Every live thread, for ps
+};
+
+/* Threads blocked until some event, woken from IRQ handlers or threads */
+struct wait_queue {
+    spinlock_t lock;
+    struct thread* head;
+    struct thread* tail;
+};
+
+#define WAIT_QUEUE_INIT { SPINLOCK_INIT, NULL, NULL }
+
+/* What ps shows, copied out so the thread may exit while it is printed */
+struct thread_info {
+    uint32_t id;
+    char name[THREAD_NAME_LEN];
+    enum thread_state state;
+    uint32_t priority;
+    uint32_t cpu;
+    uint64_t ticks;
+    uint32_t switches;
+};
+
+/* Per-CPU scheduler counters, for the cpus command */
+struct sched_cpu_stats {
+    uint64_t idle_ticks;
+    uint32_t ready;                // Threads in its run queues
+    uint32_t steals;               // Threads it took from other CPUs
+};
+
+// Turn the boot context into CPU 0's idle thread, needs kmalloc and the
+// timer
+void sched_init(void);
+
+// The same for another CPU starting up, on a THREAD_STACK_ORDER pmm block
+void sched_init_ap(uintptr_t stack);
+
+// Nonzero once sched_init() ran
+int sched_running(void);
+
+// Start a thread running entry(arg), returns NULL when out of memory.
+// Returning from entry ends the thread.
+struct thread* thread_create(const char* name, void (*entry)(void* arg), void* arg, uint32_t priority);
+
+// Same, but pinned to one CPU unless cpu is SCHED_ANY_CPU
+struct thread* thread_create_on(const char* name, void (*entry)(void* arg), void* arg, uint32_t priority,
+                                uint32_t cpu);
+
+struct thread* thread_current(void);
+void thread_yield(void);
+void thread_exit(void) __attribute__((noreturn));
+
+// Ask a thread to finish, it has to poll thread_should_stop(). Returns 0
+// if there is no such thread (the idle thread cannot be stopped)
+int thread_stop(uint32_t id);
+int thread_should_stop(void);
+
+// Fill out with up to max threads, returns how many there are
+size_t sched_snapshot(struct thread_info* out, size_t max);
+const char* thread_state_name(enum thread_state state);
+void sched_cpu_stats(uint32_t cpu, struct sched_cpu_stats* out);
+
+/*
+ * Waiting for a condition:
+ *
+ *     uint32_t flags = wait_queue_lock(&wq);
+ *     while (!condition) {
+ *         wait_queue_sleep(&wq, flags, deadline);
+ *         flags = wait_queue_lock(&wq);
+ *     }
+ *     wait_queue_unlock(&wq, flags);
+ *
+ * The waker makes the condition true before wait_queue_wake_all(), which
+ * takes the same lock, so the wakeup cannot fall between the check and
+ * the sleep on any CPU.
+ *
+ * wait_queue_sleep() blocks until a wake or the ktime_ns() deadline
+ * (0 = never), dropping the lock; it returns 0 on timeout, with the
+ * interrupt flag restored from flags. wq may be NULL (flags from
+ * irq_save()) to only wait for the deadline. Before the scheduler runs,
+ * and in idle threads, it is sti; hlt, so callers must re-check their
+ * condition and deadline in a loop anyway.
+ */
+uint32_t wait_queue_lock(struct wait_queue* wq);
+void wait_queue_unlock(struct wait_queue* wq, uint32_t flags);
+int wait_queue_sleep(struct wait_queue* wq, uint32_t flags, uint64_t deadline);
+void wait_queue_wake_all(struct wait_queue* wq);
+
+// The idle loop, each CPU ends up here after starting up
+void sched_idle(void) __attribute__((noreturn));
+
+// Called from this CPU's timer interrupt, charges the tick to the
+// running thread
+void sched_tick(void);
+
+// Called on the way out of an IRQ, switches if a better thread is ready
+void sched_preempt(void);
+
+#endif // KERNEL_SCHED_H
@@ -0,0 +1,34 @@
+#ifndef KERNEL_SELFTEST_H
+#define KERNEL_SELFTEST_H
+
+/*
+ * A self-test: run() returns NULL on success or a short description of
+ * the first check that failed. Tests may allocate but must give back
+ * everything they took.
+ */
+struct selftest {
+    const char* name;
+    const char* (*run)(void);
+};
+
+/*
+ * Register a self-test next to the code it checks. Entries go to the
+ * .selftests section, the linker script collects them between
+ * __selftests_start and __selftests_end.
+ */
+#define SELFTEST(test_name, test_run) \
+    static const struct selftest selftest_entry_##test_name \
+    __attribute__((used, section(".selftests"), aligned(sizeof(void*)))) = { \
+        #test_name, test_run \
+    }
+
+// Walk the registered self-tests (NULL starts the walk)
+const struct selftest* selftest_next(const struct selftest* prev);
+
+// Run every test whose name starts with filter ("" for all), print the
+// results on the console and one "SELFTEST name=... result=pass|fail"
+// line per test on the serial port. Returns how many failed, or -1 if no
+// test matched
+int selftest_run_all(const char* filter);
+
+#endif // KERNEL_SELFTEST_H
@@ -0,0 +1,41 @@
+#ifndef KERNEL_SERIAL_H
+#define KERNEL_SERIAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SERIAL_COM1 0x3F8
+#define SERIAL_COM1_IRQ 4
+
+/* Divisors of the 115200 Hz UART clock */
+#define SERIAL_BAUD_115200 1
+#define SERIAL_BAUD_57600 2
+#define SERIAL_BAUD_38400 3
+#define SERIAL_BAUD_9600 12
+
+struct serial_stats {
+    uint32_t tx_bytes;   // Bytes handed to the UART
+    uint32_t tx_irqs;    // THRE interrupts (one per FIFO refill)
+    uint32_t tx_stalls;  // Writes that had to wait for a full ring to drain
+    uint32_t rx_bytes;   // Bytes received
+};
+
+// Set up COM1 (8N1, FIFOs on) and its IRQ, returns 0 if no UART answers
+int serial_init(uint16_t divisor);
+
+// Queue bytes for transmission, never waits unless the TX ring is full
+void serial_putchar(char c);
+void serial_write(const char* str);
+void serial_write_n(const char* str, size_t len);
+void serial_write_dec(uint64_t value);
+
+// Busy-wait until everything queued has left the UART
+void serial_flush(void);
+
+// Terminal mirror: like serial_write_n() but with "\r\n" line ends and
+// destructive backspace, for a terminal attached to the serial line
+void serial_console_write(const char* str, size_t len);
+
+void serial_get_stats(struct serial_stats* out);
+
+#endif // KERNEL_SERIAL_H
@@ -0,0 +1,56 @@
+#ifndef KERNEL_SLAB_H
+#define KERNEL_SLAB_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define CACHE_LINE_SIZE 64
+
+/* kmalloc() serves these sizes from slabs, anything bigger gets whole pages */
+#define KMALLOC_MIN_SIZE 16
+#define KMALLOC_MAX_SLAB_SIZE 1024
+
+#define KMEM_CACHE_NAME_LEN 16
+
+struct slab;
+
+/* A cache of equally sized objects, carved out of one-page slabs */
+struct kmem_cache {
+    char name[KMEM_CACHE_NAME_LEN];
+    size_t object_size;      // Size asked for
+    size_t stride;           // Distance between objects in a slab
+    size_t link_offset;      // Where a free object keeps its free-list link
+    uint32_t objects_per_slab;
+    void (*ctor)(void* object);
+    struct slab* partial;    // Slabs with free and used objects
+    struct slab* full;
+    struct slab* empty;      // At most one, kept to avoid page allocator churn
+    uint32_t slabs;
+    uint32_t active_objects;
+    uint32_t total_objects;
+    uint32_t allocs;
+    uint32_t frees;
+    struct kmem_cache* next; // All caches, for slabinfo
+};
+
+struct kmalloc_stats {
+    uint32_t large_allocs;   // Live page-backed kmalloc() blocks
+    uint32_t large_pages;    // Pages they use
+    uint32_t bad_frees;      // kfree() of pointers we never handed out
+};
+
+// Create a cache. The constructor runs once per object when its slab is
+// created; objects come back from kmem_cache_free() still constructed.
+struct kmem_cache* kmem_cache_create(const char* name, size_t size, void (*ctor)(void* object));
+void* kmem_cache_alloc(struct kmem_cache* cache);
+void kmem_cache_free(struct kmem_cache* cache, void* object);
+
+// General purpose heap on power-of-two size classes, O(1) kfree()
+void* kmalloc(size_t size);
+void kfree(void* ptr);
+
+// Walk all caches (NULL starts the walk)
+const struct kmem_cache* kmem_cache_next(const struct kmem_cache* prev);
+void kmalloc_get_stats(struct kmalloc_stats* out);
+
+#endif // KERNEL_SLAB_H
@@ -0,0 +1,66 @@
+#ifndef KERNEL_SMP_H
+#define KERNEL_SMP_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define SMP_MAX_CPUS 8
+#define SMP_TRAMPOLINE_BASE 0x8000 // Real-mode page the other CPUs start in
+
+struct thread;
+
+/*
+ * Per-CPU data. Every CPU's gs segment starts at its own struct cpu, so
+ * the fields are one gs-relative load away and no CPU number has to be
+ * looked up first.
+ */
+struct cpu {
+    struct cpu* self;          // %gs:0, see this_cpu()
+    uint32_t id;               // 0 is the boot CPU
+    uint32_t apic_id;
+    struct thread* current;    // Thread running on this CPU
+    uint64_t timer_ticks;      // Local scheduler ticks (PIT on CPU 0, LAPIC timer on the others)
+    volatile int online;
+} __attribute__((aligned(64)));
+
+// The CPU we run on. A thread can be moved to another CPU whenever
+// interrupts are on, so keep the pointer only while they are off.
+static inline struct cpu* this_cpu(void) {
+    struct cpu* cpu;
+    __asm__ volatile ("mov %%gs:0, %0" : "=r"(cpu));
+    return cpu;
+}
+
+// One load, so it cannot be split by a move to another CPU
+static inline struct thread* this_cpu_current(void) {
+    struct thread* t;
+    __asm__ volatile ("mov %%gs:%c1, %0" : "=r"(t) : "i"(offsetof(struct cpu, current)));
+    return t;
+}
+
+// Point gs at CPU 0's data, right after gdt_init()
+void smp_early_init(void);
+
+// Find the other CPUs in the ACPI MADT, switch interrupts over to the
+// local APIC and IOAPIC and start the other CPUs. After sched_init(),
+// with interrupts enabled. Stays on one CPU (and the PIC) without ACPI.
+// dexis.smp=N on the command line limits how many CPUs are used.
+void smp_init(void);
+
+// CPUs running, at least 1
+uint32_t smp_cpu_count(void);
+struct cpu* smp_cpu(uint32_t id);
+
+// This CPU's number, usable before smp_early_init() (0 then)
+uint32_t smp_cpu_id(void);
+
+/*
+ * Parallel checksum over a large buffer with 1, 2, 4 ... up to
+ * max_threads threads (0 = one per CPU), one thread per CPU. Prints the
+ * times and speedups on the console and one "PBENCH threads=... ns=...
+ * speedup_x100=..." line per run on the serial port. Returns 0 if the
+ * buffer could not be allocated or the checksums disagreed.
+ */
+int smp_bench(uint32_t max_threads);
+
+#endif // KERNEL_SMP_H
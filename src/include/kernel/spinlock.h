@@ -0,0 +1,86 @@
+#ifndef KERNEL_SPINLOCK_H
+#define KERNEL_SPINLOCK_H
+
+#include <stdint.h>
+#include <kernel/io.h>
+#include <kernel/atomic.h>
+
+/*
+ * Test-and-test-and-set spinlock. Locks taken from IRQ handlers as well
+ * as threads must use the _irqsave variants, or the handler can spin on
+ * a lock its own CPU holds.
+ */
+typedef struct {
+    volatile uint32_t locked;
+} spinlock_t;
+
+#define SPINLOCK_INIT { 0 }
+
+static inline void cpu_relax(void) {
+    __asm__ volatile ("pause" : : : "memory");
+}
+
+static inline void spin_lock(spinlock_t* lock) {
+    uint32_t taken = 1;
+    while (1) {
+        __asm__ volatile ("xchgl %0, %1" : "+r"(taken), "+m"(lock->locked) : : "memory");
+        if (!taken)
+            return;
+        while (lock->locked) // Spin on a plain load, not on the bus
+            cpu_relax();
+        taken = 1;
+    }
+}
+
+static inline void spin_unlock(spinlock_t* lock) {
+    barrier(); // x86 stores are not reordered with older ones
+    lock->locked = 0;
+}
+
+static inline uint32_t spin_lock_irqsave(spinlock_t* lock) {
+    uint32_t flags = irq_save();
+    spin_lock(lock);
+    return flags;
+}
+
+static inline void spin_unlock_irqrestore(spinlock_t* lock, uint32_t flags) {
+    spin_unlock(lock);
+    irq_restore(flags);
+}
+
+/*
+ * Ticket lock: CPUs get the lock in the order they asked for it, so a
+ * busy one cannot starve the others. For locks many CPUs fight over.
+ */
+typedef struct {
+    volatile uint16_t owner;  // Ticket being served
+    volatile uint16_t next;   // Next ticket handed out
+} ticketlock_t;
+
+#define TICKETLOCK_INIT { 0, 0 }
+
+static inline void ticket_lock(ticketlock_t* lock) {
+    uint16_t ticket = 1;
+    __asm__ volatile ("lock xaddw %0, %1" : "+r"(ticket), "+m"(lock->next) : : "memory");
+    while (lock->owner != ticket)
+        cpu_relax();
+    barrier();
+}
+
+static inline void ticket_unlock(ticketlock_t* lock) {
+    barrier();
+    lock->owner = lock->owner + 1; // Only the holder writes owner
+}
+
+static inline uint32_t ticket_lock_irqsave(ticketlock_t* lock) {
+    uint32_t flags = irq_save();
+    ticket_lock(lock);
+    return flags;
+}
+
+static inline void ticket_unlock_irqrestore(ticketlock_t* lock, uint32_t flags) {
+    ticket_unlock(lock);
+    irq_restore(flags);
+}
+
+#endif // KERNEL_SPINLOCK_H
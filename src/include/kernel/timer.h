@@ -0,0 +1,49 @@
+#ifndef KERNEL_TIMER_H
+#define KERNEL_TIMER_H
+
+#include <stdint.h>
+
+#define TIMER_HZ 1000 // PIT tick rate
+
+#define NS_PER_US 1000ULL
+#define NS_PER_MS 1000000ULL
+#define NS_PER_SEC 1000000000ULL
+
+/* One-shot callback timer, runs from the timer IRQ */
+struct ktimer {
+    uint64_t expires;          // ktime_ns() deadline
+    void (*callback)(void* arg);
+    void* arg;
+    struct ktimer* next;
+};
+
+// Start the PIT tick and calibrate the TSC against it (before sti)
+void timer_init(void);
+
+// Monotonic nanoseconds since timer_init()
+uint64_t ktime_ns(void);
+
+// PIT ticks since timer_init()
+uint64_t timer_ticks(void);
+
+// TSC frequency in kHz, 0 if the CPU has no usable TSC
+uint32_t timer_tsc_khz(void);
+
+// Convert a TSC delta to nanoseconds
+uint64_t timer_cycles_to_ns(uint64_t cycles);
+
+// Sleep for at least the given time (other threads run meanwhile), needs
+// interrupts enabled
+void ksleep_ns(uint64_t ns);
+void ksleep_ms(uint32_t ms);
+
+// Busy-wait, for short device delays where sleeping is not possible
+void kdelay_us(uint32_t us);
+
+// Arm a callback for an absolute ktime_ns() deadline, or cancel it.
+// A timer must not be armed twice; cancel it first. Once cancel returns
+// the callback is not running anywhere, so do not cancel from inside it.
+void ktimer_arm(struct ktimer* timer, uint64_t deadline, void (*callback)(void* arg), void* arg);
+void ktimer_cancel(struct ktimer* timer);
+
+#endif // KERNEL_TIMER_H
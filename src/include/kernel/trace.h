@@ -0,0 +1,73 @@
+#ifndef KERNEL_TRACE_H
+#define KERNEL_TRACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <kernel/smp.h>
+
+#define TRACE_RING_SIZE 4096  // Events kept per CPU, a power of two
+#define TRACE_MAX_CPUS SMP_MAX_CPUS
+
+enum trace_id {
+    TRACE_KMAIN,          // Boot stage span, arg is the stage name
+    TRACE_TERMINAL_INIT,  // terminal_initialize()
+    TRACE_KEY,            // Key read by the line editor, arg is the key
+    TRACE_DSH_EXEC,       // Command dispatch span, arg is the command name
+    TRACE_SCHED_SWITCH,   // Context switch, arg is the id of the thread switched to
+    TRACE_ID_COUNT
+};
+
+enum trace_phase {
+    TRACE_PHASE_BEGIN = 'B',
+    TRACE_PHASE_END = 'E',
+    TRACE_PHASE_INSTANT = 'i',
+};
+
+// 16 bytes, four to a cache line
+struct trace_record {
+    uint64_t tsc;
+    uint16_t id;
+    uint8_t phase;
+    uint8_t reserved;
+    uint32_t arg;  // A number, or a pointer to a string that lives forever
+};
+
+/*
+ * Tracepoints cost a few instructions and one store with CONFIG_TRACE
+ * (make TRACE=1) and nothing at all without it, their arguments are not
+ * even evaluated then.
+ */
+#ifdef CONFIG_TRACE
+#define TRACE_BEGIN(id, arg) trace_event((id), TRACE_PHASE_BEGIN, (uint32_t)(uintptr_t)(arg))
+#define TRACE_END(id, arg) trace_event((id), TRACE_PHASE_END, (uint32_t)(uintptr_t)(arg))
+#define TRACE_INSTANT(id, arg) trace_event((id), TRACE_PHASE_INSTANT, (uint32_t)(uintptr_t)(arg))
+#else
+#define TRACE_BEGIN(id, arg) ((void)0)
+#define TRACE_END(id, arg) ((void)0)
+#define TRACE_INSTANT(id, arg) ((void)0)
+#endif
+
+void trace_event(uint16_t id, uint8_t phase, uint32_t arg);
+
+// 0 when the kernel was built without CONFIG_TRACE
+int trace_compiled_in(void);
+
+// Recording can be paused, it is on from boot
+void trace_set_enabled(int enabled);
+int trace_enabled(void);
+void trace_reset(void);
+
+// Events recorded since the last reset, at most TRACE_RING_SIZE per CPU
+// are still in the rings
+uint32_t trace_count(void);
+
+/*
+ * Print the kept events whose name starts with filter, oldest first.
+ * To the console with microseconds since the first event, or to the
+ * serial port as "TRACE cpu=... tsc=... ph=... name=... arg=..." lines
+ * between TRACE_BEGIN and TRACE_END, for scripts/trace2chrome.py.
+ * Recording is paused while it runs. Returns how many were printed
+ */
+uint32_t trace_dump(const char* filter, int serial);
+
+#endif // KERNEL_TRACE_H
@@ -7,6 +7,10 @@
 #define VGA_WIDTH 80
 #define VGA_HEIGHT 25
 
+/* Largest console the shadow buffer holds, 1920x1200 in 8x16 cells */
+#define TERMINAL_MAX_WIDTH 240
+#define TERMINAL_MAX_HEIGHT 75
+
 /* Colors and entry helpers */
 enum vga_color {
     VGA_COLOR_BLACK = 0,
@@ -35,16 +39,69 @@ static inline uint16_t vga_entry(unsigned char uc, uint8_t color) {
     return (uint16_t)uc | (uint16_t)color << 8;
 }
 
-/* Terminal functions */
+/* Console counters, used to measure how much video memory/port I/O we cause */
+struct terminal_stats {
+    uint32_t cell_stores;  // Cells drawn into the shadow buffer
+    uint32_t scrolls;      // Lines scrolled
+    uint32_t mmio_writes;  // Cells actually handed to the backend (video memory)
+    uint32_t port_writes;  // CRTC port writes (cursor updates)
+    uint32_t bytes;        // Bytes passed to the write functions
+    uint32_t flushes;      // Shadow buffer flushes
+};
+
+typedef void (*terminal_mirror_t)(const char* str, size_t len);
+
+// Gets every write before the screen does; returning nonzero takes the
+// text, which then reaches neither the screen nor the mirror
+typedef int (*terminal_capture_t)(const char* str, size_t len);
+
+/*
+ * Where flushed cells end up. Cells are VGA entries (character and
+ * attribute) whatever the backend, the terminal only hands over the ones
+ * that changed since the last flush.
+ */
+struct terminal_backend {
+    const char* name;
+    void (*draw)(size_t x, size_t y, uint16_t entry);
+    void (*cursor)(size_t x, size_t y);
+    // Optional: move everything shown up by lines, hiding the cursor.
+    // Without it the changed cells of every line are drawn again
+    void (*scroll)(size_t lines);
+    // Optional: called at the end of every flush
+    void (*present)(void);
+};
+
+extern const struct terminal_backend vga_text_backend;
+
+/* Terminal functions, safe from any thread, IRQ handler or CPU */
 void terminal_initialize(void);
 void terminal_putchar(char c);
+void terminal_putentryat(char c, uint8_t color, size_t x, size_t y);
 void terminal_write(const char* str);
+void terminal_write_n(const char* str, size_t len);
+void terminal_write_dec(uint32_t value);
+void terminal_write_hex(uint32_t value);
+void terminal_write_ptr(uintptr_t value);  // Hex, all 8 or 16 digits of an address
+void terminal_flush(void);
+void terminal_invalidate(void);
+void terminal_scroll(void);  // Up one line, not mirrored
+void terminal_batch_begin(void);
+void terminal_batch_end(void);
 void terminal_update_cursor(void);
 void terminal_enable_cursor(void);
 void terminal_setcolor(uint8_t color);
+terminal_mirror_t terminal_set_mirror(terminal_mirror_t mirror);  // Returns the old one
+terminal_capture_t terminal_set_capture(terminal_capture_t capture); // Returns the old one
+void terminal_get_stats(struct terminal_stats* out);
+void terminal_reset_stats(void);
+
+// Move the console to another backend and size, the text on screen is kept
+void terminal_set_backend(const struct terminal_backend* backend, size_t width, size_t height);
+const struct terminal_backend* terminal_get_backend(void);
+size_t terminal_width(void);
+size_t terminal_height(void);
 
 /* Export the global variables used by the terminal editing code */
-extern volatile uint16_t* vga_buffer;
 extern uint8_t terminal_color;
 extern size_t terminal_row;
 extern size_t terminal_column;
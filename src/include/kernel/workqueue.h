@@ -0,0 +1,39 @@
+#ifndef KERNEL_WORKQUEUE_H
+#define KERNEL_WORKQUEUE_H
+
+#include <stdint.h>
+
+/*
+ * Deferred work ("bottom halves"): an IRQ handler does the minimum, then
+ * hands the rest to work_schedule(), which queues it for a kernel thread.
+ * A work item is queued at most once at a time, scheduling it again
+ * before it starts running is a no-op, so the function has to handle
+ * everything that piled up since the last run. Functions run one at a
+ * time, with interrupts on, and must not sleep.
+ */
+struct work {
+    void (*func)(void* arg);
+    void* arg;
+    volatile uint32_t pending;  // Queued and not started yet
+};
+
+#define WORK_INIT(func, arg) { (func), (arg), 0 }
+
+struct workqueue_stats {
+    uint32_t queued;
+    uint32_t run;
+    uint32_t dropped;    // Queue full, the item was not queued
+    uint32_t direct;     // Run at once by work_schedule(), there was no worker yet
+};
+
+// Start the worker thread, after sched_init(). Until then work_schedule()
+// runs the function right away.
+void workqueue_init(void);
+
+// Queue the item from an IRQ handler or a thread on any CPU. Returns 0 if
+// it was already pending (or could not be queued).
+int work_schedule(struct work* work);
+
+void workqueue_get_stats(struct workqueue_stats* out);
+
+#endif // KERNEL_WORKQUEUE_H
@@ -0,0 +1,169 @@
+#include <kernel/acpi.h>
+#include <kernel/multiboot.h>
+#include <kernel/klib.h>
+
+#define MADT_LOCAL_APIC 0
+#define MADT_IO_APIC 1
+#define MADT_INTERRUPT_OVERRIDE 2
+#define MADT_LAPIC_ADDRESS_OVERRIDE 5
+
+#define MADT_CPU_ENABLED 0x1
+#define MADT_PCAT_COMPAT 0x1
+
+#define BIOS_EBDA_POINTER 0x40E
+#define BIOS_ROM_START 0xE0000
+#define BIOS_ROM_END 0x100000
+
+struct acpi_rsdp {
+    char signature[8];          // "RSD PTR "
+    uint8_t checksum;
+    char oem_id[6];
+    uint8_t revision;
+    uint32_t rsdt_address;      // All we use, the XSDT only adds 64-bit pointers
+} __attribute__((packed));
+
+struct acpi_sdt_header {
+    char signature[4];
+    uint32_t length;
+    uint8_t revision;
+    uint8_t checksum;
+    char oem_id[6];
+    char oem_table_id[8];
+    uint32_t oem_revision;
+    uint32_t creator_id;
+    uint32_t creator_revision;
+} __attribute__((packed));
+
+struct acpi_madt {
+    struct acpi_sdt_header header;
+    uint32_t lapic_address;
+    uint32_t flags;
+} __attribute__((packed));
+
+struct madt_entry {
+    uint8_t type;
+    uint8_t length;
+} __attribute__((packed));
+
+struct madt_local_apic {
+    struct madt_entry entry;
+    uint8_t processor_id;
+    uint8_t apic_id;
+    uint32_t flags;
+} __attribute__((packed));
+
+struct madt_io_apic {
+    struct madt_entry entry;
+    uint8_t id;
+    uint8_t reserved;
+    uint32_t address;
+    uint32_t gsi_base;
+} __attribute__((packed));
+
+struct madt_interrupt_override {
+    struct madt_entry entry;
+    uint8_t bus;
+    uint8_t source;             // ISA IRQ
+    uint32_t gsi;
+    uint16_t flags;
+} __attribute__((packed));
+
+struct madt_lapic_address_override {
+    struct madt_entry entry;
+    uint16_t reserved;
+    uint64_t address;
+} __attribute__((packed));
+
+static int checksum_ok(const void* data, uint32_t length) {
+    const uint8_t* p = data;
+    uint8_t sum = 0;
+    for (uint32_t i = 0; i < length; i++)
+        sum += p[i];
+    return sum == 0;
+}
+
+static const struct acpi_rsdp* rsdp_scan(uintptr_t start, uintptr_t end) {
+    for (uintptr_t p = start; p + sizeof(struct acpi_rsdp) <= end; p += 16) {
+        const struct acpi_rsdp* rsdp = (const struct acpi_rsdp*)p;
+        if (memcmp(rsdp->signature, "RSD PTR ", 8) == 0 && checksum_ok(rsdp, sizeof(*rsdp)))
+            return rsdp;
+    }
+    return NULL;
+}
+
+static const struct acpi_rsdp* rsdp_find(void) {
+    // GRUB hands over a copy of the RSDP, v2 first
+    const struct multiboot_tag* tag = multiboot_find_tag(MULTIBOOT_TAG_ACPI_NEW, NULL);
+    if (!tag)
+        tag = multiboot_find_tag(MULTIBOOT_TAG_ACPI_OLD, NULL);
+    if (tag && tag->size >= sizeof(*tag) + sizeof(struct acpi_rsdp))
+        return (const struct acpi_rsdp*)(tag + 1);
+
+    // First KiB of the EBDA, then the BIOS ROM area
+    const volatile uint16_t* ebda_pointer = (const volatile uint16_t*)BIOS_EBDA_POINTER;
+    __asm__ ("" : "+r"(ebda_pointer)); // A real pointer, not an offset from NULL
+    uintptr_t ebda = (uintptr_t)*ebda_pointer << 4;
+    const struct acpi_rsdp* rsdp = ebda ? rsdp_scan(ebda, ebda + 1024) : NULL;
+    return rsdp ? rsdp : rsdp_scan(BIOS_ROM_START, BIOS_ROM_END);
+}
+
+static const struct acpi_sdt_header* find_table(const struct acpi_rsdp* rsdp, const char* signature) {
+    const struct acpi_sdt_header* rsdt = (const struct acpi_sdt_header*)(uintptr_t)rsdp->rsdt_address;
+    if (!rsdt || memcmp(rsdt->signature, "RSDT", 4) != 0 || !checksum_ok(rsdt, rsdt->length))
+        return NULL;
+
+    const uint32_t* entries = (const uint32_t*)(rsdt + 1);
+    uint32_t count = (rsdt->length - sizeof(*rsdt)) / sizeof(uint32_t);
+    for (uint32_t i = 0; i < count; i++) {
+        const struct acpi_sdt_header* table = (const struct acpi_sdt_header*)(uintptr_t)entries[i];
+        if (table && memcmp(table->signature, signature, 4) == 0 && checksum_ok(table, table->length))
+            return table;
+    }
+    return NULL;
+}
+
+int acpi_parse_madt(struct acpi_madt_info* out) {
+    memset(out, 0, sizeof(*out));
+    for (int irq = 0; irq < ACPI_ISA_IRQS; irq++)
+        out->isa_gsi[irq] = irq; // Identity unless overridden
+
+    const struct acpi_rsdp* rsdp = rsdp_find();
+    if (!rsdp)
+        return 0;
+    const struct acpi_madt* madt = (const struct acpi_madt*)find_table(rsdp, "APIC");
+    if (!madt)
+        return 0;
+
+    out->lapic_address = madt->lapic_address;
+    out->has_8259 = madt->flags & MADT_PCAT_COMPAT;
+
+    const uint8_t* p = (const uint8_t*)(madt + 1);
+    const uint8_t* end = (const uint8_t*)madt + madt->header.length;
+    while (p + sizeof(struct madt_entry) <= end) {
+        const struct madt_entry* e = (const struct madt_entry*)p;
+        if (e->length < sizeof(*e) || p + e->length > end)
+            break;
+
+        if (e->type == MADT_LOCAL_APIC) {
+            const struct madt_local_apic* lapic = (const struct madt_local_apic*)e;
+            if ((lapic->flags & MADT_CPU_ENABLED) && out->cpu_count < SMP_MAX_CPUS)
+                out->cpu_apic_ids[out->cpu_count++] = lapic->apic_id;
+        } else if (e->type == MADT_IO_APIC && !out->ioapic_address) {
+            const struct madt_io_apic* ioapic = (const struct madt_io_apic*)e;
+            out->ioapic_address = ioapic->address;
+            out->ioapic_gsi_base = ioapic->gsi_base;
+        } else if (e->type == MADT_INTERRUPT_OVERRIDE) {
+            const struct madt_interrupt_override* iso = (const struct madt_interrupt_override*)e;
+            if (iso->bus == 0 && iso->source < ACPI_ISA_IRQS) {
+                out->isa_gsi[iso->source] = iso->gsi;
+                out->isa_flags[iso->source] = iso->flags;
+            }
+        } else if (e->type == MADT_LAPIC_ADDRESS_OVERRIDE) {
+            const struct madt_lapic_address_override* o = (const struct madt_lapic_address_override*)e;
+            if (o->address < 0x100000000ULL)
+                out->lapic_address = (uint32_t)o->address;
+        }
+        p += e->length;
+    }
+    return out->cpu_count > 0;
+}
@@ -0,0 +1,193 @@
+#include <kernel/apic.h>
+#include <kernel/pic.h>
+#include <kernel/cpu.h>
+#include <kernel/idt.h>
+#include <kernel/spinlock.h>
+#include <kernel/timer.h>
+
+/* Local APIC registers, offsets from the MMIO base */
+#define LAPIC_ID 0x020
+#define LAPIC_TPR 0x080
+#define LAPIC_EOI 0x0B0
+#define LAPIC_SVR 0x0F0
+#define LAPIC_ICR_LOW 0x300
+#define LAPIC_ICR_HIGH 0x310
+#define LAPIC_LVT_TIMER 0x320
+#define LAPIC_LVT_LINT0 0x350
+#define LAPIC_LVT_LINT1 0x360
+#define LAPIC_LVT_ERROR 0x370
+#define LAPIC_TIMER_INITIAL 0x380
+#define LAPIC_TIMER_CURRENT 0x390
+#define LAPIC_TIMER_DIVIDE 0x3E0
+
+#define LAPIC_SVR_ENABLE 0x100
+#define LAPIC_LVT_MASKED 0x10000
+#define LAPIC_TIMER_PERIODIC 0x20000
+#define LAPIC_TIMER_DIVIDE_16 0x3
+
+#define ICR_INIT 0x500
+#define ICR_STARTUP 0x600
+#define ICR_ASSERT 0x4000
+#define ICR_DELIVERY_PENDING 0x1000
+
+#define MSR_IA32_APIC_BASE 0x1B
+#define APIC_BASE_ENABLE 0x800
+
+/* IOAPIC: an index register and a data window */
+#define IOAPIC_REGSEL 0x00
+#define IOAPIC_WINDOW 0x10
+#define IOAPIC_VERSION 0x01
+#define IOAPIC_REDIRECTION(n) (0x10 + 2 * (n))
+
+#define IOAPIC_ACTIVE_LOW 0x2000
+#define IOAPIC_LEVEL 0x8000
+#define IOAPIC_MASKED 0x10000
+
+#define CALIBRATE_US 10000
+
+static volatile uint32_t* lapic = NULL;
+static volatile uint32_t* ioapic = NULL;
+static const struct acpi_madt_info* isa_routes = NULL;
+static uint32_t timer_count_per_10ms = 0;
+static int enabled = 0;
+static spinlock_t ioapic_lock = SPINLOCK_INIT; // Index and window are one access
+
+static inline uint32_t lapic_read(uint32_t reg) {
+    return lapic[reg / 4];
+}
+
+static inline void lapic_write(uint32_t reg, uint32_t value) {
+    lapic[reg / 4] = value;
+    (void)lapic[LAPIC_ID / 4]; // Read back so the write has landed
+}
+
+static uint32_t ioapic_read(uint32_t reg) {
+    ioapic[IOAPIC_REGSEL / 4] = reg;
+    return ioapic[IOAPIC_WINDOW / 4];
+}
+
+static void ioapic_write(uint32_t reg, uint32_t value) {
+    ioapic[IOAPIC_REGSEL / 4] = reg;
+    ioapic[IOAPIC_WINDOW / 4] = value;
+}
+
+static void lapic_enable(void) {
+    wrmsr(MSR_IA32_APIC_BASE, rdmsr(MSR_IA32_APIC_BASE) | APIC_BASE_ENABLE);
+    lapic_write(LAPIC_TPR, 0);
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_LVT_ERROR, LAPIC_LVT_MASKED);
+    lapic_write(LAPIC_SVR, LAPIC_SVR_ENABLE | APIC_SPURIOUS_VECTOR);
+}
+
+// Pin of an ISA IRQ and its redirection entry (low half), masked
+static uint32_t ioapic_entry(uint8_t irq, uint32_t* pin) {
+    uint32_t low = (IRQ_BASE + irq) | IOAPIC_MASKED;
+    uint16_t flags = isa_routes->isa_flags[irq];
+
+    *pin = isa_routes->isa_gsi[irq] - isa_routes->ioapic_gsi_base;
+    if ((flags & ACPI_POLARITY_MASK) == ACPI_POLARITY_LOW)
+        low |= IOAPIC_ACTIVE_LOW;
+    if ((flags & ACPI_TRIGGER_MASK) == ACPI_TRIGGER_LEVEL)
+        low |= IOAPIC_LEVEL;
+    return low;
+}
+
+int apic_init(const struct acpi_madt_info* madt) {
+    if (!madt->ioapic_address || !madt->lapic_address)
+        return 0;
+    if (!(cpuid_features_edx() & CPUID_FEAT_APIC) || !(cpuid_features_edx() & CPUID_FEAT_MSR))
+        return 0;
+
+    lapic = (volatile uint32_t*)(uintptr_t)madt->lapic_address;
+    ioapic = (volatile uint32_t*)(uintptr_t)madt->ioapic_address;
+    isa_routes = madt;
+    lapic_enable();
+
+    // Every ISA IRQ goes to the boot CPU, drivers unmask what they use
+    uint32_t pins = ((ioapic_read(IOAPIC_VERSION) >> 16) & 0xFF) + 1;
+    uint16_t unmasked = ~pic_get_mask();
+    for (uint8_t irq = 0; irq < ACPI_ISA_IRQS; irq++) {
+        uint32_t pin;
+        uint32_t low = ioapic_entry(irq, &pin);
+        if (pin >= pins)
+            continue;
+        ioapic_write(IOAPIC_REDIRECTION(pin) + 1, lapic_id() << 24);
+        ioapic_write(IOAPIC_REDIRECTION(pin), low);
+    }
+    pic_disable();
+    enabled = 1;
+
+    // Carry over what drivers had enabled on the 8259s, IRQ 2 is only the cascade
+    for (uint8_t irq = 0; irq < ACPI_ISA_IRQS; irq++) {
+        if (irq != 2 && (unmasked & (1 << irq)))
+            ioapic_unmask_irq(irq);
+    }
+    return 1;
+}
+
+void apic_init_ap(void) {
+    lapic_enable();
+}
+
+int apic_enabled(void) {
+    return enabled;
+}
+
+uint32_t lapic_id(void) {
+    return lapic_read(LAPIC_ID) >> 24;
+}
+
+void lapic_eoi(void) {
+    lapic[LAPIC_EOI / 4] = 0;
+}
+
+static void lapic_send(uint32_t apic_id, uint32_t command) {
+    uint32_t flags = irq_save();
+    lapic_write(LAPIC_ICR_HIGH, apic_id << 24);
+    lapic_write(LAPIC_ICR_LOW, command);
+    while (lapic_read(LAPIC_ICR_LOW) & ICR_DELIVERY_PENDING)
+        __asm__ volatile ("pause");
+    irq_restore(flags);
+}
+
+void lapic_send_ipi(uint32_t apic_id, uint8_t vector) {
+    lapic_send(apic_id, ICR_ASSERT | vector);
+}
+
+void lapic_send_init(uint32_t apic_id) {
+    lapic_send(apic_id, ICR_INIT | ICR_ASSERT);
+}
+
+void lapic_send_startup(uint32_t apic_id, uint32_t page_address) {
+    lapic_send(apic_id, ICR_STARTUP | ICR_ASSERT | (page_address >> 12));
+}
+
+void lapic_timer_start(uint32_t hz) {
+    lapic_write(LAPIC_TIMER_DIVIDE, LAPIC_TIMER_DIVIDE_16);
+    if (!timer_count_per_10ms) {
+        // All local timers run off the same bus clock, measure it once
+        lapic_write(LAPIC_LVT_TIMER, LAPIC_LVT_MASKED);
+        lapic_write(LAPIC_TIMER_INITIAL, 0xFFFFFFFF);
+        kdelay_us(CALIBRATE_US);
+        timer_count_per_10ms = 0xFFFFFFFF - lapic_read(LAPIC_TIMER_CURRENT);
+        lapic_write(LAPIC_TIMER_INITIAL, 0);
+    }
+    lapic_write(LAPIC_LVT_TIMER, LAPIC_TIMER_PERIODIC | APIC_TIMER_VECTOR);
+    lapic_write(LAPIC_TIMER_INITIAL, (uint32_t)((uint64_t)timer_count_per_10ms * (1000000 / CALIBRATE_US) / hz));
+}
+
+void ioapic_mask_irq(uint8_t irq) {
+    uint32_t pin;
+    uint32_t low = ioapic_entry(irq, &pin);
+    uint32_t flags = spin_lock_irqsave(&ioapic_lock);
+    ioapic_write(IOAPIC_REDIRECTION(pin), low);
+    spin_unlock_irqrestore(&ioapic_lock, flags);
+}
+
+void ioapic_unmask_irq(uint8_t irq) {
+    uint32_t pin;
+    uint32_t low = ioapic_entry(irq, &pin);
+    uint32_t flags = spin_lock_irqsave(&ioapic_lock);
+    ioapic_write(IOAPIC_REDIRECTION(pin), low & ~IOAPIC_MASKED);
+    spin_unlock_irqrestore(&ioapic_lock, flags);
+}
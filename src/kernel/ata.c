@@ -0,0 +1,486 @@
+#include <kernel/ata.h>
+#include <kernel/blk.h>
+#include <kernel/pci.h>
+#include <kernel/idt.h>
+#include <kernel/io.h>
+#include <kernel/pmm.h>
+#include <kernel/sched.h>
+#include <kernel/timer.h>
+#include <kernel/klib.h>
+#include <kernel/vga.h>
+
+/* Command block registers, from the channel's I/O base */
+#define ATA_REG_DATA 0
+#define ATA_REG_ERROR 1
+#define ATA_REG_COUNT 2
+#define ATA_REG_LBA0 3
+#define ATA_REG_LBA1 4
+#define ATA_REG_LBA2 5
+#define ATA_REG_DRIVE 6
+#define ATA_REG_STATUS 7
+#define ATA_REG_COMMAND 7
+
+/* Control block: alternate status when read, device control when written */
+#define ATA_CTRL_NIEN 0x02       // No interrupts from the drive
+#define ATA_CTRL_SRST 0x04
+
+#define ATA_SR_ERR 0x01
+#define ATA_SR_DRQ 0x08
+#define ATA_SR_DF 0x20
+#define ATA_SR_BSY 0x80
+
+#define ATA_CMD_READ_PIO 0x20
+#define ATA_CMD_READ_PIO_EXT 0x24
+#define ATA_CMD_READ_DMA 0xC8
+#define ATA_CMD_READ_DMA_EXT 0x25
+#define ATA_CMD_WRITE_PIO 0x30
+#define ATA_CMD_WRITE_PIO_EXT 0x34
+#define ATA_CMD_WRITE_DMA 0xCA
+#define ATA_CMD_WRITE_DMA_EXT 0x35
+#define ATA_CMD_FLUSH 0xE7
+#define ATA_CMD_FLUSH_EXT 0xEA
+#define ATA_CMD_IDENTIFY 0xEC
+
+/* Bus master IDE registers, BAR4 of the controller, secondary at +8 */
+#define BM_COMMAND 0
+#define BM_STATUS 2
+#define BM_PRDT 4
+#define BM_CMD_START 0x01
+#define BM_CMD_READ 0x08         // Drive to memory
+#define BM_ST_ERROR 0x02
+#define BM_ST_IRQ 0x04
+#define BM_ST_DRIVE0_DMA 0x20    // Set by firmware: the drive is set up for DMA
+
+#define PRD_EOT 0x8000           // Last entry of the table
+#define PRD_MAX (PAGE_SIZE / sizeof(struct prd))
+
+#define ATA_MAX_SECTORS 128      // 64 KiB per command, what both LBA28 and
+                                 // the PRD byte counts handle comfortably
+#define ATA_TIMEOUT_MS 2000
+#define ATA_FLUSH_TIMEOUT_MS 30000
+
+/* Physical region descriptor: one piece of a DMA transfer. A piece may not
+ * cross a 64 KiB boundary; a byte count of 0 means 64 KiB. */
+struct prd {
+    uint32_t address;
+    uint16_t bytes;
+    uint16_t flags;
+} __attribute__((packed));
+
+/*
+ * The drives on a channel share its registers, so one command runs at a
+ * time: owned says who has it, under the wait queue's lock, and the IRQ
+ * handler reports a finished DMA there too.
+ */
+struct ata_channel {
+    uint16_t io;
+    uint16_t ctrl;
+    uint16_t bmide;          // 0: no bus master, PIO only
+    uint8_t irq;
+    struct prd* prdt;        // One page
+    struct wait_queue wq;
+    int owned;
+    volatile int irq_done;
+    volatile uint8_t bm_status;
+    volatile uint8_t status;
+};
+
+struct ata_drive {
+    struct blk_device blk;
+    struct ata_channel* channel;
+    uint8_t slave;
+    int lba48;
+    int dma;
+    char model[41];
+};
+
+static struct ata_channel channels[2];
+static struct ata_drive drives[ATA_MAX_DRIVES];
+static uint32_t drive_count = 0;
+
+// Reading the alternate status takes ~100 ns; four of them are the 400 ns
+// a drive may need before its status is meaningful
+static void ata_delay(const struct ata_channel* ch) {
+    for (int i = 0; i < 4; i++)
+        inb(ch->ctrl);
+}
+
+// Wait until BSY clears, returns the status or -1 on timeout
+static int ata_wait_idle(const struct ata_channel* ch, uint32_t timeout_ms) {
+    uint64_t deadline = ktime_ns() + timeout_ms * NS_PER_MS;
+    while (1) {
+        uint8_t status = inb(ch->ctrl);
+        if (!(status & ATA_SR_BSY))
+            return status;
+        if (ktime_ns() > deadline)
+            return -1;
+        cpu_relax();
+    }
+}
+
+// Wait for the drive to want data, returns 0 when it does
+static int ata_wait_drq(const struct ata_channel* ch) {
+    int status = ata_wait_idle(ch, ATA_TIMEOUT_MS);
+    if (status < 0 || (status & (ATA_SR_ERR | ATA_SR_DF)))
+        return -1;
+    return (status & ATA_SR_DRQ) ? 0 : -1;
+}
+
+// Device, LBA and count registers for a command on sectors at lba
+static void ata_setup(const struct ata_drive* drive, uint64_t lba, uint32_t sectors) {
+    uint16_t io = drive->channel->io;
+
+    if (drive->lba48) {
+        outb(io + ATA_REG_DRIVE, 0x40 | (drive->slave << 4));
+        ata_delay(drive->channel);
+        // High bytes first, the registers are two deep
+        outb(io + ATA_REG_COUNT, (uint8_t)(sectors >> 8));
+        outb(io + ATA_REG_LBA0, (uint8_t)(lba >> 24));
+        outb(io + ATA_REG_LBA1, (uint8_t)(lba >> 32));
+        outb(io + ATA_REG_LBA2, (uint8_t)(lba >> 40));
+    } else {
+        outb(io + ATA_REG_DRIVE, 0xE0 | (drive->slave << 4) | ((lba >> 24) & 0x0F));
+        ata_delay(drive->channel);
+    }
+    outb(io + ATA_REG_COUNT, (uint8_t)sectors);
+    outb(io + ATA_REG_LBA0, (uint8_t)lba);
+    outb(io + ATA_REG_LBA1, (uint8_t)(lba >> 8));
+    outb(io + ATA_REG_LBA2, (uint8_t)(lba >> 16));
+}
+
+static void channel_acquire(struct ata_channel* ch) {
+    uint32_t flags = wait_queue_lock(&ch->wq);
+    while (ch->owned) {
+        wait_queue_sleep(&ch->wq, flags, 0);
+        flags = wait_queue_lock(&ch->wq);
+    }
+    ch->owned = 1;
+    wait_queue_unlock(&ch->wq, flags);
+}
+
+static void channel_release(struct ata_channel* ch) {
+    uint32_t flags = wait_queue_lock(&ch->wq);
+    ch->owned = 0;
+    wait_queue_unlock(&ch->wq, flags);
+    wait_queue_wake_all(&ch->wq);
+}
+
+// After a failed command: reset both drives of the channel
+static void channel_reset(struct ata_channel* ch) {
+    outb(ch->ctrl, ATA_CTRL_NIEN | ATA_CTRL_SRST);
+    kdelay_us(5);
+    outb(ch->ctrl, ATA_CTRL_NIEN);
+    ksleep_ms(2);
+    ata_wait_idle(ch, ATA_TIMEOUT_MS);
+}
+
+static int ata_pio(struct ata_drive* drive, uint64_t lba, const struct blk_segment* segments, uint32_t count,
+                   uint32_t sectors, int write) {
+    struct ata_channel* ch = drive->channel;
+    uint8_t command;
+
+    if (write)
+        command = drive->lba48 ? ATA_CMD_WRITE_PIO_EXT : ATA_CMD_WRITE_PIO;
+    else
+        command = drive->lba48 ? ATA_CMD_READ_PIO_EXT : ATA_CMD_READ_PIO;
+
+    outb(ch->ctrl, ATA_CTRL_NIEN); // Polled
+    if (ata_wait_idle(ch, ATA_TIMEOUT_MS) < 0)
+        return -1;
+    ata_setup(drive, lba, sectors);
+    outb(ch->io + ATA_REG_COMMAND, command);
+    ata_delay(ch);
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint8_t* p = segments[i].buffer;
+        for (uint32_t s = 0; s < segments[i].sectors; s++, p += BLK_SECTOR_SIZE) {
+            if (ata_wait_drq(ch))
+                return -1;
+            if (write)
+                outsw(ch->io + ATA_REG_DATA, p, BLK_SECTOR_SIZE / 2);
+            else
+                insw(ch->io + ATA_REG_DATA, p, BLK_SECTOR_SIZE / 2);
+        }
+    }
+    int status = ata_wait_idle(ch, ATA_TIMEOUT_MS);
+    return (status < 0 || (status & (ATA_SR_ERR | ATA_SR_DF))) ? -1 : 0;
+}
+
+// Describe the segments in the channel's PRD table, returns the number of
+// entries or 0 if they cannot be described (odd address, too many pieces)
+static uint32_t build_prdt(struct ata_channel* ch, const struct blk_segment* segments, uint32_t count) {
+    uint32_t n = 0;
+
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t address = (uint32_t)(uintptr_t)segments[i].buffer;
+        uint32_t left = segments[i].sectors * BLK_SECTOR_SIZE;
+        if (address & 1)
+            return 0;
+        while (left) {
+            uint32_t chunk = 0x10000 - (address & 0xFFFF);
+            if (chunk > left)
+                chunk = left;
+            if (n == PRD_MAX)
+                return 0;
+            ch->prdt[n].address = address;
+            ch->prdt[n].bytes = (uint16_t)chunk;
+            ch->prdt[n].flags = 0;
+            address += chunk;
+            left -= chunk;
+            n++;
+        }
+    }
+    ch->prdt[n - 1].flags = PRD_EOT;
+    return n;
+}
+
+#define DMA_UNSUITABLE 1  // Not an error: these buffers have to go by PIO
+
+static int ata_dma(struct ata_drive* drive, uint64_t lba, const struct blk_segment* segments, uint32_t count,
+                   uint32_t sectors, int write) {
+    struct ata_channel* ch = drive->channel;
+    uint16_t bm = ch->bmide;
+    uint8_t direction = write ? 0 : BM_CMD_READ;
+    uint8_t command;
+
+    if (!build_prdt(ch, segments, count))
+        return DMA_UNSUITABLE;
+    if (write)
+        command = drive->lba48 ? ATA_CMD_WRITE_DMA_EXT : ATA_CMD_WRITE_DMA;
+    else
+        command = drive->lba48 ? ATA_CMD_READ_DMA_EXT : ATA_CMD_READ_DMA;
+
+    if (ata_wait_idle(ch, ATA_TIMEOUT_MS) < 0)
+        return -1;
+    outl(bm + BM_PRDT, (uint32_t)(uintptr_t)ch->prdt);
+    outb(bm + BM_COMMAND, direction);
+    outb(bm + BM_STATUS, inb(bm + BM_STATUS) | BM_ST_ERROR | BM_ST_IRQ); // Write 1 to clear
+    ch->irq_done = 0;
+    outb(ch->ctrl, 0); // The drive interrupts when it is done
+    ata_setup(drive, lba, sectors);
+    outb(ch->io + ATA_REG_COMMAND, command);
+    outb(bm + BM_COMMAND, direction | BM_CMD_START);
+
+    uint64_t deadline = ktime_ns() + ATA_TIMEOUT_MS * NS_PER_MS;
+    uint32_t flags = wait_queue_lock(&ch->wq);
+    while (!ch->irq_done && ktime_ns() < deadline) {
+        wait_queue_sleep(&ch->wq, flags, deadline);
+        flags = wait_queue_lock(&ch->wq);
+    }
+    int done = ch->irq_done;
+    wait_queue_unlock(&ch->wq, flags);
+
+    outb(bm + BM_COMMAND, direction); // Stop, also after a timeout
+    outb(ch->ctrl, ATA_CTRL_NIEN);
+    if (!done || (ch->bm_status & BM_ST_ERROR) || (ch->status & (ATA_SR_ERR | ATA_SR_DF))) {
+        channel_reset(ch);
+        return -1;
+    }
+    return 0;
+}
+
+static void ata_irq(struct interrupt_frame* frame) {
+    uint8_t irq = (uint8_t)(frame->int_no - IRQ_BASE);
+
+    for (int i = 0; i < 2; i++) {
+        struct ata_channel* ch = &channels[i];
+        if (!ch->io || ch->irq != irq)
+            continue;
+        uint8_t bm_status = ch->bmide ? inb(ch->bmide + BM_STATUS) : 0;
+        if (ch->bmide && !(bm_status & BM_ST_IRQ))
+            continue;  // Not from this channel
+        ch->status = inb(ch->io + ATA_REG_STATUS); // Acknowledges it on the drive
+        if (ch->bmide)
+            outb(ch->bmide + BM_STATUS, bm_status | BM_ST_ERROR | BM_ST_IRQ);
+        ch->bm_status = bm_status;
+        ch->irq_done = 1;
+        wait_queue_wake_all(&ch->wq);
+    }
+}
+
+static int ata_transfer(struct blk_device* dev, uint64_t lba, const struct blk_segment* segments, uint32_t count,
+                        int write) {
+    struct ata_drive* drive = dev->driver;
+    uint32_t sectors = 0;
+    int result = -1;
+
+    for (uint32_t i = 0; i < count; i++)
+        sectors += segments[i].sectors;
+
+    channel_acquire(drive->channel);
+    if (drive->dma) {
+        result = ata_dma(drive, lba, segments, count, sectors, write);
+        if (result < 0) {
+            // Maybe the controller only claims to do DMA; PIO still works
+            drive->dma = 0;
+            dev->mode = "pio";
+            terminal_write(dev->name);
+            terminal_write(": DMA failed, using PIO\n");
+        }
+    }
+    if (result)
+        result = ata_pio(drive, lba, segments, count, sectors, write);
+    channel_release(drive->channel);
+    return result;
+}
+
+static int ata_flush(struct blk_device* dev) {
+    struct ata_drive* drive = dev->driver;
+    struct ata_channel* ch = drive->channel;
+
+    channel_acquire(ch);
+    outb(ch->ctrl, ATA_CTRL_NIEN);
+    int status = ata_wait_idle(ch, ATA_TIMEOUT_MS);
+    if (status >= 0) {
+        outb(ch->io + ATA_REG_DRIVE, 0xE0 | (drive->slave << 4));
+        ata_delay(ch);
+        outb(ch->io + ATA_REG_COMMAND, drive->lba48 ? ATA_CMD_FLUSH_EXT : ATA_CMD_FLUSH);
+        ata_delay(ch);
+        status = ata_wait_idle(ch, ATA_FLUSH_TIMEOUT_MS);
+    }
+    channel_release(ch);
+    return (status < 0 || (status & (ATA_SR_ERR | ATA_SR_DF))) ? -1 : 0;
+}
+
+// IDENTIFY DEVICE, polled. Returns 0 for no drive or a packet (ATAPI) device
+static int ata_identify(struct ata_channel* ch, uint8_t slave, uint16_t* id) {
+    outb(ch->io + ATA_REG_DRIVE, 0xA0 | (slave << 4));
+    ata_delay(ch);
+    outb(ch->io + ATA_REG_COUNT, 0);
+    outb(ch->io + ATA_REG_LBA0, 0);
+    outb(ch->io + ATA_REG_LBA1, 0);
+    outb(ch->io + ATA_REG_LBA2, 0);
+    outb(ch->io + ATA_REG_COMMAND, ATA_CMD_IDENTIFY);
+    ata_delay(ch);
+    if (inb(ch->io + ATA_REG_STATUS) == 0)
+        return 0;
+    if (ata_wait_idle(ch, ATA_TIMEOUT_MS) < 0)
+        return 0;
+    // Packet devices put a signature here and abort the command
+    if (inb(ch->io + ATA_REG_LBA1) || inb(ch->io + ATA_REG_LBA2))
+        return 0;
+    if (ata_wait_drq(ch))
+        return 0;
+    insw(ch->io + ATA_REG_DATA, id, 256);
+    return 1;
+}
+
+// The model string is big-endian within each word and padded with spaces
+static void copy_model(char* out, const uint16_t* id) {
+    for (int i = 0; i < 20; i++) {
+        out[2 * i] = (char)(id[27 + i] >> 8);
+        out[2 * i + 1] = (char)id[27 + i];
+    }
+    int n = 40;
+    while (n > 0 && out[n - 1] == ' ')
+        n--;
+    out[n] = '\0';
+}
+
+static void ata_probe(struct ata_channel* ch, uint32_t channel_index) {
+    static uint16_t id[256];
+
+    if (inb(ch->io + ATA_REG_STATUS) == 0xFF)
+        return; // Floating bus, nothing attached
+    outb(ch->ctrl, ATA_CTRL_NIEN);
+
+    for (uint8_t slave = 0; slave < 2; slave++) {
+        if (!ata_identify(ch, slave, id))
+            continue;
+        struct ata_drive* drive = &drives[drive_count];
+        memset(drive, 0, sizeof(*drive));
+        drive->channel = ch;
+        drive->slave = slave;
+        drive->lba48 = (id[83] & (1 << 10)) != 0;
+        copy_model(drive->model, id);
+
+        uint64_t sectors;
+        if (drive->lba48)
+            sectors = (uint64_t)id[100] | ((uint64_t)id[101] << 16) | ((uint64_t)id[102] << 32) |
+                      ((uint64_t)id[103] << 48);
+        else
+            sectors = (uint32_t)id[60] | ((uint32_t)id[61] << 16);
+        if (!sectors)
+            continue;
+
+        drive->dma = ch->bmide && (id[49] & (1 << 8));
+        if (drive->dma) {
+            // Firmware would normally say the drive is ready for DMA
+            outb(ch->bmide + BM_STATUS, inb(ch->bmide + BM_STATUS) | (BM_ST_DRIVE0_DMA << slave));
+        }
+
+        struct blk_device* blk = &drive->blk;
+        blk->name[0] = 'h';
+        blk->name[1] = 'd';
+        blk->name[2] = (char)('a' + channel_index * 2 + slave);
+        blk->name[3] = '\0';
+        blk->sectors = sectors;
+        blk->max_sectors = ATA_MAX_SECTORS;
+        blk->transfer = ata_transfer;
+        blk->flush = ata_flush;
+        blk->driver = drive;
+        blk->mode = drive->dma ? "dma" : "pio";
+        if (!blk_register(blk))
+            return;
+        drive_count++;
+
+        terminal_write(blk->name);
+        terminal_write(": ");
+        terminal_write(drive->model);
+        terminal_write(", ");
+        terminal_write_dec((uint32_t)(sectors / (1024 * 1024 / BLK_SECTOR_SIZE)));
+        terminal_write(" MiB, ");
+        terminal_write(blk->mode);
+        terminal_write("\n");
+    }
+}
+
+void ata_init(void) {
+    struct pci_device pci;
+
+    if (!pci_find_class(PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE, &pci))
+        return;
+    uint16_t command = pci_read16(&pci, PCI_COMMAND);
+    pci_write16(&pci, PCI_COMMAND, command | PCI_COMMAND_IO | PCI_COMMAND_BUS_MASTER);
+
+    // prog_if bits 0 and 2: channel in native mode (ports in the BARs),
+    // bit 7: bus master capable
+    uint8_t interrupt_line = pci_read8(&pci, PCI_INTERRUPT_LINE);
+    uint32_t bmide = (pci.prog_if & 0x80) ? pci_bar(&pci, 4) : 0;
+    for (uint32_t i = 0; i < 2; i++) {
+        struct ata_channel* ch = &channels[i];
+        if (pci.prog_if & (1 << (2 * i))) {
+            ch->io = (uint16_t)pci_bar(&pci, 2 * i);
+            ch->ctrl = (uint16_t)pci_bar(&pci, 2 * i + 1) + 2;
+            ch->irq = interrupt_line;
+        } else {
+            ch->io = i ? 0x170 : 0x1F0;
+            ch->ctrl = i ? 0x376 : 0x3F6;
+            ch->irq = i ? 15 : 14;
+        }
+        ch->bmide = bmide ? (uint16_t)(bmide + 8 * i) : 0;
+        ch->wq = (struct wait_queue)WAIT_QUEUE_INIT;
+        if (ch->bmide) {
+            ch->prdt = (struct prd*)pmm_alloc(0);
+            if (!ch->prdt)
+                ch->bmide = 0;
+        }
+
+        uint32_t before = drive_count;
+        ata_probe(ch, i);
+        if (drive_count > before && ch->irq < 16)
+            irq_register_handler(ch->irq, ata_irq);
+    }
+}
+
+int ata_get_info(uint32_t index, struct ata_info* out) {
+    if (index >= drive_count)
+        return 0;
+    const struct ata_drive* drive = &drives[index];
+    memcpy(out->name, drive->blk.name, sizeof(out->name));
+    memcpy(out->model, drive->model, sizeof(out->model));
+    out->sectors = drive->blk.sectors;
+    out->lba48 = drive->lba48;
+    out->dma = drive->dma;
+    return 1;
+}
@@ -0,0 +1,186 @@
+#include <kernel/bench.h>
+#include <kernel/vga.h>
+#include <kernel/serial.h>
+#include <kernel/timer.h>
+#include <kernel/slab.h>
+#include <kernel/klib.h>
+#include <kernel/cpu.h>
+#include <kernel/sched.h>
+
+#define BENCH_WARMUP 8
+#define BENCH_MAX_RESULTS 64
+
+/* Symbols from scripts/linker.ld */
+extern const struct bench __benches_start[];
+extern const struct bench __benches_end[];
+
+const struct bench* bench_next(const struct bench* prev) {
+    const struct bench* b = prev ? prev + 1 : __benches_start;
+    return b < __benches_end ? b : NULL;
+}
+
+// Cost of an empty rdtsc pair, taken off every sample
+static uint32_t rdtsc_overhead(void) {
+    uint64_t best = ~0ULL;
+    for (int i = 0; i < 1000; i++) {
+        uint64_t start = rdtsc();
+        uint64_t cycles = rdtsc() - start;
+        if (cycles < best)
+            best = cycles;
+    }
+    return (uint32_t)best;
+}
+
+static void sift_down(uint32_t* a, size_t root, size_t n) {
+    while (2 * root + 1 < n) {
+        size_t child = 2 * root + 1;
+        if (child + 1 < n && a[child + 1] > a[child])
+            child++;
+        if (a[root] >= a[child])
+            return;
+        uint32_t t = a[root];
+        a[root] = a[child];
+        a[child] = t;
+        root = child;
+    }
+}
+
+// Heapsort, no recursion and no extra memory
+static void sort_samples(uint32_t* a, size_t n) {
+    for (size_t i = n / 2; i > 0; i--)
+        sift_down(a, i - 1, n);
+    for (size_t end = n; end > 1; end--) {
+        uint32_t t = a[0];
+        a[0] = a[end - 1];
+        a[end - 1] = t;
+        sift_down(a, 0, end - 1);
+    }
+}
+
+/*
+ * One benchmark at a time across all threads and CPUs: setup() and
+ * teardown() keep their state in globals (klib's buffer, for one), so a
+ * second run would free it under the first. Waiters sleep, a run can take
+ * a while.
+ */
+static struct wait_queue bench_wait = WAIT_QUEUE_INIT;
+static int bench_busy;
+
+static void bench_lock(void) {
+    uint32_t flags = wait_queue_lock(&bench_wait);
+    while (bench_busy) {
+        wait_queue_sleep(&bench_wait, flags, 0);
+        flags = wait_queue_lock(&bench_wait);
+    }
+    bench_busy = 1;
+    wait_queue_unlock(&bench_wait, flags);
+}
+
+static void bench_unlock(void) {
+    uint32_t flags = wait_queue_lock(&bench_wait);
+    bench_busy = 0;
+    wait_queue_unlock(&bench_wait, flags);
+    wait_queue_wake_all(&bench_wait);
+}
+
+static int bench_run_locked(const struct bench* b, struct bench_result* out) {
+    uint32_t* samples = kmalloc(b->samples * sizeof(uint32_t));
+    if (!samples)
+        return 0;
+    if (b->setup && b->setup() != 0) {
+        kfree(samples);
+        return 0;
+    }
+
+    uint32_t overhead = rdtsc_overhead();
+    for (int i = 0; i < BENCH_WARMUP; i++)
+        b->run();
+    // Interrupts stay on: p99 shows what a timer or serial IRQ costs the
+    // code being measured, min and median are what it costs on its own
+    for (uint32_t i = 0; i < b->samples; i++) {
+        uint64_t start = rdtsc();
+        b->run();
+        uint64_t cycles = rdtsc() - start;
+        samples[i] = cycles > overhead ? (uint32_t)(cycles - overhead) : 0;
+    }
+    if (b->teardown)
+        b->teardown();
+
+    sort_samples(samples, b->samples);
+    out->min = samples[0];
+    out->median = samples[b->samples / 2];
+    out->p99 = samples[(uint64_t)b->samples * 99 / 100];
+    out->samples = b->samples;
+    kfree(samples);
+    return 1;
+}
+
+int bench_run(const struct bench* b, struct bench_result* out) {
+    bench_lock();
+    int ok = bench_run_locked(b, out);
+    bench_unlock();
+    return ok;
+}
+
+static void write_column(uint32_t value, size_t width) {
+    size_t digits = 1;
+    for (uint32_t v = value; v >= 10; v /= 10)
+        digits++;
+    while (width-- > digits)
+        terminal_putchar(' ');
+    terminal_write_dec(value);
+}
+
+int bench_run_all(const char* filter) {
+    static struct bench_result results[BENCH_MAX_RESULTS];
+    static const struct bench* ran[BENCH_MAX_RESULTS];
+    size_t filter_len = strlen(filter);
+    int count = 0;
+
+    // Benchmarks draw on the screen, keep that off the serial console
+    // and repaint with the results when they are done
+    terminal_mirror_t mirror = terminal_set_mirror(NULL);
+    for (const struct bench* b = bench_next(NULL); b && count < BENCH_MAX_RESULTS; b = bench_next(b)) {
+        if (strncmp(b->name, filter, filter_len) != 0)
+            continue;
+        if (bench_run(b, &results[count]))
+            ran[count++] = b;
+    }
+    terminal_initialize();
+    terminal_set_mirror(mirror);
+
+    terminal_write("benchmark               min    median       p99  (cycles/call)\n");
+    for (int i = 0; i < count; i++) {
+        size_t len = strlen(ran[i]->name);
+        terminal_write(ran[i]->name);
+        while (len++ < 18)
+            terminal_putchar(' ');
+        write_column(results[i].min, 8);
+        write_column(results[i].median, 10);
+        write_column(results[i].p99, 10);
+        terminal_write("\n");
+    }
+
+    // One line per result for scripts diffing runs across commits
+    serial_write("\r\nBENCH_INFO arch=" ARCH_NAME " tsc_khz=");
+    serial_write_dec(timer_tsc_khz());
+    serial_write(" sse2=");
+    serial_write_dec(klib_sse2_enabled());
+    serial_write(" count=");
+    serial_write_dec(count);
+    serial_write("\r\n");
+    for (int i = 0; i < count; i++) {
+        serial_write("BENCH name=");
+        serial_write(ran[i]->name);
+        serial_write(" samples=");
+        serial_write_dec(results[i].samples);
+        serial_write(" min=");
+        serial_write_dec(results[i].min);
+        serial_write(" median=");
+        serial_write_dec(results[i].median);
+        serial_write(" p99=");
+        serial_write_dec(results[i].p99);
+        serial_write("\r\n");
+    }
+    return count;
+}
@@ -0,0 +1,735 @@
+#include <kernel/blk.h>
+#include <kernel/pmm.h>
+#include <kernel/klib.h>
+#include <kernel/timer.h>
+#include <kernel/vga.h>
+#include <kernel/serial.h>
+#include <kernel/selftest.h>
+
+#if BLK_BLOCK_SIZE != PAGE_SIZE
+#error "cache blocks are single pmm pages"
+#endif
+
+#define CACHE_BLOCKS 512         // 2 MiB
+#define CACHE_HASH_BITS 8
+#define READAHEAD_BLOCKS 16      // 64 KiB, one full-size ATA transfer
+#define WRITEBACK_BATCH 32
+
+static struct blk_device* devices[BLK_MAX_DEVICES];
+static uint32_t device_count = 0;
+
+int blk_register(struct blk_device* dev) {
+    if (device_count == BLK_MAX_DEVICES)
+        return 0;
+    dev->queue = (struct wait_queue)WAIT_QUEUE_INIT;
+    dev->pending = NULL;
+    dev->busy = 0;
+    dev->plugged = 0;
+    memset(&dev->stats, 0, sizeof(dev->stats));
+    devices[device_count++] = dev;
+    return 1;
+}
+
+struct blk_device* blk_get(uint32_t index) {
+    return index < device_count ? devices[index] : NULL;
+}
+
+struct blk_device* blk_find(const char* name) {
+    for (uint32_t i = 0; i < device_count; i++) {
+        if (strcmp(devices[i]->name, name) == 0)
+            return devices[i];
+    }
+    return NULL;
+}
+
+uint32_t blk_device_blocks(const struct blk_device* dev) {
+    return (uint32_t)(dev->sectors / BLK_SECTORS_PER_BLOCK);
+}
+
+/* ---- Request queue ---- */
+
+// Sorted by lba, so adjacent requests end up next to each other
+static void queue_insert(struct blk_device* dev, struct blk_request* req) {
+    struct blk_request** link = &dev->pending;
+    while (*link && (*link)->lba <= req->lba)
+        link = &(*link)->next;
+    req->next = *link;
+    *link = req;
+}
+
+// Unlink the first request and the ones that continue it, returns how
+// many there are
+static uint32_t queue_take_batch(struct blk_device* dev, struct blk_request** batch) {
+    struct blk_request* first = dev->pending;
+    struct blk_request* last = first;
+    uint64_t end = first->lba + first->count;
+    uint32_t sectors = first->count;
+    uint32_t count = 1;
+
+    while (last->next && count < BLK_MAX_SEGMENTS) {
+        struct blk_request* next = last->next;
+        if (next->write != first->write || next->lba != end || sectors + next->count > dev->max_sectors)
+            break;
+        end += next->count;
+        sectors += next->count;
+        last = next;
+        count++;
+    }
+    dev->pending = last->next;
+    last->next = NULL;
+    *batch = first;
+    return count;
+}
+
+// Called holding the queue lock, returns with it released. Whoever finds
+// the device idle dispatches everything queued, the others only wait.
+static void run_queue(struct blk_device* dev, uint32_t flags) {
+    if (dev->busy || dev->plugged || !dev->pending) {
+        wait_queue_unlock(&dev->queue, flags);
+        return;
+    }
+    dev->busy = 1;
+    while (dev->pending && !dev->plugged) {
+        struct blk_request* batch;
+        struct blk_segment segments[BLK_MAX_SEGMENTS];
+        uint32_t count = queue_take_batch(dev, &batch);
+        uint64_t lba = batch->lba;
+        int write = batch->write;
+        uint32_t sectors = 0;
+
+        struct blk_request* req = batch;
+        for (uint32_t i = 0; i < count; i++, req = req->next) {
+            segments[i].buffer = req->buffer;
+            segments[i].sectors = req->count;
+            sectors += req->count;
+        }
+        dev->stats.transfers++;
+        dev->stats.merged += count - 1;
+        wait_queue_unlock(&dev->queue, flags);
+
+        int error = dev->transfer(dev, lba, segments, count, write);
+
+        flags = wait_queue_lock(&dev->queue);
+        if (error)
+            dev->stats.errors++;
+        else if (write)
+            dev->stats.sectors_written += sectors;
+        else
+            dev->stats.sectors_read += sectors;
+        // The next link is gone once a waiter sees done, read it first
+        for (req = batch; req; ) {
+            struct blk_request* next = req->next;
+            req->error = error;
+            barrier();
+            req->done = 1;
+            req = next;
+        }
+        wait_queue_unlock(&dev->queue, flags);
+        wait_queue_wake_all(&dev->queue);
+        flags = wait_queue_lock(&dev->queue);
+    }
+    dev->busy = 0;
+    wait_queue_unlock(&dev->queue, flags);
+}
+
+void blk_submit(struct blk_device* dev, struct blk_request* req) {
+    req->done = 0;
+    req->error = 0;
+    if (!req->count || req->count > dev->max_sectors || req->lba + req->count > dev->sectors) {
+        req->error = -1;
+        req->done = 1;
+        return;
+    }
+    uint32_t flags = wait_queue_lock(&dev->queue);
+    dev->stats.requests++;
+    queue_insert(dev, req);
+    run_queue(dev, flags);
+}
+
+int blk_wait(struct blk_device* dev, struct blk_request* req) {
+    uint32_t flags = wait_queue_lock(&dev->queue);
+    while (!req->done) {
+        wait_queue_sleep(&dev->queue, flags, 0);
+        flags = wait_queue_lock(&dev->queue);
+    }
+    wait_queue_unlock(&dev->queue, flags);
+    return req->error;
+}
+
+void blk_plug(struct blk_device* dev) {
+    uint32_t flags = wait_queue_lock(&dev->queue);
+    dev->plugged++;
+    wait_queue_unlock(&dev->queue, flags);
+}
+
+void blk_unplug(struct blk_device* dev) {
+    uint32_t flags = wait_queue_lock(&dev->queue);
+    dev->plugged--;
+    run_queue(dev, flags);
+}
+
+int blk_rw(struct blk_device* dev, uint64_t lba, uint32_t count, void* buffer, int write) {
+    uint8_t* p = buffer;
+    while (count) {
+        uint32_t n = count < dev->max_sectors ? count : dev->max_sectors;
+        struct blk_request req = { lba, n, p, write, 0, 0, NULL };
+        blk_submit(dev, &req);
+        if (blk_wait(dev, &req))
+            return -1;
+        lba += n;
+        count -= n;
+        p += n * BLK_SECTOR_SIZE;
+    }
+    return 0;
+}
+
+/* ---- Buffer cache ----
+ *
+ * Everything below is under the lock of the cache wait queue, which is
+ * also where threads sleep until a block's I/O (BLK_BUF_BUSY) is over.
+ * Every buffer that has a page is on the LRU list; those with dev == NULL
+ * are free and not hashed.
+ */
+static struct blk_buf bufs[CACHE_BLOCKS];
+static struct blk_request buf_requests[CACHE_BLOCKS]; // bufs[i]'s I/O
+static uint32_t bufs_used = 0;                        // Have a page
+static struct blk_buf* hash_table[1 << CACHE_HASH_BITS];
+static struct blk_buf* lru_head = NULL;
+static struct blk_buf* lru_tail = NULL;
+static struct wait_queue cache = WAIT_QUEUE_INIT;
+static struct blk_cache_stats cache_stats;
+static struct blk_device* seq_dev = NULL;             // Readahead: where the last
+static uint32_t seq_next = 0;                         // miss's batch ended
+
+static uint32_t hash_index(const struct blk_device* dev, uint32_t block) {
+    uint32_t key = block ^ ((uint32_t)(uintptr_t)dev >> 4);
+    return (key * 2654435761u) >> (32 - CACHE_HASH_BITS);
+}
+
+static struct blk_buf* cache_lookup(const struct blk_device* dev, uint32_t block) {
+    for (struct blk_buf* b = hash_table[hash_index(dev, block)]; b; b = b->hash_next) {
+        if (b->dev == dev && b->block == block)
+            return b;
+    }
+    return NULL;
+}
+
+static void hash_insert(struct blk_buf* b) {
+    struct blk_buf** bucket = &hash_table[hash_index(b->dev, b->block)];
+    b->hash_next = *bucket;
+    *bucket = b;
+}
+
+static void hash_remove(struct blk_buf* b) {
+    struct blk_buf** link = &hash_table[hash_index(b->dev, b->block)];
+    while (*link != b)
+        link = &(*link)->hash_next;
+    *link = b->hash_next;
+}
+
+static void lru_remove(struct blk_buf* b) {
+    if (b->lru_prev)
+        b->lru_prev->lru_next = b->lru_next;
+    else
+        lru_head = b->lru_next;
+    if (b->lru_next)
+        b->lru_next->lru_prev = b->lru_prev;
+    else
+        lru_tail = b->lru_prev;
+}
+
+static void lru_push_head(struct blk_buf* b) {
+    b->lru_prev = NULL;
+    b->lru_next = lru_head;
+    if (lru_head)
+        lru_head->lru_prev = b;
+    else
+        lru_tail = b;
+    lru_head = b;
+}
+
+static void lru_touch(struct blk_buf* b) {
+    if (lru_head != b) {
+        lru_remove(b);
+        lru_push_head(b);
+    }
+}
+
+// Forget a block: free the buffer for reuse
+static void cache_forget(struct blk_buf* b) {
+    hash_remove(b);
+    b->dev = NULL;
+    b->flags = 0;
+}
+
+// Drop the lock to wake the sleepers, wait_queue_wake_all() takes it
+static void cache_wake(uint32_t* flags) {
+    wait_queue_unlock(&cache, *flags);
+    wait_queue_wake_all(&cache);
+    *flags = wait_queue_lock(&cache);
+}
+
+// A buffer to load a block into, unhashed and off the LRU list: a new
+// page while the cache grows, then the least recently used clean block
+static struct blk_buf* cache_get_free(void) {
+    if (bufs_used < CACHE_BLOCKS) {
+        uintptr_t page = pmm_alloc(0);
+        if (page) {
+            struct blk_buf* b = &bufs[bufs_used++];
+            b->data = (uint8_t*)page;
+            return b;
+        }
+    }
+    for (struct blk_buf* b = lru_tail; b; b = b->lru_prev) {
+        if (b->refs || (b->flags & (BLK_BUF_BUSY | BLK_BUF_DIRTY)))
+            continue;
+        if (b->dev) {
+            cache_forget(b);
+            cache_stats.evictions++;
+        }
+        lru_remove(b);
+        return b;
+    }
+    return NULL;
+}
+
+// Write up to WRITEBACK_BATCH of dev's dirty blocks, oldest first, in one
+// plugged batch so they merge. Drops the lock meanwhile. Returns the
+// number of errors, *written the blocks that made it to the disk.
+static int cache_writeback(struct blk_device* dev, uint32_t* flags, uint32_t* written) {
+    struct blk_buf* batch[WRITEBACK_BATCH];
+    uint32_t count = 0;
+    int errors = 0;
+
+    *written = 0;
+    for (struct blk_buf* b = lru_tail; b && count < WRITEBACK_BATCH; b = b->lru_prev) {
+        if (b->dev != dev || !(b->flags & BLK_BUF_DIRTY) || (b->flags & BLK_BUF_BUSY))
+            continue;
+        // Dirty again if someone changes it while it is written
+        b->flags = (b->flags & ~BLK_BUF_DIRTY) | BLK_BUF_BUSY;
+        batch[count++] = b;
+    }
+    if (!count)
+        return 0;
+    wait_queue_unlock(&cache, *flags);
+
+    blk_plug(dev);
+    for (uint32_t i = 0; i < count; i++) {
+        struct blk_request* req = &buf_requests[batch[i] - bufs];
+        req->lba = (uint64_t)batch[i]->block * BLK_SECTORS_PER_BLOCK;
+        req->count = BLK_SECTORS_PER_BLOCK;
+        req->buffer = batch[i]->data;
+        req->write = 1;
+        blk_submit(dev, req);
+    }
+    blk_unplug(dev);
+    for (uint32_t i = 0; i < count; i++)
+        blk_wait(dev, &buf_requests[batch[i] - bufs]);
+
+    *flags = wait_queue_lock(&cache);
+    for (uint32_t i = 0; i < count; i++) {
+        batch[i]->flags &= ~BLK_BUF_BUSY;
+        if (buf_requests[batch[i] - bufs].error) {
+            batch[i]->flags |= BLK_BUF_DIRTY; // Keep the data, sync reports it
+            errors++;
+        } else {
+            cache_stats.writebacks++;
+            (*written)++;
+        }
+    }
+    cache_wake(flags);
+    return errors;
+}
+
+// Nothing clean to reuse: write back the oldest dirty blocks or wait for
+// I/O in flight. Returns -1 if every block is referenced.
+static int cache_make_room(uint32_t* flags) {
+    for (struct blk_buf* b = lru_tail; b; b = b->lru_prev) {
+        if (!b->refs && (b->flags & BLK_BUF_DIRTY) && !(b->flags & BLK_BUF_BUSY)) {
+            uint32_t written;
+            cache_writeback(b->dev, flags, &written);
+            return written ? 0 : -1;
+        }
+    }
+    for (struct blk_buf* b = lru_tail; b; b = b->lru_prev) {
+        if (!b->refs && (b->flags & BLK_BUF_BUSY)) {
+            wait_queue_sleep(&cache, *flags, 0);
+            *flags = wait_queue_lock(&cache);
+            return 0;
+        }
+    }
+    return -1;
+}
+
+// Read the missing block, and when it continues the previous miss, the
+// blocks after it too (up to the first one already cached). Drops the
+// lock meanwhile. Returns -1 if the block could not be read, 0 when the
+// caller should look it up again.
+static int cache_fill(struct blk_device* dev, uint32_t block, uint32_t* flags) {
+    struct blk_buf* batch[READAHEAD_BLOCKS];
+    uint32_t count = (dev == seq_dev && block == seq_next) ? READAHEAD_BLOCKS : 1;
+    uint32_t left = blk_device_blocks(dev) - block;
+    uint32_t n = 0;
+
+    if (count > left)
+        count = left;
+    for (; n < count; n++) {
+        if (n && cache_lookup(dev, block + n))
+            break;
+        struct blk_buf* b = cache_get_free();
+        if (!b)
+            break;
+        b->dev = dev;
+        b->block = block + n;
+        b->flags = BLK_BUF_BUSY;
+        b->refs = 0;
+        hash_insert(b);
+        lru_push_head(b);
+        batch[n] = b;
+    }
+    if (!n)
+        return cache_make_room(flags);
+    seq_dev = dev;
+    seq_next = block + n;
+    cache_stats.readahead += n - 1;
+    wait_queue_unlock(&cache, *flags);
+
+    blk_plug(dev);
+    for (uint32_t i = 0; i < n; i++) {
+        struct blk_request* req = &buf_requests[batch[i] - bufs];
+        req->lba = (uint64_t)batch[i]->block * BLK_SECTORS_PER_BLOCK;
+        req->count = BLK_SECTORS_PER_BLOCK;
+        req->buffer = batch[i]->data;
+        req->write = 0;
+        blk_submit(dev, req);
+    }
+    blk_unplug(dev);
+    for (uint32_t i = 0; i < n; i++)
+        blk_wait(dev, &buf_requests[batch[i] - bufs]);
+
+    *flags = wait_queue_lock(&cache);
+    int error = buf_requests[batch[0] - bufs].error;
+    for (uint32_t i = 0; i < n; i++) {
+        if (buf_requests[batch[i] - bufs].error)
+            cache_forget(batch[i]);
+        else
+            batch[i]->flags = BLK_BUF_VALID;
+    }
+    cache_wake(flags);
+    return error ? -1 : 0;
+}
+
+struct blk_buf* blk_bread(struct blk_device* dev, uint32_t block) {
+    int missed = 0;
+
+    if (block >= blk_device_blocks(dev))
+        return NULL;
+    uint32_t flags = wait_queue_lock(&cache);
+    while (1) {
+        struct blk_buf* b = cache_lookup(dev, block);
+        if (b && (b->flags & BLK_BUF_VALID)) {
+            b->refs++;
+            lru_touch(b);
+            if (!missed)
+                cache_stats.hits++;
+            wait_queue_unlock(&cache, flags);
+            return b;
+        }
+        if (b) {
+            // Someone else is reading it
+            wait_queue_sleep(&cache, flags, 0);
+            flags = wait_queue_lock(&cache);
+            continue;
+        }
+        if (!missed) {
+            missed = 1;
+            cache_stats.misses++;
+        }
+        if (cache_fill(dev, block, &flags) < 0) {
+            wait_queue_unlock(&cache, flags);
+            return NULL;
+        }
+    }
+}
+
+void blk_mark_dirty(struct blk_buf* buf) {
+    uint32_t flags = wait_queue_lock(&cache);
+    buf->flags |= BLK_BUF_DIRTY;
+    wait_queue_unlock(&cache, flags);
+}
+
+void blk_brelse(struct blk_buf* buf) {
+    uint32_t flags = wait_queue_lock(&cache);
+    buf->refs--;
+    wait_queue_unlock(&cache, flags);
+}
+
+static int sync_device(struct blk_device* dev) {
+    int errors = 0;
+    uint32_t flags = wait_queue_lock(&cache);
+    while (1) {
+        uint32_t written;
+        int failed = cache_writeback(dev, &flags, &written);
+        errors += failed;
+        if (!written || failed)
+            break;
+    }
+    wait_queue_unlock(&cache, flags);
+    if (dev->flush && dev->flush(dev))
+        errors++;
+    return errors;
+}
+
+int blk_sync(struct blk_device* dev) {
+    if (dev)
+        return sync_device(dev);
+    int errors = 0;
+    for (uint32_t i = 0; i < device_count; i++)
+        errors += sync_device(devices[i]);
+    return errors;
+}
+
+int blk_cache_drop(struct blk_device* dev) {
+    int errors = blk_sync(dev);
+    uint32_t flags = wait_queue_lock(&cache);
+    for (struct blk_buf* b = lru_head; b; b = b->lru_next) {
+        if (b->dev == dev && !b->refs && !(b->flags & (BLK_BUF_BUSY | BLK_BUF_DIRTY)))
+            cache_forget(b);
+    }
+    if (seq_dev == dev)
+        seq_dev = NULL;
+    wait_queue_unlock(&cache, flags);
+    return errors;
+}
+
+void blk_cache_get_stats(struct blk_cache_stats* out) {
+    uint32_t flags = wait_queue_lock(&cache);
+    *out = cache_stats;
+    out->blocks = 0;
+    out->dirty = 0;
+    for (struct blk_buf* b = lru_head; b; b = b->lru_next) {
+        if (b->dev)
+            out->blocks++;
+        if (b->flags & BLK_BUF_DIRTY)
+            out->dirty++;
+    }
+    wait_queue_unlock(&cache, flags);
+}
+
+/* ---- blkbench ---- */
+
+static uint32_t kib_per_sec(uint64_t bytes, uint64_t ns) {
+    return ns ? (uint32_t)(bytes * (NS_PER_SEC / 1024) / ns) : 0;
+}
+
+static void bench_report(const struct blk_device* dev, const char* test, uint64_t bytes, uint64_t ns,
+                         uint32_t hits, uint32_t lookups) {
+    uint32_t rate = kib_per_sec(bytes, ns);
+    uint32_t hit_pct = lookups ? hits * 100 / lookups : 0;
+
+    terminal_write("  ");
+    terminal_write(test);
+    for (size_t n = strlen(test); n < 12; n++)
+        terminal_putchar(' ');
+    terminal_write_dec(rate);
+    terminal_write(" KiB/s");
+    if (lookups) {
+        terminal_write(", hits ");
+        terminal_write_dec(hit_pct);
+        terminal_write("%");
+    }
+    terminal_write("\n");
+
+    serial_write("BLKBENCH dev=");
+    serial_write(dev->name);
+    serial_write(" test=");
+    serial_write(test);
+    serial_write(" kib_s=");
+    serial_write_dec(rate);
+    serial_write(" hit_pct=");
+    serial_write_dec(hit_pct);
+    serial_write("\r\n");
+}
+
+// Read blocks through the cache, returns the time or 0 on an error
+static uint64_t bench_blocks(struct blk_device* dev, uint32_t count, uint32_t range, int random) {
+    uint32_t seed = 2463534242u;
+    uint64_t start = ktime_ns();
+    for (uint32_t i = 0; i < count; i++) {
+        uint32_t block = i;
+        if (random) {
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+            block = seed % range;
+        }
+        struct blk_buf* b = blk_bread(dev, block);
+        if (!b)
+            return 0;
+        blk_brelse(b);
+    }
+    uint64_t ns = ktime_ns() - start;
+    return ns ? ns : 1;
+}
+
+int blk_bench(struct blk_device* dev, uint32_t mib) {
+    struct blk_cache_stats before, after;
+    uint32_t order = pmm_order_for(dev->max_sectors * BLK_SECTOR_SIZE);
+    uintptr_t buffer = pmm_alloc(order);
+    if (!buffer) {
+        terminal_write("blkbench: out of memory\n");
+        return 0;
+    }
+
+    uint32_t blocks = (mib ? mib : 16) * (1024 * 1024 / BLK_BLOCK_SIZE);
+    if (blocks > blk_device_blocks(dev))
+        blocks = blk_device_blocks(dev);
+    uint64_t sectors = (uint64_t)blocks * BLK_SECTORS_PER_BLOCK;
+
+    terminal_write(dev->name);
+    terminal_write(": ");
+    terminal_write_dec(blocks * BLK_BLOCK_SIZE / 1024);
+    terminal_write(" KiB, ");
+    terminal_write(dev->mode);
+    terminal_write("\n");
+
+    int ok = 1;
+    // Raw: largest transfers the driver takes, no cache
+    uint64_t start = ktime_ns();
+    for (uint64_t lba = 0; lba < sectors && ok; lba += dev->max_sectors) {
+        uint32_t n = sectors - lba < dev->max_sectors ? (uint32_t)(sectors - lba) : dev->max_sectors;
+        ok = blk_rw(dev, lba, n, (void*)buffer, 0) == 0;
+    }
+    if (ok)
+        bench_report(dev, "raw_seq", sectors * BLK_SECTOR_SIZE, ktime_ns() - start, 0, 0);
+
+    // Cached sequential: one block per read, readahead does the batching
+    if (ok) {
+        blk_cache_drop(dev);
+        blk_cache_get_stats(&before);
+        uint64_t ns = bench_blocks(dev, blocks, blocks, 0);
+        blk_cache_get_stats(&after);
+        ok = ns != 0;
+        if (ok)
+            bench_report(dev, "cached_seq", (uint64_t)blocks * BLK_BLOCK_SIZE, ns, after.hits - before.hits,
+                         (after.hits - before.hits) + (after.misses - before.misses));
+    }
+
+    // Random blocks over twice the cache size, so about half can hit
+    if (ok) {
+        uint32_t range = blocks < 2 * CACHE_BLOCKS ? blocks : 2 * CACHE_BLOCKS;
+        uint32_t reads = 4 * range;
+        blk_cache_drop(dev);
+        blk_cache_get_stats(&before);
+        uint64_t ns = bench_blocks(dev, reads, range, 1);
+        blk_cache_get_stats(&after);
+        ok = ns != 0;
+        if (ok)
+            bench_report(dev, "random", (uint64_t)reads * BLK_BLOCK_SIZE, ns, after.hits - before.hits,
+                         (after.hits - before.hits) + (after.misses - before.misses));
+    }
+
+    if (!ok)
+        terminal_write("blkbench: I/O error\n");
+    pmm_free(buffer, order);
+    return ok;
+}
+
+/* Self-test, see selftest.h: a RAM disk, so no real disk is written */
+#define RAMDISK_ORDER 6  // 256 KiB
+
+static struct {
+    struct blk_device dev;
+    uint8_t* data;
+    uint32_t transfers;
+} ramdisk;
+
+static int ramdisk_transfer(struct blk_device* dev, uint64_t lba, const struct blk_segment* segments,
+                            uint32_t count, int write) {
+    (void)dev;
+    uint8_t* p = ramdisk.data + lba * BLK_SECTOR_SIZE;
+    for (uint32_t i = 0; i < count; i++) {
+        size_t bytes = segments[i].sectors * BLK_SECTOR_SIZE;
+        if (write)
+            memcpy(p, segments[i].buffer, bytes);
+        else
+            memcpy(segments[i].buffer, p, bytes);
+        p += bytes;
+    }
+    ramdisk.transfers++;
+    return 0;
+}
+
+static const char* blk_selftest(void) {
+    static uint8_t sectors[4][8 * BLK_SECTOR_SIZE];
+    const char* error = NULL;
+
+    uintptr_t data = pmm_alloc(RAMDISK_ORDER);
+    if (!data)
+        return "out of memory";
+    memset(&ramdisk, 0, sizeof(ramdisk));
+    ramdisk.data = (uint8_t*)data;
+    memset(ramdisk.data, 0, PAGE_SIZE << RAMDISK_ORDER);
+    strncpy(ramdisk.dev.name, "ram", BLK_NAME_LEN - 1);
+    ramdisk.dev.sectors = (PAGE_SIZE << RAMDISK_ORDER) / BLK_SECTOR_SIZE;
+    ramdisk.dev.max_sectors = 128;
+    ramdisk.dev.transfer = ramdisk_transfer;
+    ramdisk.dev.mode = "ram";
+    ramdisk.dev.queue = (struct wait_queue)WAIT_QUEUE_INIT;
+
+    // Out of order while plugged: sorted and merged into one transfer
+    static const uint32_t order[4] = { 2, 0, 3, 1 };
+    struct blk_request reqs[4];
+    blk_plug(&ramdisk.dev);
+    for (int i = 0; i < 4; i++) {
+        memset(sectors[order[i]], 'a' + order[i], sizeof(sectors[0]));
+        reqs[i] = (struct blk_request){ order[i] * 8, 8, sectors[order[i]], 1, 0, 0, NULL };
+        blk_submit(&ramdisk.dev, &reqs[i]);
+    }
+    if (ramdisk.transfers != 0)
+        error = "plugged queue was dispatched";
+    blk_unplug(&ramdisk.dev);
+    for (int i = 0; i < 4; i++)
+        blk_wait(&ramdisk.dev, &reqs[i]);
+    if (!error && ramdisk.transfers != 1)
+        error = "adjacent requests not merged";
+    for (int i = 0; i < 4 && !error; i++) {
+        if (ramdisk.data[i * 8 * BLK_SECTOR_SIZE] != 'a' + i ||
+            ramdisk.data[(i * 8 + 7) * BLK_SECTOR_SIZE + 511] != 'a' + i)
+            error = "merged write landed in the wrong place";
+    }
+
+    // Write back: the change reaches the disk on sync, not before
+    struct blk_buf* b = error ? NULL : blk_bread(&ramdisk.dev, 5);
+    if (!error && !b)
+        error = "blk_bread failed";
+    if (b) {
+        if (b->data[0] != 0)
+            error = "cache read wrong data";
+        memset(b->data, 'z', BLK_BLOCK_SIZE);
+        blk_mark_dirty(b);
+        blk_brelse(b);
+        if (!error && ramdisk.data[5 * BLK_BLOCK_SIZE] != 0)
+            error = "write went through before sync";
+        if (blk_sync(&ramdisk.dev) && !error)
+            error = "sync failed";
+        if (!error && ramdisk.data[6 * BLK_BLOCK_SIZE - 1] != 'z')
+            error = "sync did not write the block";
+    }
+
+    // A second read of the same block hits
+    struct blk_cache_stats before, after;
+    blk_cache_get_stats(&before);
+    b = error ? NULL : blk_bread(&ramdisk.dev, 5);
+    if (b) {
+        blk_cache_get_stats(&after);
+        if (after.hits != before.hits + 1 || b->data[0] != 'z')
+            error = "cached block not found";
+        blk_brelse(b);
+    }
+
+    blk_cache_drop(&ramdisk.dev);
+    pmm_free(data, RAMDISK_ORDER);
+    return error;
+}
+SELFTEST(blk, blk_selftest);
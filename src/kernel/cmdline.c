@@ -0,0 +1,34 @@
+#include <kernel/cmdline.h>
+#include <kernel/multiboot.h>
+#include <kernel/klib.h>
+
+// Step over one word, copying it without its quotes into out if given
+static const char* cmdline_word(const char* p, char* out, size_t size) {
+    size_t len = 0;
+    int quoted = 0;
+    for (; *p && (quoted || *p != ' '); p++) {
+        if (*p == '"')
+            quoted = !quoted;
+        else if (out && len + 1 < size)
+            out[len++] = *p;
+    }
+    if (out)
+        out[len] = '\0';
+    return p;
+}
+
+int cmdline_get(const char* key, char* value, size_t size) {
+    const char* p = multiboot_cmdline();
+    size_t key_len = strlen(key);
+
+    while (*p) {
+        while (*p == ' ')
+            p++;
+        if (strncmp(p, key, key_len) == 0 && p[key_len] == '=') {
+            cmdline_word(p + key_len + 1, value, size);
+            return 1;
+        }
+        p = cmdline_word(p, NULL, 0);
+    }
+    return 0;
+}
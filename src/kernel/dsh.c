@@ -1,9 +1,21 @@
 #include <kernel/dsh.h>
+#include <kernel/dsh_history.h>
+#include <kernel/gapbuf.h>
+#include <kernel/klib.h>
+#include <kernel/bench.h>
+#include <kernel/selftest.h>
+#include <kernel/trace.h>
 #include <kernel/vga.h>
 #include <kernel/io.h>
+#include <kernel/input.h>
+#include <kernel/keymap.h>
+#include <kernel/serial.h>
+#include <kernel/timer.h>
+#include <kernel/pmm.h>
+#include <kernel/slab.h>
+#include <kernel/sched.h>
 #include <stdint.h>
 #include <stddef.h>
-#include <string.h>
 
 extern size_t terminal_column;
 
@@ -11,535 +23,807 @@ extern size_t terminal_column;
 #define PROMPT_LEN (sizeof(PROMPT) - 1)
 #define PROMPT_COLOR VGA_COLOR_LIGHT_BROWN
 
-static void refresh_input_line(const char *buffer, size_t buf_len, size_t cursor_pos, size_t start_row) {
-    size_t total_columns = PROMPT_LEN + buf_len;
-    size_t lines_needed = (total_columns + VGA_WIDTH - 1) / VGA_WIDTH;
-    
-    for (size_t row = start_row; row < start_row + lines_needed+1; row++) {
-        for (size_t col = 0; col < VGA_WIDTH; col++) {
-            vga_buffer[row * VGA_WIDTH + col] = vga_entry(' ', terminal_color);
-        }
+#define CTRL(c) ((c) & 0x1F)
+
+#define LINE_CLEAN ((size_t)-1)
+
+/*
+ * The line being edited is drawn as prompt + text from column 0 of
+ * start_row, positions here are cells of that string. Edits only record
+ * the first cell they changed and line_flush() redraws from there, so
+ * typing at the end of a long line draws one cell and a burst of queued
+ * input (a paste) is drawn once, when the queue runs dry.
+ */
+struct line_editor {
+    struct gap_buffer *text;  // The gap is at the cursor
+    const char *prompt;
+    size_t prompt_len;
+    int start_row;            // Negative once the line is taller than the screen
+    size_t shown;             // Cells on screen
+    size_t dirty;             // First cell to redraw, LINE_CLEAN if none
+    size_t serial_cell;       // Cell the serial terminal's cursor is at
+    int echo_serial;          // Also draw on the serial terminal
+};
+
+static char line_cell(const struct line_editor *ed, size_t x) {
+    return x < ed->prompt_len ? ed->prompt[x] : gap_buffer_at(ed->text, x - ed->prompt_len);
+}
+
+static void line_mark(struct line_editor *ed, size_t cell) {
+    if (cell < ed->dirty)
+        ed->dirty = cell;
+}
+
+// Step the serial terminal's cursor left or right
+static void serial_cursor_move(long delta) {
+    if (delta == 0)
+        return;
+    char seq[16] = "\x1b[";
+    size_t n = delta < 0 ? (size_t)-delta : (size_t)delta, len = 2, digits = 1;
+    for (size_t v = n; v >= 10; v /= 10)
+        digits++;
+    for (size_t i = digits; i > 0; i--, n /= 10)
+        seq[len + i - 1] = '0' + n % 10;
+    len += digits;
+    seq[len++] = delta < 0 ? 'D' : 'C';
+    serial_write_n(seq, len);
+}
+
+static void serial_write_text(const struct gap_buffer *gb, size_t from) {
+    size_t len = gap_buffer_length(gb);
+    if (from < gb->gap_start) {
+        serial_write_n(gb->data + from, gb->gap_start - from);
+        from = gb->gap_start;
     }
-    
-    size_t current_row = start_row;
-    size_t current_col = 0;
-    for (size_t i = 0; i < PROMPT_LEN; i++) {
-        vga_buffer[current_row * VGA_WIDTH + current_col] = vga_entry(PROMPT[i], PROMPT_COLOR);
-        current_col++;
+    if (from < len)
+        serial_write_n(gb->data + gb->gap_end + (from - gb->gap_start), len - from);
+}
+
+static void line_flush(struct line_editor *ed) {
+    size_t cells = ed->prompt_len + gap_buffer_length(ed->text);
+    size_t cursor = ed->prompt_len + ed->text->gap_start;
+    size_t end = cells > ed->shown ? cells : ed->shown;
+    size_t width = terminal_width();
+
+    // Keep the last row, where the cursor goes after the final cell, on screen
+    while (ed->start_row + (int)(cells / width) >= (int)terminal_height()) {
+        terminal_scroll();
+        ed->start_row--;
     }
 
-    for (size_t i = 0; i < buf_len; i++) {
-        if (current_col >= VGA_WIDTH) {
-            current_row++;
-            current_col = 0;
+    if (ed->dirty < end) {
+        // Cells go to the terminal's shadow buffer, the flush below only
+        // touches video memory for the cells that actually changed
+        size_t x = ed->dirty;
+        if (ed->start_row < 0 && x < (size_t)-ed->start_row * width)
+            x = (size_t)-ed->start_row * width;  // Scrolled off the top
+        for (; x < end; x++) {
+            char c = x < cells ? line_cell(ed, x) : ' ';
+            uint8_t color = x < ed->prompt_len ? PROMPT_COLOR : terminal_color;
+            terminal_putentryat(c, color, x % width, (size_t)(ed->start_row + (int)(x / width)));
         }
-        vga_buffer[current_row * VGA_WIDTH + current_col] = vga_entry(buffer[i], terminal_color);
-        current_col++;
+
+        // Same cells on a terminal on the serial port: go to the first
+        // changed one, rewrite the rest and erase what is left of the old line
+        size_t from = ed->dirty < cells ? ed->dirty : cells;
+        if (ed->echo_serial) {
+            if (from == 0)
+                serial_write("\r");
+            else
+                serial_cursor_move((long)from - (long)ed->serial_cell);
+            if (from < ed->prompt_len)
+                serial_write_n(ed->prompt + from, ed->prompt_len - from);
+            serial_write_text(ed->text, from > ed->prompt_len ? from - ed->prompt_len : 0);
+            if (cells < ed->shown)
+                serial_write("\x1b[K");
+        }
+        ed->serial_cell = cells;
     }
+    if (ed->echo_serial)
+        serial_cursor_move((long)cursor - (long)ed->serial_cell);
+    ed->serial_cell = cursor;
+    ed->shown = cells;
+    ed->dirty = LINE_CLEAN;
+
+    int row = ed->start_row + (int)(cursor / width);
+    terminal_row = row < 0 ? 0 : (size_t)row;
+    terminal_column = cursor % width;
+    terminal_flush();  // Cells and cursor go out together
+}
 
-    size_t absolute_pos = PROMPT_LEN + cursor_pos;
-    current_row = start_row + (absolute_pos / VGA_WIDTH);
-    current_col = absolute_pos % VGA_WIDTH;
-    terminal_row = current_row;
-    terminal_column = current_col;
-    terminal_update_cursor();
+static void line_insert(struct line_editor *ed, const char *text, size_t len) {
+    size_t cell = ed->prompt_len + ed->text->gap_start;
+    if (gap_buffer_insert(ed->text, text, len))
+        line_mark(ed, cell);
 }
 
+static void line_backspace(struct line_editor *ed) {
+    if (ed->text->gap_start == 0)
+        return;
+    gap_buffer_delete_before(ed->text, 1);
+    line_mark(ed, ed->prompt_len + ed->text->gap_start);
+}
 
-static int caps_lock = 0;
-static int num_lock = 0;
+// Replace the text, keeping (and not redrawing) what it shares with the old one
+static void line_set(struct line_editor *ed, const char *text) {
+    size_t len = gap_buffer_length(ed->text), common = 0;
+    while (common < len && text[common] && gap_buffer_at(ed->text, common) == text[common])
+        common++;
+    gap_buffer_move(ed->text, common);
+    gap_buffer_truncate(ed->text);
+    line_mark(ed, ed->prompt_len + common);
+    gap_buffer_insert(ed->text, text + common, strlen(text + common));
+}
 
-static void serial_write(const char* str) {
-    while (*str) {
-        outb(0x3F8, *str++);  // COM1 port
-    }
+static void line_set_prompt(struct line_editor *ed, const char *prompt, size_t len) {
+    ed->prompt = prompt;
+    ed->prompt_len = len;
+    line_mark(ed, 0);
 }
 
-static inline void outw(uint16_t port, uint16_t data) {
-    __asm__ volatile ("outw %0, %1" : : "a"(data), "Nd"(port));
+static struct kbd_decoder keyboard = KBD_DECODER_INIT;
+
+#define DSH_BUFFER_SIZE 128  // Initial line size, the line grows as needed
+
+#define KEY_REPEAT_DELAY_MS 500   // Hold time before a key starts repeating
+#define KEY_REPEAT_INTERVAL_MS 33 // ~30 characters per second
+
+/*
+ * Command registry. The linker collects the DSH_COMMAND() entries and at
+ * start-up they go into a trie keyed on the name, so finding a command
+ * costs one step per character however many commands there are, and help
+ * and Tab completion walk the same trie in name order.
+ */
+extern const struct dsh_command __dsh_commands_start[];
+extern const struct dsh_command __dsh_commands_end[];
+
+#define TRIE_FANOUT 38  // a-z, 0-9, '_' and '-'
+
+struct trie_node {
+    const struct dsh_command *command;  // Command whose name ends here
+    struct trie_node *child[TRIE_FANOUT];
+};
+
+static struct kmem_cache *trie_cache;
+static struct trie_node *command_trie;
+
+static int trie_slot(char c) {
+    if (c >= 'a' && c <= 'z')
+        return c - 'a';
+    if (c >= '0' && c <= '9')
+        return 26 + c - '0';
+    if (c == '_')
+        return 36;
+    if (c == '-')
+        return 37;
+    return -1;
 }
 
-static inline void *dex_memmove(void *dest, const void *src, size_t n) {
-    if (dest == src || n == 0)
-        return dest;
+static char trie_char(int slot) {
+    if (slot < 26)
+        return 'a' + slot;
+    if (slot < 36)
+        return '0' + slot - 26;
+    return slot == 36 ? '_' : '-';
+}
+
+static struct trie_node *trie_node_new(void) {
+    struct trie_node *node = kmem_cache_alloc(trie_cache);
+    if (!node)
+        return NULL;
+    memset(node, 0, sizeof(*node));
+    return node;
+}
 
-    unsigned char *d = dest;
-    const unsigned char *s = src;
-    
-    if (d < s) {
-        for (size_t i = 0; i < n; i++)
-            d[i] = s[i];
-    } else {
-        for (size_t i = n; i > 0; i--)
-            d[i-1] = s[i-1];
+// Built on first use: by dsh_run() or by a batch mode running a line
+static void registry_init(void) {
+    if (command_trie)
+        return;
+    trie_cache = kmem_cache_create("dsh_trie", sizeof(struct trie_node), NULL);
+    if (!trie_cache || !(command_trie = trie_node_new()))
+        return;
+
+    for (const struct dsh_command *cmd = __dsh_commands_start; cmd < __dsh_commands_end; cmd++) {
+        struct trie_node *node = command_trie;
+        for (const char *p = cmd->name; *p && node; p++) {
+            int slot = trie_slot(*p);
+            if (slot < 0) {  // Not a name the shell could type
+                node = NULL;
+                break;
+            }
+            if (!node->child[slot])
+                node->child[slot] = trie_node_new();
+            node = node->child[slot];
+        }
+        if (node)
+            node->command = cmd;
     }
-    return dest;
 }
 
-static inline char *dex_strncpy(char *dest, const char *src, size_t n) {
-    if (!dest || !src || n == 0)
-        return dest;
+// Node reached by the first len characters of name, NULL if no command starts so
+static struct trie_node *trie_find(const char *name, size_t len) {
+    struct trie_node *node = command_trie;
+    for (size_t i = 0; i < len && node; i++) {
+        int slot = trie_slot(name[i]);
+        node = slot < 0 ? NULL : node->child[slot];
+    }
+    return node;
+}
 
-    char *start = dest;
-    while (n && (*dest++ = *src++))
-        n--;
-    if (n)
-        while (--n)
-            *dest++ = '\0';
-    return start;
+static void trie_visit(const struct trie_node *node,
+                       void (*fn)(const struct dsh_command *cmd, void *ctx), void *ctx) {
+    if (node->command)
+        fn(node->command, ctx);
+    for (int i = 0; i < TRIE_FANOUT; i++)
+        if (node->child[i])
+            trie_visit(node->child[i], fn, ctx);
 }
 
-static inline size_t dex_strlen(const char *s) {
-    if (!s)
-        return 0;
-    const char *p = s;
-    while (*p)
-        p++;
-    return (size_t)(p - s);
+void dsh_for_each_command(void (*fn)(const struct dsh_command *cmd, void *ctx), void *ctx) {
+    if (command_trie)
+        trie_visit(command_trie, fn, ctx);
 }
 
-static void delay(volatile int count) {
-    while(count--) {
-        io_wait();
+// Split a line in place into words, double quotes keep spaces inside a
+// word. Returns the word count or -1 if there are more than DSH_MAX_ARGS
+static int tokenize(char *line, char **argv) {
+    int argc = 0;
+    char *p = line;
+
+    while (1) {
+        while (*p == ' ')
+            p++;
+        if (*p == '\0')
+            break;
+        if (argc == DSH_MAX_ARGS)
+            return -1;
+
+        char *word = p;
+        int quoted = 0;
+        argv[argc++] = word;
+        while (*p && (quoted || *p != ' ')) {
+            if (*p == '"')
+                quoted = !quoted;
+            else
+                *word++ = *p;
+            p++;
+        }
+        if (*p)
+            p++;
+        *word = '\0';
     }
+    argv[argc] = NULL;
+    return argc;
 }
 
+/*
+ * Pipelines. Each stage but the last writes into a growing buffer
+ * through the terminal capture hook, so commands need not know where
+ * their output goes; the next stage reads that buffer whole. The hook
+ * only takes writes from the thread running the pipeline, other threads
+ * keep printing to the console.
+ */
+#define DSH_MAX_STAGES 8
+#define DSH_PIPE_MAX (256 * 1024)  // Beyond this a stage's output is dropped
+#define DSH_SCRIPT_DEPTH 8         // Scripts running scripts
+
+struct dsh_stream {
+    char *data;
+    size_t len;
+    size_t size;
+    int truncated;
+};
+
+static struct dsh_stream *stage_out;       // NULL: the console
+static const struct dsh_stream *stage_in;  // NULL: not reading a pipe
+static struct thread *stage_thread;
+static int script_depth = 0;
+
+static int stream_capture(const char *str, size_t len) {
+    struct dsh_stream *out = stage_out;
+    if (!out || thread_current() != stage_thread)
+        return 0;
+    if (out->len + len > out->size) {
+        size_t size = out->size ? out->size : 256;
+        while (size < out->len + len && size < DSH_PIPE_MAX)
+            size *= 2;
+        char *data = size > out->size ? kmalloc(size) : NULL;
+        if (data) {
+            memcpy(data, out->data, out->len);
+            kfree(out->data);
+            out->data = data;
+            out->size = size;
+        }
+        if (out->len + len > out->size) {
+            out->truncated = 1;
+            len = out->size - out->len;
+        }
+    }
+    memcpy(out->data + out->len, str, len);
+    out->len += len;
+    return 1;
+}
 
-#define DSH_BUFFER_SIZE 128
-#define MAX_COMMAND_HISTORY 10
+const char *dsh_input(size_t *len) {
+    *len = stage_in ? stage_in->len : 0;
+    return stage_in ? (stage_in->data ? stage_in->data : "") : NULL;
+}
 
-#define INITIAL_REPEAT_DELAY 2500000
-#define SUBSEQUENT_REPEAT_DELAY 500000
+int dsh_output_piped(void) {
+    return stage_out != NULL;
+}
 
-static char command_history[MAX_COMMAND_HISTORY][DSH_BUFFER_SIZE];
-static int history_count = 0;
-static int history_position = 0;
+struct dsh_stream *dsh_console_begin(void) {
+    struct dsh_stream *out = stage_out;
+    stage_out = NULL;
+    return out;
+}
 
-static int string_equal(const char *s1, const char *s2);
-static int string_starts_with(const char *str, const char *prefix);
-static void add_to_history(const char *cmd);
+void dsh_console_end(struct dsh_stream *out) {
+    stage_out = out;
+}
 
-static char scancode_to_ascii(uint8_t sc) {
-    static int shift_pressed = 0;
+void dsh_error(const char *msg) {
+    struct dsh_stream *out = dsh_console_begin();
+    terminal_write("\n");
+    terminal_write(msg);
+    terminal_write("\n\n");
+    dsh_console_end(out);
+}
 
-    // Handle special keys
-    if (sc == 0x2A || sc == 0x36) {
-        shift_pressed = 1;
-        return 0;
+// Tokenize words in place and run the command, -2 if there is none
+static int run_command(char *words) {
+    char *argv[DSH_MAX_ARGS + 1];
+    int argc = tokenize(words, argv);
+    if (argc < 0) {
+        dsh_error("dsh: too many arguments");
+        return -1;
     }
-    if (sc == 0xAA || sc == 0xB6) {
-        shift_pressed = 0;
-        return 0;
-    }
-    if (sc == 0x3A) { // Caps Lock press
-        caps_lock = !caps_lock;
-        return 0;
-    }
-    if (sc == 0x45) { // Num Lock press
-        num_lock = !num_lock;
-        return 0;
+    if (argc == 0)
+        return -2;
+
+    struct trie_node *node = trie_find(argv[0], strlen(argv[0]));
+    const struct dsh_command *cmd = node ? node->command : NULL;
+    if (!cmd) {
+        struct dsh_stream *out = dsh_console_begin();
+        terminal_write("\nUnknown command!\n");
+        terminal_setcolor(VGA_COLOR_LIGHT_GREEN);
+        terminal_write("Type 'help' for available commands list\n\n");
+        terminal_setcolor(VGA_COLOR_WHITE);
+        dsh_console_end(out);
+        return -1;
     }
-
-    if (sc & 0x80) {
-        return 0;
+    if (argc - 1 < cmd->min_args || argc - 1 > cmd->max_args) {
+        struct dsh_stream *out = dsh_console_begin();
+        terminal_write("\nUsage: ");
+        terminal_write(cmd->name);
+        terminal_write(" ");
+        terminal_write(cmd->usage);
+        terminal_write("\n\n");
+        dsh_console_end(out);
+        return -1;
     }
+    TRACE_BEGIN(TRACE_DSH_EXEC, cmd->name);
+    int status = cmd->handler(argc, argv);
+    TRACE_END(TRACE_DSH_EXEC, cmd->name);
+    return status;
+}
 
-    // Handle numpad with Num Lock
-    if (num_lock) {
-        switch (sc) {
-            case 0x47: return '7';
-            case 0x48: return '8';
-            case 0x49: return '9';
-            case 0x4B: return '4';
-            case 0x4C: return '5';
-            case 0x4D: return '6';
-            case 0x4F: return '1';
-            case 0x50: return '2';
-            case 0x51: return '3';
-            case 0x52: return '0';
-            case 0x53: return '.';
-            case 0x37: return '*';
-            case 0x4A: return '-';
-            case 0x4E: return '+';
+// The first stage reads what the enclosing stage reads (a script run in a
+// pipeline), the last writes where it writes
+static int run_pipeline(char **stages, int count) {
+    struct dsh_stream *outer_out = stage_out;
+    const struct dsh_stream *outer_in = stage_in;
+    struct dsh_stream buffers[2];
+    int status = 0;
+
+    memset(buffers, 0, sizeof(buffers));
+    stage_thread = thread_current();
+    for (int i = 0; i < count; i++) {
+        struct dsh_stream *out = i == count - 1 ? outer_out : &buffers[i & 1];
+        if (out != outer_out) {
+            out->len = 0;
+            out->truncated = 0;
         }
+        stage_in = i == 0 ? outer_in : &buffers[(i - 1) & 1];
+        stage_out = out;
+        status = run_command(stages[i]);
+        if (status == -2) {
+            stage_out = outer_out;
+            if (count > 1) {
+                dsh_error("dsh: empty command in a pipeline");
+                status = -1;
+                break;
+            }
+            status = 0;
+        }
+        if (out != outer_out && out->truncated)
+            dsh_error("dsh: pipe buffer full, output cut short");
     }
+    stage_in = outer_in;
+    stage_out = outer_out;
+    kfree(buffers[0].data);
+    kfree(buffers[1].data);
+    return status;
+}
 
-    // Handle regular keys with Shift or Caps Lock
-    if (shift_pressed || (caps_lock && ((sc >= 0x10 && sc <= 0x19) || (sc >= 0x1E && sc <= 0x26) || (sc >= 0x2C && sc <= 0x32)))) {
-        switch (sc) {
-            case 0x02: return '!';
-            case 0x03: return '@';
-            case 0x04: return '#';
-            case 0x05: return '$';
-            case 0x06: return '%';
-            case 0x07: return '^';
-            case 0x08: return '&';
-            case 0x09: return '*';
-            case 0x0A: return '(';
-            case 0x0B: return ')';
-            case 0x0C: return '_';
-            case 0x0D: return '+';
-            case 0x10: return 'Q';
-            case 0x11: return 'W';
-            case 0x12: return 'E';
-            case 0x13: return 'R';
-            case 0x14: return 'T';
-            case 0x15: return 'Y';
-            case 0x16: return 'U';
-            case 0x17: return 'I';
-            case 0x18: return 'O';
-            case 0x19: return 'P';
-            case 0x1A: return '{';
-            case 0x1B: return '}';
-            case 0x1E: return 'A';
-            case 0x1F: return 'S';
-            case 0x20: return 'D';
-            case 0x21: return 'F';
-            case 0x22: return 'G';
-            case 0x23: return 'H';
-            case 0x24: return 'J';
-            case 0x25: return 'K';
-            case 0x26: return 'L';
-            case 0x27: return ':';
-            case 0x28: return '"';
-            case 0x29: return '~';
-            case 0x2B: return '|';
-            case 0x2C: return 'Z';
-            case 0x2D: return 'X';
-            case 0x2E: return 'C';
-            case 0x2F: return 'V';
-            case 0x30: return 'B';
-            case 0x31: return 'N';
-            case 0x32: return 'M';
-            case 0x33: return '<';
-            case 0x34: return '>';
-            case 0x35: return '?';
-            case 0x39: return ' ';
-            case 0x0E: return '\b';
-            case 0x1C: return '\n';
-            default: return 0;
+static int execute_n(const char *line, size_t len) {
+    char *stages[DSH_MAX_STAGES];
+    int status = 0;
+
+    registry_init();
+    terminal_set_capture(stream_capture);
+    // Handlers get writable words, so split a copy
+    char *copy = kmalloc(len + 1);
+    if (!copy) {
+        dsh_error("dsh: out of memory");
+        return -1;
+    }
+    memcpy(copy, line, len);
+    copy[len] = '\0';
+
+    // One pipeline per ';', split into stages at '|', both outside quotes
+    char *p = copy;
+    while (*p) {
+        int count = 1;
+        int quoted = 0;
+        stages[0] = p;
+        for (; *p && (quoted || *p != ';'); p++) {
+            if (*p == '"') {
+                quoted = !quoted;
+            } else if (*p == '|' && !quoted) {
+                if (count == DSH_MAX_STAGES) {
+                    dsh_error("dsh: too many pipeline stages");
+                    kfree(copy);
+                    return -1;
+                }
+                *p = '\0';
+                stages[count++] = p + 1;
+            }
         }
+        if (*p)
+            *p++ = '\0';
+        status = run_pipeline(stages, count);
     }
+    kfree(copy);
+    return status;
+}
 
-    switch (sc) {
-        case 0x02: return '1';
-        case 0x03: return '2';
-        case 0x04: return '3';
-        case 0x05: return '4';
-        case 0x06: return '5';
-        case 0x07: return '6';
-        case 0x08: return '7';
-        case 0x09: return '8';
-        case 0x0A: return '9';
-        case 0x0B: return '0';
-        case 0x0C: return '-';
-        case 0x0D: return '=';
-        case 0x10: return 'q';
-        case 0x11: return 'w';
-        case 0x12: return 'e';
-        case 0x13: return 'r';
-        case 0x14: return 't';
-        case 0x15: return 'y';
-        case 0x16: return 'u';
-        case 0x17: return 'i';
-        case 0x18: return 'o';
-        case 0x19: return 'p';
-        case 0x1A: return '[';
-        case 0x1B: return ']';
-        case 0x1E: return 'a';
-        case 0x1F: return 's';
-        case 0x20: return 'd';
-        case 0x21: return 'f';
-        case 0x22: return 'g';
-        case 0x23: return 'h';
-        case 0x24: return 'j';
-        case 0x25: return 'k';
-        case 0x26: return 'l';
-        case 0x27: return ';';
-        case 0x28: return '\'';
-        case 0x29: return '`';
-        case 0x2B: return '\\';
-        case 0x2C: return 'z';
-        case 0x2D: return 'x';
-        case 0x2E: return 'c';
-        case 0x2F: return 'v';
-        case 0x30: return 'b';
-        case 0x31: return 'n';
-        case 0x32: return 'm';
-        case 0x33: return ',';
-        case 0x34: return '.';
-        case 0x35: return '/';
-        case 0x39: return ' ';
-        case 0x0E: return '\b';
-        case 0x1C: return '\n';
-        default:   return 0;
-    }
+int dsh_execute(const char *line) {
+    return execute_n(line, strlen(line));
 }
 
-static void add_to_history(const char *cmd) {
-    if (!cmd || cmd[0] == '\0') return;
-    
-    if (history_count > 0 && string_equal(command_history[history_count - 1], cmd)) {
-        history_position = history_count;
-        return;
+int dsh_execute_script(const char *text, size_t len) {
+    int status = 0;
+
+    if (script_depth == DSH_SCRIPT_DEPTH) {
+        dsh_error("dsh: scripts nested too deep");
+        return -1;
     }
-    
-    if (history_count == MAX_COMMAND_HISTORY) {
-        dex_memmove(command_history[0], command_history[1], 
-                (MAX_COMMAND_HISTORY - 1) * DSH_BUFFER_SIZE);
-        history_count--;
+    script_depth++;
+    for (size_t start = 0; start < len; ) {
+        size_t end = start;
+        while (end < len && text[end] != '\n')
+            end++;
+        size_t first = start;
+        while (first < end && (text[first] == ' ' || text[first] == '\t'))
+            first++;
+        if (first < end && text[first] != '#')
+            status = execute_n(text + first, end - first - (text[end - 1] == '\r'));
+        start = end + 1;
     }
-    
-    dex_strncpy(command_history[history_count], cmd, DSH_BUFFER_SIZE - 1);
-    command_history[history_count][DSH_BUFFER_SIZE - 1] = '\0';
-    history_count++;
-    history_position = history_count;
+    script_depth--;
+    return status;
 }
 
-static int string_equal(const char *s1, const char *s2) {
-    if (!s1 || !s2) return 0;
-    while (*s1 && *s2) {
-        if (*s1 != *s2)
+// Turn a byte from a serial terminal into a key, decoding the VT100 escape
+// sequences terminals send for arrows, Home and End
+static int serial_key(uint8_t c) {
+    static int esc_state = 0;  // 1: got ESC, 2: got ESC [, 3: got ESC [ digit
+    static uint8_t esc_digit = 0;
+    static uint8_t last = 0;
+    uint8_t prev = last;
+    last = c;
+
+    switch (esc_state) {
+    case 1:
+        esc_state = (c == '[' || c == 'O') ? 2 : 0;
+        return 0;
+    case 2:
+        esc_state = 0;
+        switch (c) {
+            case 'A': return KEY_UP;
+            case 'B': return KEY_DOWN;
+            case 'C': return KEY_RIGHT;
+            case 'D': return KEY_LEFT;
+            case 'H': return KEY_HOME;
+            case 'F': return KEY_END;
+        }
+        if (c >= '0' && c <= '9') {
+            esc_digit = c;
+            esc_state = 3;
+        }
+        return 0;
+    case 3:
+        esc_state = 0;
+        if (c != '~')
             return 0;
-        s1++; s2++;
+        if (esc_digit == '1' || esc_digit == '7')
+            return KEY_HOME;
+        if (esc_digit == '4' || esc_digit == '8')
+            return KEY_END;
+        return 0;
     }
-    return (*s1 == '\0' && *s2 == '\0');
-}
 
-static int string_starts_with(const char *str, const char *prefix) {
-    if (!str || !prefix) return 0;
-    while (*prefix) {
-        if (*prefix++ != *str++)
-            return 0;
+    if (c == 0x1B) {
+        esc_state = 1;
+        return 0;
     }
-    return 1;
+    if (c == '\r' || (c == '\n' && prev != '\r'))
+        return '\n';
+    if (c == 0x7F || c == 0x08)
+        return '\b';
+    if (c == '\t' || (c >= CTRL('A') && c <= CTRL('Z')))
+        return c;
+    if (c < 0x20 || c > 0x7E)
+        return 0;
+    return c;
 }
 
-static void read_line(char *buffer, size_t buffer_size) {
-    if (!buffer || buffer_size == 0) return;
-    
-    size_t index = 0;
-    size_t cursor_pos = 0;
-    uint8_t last_processed_sc = 0;
-    int delay_counter = 0;
-    int current_repeat_delay = INITIAL_REPEAT_DELAY;
-    int enter_pressed = 0;
-
-    size_t start_row = terminal_row;
-
-    start_row = terminal_row;
+// Keys that go into the line: printable ASCII, and the bytes above it a
+// keymap can type in the console's code page
+static int key_is_text(int key) {
+    return key >= 0x20 && key <= 0xFF && key != 0x7F;
+}
 
-    buffer[0] = '\0';
+/*
+ * Wait for the next key from any input source. Keyboard auto-repeat is
+ * generated here from the clock: the keyboard's own typematic make codes
+ * are ignored and a held key repeats on a deadline, so the rate is the
+ * same no matter how fast the host or the emulated controller is. With
+ * wait == 0 it returns 0 instead of sleeping once the queue is empty.
+ */
+static int read_key(int wait) {
+    static uint8_t held_code = 0;  // Key code being held, 0 if none
+    static uint64_t repeat_deadline = 0;
 
     while (1) {
-        uint8_t sc = inb(0x60);
-
-        if (sc & 0x80) {
-            uint8_t key_released = sc & 0x7F;
-            if (key_released == 0x2A || key_released == 0x36) {
-                scancode_to_ascii(sc);
-            }
-            if (key_released == last_processed_sc) {
-                last_processed_sc = 0;
-                continue;
-            }
-            if (sc == 0x9C && enter_pressed) {  // Enter key released (0x1C | 0x80)
-                buffer[index] = '\0';
-                terminal_putchar('\n');
-                add_to_history(buffer);
-                break;
-            }
-            if ((sc & 0x7F) == last_processed_sc)
-                last_processed_sc = 0;
+        uint16_t event;
+        int got = wait ? input_wait_until(held_code ? repeat_deadline : 0, &event)
+                       : input_read(&event);
+        if (!got) {
+            uint64_t now = ktime_ns();
+            if (!wait && !(held_code && now >= repeat_deadline))
+                return 0;
+            repeat_deadline += KEY_REPEAT_INTERVAL_MS * NS_PER_MS;
+            if (repeat_deadline < now)  // We were busy, do not replay missed repeats
+                repeat_deadline = now + KEY_REPEAT_INTERVAL_MS * NS_PER_MS;
+            int key = kbd_key(&keyboard, held_code);
+            if (key)
+                return key;
             continue;
         }
 
-        if (sc == last_processed_sc) {
-            delay_counter++;
-            if (delay_counter < current_repeat_delay)
-                continue;
-            delay_counter = 0;
-            current_repeat_delay = SUBSEQUENT_REPEAT_DELAY;
-        } else {
-            last_processed_sc = sc;
-            delay_counter = 0;
-            current_repeat_delay = INITIAL_REPEAT_DELAY;
-        }
-
-        if (sc == 0x4B) {  // Arrow Left
-            if (cursor_pos > 0) {
-                cursor_pos--;
-                refresh_input_line(buffer, index, cursor_pos, start_row);
-            }
+        if ((event & INPUT_SOURCE_MASK) == INPUT_SERIAL) {
+            int key = serial_key(event & 0xFF);
+            if (key)
+                return key;
             continue;
         }
-        if (sc == 0x4D) {  // Arrow Right
-            if (cursor_pos < index) {
-                cursor_pos++;
-                refresh_input_line(buffer, index, cursor_pos, start_row);
-            }
+
+        struct kbd_event key_event;
+        if (!kbd_decode(&keyboard, event & 0xFF, &key_event))
             continue;
-        }
-        // Home (0x47) – moving the cursor to the beginning of the line (cursor_pos = 0)
-        if (sc == 0x47) {
-            cursor_pos = 0;
-            refresh_input_line(buffer, index, cursor_pos, start_row);
+        if (!key_event.pressed) {
+            if (key_event.code == held_code)
+                held_code = 0;
             continue;
         }
-        // End (0x4F) – moving the cursor to the end of the line (cursor_pos = index)
-        if (sc == 0x4F) {
-            cursor_pos = index;
-            refresh_input_line(buffer, index, cursor_pos, start_row);
+        if (key_event.repeat)
+            continue;  // Typematic repeat from the keyboard itself
+
+        int key = kbd_key(&keyboard, key_event.code);
+        if (key == 0)
             continue;
-        }
-        if (sc == 0x48) {  // Arrow Up
-            if (history_count > 0) {
-                while (index > 0) {
-                    terminal_write("\b \b");
-                    index--;
-                }
-                if (history_position > 0)
-                    history_position--;
-                dex_strncpy(buffer, command_history[history_position], buffer_size - 1);
-                buffer[buffer_size - 1] = '\0';
-                terminal_write(buffer);
-                index = dex_strlen(buffer);
-                cursor_pos = index;
-                refresh_input_line(buffer, index, cursor_pos, start_row);
+        // Modifiers produce no key and Enter should not auto-repeat
+        held_code = key == '\n' ? 0 : key_event.code;
+        repeat_deadline = ktime_ns() + KEY_REPEAT_DELAY_MS * NS_PER_MS;
+        return key;
+    }
+}
+
+static void list_candidate(const struct dsh_command *cmd, void *ctx) {
+    (void)ctx;
+    terminal_write(cmd->name);
+    terminal_write("  ");
+}
+
+// Tab on the command word: extend it as far as all matching names agree,
+// finish it with a space once it is unique, or list the matches when the
+// names branch right at the cursor
+static void complete_command(struct line_editor *ed) {
+    struct gap_buffer *text = ed->text;
+    size_t len = gap_buffer_length(text);
+    if (text->gap_start != len)
+        return;
+    // With the cursor at the end the text is contiguous
+    for (size_t i = 0; i < len; i++)
+        if (text->data[i] == ' ')
+            return;  // Only the command name is completed
+
+    struct trie_node *node = trie_find(text->data, len);
+    if (!node)
+        return;
+
+    while (!node->command) {
+        int only = -1;
+        for (int i = 0; i < TRIE_FANOUT; i++) {
+            if (!node->child[i])
+                continue;
+            if (only >= 0) {
+                only = -1;
+                break;
             }
-            continue;
+            only = i;
         }
-        if (sc == 0x50) {  // Arrow Down
-            if (history_count > 0) {
-                while (index > 0) {
-                    terminal_write("\b \b");
-                    index--;
-                }
-                if (history_position < history_count - 1) {
-                    history_position++;
-                    dex_strncpy(buffer, command_history[history_position], buffer_size - 1);
-                    buffer[buffer_size - 1] = '\0';
-                    terminal_write(buffer);
-                    index = dex_strlen(buffer);
-                    cursor_pos = index;
-                } else {
-                    history_position = history_count;
-                    buffer[0] = '\0';
-                    index = 0;
-                    cursor_pos = 0;
-                }
-                refresh_input_line(buffer, index, cursor_pos, start_row);
-            }
+        if (only < 0)
+            break;
+        char c = trie_char(only);
+        line_insert(ed, &c, 1);
+        node = node->child[only];
+    }
+
+    int leaf = 1;
+    for (int i = 0; i < TRIE_FANOUT; i++)
+        if (node->child[i])
+            leaf = 0;
+    if (node->command && leaf)
+        line_insert(ed, " ", 1);
+
+    if (gap_buffer_length(text) == len) {
+        line_flush(ed);
+        terminal_write("\n");
+        trie_visit(node, list_candidate, NULL);
+        terminal_write("\n");
+        // Prompt and line again below the list
+        ed->start_row = (int)terminal_row;
+        ed->shown = 0;
+        ed->serial_cell = 0;
+        line_mark(ed, 0);
+    }
+}
+
+#define SEARCH_PROMPT "(reverse-i-search)`"
+#define SEARCH_FAILED_PROMPT "(failed reverse-i-search)`"
+
+/*
+ * Ctrl-R search. Typing narrows the matches, Ctrl-R steps to an older
+ * one, Ctrl-G gives the original line back, Enter runs the match and any
+ * other key leaves it on the line for editing. Returns 1 for Enter
+ */
+static int reverse_search(struct line_editor *ed) {
+    char prompt[sizeof(SEARCH_FAILED_PROMPT) + HISTORY_QUERY_MAX + 3];
+    const char *match = NULL;
+    size_t saved_len = gap_buffer_length(ed->text);
+    char *saved = kmalloc(saved_len + 1);
+    if (!saved)
+        return 0;
+    memcpy(saved, gap_buffer_text(ed->text), saved_len + 1);
+
+    history_search_begin();
+    while (1) {
+        const char *query = history_search_query();
+        const char *head = match || !query[0] ? SEARCH_PROMPT : SEARCH_FAILED_PROMPT;
+        size_t prompt_len = 0;
+        while (*head)
+            prompt[prompt_len++] = *head++;
+        while (*query)
+            prompt[prompt_len++] = *query++;
+        prompt[prompt_len++] = '\'';
+        prompt[prompt_len++] = ':';
+        prompt[prompt_len++] = ' ';
+        line_set_prompt(ed, prompt, prompt_len);
+        line_set(ed, match ? match : "");
+        line_flush(ed);
+
+        int key = read_key(1);
+        if (key == CTRL('R')) {
+            if (match)
+                match = history_search_next();
             continue;
         }
-        if (sc == 0x1C) {
-            enter_pressed = 1;
+        if (key == '\b') {
+            match = history_search_pop();
             continue;
         }
-        
-        char c = scancode_to_ascii(sc);
-        if (c == 0)
+        if (key_is_text(key)) {
+            match = history_search_push((char)key);
             continue;
-        
-        if (c == '\b') {  // Backspace
-            if (cursor_pos > 0) {
-                // Move the cursor one position to the left
-                for (size_t j = cursor_pos - 1; j < index; j++) {
-                    buffer[j] = buffer[j + 1];
-                }
-                index--; 
-                cursor_pos--;
-                refresh_input_line(buffer, index, cursor_pos, start_row);
-            }
-        } else {
-            if (index < buffer_size - 1) {
-                // If the buffer is not full, insert the character at the cursor position
-                if (cursor_pos < index) {
-                    // Move the characters to the right to make space for the new character
-                    for (size_t j = index; j > cursor_pos; j--) {
-                        buffer[j] = buffer[j - 1];
-                    }
-                    buffer[cursor_pos] = c;
-                    index++;
-                    cursor_pos++;
-                } else {
-                    // If the buffer is full, replace the last character with the new character
-                    buffer[index++] = c;
-                    cursor_pos++;
-                }
-                buffer[index] = '\0';
-                refresh_input_line(buffer, index, cursor_pos, start_row);
-            }
         }
-        delay(10000);
+
+        if (!match || key == CTRL('G'))
+            line_set(ed, saved);
+        history_search_end();
+        line_set_prompt(ed, PROMPT, PROMPT_LEN);
+        kfree(saved);
+        return key == '\n';
     }
 }
 
-static void execute_command(const char *cmd) {
-    if (!cmd || cmd[0] == '\0')
-        return;
-    
-    if (string_equal(cmd, "shutdown")) {
-        terminal_write("\nShutting down...\n");
-        serial_write("\nShutting down...\n");
-        outw(0x604, 0x2000);
-        while (1) {
-            __asm__ volatile("cli; hlt");
+static void read_line(struct gap_buffer *text) {
+    struct line_editor ed = {
+        .text = text,
+        .prompt = PROMPT,
+        .prompt_len = PROMPT_LEN,
+        .start_row = (int)terminal_row,
+        .shown = PROMPT_LEN,  // dsh_run() has written the prompt
+        .dirty = LINE_CLEAN,
+        .serial_cell = PROMPT_LEN,
+        .echo_serial = 1,
+    };
+    uint32_t history_position = history_end();
+
+    gap_buffer_clear(text);
+
+    while (1) {
+        // Draw once the queued input is used up, then sleep until the
+        // keyboard or the serial port queues more
+        int key = read_key(0);
+        if (!key) {
+            line_flush(&ed);
+            key = read_key(1);
         }
-    }
-    if (string_equal(cmd, "reboot")) {
-        terminal_write("\nRebooting...\n");
-        serial_write("\nRebooting...\n");
-        uint8_t good = 0x02;
-        while (good & 0x02)
-            good = inb(0x64);
-        outb(0x64, 0xFE);
-        while (1) {
-            __asm__ volatile("cli; hlt");
+        TRACE_INSTANT(TRACE_KEY, key);
+
+        if (key == CTRL('R')) {
+            int run = reverse_search(&ed);
+            history_position = history_end();
+            if (!run)
+                continue;
+            key = '\n';
+        }
+
+        switch (key) {
+        case '\n':  // Enter, the newline goes below the whole line
+            gap_buffer_move(text, gap_buffer_length(text));
+            line_flush(&ed);
+            terminal_putchar('\n');
+            history_add(gap_buffer_text(text));
+            return;
+        case KEY_LEFT:
+            if (text->gap_start > 0)
+                gap_buffer_move(text, text->gap_start - 1);
+            break;
+        case KEY_RIGHT:
+            gap_buffer_move(text, text->gap_start + 1);
+            break;
+        case KEY_HOME:
+            gap_buffer_move(text, 0);
+            break;
+        case KEY_END:
+            gap_buffer_move(text, gap_buffer_length(text));
+            break;
+        case KEY_UP:
+            if (history_prev(&history_position))
+                line_set(&ed, history_get(history_position));
+            break;
+        case KEY_DOWN:
+            if (history_position != history_end())
+                line_set(&ed, history_next(&history_position) ? history_get(history_position) : "");
+            break;
+        case '\t':
+            complete_command(&ed);
+            break;
+        case '\b':
+            line_backspace(&ed);
+            break;
+        default:
+            if (key_is_text(key)) {
+                char c = (char)key;
+                line_insert(&ed, &c, 1);
+            }
         }
     }
-    if (string_equal(cmd, "cleanup")) {
-        terminal_initialize();
-        return;
-    }
-    if (string_equal(cmd, "sysabout")) {
-        terminal_setcolor(VGA_COLOR_BROWN);
-        terminal_write("\nSystem Information:\n");
-        terminal_setcolor(VGA_COLOR_WHITE);
-        terminal_write("\ndsh (DexisShell) v0.0.3\n");
-        terminal_write("Author: ShLKV (The Shlyukov)\n");
-        terminal_write("License: MIT\n");
-        terminal_write("https://github.com/TheShlyukov/DexisCore");
-        terminal_write("\nType 'help' for available commands list\n\n");
-        return;
-    }
-    if (string_equal(cmd, "echo") || string_starts_with(cmd, "echo ")) {
-        terminal_write("\n");
-        if (dex_strlen(cmd) > 5)
-            terminal_write(cmd + 5);
-        terminal_write("\n\n");
-        return;
-    }
-    if (string_equal(cmd, "help")) {
-        terminal_write("\nAvailable commands:\n");
-        terminal_setcolor(VGA_COLOR_LIGHT_GREEN);
-        terminal_write("==============\n");
-        terminal_setcolor(VGA_COLOR_WHITE);
-        terminal_write("shutdown - shutdown system\n");
-        terminal_write("reboot - reboot system\n");
-        terminal_write("cleanup - clear terminal\n");
-        terminal_write("sysabout - about system\n");
-        terminal_write("echo - echo string\n");
-        terminal_write("help - available commands list\n");
-        terminal_setcolor(VGA_COLOR_LIGHT_GREEN);
-        terminal_write("==============\n\n");
-        terminal_setcolor(VGA_COLOR_WHITE);
-        return;
-    }
-    terminal_write("\nUnknown command!\n");
-    terminal_setcolor(VGA_COLOR_LIGHT_GREEN);
-    terminal_write("Type 'help' for available commands list\n\n");
-    terminal_setcolor(VGA_COLOR_WHITE);
 }
 
 void terminal_setcolor(uint8_t color) {
@@ -547,7 +831,12 @@ void terminal_setcolor(uint8_t color) {
 }
 
 void dsh_run(void) {
-    char buffer[DSH_BUFFER_SIZE];
+    struct gap_buffer line;
+    if (!gap_buffer_init(&line, DSH_BUFFER_SIZE)) {
+        terminal_write("\ndsh: out of memory\n");
+        return;
+    }
+    registry_init();
     terminal_write("\nRunning dsh (DexShell) v0.0.3\n");
     terminal_setcolor(VGA_COLOR_LIGHT_GREEN);
     terminal_write("Type 'help' for available commands list\n\n");
@@ -556,7 +845,147 @@ void dsh_run(void) {
         terminal_setcolor(PROMPT_COLOR);
         terminal_write(PROMPT);
         terminal_setcolor(VGA_COLOR_WHITE);
-        read_line(buffer, DSH_BUFFER_SIZE);
-        execute_command(buffer);
+        read_line(&line);
+        // Command output is flushed to the screen once, when it is done
+        terminal_batch_begin();
+        dsh_execute(gap_buffer_text(&line));
+        terminal_batch_end();
+    }
+}
+
+/* Benchmarks, see bench.h */
+#define BENCH_LINE_LEN 120
+
+static struct gap_buffer bench_text;
+static struct line_editor bench_ed;
+
+static int bench_line_setup(void) {
+    if (!gap_buffer_init(&bench_text, DSH_BUFFER_SIZE))
+        return -1;
+    for (int i = 0; i < BENCH_LINE_LEN; i++) {
+        char c = 'a' + i % 26;
+        gap_buffer_insert(&bench_text, &c, 1);
+    }
+    terminal_initialize();
+    struct line_editor ed = {
+        .text = &bench_text,
+        .prompt = PROMPT,
+        .prompt_len = PROMPT_LEN,
+        .dirty = 0,
+    };
+    bench_ed = ed;
+    line_flush(&bench_ed);
+    gap_buffer_move(&bench_text, 10);
+    return 0;
+}
+
+static void bench_line_teardown(void) {
+    gap_buffer_release(&bench_text);
+}
+
+// Insert and delete in turn near the start of a 120 character line, each
+// followed by the suffix redraw
+static void bench_line_edit(void) {
+    static int insert = 0;
+    if ((insert = !insert))
+        line_insert(&bench_ed, "x", 1);
+    else
+        line_backspace(&bench_ed);
+    line_flush(&bench_ed);
+}
+BENCH(line_edit_redraw, bench_line_edit, bench_line_setup, bench_line_teardown, 2000);
+
+// Typing at the end of the same line
+static void bench_line_append(void) {
+    static int insert = 0;
+    gap_buffer_move(&bench_text, gap_buffer_length(&bench_text));
+    if ((insert = !insert))
+        line_insert(&bench_ed, "x", 1);
+    else
+        line_backspace(&bench_ed);
+    line_flush(&bench_ed);
+}
+BENCH(line_append_redraw, bench_line_append, bench_line_setup, bench_line_teardown, 2000);
+
+// A three-stage pipeline with its output captured, no console drawing
+static struct dsh_stream bench_sink;
+
+static void bench_pipeline(void) {
+    struct dsh_stream *outer = stage_out;
+    bench_sink.len = 0;
+    stage_out = &bench_sink;
+    dsh_execute("echo a b c | grep b | wc");
+    stage_out = outer;
+}
+
+static void bench_pipeline_teardown(void) {
+    kfree(bench_sink.data);
+    memset(&bench_sink, 0, sizeof(bench_sink));
+}
+BENCH(dsh_pipeline, bench_pipeline, NULL, bench_pipeline_teardown, 1000);
+
+/* Self-test, see selftest.h */
+static const char *dsh_selftest(void) {
+    char line[] = "  echo \"a  b\"  c\"d e\"f ";
+    char *argv[DSH_MAX_ARGS + 1];
+    if (tokenize(line, argv) != 3 || strcmp(argv[0], "echo") != 0 ||
+        strcmp(argv[1], "a  b") != 0 || strcmp(argv[2], "cd ef") != 0 || argv[3])
+        return "tokenize: wrong words";
+    char many[2 * DSH_MAX_ARGS + 2];
+    for (int i = 0; i <= DSH_MAX_ARGS; i++) {
+        many[2 * i] = 'x';
+        many[2 * i + 1] = ' ';
+    }
+    many[2 * DSH_MAX_ARGS + 1] = '\0';
+    if (tokenize(many, argv) != -1)
+        return "tokenize: argument limit";
+
+    registry_init();
+    if (!command_trie)
+        return "no command trie";
+    for (const struct dsh_command *cmd = __dsh_commands_start; cmd < __dsh_commands_end; cmd++) {
+        struct trie_node *node = trie_find(cmd->name, strlen(cmd->name));
+        if (!node || node->command != cmd)
+            return "registered command not found";
     }
+    struct trie_node *node = trie_find("hel", 3);
+    if (!node || node->command)
+        return "prefix found as a command";
+    if (trie_find("help!", 5) || trie_find("nosuchcommand", 13))
+        return "unknown name found";
+    return NULL;
+}
+SELFTEST(dsh, dsh_selftest);
+
+// Runs with the output captured into result, like a pipeline stage
+static const char *run_captured(struct dsh_stream *result, const char *text, size_t len, int script) {
+    struct dsh_stream *outer = stage_out;
+    result->len = 0;
+    stage_out = result;
+    if (script)
+        dsh_execute_script(text, len);
+    else
+        dsh_execute(text);
+    stage_out = outer;
+    return result->data ? result->data : "";
+}
+
+static const char *dsh_pipe_selftest(void) {
+    static const char script[] = "# comment\n  echo x\r\n\necho \"y z\" | wc\n";
+    struct dsh_stream result;
+    const char *error = NULL;
+
+    memset(&result, 0, sizeof(result));
+    const char *out = run_captured(&result, "echo one two; echo \"a|b;c\" | grep b | wc", 0, 0);
+    if (result.len != 14 || memcmp(out, "one two\n1 1 6\n", 14) != 0)
+        error = "pipeline output wrong";
+    out = run_captured(&result, "echo abc | grep x; echo c | cat | cat | cat", 0, 0);
+    if (!error && (result.len != 2 || memcmp(out, "c\n", 2) != 0))
+        error = "stages not chained";
+    out = run_captured(&result, script, sizeof(script) - 1, 1);
+    if (!error && (result.len != 8 || memcmp(out, "x\n1 2 4\n", 8) != 0))
+        error = "script output wrong";
+    kfree(result.data);
+    return error;
 }
+SELFTEST(dsh_pipe, dsh_pipe_selftest);
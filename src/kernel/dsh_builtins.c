@@ -0,0 +1,1327 @@
+/*
+ * dsh builtin commands. Each one registers itself with DSH_COMMAND(), the
+ * shell finds them through the linker section, so adding a command needs
+ * no change anywhere else.
+ */
+#include <kernel/dsh.h>
+#include <kernel/vga.h>
+#include <kernel/io.h>
+#include <kernel/serial.h>
+#include <kernel/timer.h>
+#include <kernel/pmm.h>
+#include <kernel/slab.h>
+#include <kernel/cpu.h>
+#include <kernel/paging.h>
+#include <kernel/klib.h>
+#include <kernel/bench.h>
+#include <kernel/selftest.h>
+#include <kernel/trace.h>
+#include <kernel/prof.h>
+#include <kernel/ksyms.h>
+#include <kernel/sched.h>
+#include <kernel/smp.h>
+#include <kernel/blk.h>
+#include <kernel/initrd.h>
+#include <kernel/keymap.h>
+#include <stdint.h>
+#include <stddef.h>
+
+static int cmd_shutdown(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    terminal_write("\nShutting down...\n");
+    terminal_flush();
+    serial_flush();
+    outw(0x604, 0x2000);
+    while (1) {
+        __asm__ volatile("cli; hlt");
+    }
+    return 0;  // Not reached
+}
+DSH_COMMAND(shutdown, cmd_shutdown, 0, 0, "", "shutdown system");
+
+static int cmd_reboot(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    terminal_write("\nRebooting...\n");
+    terminal_flush();
+    serial_flush();
+    uint8_t good = 0x02;
+    while (good & 0x02)
+        good = inb(0x64);
+    outb(0x64, 0xFE);
+    while (1) {
+        __asm__ volatile("cli; hlt");
+    }
+    return 0;  // Not reached
+}
+DSH_COMMAND(reboot, cmd_reboot, 0, 0, "", "reboot system");
+
+static int cmd_cleanup(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    terminal_initialize();
+    return 0;
+}
+DSH_COMMAND(cleanup, cmd_cleanup, 0, 0, "", "clear terminal");
+
+static int cmd_sysabout(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    terminal_setcolor(VGA_COLOR_BROWN);
+    terminal_write("\nSystem Information:\n");
+    terminal_setcolor(VGA_COLOR_WHITE);
+    terminal_write("\ndsh (DexisShell) v0.0.3\n");
+    terminal_write("Author: ShLKV (The Shlyukov)\n");
+    terminal_write("License: MIT\n");
+    terminal_write("https://github.com/TheShlyukov/DexisCore");
+    terminal_write("\nType 'help' for available commands list\n\n");
+    return 0;
+}
+DSH_COMMAND(sysabout, cmd_sysabout, 0, 0, "", "about system");
+
+// The blank lines around a command's output only space out the console,
+// a pipe gets the text alone
+static void output_begin(void) {
+    if (!dsh_output_piped())
+        terminal_write("\n");
+}
+
+static void output_end(void) {
+    if (!dsh_output_piped())
+        terminal_write("\n");
+}
+
+static int cmd_echo(int argc, char **argv) {
+    output_begin();
+    for (int i = 1; i < argc; i++) {
+        if (i > 1)
+            terminal_putchar(' ');
+        terminal_write(argv[i]);
+    }
+    terminal_write("\n");
+    output_end();
+    return 0;
+}
+DSH_COMMAND(echo, cmd_echo, 0, DSH_MAX_ARGS - 1, "[text...]", "echo string");
+
+static int cmd_uptime(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    uint32_t ms = (uint32_t)(ktime_ns() / NS_PER_MS);
+    terminal_write("\nUp ");
+    terminal_write_dec(ms / 1000);
+    terminal_write(".");
+    terminal_write_dec(ms / 100 % 10);
+    terminal_write(" s, TSC ");
+    terminal_write_dec(timer_tsc_khz() / 1000);
+    terminal_write(" MHz\n\n");
+    return 0;
+}
+DSH_COMMAND(uptime, cmd_uptime, 0, 0, "", "time since boot");
+
+#define TERMSTAT_BENCH_CALLS 50
+#define TERMSTAT_BENCH_KB 4
+
+static void termstat_line(const char *label, uint32_t value) {
+    terminal_write(label);
+    terminal_write_dec(value);
+    terminal_write("\n");
+}
+
+// Scaled to 1024 bytes of output before dividing, a run that wrote less
+// than a KB still shows its cost
+static uint32_t termstat_per_kb(uint32_t count, uint32_t bytes) {
+    return (uint32_t)((uint64_t)count * 1024 / bytes);
+}
+
+// Per-call cost of terminal_write() on the shadow buffer compared with the
+// old console that stored every cell (and every scrolled cell) straight
+// into video memory, read the screen back on each scroll and moved the
+// hardware cursor (4 port writes) after every byte
+static void termstat_bench(void) {
+    char line[TERMINAL_MAX_WIDTH + 1];
+    size_t width = terminal_width();
+    size_t height = terminal_height();
+    struct terminal_stats single, batched;
+
+    for (size_t i = 0; i < width - 1; i++)
+        line[i] = 'a' + i % 26;
+    line[width - 1] = '\n';
+    line[width] = '\0';
+
+    // dsh runs commands inside a batch, flush by hand to get the
+    // behaviour of a plain terminal_write() call
+    terminal_reset_stats();
+    for (int i = 0; i < TERMSTAT_BENCH_CALLS; i++) {
+        terminal_write(line);
+        terminal_flush();
+    }
+    terminal_get_stats(&single);
+
+    // Command output path: many writes inside one batch
+    terminal_reset_stats();
+    terminal_batch_begin();
+    for (size_t i = 0; i < TERMSTAT_BENCH_KB * 1024 / width; i++)
+        terminal_write_n(line, width);
+    terminal_batch_end();
+    terminal_flush();
+    terminal_get_stats(&batched);
+
+    uint32_t direct_writes = single.cell_stores + single.scrolls * width * height;
+    uint32_t direct_reads = single.scrolls * width * (height - 1);
+
+    terminal_write("\nterminal_write() of a full line (");
+    terminal_write_dec(width);
+    terminal_write(" columns), per call:\n");
+    termstat_line("  direct MMIO writes: ", direct_writes / TERMSTAT_BENCH_CALLS);
+    termstat_line("  direct MMIO reads:  ", direct_reads / TERMSTAT_BENCH_CALLS);
+    termstat_line("  shadow MMIO writes: ", single.mmio_writes / TERMSTAT_BENCH_CALLS);
+    termstat_line("  shadow MMIO reads:  ", 0);
+    termstat_line("  direct port writes: ", single.bytes * 4 / TERMSTAT_BENCH_CALLS);
+    termstat_line("  cursor port writes: ", single.port_writes / TERMSTAT_BENCH_CALLS);
+    if (batched.bytes) {
+        terminal_write("Batched command output, per KB:\n");
+        termstat_line("  direct port writes: ", termstat_per_kb(batched.bytes * 4, batched.bytes));
+        termstat_line("  cursor port writes: ", termstat_per_kb(batched.port_writes, batched.bytes));
+        termstat_line("  shadow MMIO writes: ", termstat_per_kb(batched.mmio_writes, batched.bytes));
+    }
+    terminal_write("\n");
+}
+
+#define REDRAW_BENCH_ROUNDS 100
+#define VGA_TEXT_WINDOW 0xB8000
+#define VGA_TEXT_WINDOW_SIZE 0x8000
+
+// Cycles for one full-screen repaint, the work terminal_initialize() does
+// on a screen with unknown contents
+static uint32_t redraw_cycles(void) {
+    uint64_t start = rdtsc();
+    for (int i = 0; i < REDRAW_BENCH_ROUNDS; i++) {
+        terminal_invalidate();
+        terminal_flush();
+    }
+    return (uint32_t)((rdtsc() - start) / REDRAW_BENCH_ROUNDS);
+}
+
+// Cycles per scrolled line when every line differs from its neighbour,
+// so each terminal_scroll() makes the flush rewrite the whole screen
+static uint32_t scroll_cycles(void) {
+    char line[VGA_WIDTH];
+    uint64_t start = rdtsc();
+    for (int i = 0; i < REDRAW_BENCH_ROUNDS; i++) {
+        for (size_t x = 0; x < VGA_WIDTH - 1; x++)
+            line[x] = 'A' + (i + x) % 26;
+        line[VGA_WIDTH - 1] = '\n';
+        terminal_write_n(line, VGA_WIDTH);
+        terminal_flush();
+    }
+    return (uint32_t)((rdtsc() - start) / REDRAW_BENCH_ROUNDS);
+}
+
+// Full-screen redraw and scroll cost with the VGA window uncached (how it
+// ran before paging) and write-combining
+static void termstat_redraw(void) {
+    uint32_t uc_redraw, uc_scroll, wc_redraw, wc_scroll;
+
+    if (terminal_get_backend() != &vga_text_backend) {
+        dsh_error("termstat: redraw measures the VGA text window, the console is not on it");
+        return;
+    }
+
+    paging_set_cache(VGA_TEXT_WINDOW, VGA_TEXT_WINDOW_SIZE, PAGE_CACHE_UC);
+    uc_redraw = redraw_cycles();
+    uc_scroll = scroll_cycles();
+    paging_set_cache(VGA_TEXT_WINDOW, VGA_TEXT_WINDOW_SIZE, PAGE_CACHE_WC);
+    wc_redraw = redraw_cycles();
+    wc_scroll = scroll_cycles();
+
+    terminal_write("\nCycles per full-screen redraw / scrolled line:\n");
+    terminal_write("  uncached:        ");
+    terminal_write_dec(uc_redraw);
+    terminal_write(" / ");
+    terminal_write_dec(uc_scroll);
+    terminal_write("\n  write-combining: ");
+    terminal_write_dec(wc_redraw);
+    terminal_write(" / ");
+    terminal_write_dec(wc_scroll);
+    terminal_write(paging_has_pat() ? "\n\n" : "\n(no PAT on this CPU, WC falls back to write-through)\n\n");
+}
+
+static int cmd_termstat(int argc, char **argv) {
+    struct terminal_stats st;
+
+    if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+        termstat_bench();
+        return 0;
+    }
+    if (argc > 1 && strcmp(argv[1], "redraw") == 0) {
+        termstat_redraw();
+        return 0;
+    }
+    if (argc > 1) {
+        dsh_error("termstat: unknown mode");
+        return 1;
+    }
+    terminal_get_stats(&st);
+    terminal_write("\nConsole: ");
+    terminal_write(terminal_get_backend()->name);
+    terminal_write(", ");
+    terminal_write_dec(terminal_width());
+    terminal_write("x");
+    terminal_write_dec(terminal_height());
+    terminal_write(" cells\n");
+    termstat_line("Bytes written: ", st.bytes);
+    termstat_line("Cells drawn:  ", st.cell_stores);
+    termstat_line("Lines scrolled: ", st.scrolls);
+    termstat_line("MMIO writes:  ", st.mmio_writes);
+    termstat_line("Port writes:  ", st.port_writes);
+    termstat_line("Flushes:      ", st.flushes);
+    terminal_write("\n");
+    return 0;
+}
+DSH_COMMAND(termstat, cmd_termstat, 0, 1, "[bench|redraw]", "console I/O counters");
+
+static int cmd_meminfo(int argc, char **argv) {
+    struct pmm_stats st;
+    (void)argc;
+    (void)argv;
+    pmm_get_stats(&st);
+
+    terminal_write("\nPhysical memory:\n");
+    terminal_write("  Total: ");
+    terminal_write_dec(st.total_pages * (PAGE_SIZE / 1024));
+    terminal_write(" KiB\n  Used:  ");
+    terminal_write_dec((st.total_pages - st.free_pages) * (PAGE_SIZE / 1024));
+    terminal_write(" KiB\n  Free:  ");
+    terminal_write_dec(st.free_pages * (PAGE_SIZE / 1024));
+    terminal_write(" KiB\nFree blocks by size:\n");
+    for (int order = 0; order <= PMM_MAX_ORDER; order++) {
+        terminal_write("  ");
+        terminal_write_dec((PAGE_SIZE / 1024) << order);
+        terminal_write(" KiB: ");
+        terminal_write_dec(st.free_blocks[order]);
+        terminal_write(order % 2 ? "\n" : "\t");
+    }
+    terminal_write("\n\n");
+    return 0;
+}
+DSH_COMMAND(meminfo, cmd_meminfo, 0, 0, "", "physical memory usage");
+
+// Right-align a number in a column of the given width
+static void write_padded_dec(uint32_t value, size_t width) {
+    size_t digits = 1;
+    for (uint32_t v = value; v >= 10; v /= 10)
+        digits++;
+    while (width-- > digits)
+        terminal_putchar(' ');
+    terminal_write_dec(value);
+}
+
+#define SLAB_STRESS_OPS 100000
+#define SLAB_STRESS_SLOTS 256
+
+// Random kmalloc/kfree mix over all size classes, timed per operation
+static void slab_stress(void) {
+    static void *slots[SLAB_STRESS_SLOTS];
+    uint32_t seed = 0x2545F491;
+    uint64_t total = 0, worst = 0;
+
+    for (int i = 0; i < SLAB_STRESS_OPS; i++) {
+        seed ^= seed << 13;
+        seed ^= seed >> 17;
+        seed ^= seed << 5;
+        uint32_t slot = seed % SLAB_STRESS_SLOTS;
+
+        uint64_t start = rdtsc();
+        if (slots[slot]) {
+            kfree(slots[slot]);
+            slots[slot] = NULL;
+        } else {
+            slots[slot] = kmalloc(KMALLOC_MIN_SIZE + (seed >> 8) % KMALLOC_MAX_SLAB_SIZE);
+        }
+        uint64_t cycles = rdtsc() - start;
+
+        total += cycles;
+        if (cycles > worst)
+            worst = cycles;
+    }
+    for (int i = 0; i < SLAB_STRESS_SLOTS; i++) {
+        kfree(slots[i]);
+        slots[i] = NULL;
+    }
+
+    uint64_t total_ns = timer_cycles_to_ns(total);
+    terminal_write("\nkmalloc/kfree stress, ");
+    terminal_write_dec(SLAB_STRESS_OPS);
+    terminal_write(" ops:\n  average: ");
+    terminal_write_dec((uint32_t)(total / SLAB_STRESS_OPS));
+    terminal_write(" cycles/op\n  throughput: ");
+    terminal_write_dec(total_ns ? (uint32_t)(SLAB_STRESS_OPS * 1000000ULL / total_ns) : 0);
+    terminal_write(" kops/s\n  worst case: ");
+    terminal_write_dec((uint32_t)worst);
+    terminal_write(" cycles (");
+    terminal_write_dec((uint32_t)timer_cycles_to_ns(worst));
+    terminal_write(" ns)\n\n");
+}
+
+static int cmd_slabinfo(int argc, char **argv) {
+    struct kmalloc_stats large;
+
+    if (argc > 1 && strcmp(argv[1], "stress") == 0) {
+        slab_stress();
+        return 0;
+    }
+    if (argc > 1) {
+        dsh_error("slabinfo: unknown mode");
+        return 1;
+    }
+
+    terminal_write("\ncache           objsize  active   total  slabs  frag%\n");
+    for (const struct kmem_cache *c = kmem_cache_next(NULL); c; c = kmem_cache_next(c)) {
+        size_t len = strlen(c->name);
+        terminal_write(c->name);
+        for (size_t i = len; i < KMEM_CACHE_NAME_LEN; i++)
+            terminal_putchar(' ');
+        write_padded_dec(c->object_size, 7);
+        write_padded_dec(c->active_objects, 8);
+        write_padded_dec(c->total_objects, 8);
+        write_padded_dec(c->slabs, 7);
+        // Share of slab memory not holding live objects
+        uint32_t bytes = c->slabs * PAGE_SIZE;
+        uint32_t used = c->active_objects * c->object_size;
+        write_padded_dec(bytes ? (bytes - used) * 100 / bytes : 0, 7);
+        terminal_write("\n");
+    }
+    kmalloc_get_stats(&large);
+    terminal_write("Page-backed kmalloc blocks: ");
+    terminal_write_dec(large.large_allocs);
+    terminal_write(" (");
+    terminal_write_dec(large.large_pages);
+    terminal_write(" pages)\n\n");
+    return 0;
+}
+DSH_COMMAND(slabinfo, cmd_slabinfo, 0, 1, "[stress]", "kernel heap caches");
+
+#define KLIB_TEST_ROUNDS 2000
+#define KLIB_BUFFER_ORDER 9          // 2 MiB: 1 MiB source and destination
+#define KLIB_REGION (512 * 1024)     // Test areas inside the buffer
+#define KLIB_BENCH_BYTES (4 * 1024 * 1024)
+
+static uint32_t xorshift(uint32_t *seed) {
+    *seed ^= *seed << 13;
+    *seed ^= *seed >> 17;
+    *seed ^= *seed << 5;
+    return *seed;
+}
+
+// Byte-at-a-time references, the way the shell copied and filled before
+static void byte_copy(uint8_t *d, const uint8_t *s, size_t n) {
+    if (d < s) {
+        for (size_t i = 0; i < n; i++)
+            d[i] = s[i];
+    } else {
+        for (size_t i = n; i > 0; i--)
+            d[i - 1] = s[i - 1];
+    }
+}
+
+static void byte_fill(uint8_t *d, uint8_t c, size_t n) {
+    for (size_t i = 0; i < n; i++)
+        d[i] = c;
+}
+
+static int byte_equal(const uint8_t *a, const uint8_t *b, size_t n) {
+    for (size_t i = 0; i < n; i++)
+        if (a[i] != b[i])
+            return 0;
+    return 1;
+}
+
+static size_t byte_strlen(const char *s) {
+    size_t n = 0;
+    while (s[n])
+        n++;
+    return n;
+}
+
+static int sign(int v) {
+    return (v > 0) - (v < 0);
+}
+
+// Random sizes and alignments against the byte references, returns the
+// name of the first routine that disagreed or NULL
+static const char *klib_check(uint8_t *buf) {
+    uint8_t *src = buf, *dst = buf + KLIB_REGION, *ref = buf + 2 * KLIB_REGION;
+    uint32_t seed = 0x9E3779B9;
+
+    for (int round = 0; round < KLIB_TEST_ROUNDS; round++) {
+        size_t n = round % 4 ? xorshift(&seed) % 600 : xorshift(&seed) % 70000;
+        size_t da = xorshift(&seed) % 64, sa = xorshift(&seed) % 64;
+        size_t span = n + 128;
+        for (size_t i = 0; i < span + 64; i++)
+            src[i] = (uint8_t)xorshift(&seed);
+
+        byte_copy(dst, src, span);
+        byte_copy(ref, src, span);
+        memcpy(dst + da, src + sa + 64, n);
+        byte_copy(ref + da, src + sa + 64, n);
+        if (!byte_equal(dst, ref, span))
+            return "memcpy";
+
+        memmove(dst + da, dst + sa, n);
+        byte_copy(ref + da, ref + sa, n);
+        if (!byte_equal(dst, ref, span))
+            return "memmove";
+
+        uint8_t c = (uint8_t)xorshift(&seed);
+        memset(dst + da, c, n);
+        byte_fill(ref + da, c, n);
+        if (!byte_equal(dst, ref, span))
+            return "memset";
+
+        uint16_t *cells = (uint16_t *)(dst + (da & ~1u));
+        uint16_t *ref_cells = (uint16_t *)(ref + (da & ~1u));
+        memsetw(cells, (uint16_t)round, n / 2);
+        for (size_t i = 0; i < n / 2; i++)
+            ref_cells[i] = (uint16_t)round;
+        if (!byte_equal(dst, ref, span))
+            return "memsetw";
+
+        if (memcmp(dst, ref, span) != 0)
+            return "memcmp";
+        if (n) {
+            size_t at = xorshift(&seed) % n;
+            dst[at] ^= 1 + xorshift(&seed) % 255;
+            if (sign(memcmp(dst, ref, n)) != (dst[at] > ref[at] ? 1 : -1))
+                return "memcmp";
+        }
+
+        char *s1 = (char *)src + sa, *s2 = (char *)dst + da;
+        size_t len = xorshift(&seed) % 300;
+        for (size_t i = 0; i < len; i++)
+            s1[i] = s2[i] = 'a' + xorshift(&seed) % 3;
+        s1[len] = s2[len] = '\0';
+        if (len && (round & 1))
+            s2[xorshift(&seed) % len] = 'z';
+        if (strlen(s1) != byte_strlen(s1))
+            return "strlen";
+        size_t k = 0;
+        while (s1[k] && s1[k] == s2[k])
+            k++;
+        if (sign(strcmp(s1, s2)) != sign((uint8_t)s1[k] - (uint8_t)s2[k]))
+            return "strcmp";
+    }
+    return NULL;
+}
+
+static void klib_test(uint8_t *buf) {
+    int sse2 = klib_sse2_enabled();
+    for (int pass = sse2; pass >= 0; pass--) {
+        klib_use_sse2(pass);
+        const char *failed = klib_check(buf);
+        terminal_write(pass ? "  SSE2 paths:        " : "  rep string paths:  ");
+        if (failed) {
+            terminal_write(failed);
+            terminal_write(" FAILED\n");
+        } else {
+            terminal_write_dec(KLIB_TEST_ROUNDS);
+            terminal_write(" rounds OK\n");
+        }
+    }
+    klib_use_sse2(sse2);
+}
+
+// The same checks for selftest, on every copy path the CPU has
+static const char *klib_selftest(void) {
+    uintptr_t buf = pmm_alloc(KLIB_BUFFER_ORDER);
+    if (!buf)
+        return "no 2 MiB block free";
+    int sse2 = klib_sse2_enabled();
+    const char *failed = NULL;
+    for (int pass = sse2; pass >= 0 && !failed; pass--) {
+        klib_use_sse2(pass);
+        failed = klib_check((uint8_t *)buf);
+    }
+    klib_use_sse2(sse2);
+    pmm_free(buf, KLIB_BUFFER_ORDER);
+    return failed;
+}
+SELFTEST(klib, klib_selftest);
+
+enum klib_bench_op { BENCH_COPY, BENCH_FILL, BENCH_STRLEN };
+
+// Cycles per call, the best of three batches
+static uint32_t klib_time(enum klib_bench_op op, int byte_ref, uint8_t *dst, uint8_t *src, size_t size) {
+    uint32_t iters = KLIB_BENCH_BYTES / size;
+    if (iters > 20000)
+        iters = 20000;
+    uint64_t best = ~0ULL;
+
+    for (int batch = 0; batch < 3; batch++) {
+        uint64_t start = rdtsc();
+        for (uint32_t i = 0; i < iters; i++) {
+            switch (op) {
+            case BENCH_COPY:
+                if (byte_ref)
+                    byte_copy(dst, src, size);
+                else
+                    memcpy(dst, src, size);
+                break;
+            case BENCH_FILL:
+                if (byte_ref)
+                    byte_fill(dst, (uint8_t)i, size);
+                else
+                    memset(dst, i, size);
+                break;
+            case BENCH_STRLEN:
+                if ((byte_ref ? byte_strlen((char *)src) : strlen((char *)src)) != size - 1)
+                    return 0;
+                break;
+            }
+        }
+        uint64_t cycles = rdtsc() - start;
+        if (cycles < best)
+            best = cycles;
+    }
+    return (uint32_t)(best / iters);
+}
+
+static void klib_bench(uint8_t *buf) {
+    static const uint32_t sizes[] = { 1, 16, 64, 256, 1024, 4096, 65536, 262144, 1048576 };
+    static const char *const names[] = { "memcpy", "memset", "strlen" };
+    uint8_t *src = buf, *dst = buf + (1 << 20);
+    int sse2 = klib_sse2_enabled();
+
+    for (int op = BENCH_COPY; op <= BENCH_STRLEN; op++) {
+        terminal_write("\n");
+        terminal_write(names[op]);
+        terminal_write(" cycles/call\n    bytes    bytewise  rep/word     SSE2\n");
+        for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+            uint32_t size = sizes[i];
+            if (op == BENCH_STRLEN) {
+                byte_fill(src, 'a', size - 1);
+                src[size - 1] = '\0';
+            }
+            write_padded_dec(size, 9);
+            write_padded_dec(klib_time(op, 1, dst, src, size), 12);
+            klib_use_sse2(0);
+            write_padded_dec(klib_time(op, 0, dst, src, size), 10);
+            klib_use_sse2(sse2);
+            if (sse2 && op != BENCH_STRLEN)
+                write_padded_dec(klib_time(op, 0, dst, src, size), 9);
+            else
+                terminal_write("        -");
+            terminal_write("\n");
+            terminal_flush();  // Long run, show progress
+        }
+    }
+    terminal_write("\n");
+}
+
+static int cmd_klib(int argc, char **argv) {
+    int bench = strcmp(argv[1], "bench") == 0;
+    if (!bench && strcmp(argv[1], "test") != 0) {
+        dsh_error("klib: unknown mode");
+        return 1;
+    }
+    (void)argc;
+
+    uintptr_t buf = pmm_alloc(KLIB_BUFFER_ORDER);
+    if (!buf) {
+        dsh_error("klib: no 2 MiB block free");
+        return 1;
+    }
+    terminal_write(klib_sse2_enabled() ? "\nSSE2 available\n" : "\nNo SSE2, rep string paths only\n");
+    if (bench)
+        klib_bench((uint8_t *)buf);
+    else
+        klib_test((uint8_t *)buf);
+    pmm_free(buf, KLIB_BUFFER_ORDER);
+    terminal_write("\n");
+    return 0;
+}
+DSH_COMMAND(klib, cmd_klib, 1, 1, "test|bench", "string/memory routine checks and timings");
+
+static int cmd_bench(int argc, char **argv) {
+    if (argc > 1 && strcmp(argv[1], "list") == 0) {
+        terminal_write("\n");
+        for (const struct bench *b = bench_next(NULL); b; b = bench_next(b)) {
+            terminal_write(b->name);
+            terminal_write("\n");
+        }
+        terminal_write("\n");
+        return 0;
+    }
+    // The results replace the screen, bench_run_all() clears it
+    if (bench_run_all(argc > 1 ? argv[1] : "") == 0) {
+        dsh_error("bench: no benchmark matches");
+        return 1;
+    }
+    terminal_write("\n");
+    return 0;
+}
+DSH_COMMAND(bench, cmd_bench, 0, 1, "[list|prefix]", "run microbenchmarks (cycles min/median/p99)");
+
+static int cmd_selftest(int argc, char **argv) {
+    terminal_write("\n");
+    int failed = selftest_run_all(argc > 1 ? argv[1] : "");
+    terminal_write("\n");
+    // The results are output, the verdict goes to the console
+    if (failed < 0)
+        dsh_error("selftest: no test matches");
+    else if (failed > 0)
+        dsh_error("selftest: some tests FAILED");
+    return failed != 0;
+}
+DSH_COMMAND(selftest, cmd_selftest, 0, 1, "[prefix]", "run the kernel self-tests");
+
+// Mode words are checked before a command prints anything, so a typo
+// leaves nothing behind in a pipeline
+static int mode_known(const char *mode, const char *const *modes, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        if (strcmp(mode, modes[i]) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+static int cmd_trace(int argc, char **argv) {
+    static const char *const modes[] = { "dump", "serial", "reset", "on", "off", "status" };
+    const char *mode = argc > 1 ? argv[1] : "dump";
+    const char *filter = argc > 2 ? argv[2] : "";
+
+    if (!trace_compiled_in()) {
+        dsh_error("trace: built without tracepoints, rebuild with make TRACE=1");
+        return 1;
+    }
+    if (!mode_known(mode, modes, sizeof(modes) / sizeof(modes[0]))) {
+        dsh_error("trace: unknown mode");
+        return 1;
+    }
+    terminal_write("\n");
+    if (strcmp(mode, "dump") == 0) {
+        trace_dump(filter, 0);
+    } else if (strcmp(mode, "serial") == 0) {
+        terminal_write_dec(trace_dump(filter, 1));
+        terminal_write(" events sent to the serial port\n");
+    } else if (strcmp(mode, "reset") == 0) {
+        trace_reset();
+    } else if (strcmp(mode, "on") == 0 || strcmp(mode, "off") == 0) {
+        trace_set_enabled(mode[1] == 'n');
+    } else { // status
+        terminal_write(trace_enabled() ? "recording, " : "paused, ");
+        terminal_write_dec(trace_count());
+        terminal_write(" events since reset, ring holds ");
+        terminal_write_dec(TRACE_RING_SIZE);
+        terminal_write("\n");
+    }
+    terminal_write("\n");
+    return 0;
+}
+DSH_COMMAND(trace, cmd_trace, 0, 2, "[dump|serial|reset|on|off|status] [prefix]",
+            "tracepoint ring, serial output feeds scripts/trace2chrome.py");
+
+static int cmd_prof(int argc, char **argv) {
+    static const char *const modes[] = { "start", "stop", "reset", "report" };
+
+    if (!mode_known(argv[1], modes, sizeof(modes) / sizeof(modes[0]))) {
+        dsh_error("prof: unknown mode");
+        return 1;
+    }
+    if (strcmp(argv[1], "start") == 0 && !prof_start()) {
+        dsh_error("prof: out of memory");
+        return 1;
+    }
+    terminal_write("\n");
+    if (strcmp(argv[1], "start") == 0) {
+        terminal_write("Sampling at ");
+        terminal_write_dec(TIMER_HZ);
+        terminal_write(" Hz over ");
+        terminal_write_dec(ksym_count());
+        terminal_write(" functions\n");
+    } else if (strcmp(argv[1], "stop") == 0) {
+        prof_stop();
+    } else if (strcmp(argv[1], "reset") == 0) {
+        prof_reset();
+    } else { // report
+        uint32_t top = 10;
+        if (argc > 2) {
+            top = 0;
+            for (const char *p = argv[2]; *p >= '0' && *p <= '9'; p++)
+                top = top * 10 + (*p - '0');
+        }
+        prof_report(top);
+    }
+    terminal_write("\n");
+    return 0;
+}
+DSH_COMMAND(prof, cmd_prof, 1, 2, "start|stop|reset|report [top]", "sampling profiler, top functions by samples");
+
+#define PS_MAX_THREADS 32
+
+static int cmd_ps(int argc, char **argv) {
+    static struct thread_info threads[PS_MAX_THREADS];
+    (void)argc;
+    (void)argv;
+
+    size_t count = sched_snapshot(threads, PS_MAX_THREADS);
+    terminal_write("\n  id name             state    pri cpu   cpu ms  switches\n");
+    for (size_t i = 0; i < count && i < PS_MAX_THREADS; i++) {
+        const struct thread_info *t = &threads[i];
+        write_padded_dec(t->id, 4);
+        terminal_putchar(' ');
+        terminal_write(t->name);
+        for (size_t n = strlen(t->name); n < THREAD_NAME_LEN + 1; n++)
+            terminal_putchar(' ');
+        const char *state = thread_state_name(t->state);
+        terminal_write(state);
+        for (size_t n = strlen(state); n < 8; n++)
+            terminal_putchar(' ');
+        write_padded_dec(t->priority, 4);
+        write_padded_dec(t->cpu, 4);
+        write_padded_dec((uint32_t)(t->ticks * 1000 / TIMER_HZ), 9);
+        write_padded_dec(t->switches, 10);
+        terminal_write("\n");
+    }
+    if (count > PS_MAX_THREADS) {
+        terminal_write_dec(count - PS_MAX_THREADS);
+        terminal_write(" more not shown\n");
+    }
+    terminal_write("\n");
+    return 0;
+}
+DSH_COMMAND(ps, cmd_ps, 0, 0, "", "list kernel threads");
+
+/* Background workers for spawn. They run until killed */
+static void worker_spin(void *arg) {
+    (void)arg;
+    volatile uint32_t count = 0;
+    while (!thread_should_stop())
+        count++;
+}
+
+static void worker_sleep(void *arg) {
+    (void)arg;
+    while (!thread_should_stop())
+        ksleep_ms(100);
+}
+
+// Benchmarks that would fight the shell from a worker thread: the
+// terminal_ and line_ ones draw on its console, the dsh_ ones run
+// pipelines through its stage state
+static int bench_needs_shell(const struct bench *b) {
+    return strncmp(b->name, "terminal_", 9) == 0 || strncmp(b->name, "line_", 5) == 0 ||
+           strncmp(b->name, "dsh_", 4) == 0;
+}
+
+// Benchmark loop over every benchmark starting with the prefix in arg
+static void worker_bench(void *arg) {
+    char *prefix = arg;
+    size_t len = strlen(prefix);
+    struct bench_result result;
+
+    while (!thread_should_stop()) {
+        int ran = 0;
+        for (const struct bench *b = bench_next(NULL); b && !thread_should_stop(); b = bench_next(b)) {
+            if (strncmp(b->name, prefix, len) == 0 && !bench_needs_shell(b))
+                ran += bench_run(b, &result);
+        }
+        if (!ran)
+            break;
+    }
+    kfree(prefix);
+}
+
+static uint32_t parse_dec(const char *s, int *ok) {
+    uint32_t value = 0;
+    *ok = *s != '\0';
+    for (; *s; s++) {
+        if (*s < '0' || *s > '9')
+            *ok = 0;
+        else
+            value = value * 10 + (*s - '0');
+    }
+    return value;
+}
+
+static int cmd_spawn(int argc, char **argv) {
+    void (*entry)(void *arg) = NULL;
+    void *arg = NULL;
+    int next = 2;  // argv index of the optional priority
+
+    if (strcmp(argv[1], "spin") == 0) {
+        entry = worker_spin;
+    } else if (strcmp(argv[1], "sleep") == 0) {
+        entry = worker_sleep;
+    } else if (strcmp(argv[1], "bench") == 0) {
+        const char *prefix = argc > 2 ? argv[2] : "memcpy";
+        size_t len = strlen(prefix) + 1;
+        if (argc > 2)
+            next = 3;
+        if (!(arg = kmalloc(len))) {
+            dsh_error("spawn: out of memory");
+            return 1;
+        }
+        memcpy(arg, prefix, len);
+        entry = worker_bench;
+    } else {
+        dsh_error("spawn: unknown worker");
+        return 1;
+    }
+
+    uint32_t priority = THREAD_PRIORITY_DEFAULT;
+    if (argc > next + 1) {
+        dsh_error("spawn: too many arguments");
+        kfree(arg);
+        return 1;
+    }
+    if (argc > next) {
+        int ok;
+        priority = parse_dec(argv[next], &ok);
+        if (!ok || priority >= THREAD_PRIORITIES) {
+            struct dsh_stream *out = dsh_console_begin();
+            terminal_write("\nspawn: priority is 0 (highest) to ");
+            terminal_write_dec(THREAD_PRIORITIES - 1);
+            terminal_write("\n\n");
+            dsh_console_end(out);
+            kfree(arg);
+            return 1;
+        }
+    }
+
+    struct thread *t = thread_create(argv[1], entry, arg, priority);
+    if (!t) {
+        dsh_error("spawn: out of memory");
+        kfree(arg);
+        return 1;
+    }
+    terminal_write("\nStarted thread ");
+    terminal_write_dec(t->id);
+    terminal_write("\n\n");
+    return 0;
+}
+DSH_COMMAND(spawn, cmd_spawn, 1, 3, "spin|sleep|bench [prefix] [priority]", "start a background worker thread");
+
+static int cmd_kill(int argc, char **argv) {
+    int ok;
+    (void)argc;
+    uint32_t id = parse_dec(argv[1], &ok);
+    if (!ok || !thread_stop(id)) {
+        dsh_error("kill: no such thread");
+        return 1;
+    }
+    terminal_write("\n");
+    return 0;
+}
+DSH_COMMAND(kill, cmd_kill, 1, 1, "id", "ask a thread to stop");
+
+static int cmd_cpus(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    terminal_write("\ncpu apic  busy %  ready  steals\n");
+    for (uint32_t i = 0; i < smp_cpu_count(); i++) {
+        const struct cpu *cpu = smp_cpu(i);
+        struct sched_cpu_stats stats;
+        sched_cpu_stats(i, &stats);
+        uint64_t ticks = cpu->timer_ticks;
+        uint32_t busy = ticks ? (uint32_t)((ticks - stats.idle_ticks) * 100 / ticks) : 0;
+        write_padded_dec(i, 3);
+        write_padded_dec(cpu->apic_id, 5);
+        write_padded_dec(busy, 8);
+        write_padded_dec(stats.ready, 7);
+        write_padded_dec(stats.steals, 8);
+        terminal_write("\n");
+    }
+    terminal_write("\n");
+    return 0;
+}
+DSH_COMMAND(cpus, cmd_cpus, 0, 0, "", "list CPUs with their load since boot");
+
+static int cmd_pbench(int argc, char **argv) {
+    uint32_t threads = 0;
+    if (argc > 1) {
+        int ok;
+        threads = parse_dec(argv[1], &ok);
+        if (!ok || threads == 0) {
+            dsh_error("pbench: bad thread count");
+            return 1;
+        }
+    }
+    terminal_write("\n");
+    int ok = smp_bench(threads);
+    terminal_write("\n");
+    return !ok;
+}
+DSH_COMMAND(pbench, cmd_pbench, 0, 1, "[threads]", "parallel checksum on 1, 2, 4 ... threads");
+
+static int cmd_lsblk(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    struct blk_cache_stats cache;
+
+    terminal_write("\nname      MiB  mode  requests  transfers  merged  errors\n");
+    for (uint32_t i = 0; blk_get(i); i++) {
+        const struct blk_device *dev = blk_get(i);
+        terminal_write(dev->name);
+        for (size_t n = strlen(dev->name); n < 4; n++)
+            terminal_putchar(' ');
+        write_padded_dec((uint32_t)(dev->sectors / (1024 * 1024 / BLK_SECTOR_SIZE)), 7);
+        terminal_write("  ");
+        terminal_write(dev->mode);
+        write_padded_dec(dev->stats.requests, 12 - strlen(dev->mode));
+        write_padded_dec(dev->stats.transfers, 11);
+        write_padded_dec(dev->stats.merged, 8);
+        write_padded_dec(dev->stats.errors, 8);
+        terminal_write("\n");
+    }
+    blk_cache_get_stats(&cache);
+    terminal_write("cache: ");
+    terminal_write_dec(cache.blocks);
+    terminal_write(" blocks, ");
+    terminal_write_dec(cache.dirty);
+    terminal_write(" dirty, ");
+    terminal_write_dec(cache.hits);
+    terminal_write(" hits, ");
+    terminal_write_dec(cache.misses);
+    terminal_write(" misses, ");
+    terminal_write_dec(cache.readahead);
+    terminal_write(" read ahead, ");
+    terminal_write_dec(cache.evictions);
+    terminal_write(" evicted, ");
+    terminal_write_dec(cache.writebacks);
+    terminal_write(" written back\n\n");
+    return 0;
+}
+DSH_COMMAND(lsblk, cmd_lsblk, 0, 0, "", "list block devices and cache counters");
+
+static int cmd_sync(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    int errors = blk_sync(NULL);
+    if (errors) {
+        struct dsh_stream *out = dsh_console_begin();
+        terminal_write("\nsync: ");
+        terminal_write_dec(errors);
+        terminal_write(" errors\n\n");
+        dsh_console_end(out);
+    }
+    return errors != 0;
+}
+DSH_COMMAND(sync, cmd_sync, 0, 0, "", "write dirty cached blocks to disk");
+
+static int cmd_blkbench(int argc, char **argv) {
+    struct blk_device *dev = argc > 1 ? blk_find(argv[1]) : blk_get(0);
+    uint32_t mib = 0;
+    if (!dev) {
+        dsh_error("blkbench: no such block device");
+        return 1;
+    }
+    if (argc > 2) {
+        int ok;
+        mib = parse_dec(argv[2], &ok);
+        if (!ok || mib == 0) {
+            dsh_error("blkbench: bad size");
+            return 1;
+        }
+    }
+    terminal_write("\n");
+    int ok = blk_bench(dev, mib);
+    terminal_write("\n");
+    return !ok;
+}
+DSH_COMMAND(blkbench, cmd_blkbench, 0, 2, "[dev] [MiB]", "sequential and random read throughput, cache hit rate");
+
+// Look a path up in the initrd, complaining on the console for cmd
+static const struct initrd_file *initrd_path(const char *cmd, const char *path) {
+    const struct initrd_file *file = initrd_lookup(path);
+    if (!file) {
+        struct dsh_stream *out = dsh_console_begin();
+        terminal_write("\n");
+        terminal_write(cmd);
+        terminal_write(initrd_get_index() ? ": no such file: " : ": no initrd loaded");
+        terminal_write(initrd_get_index() ? path : "");
+        terminal_write("\n\n");
+        dsh_console_end(out);
+    }
+    return file;
+}
+
+static void ls_line(const struct initrd_file *file, void *ctx) {
+    (void)ctx;
+    // The last component of the path
+    const char *name = file->path + file->path_len;
+    size_t len = 0;
+    while (name > file->path && name[-1] != '/') {
+        name--;
+        len++;
+    }
+    write_padded_dec(file->size, 8);
+    terminal_write("  ");
+    terminal_write_n(name, len);
+    if (file->type == INITRD_DIR)
+        terminal_putchar('/');
+    terminal_write("\n");
+}
+
+static int cmd_ls(int argc, char **argv) {
+    const struct initrd_file *dir = initrd_path("ls", argc > 1 ? argv[1] : "/");
+    if (!dir)
+        return 1;
+    terminal_write("\n");
+    if (dir->type == INITRD_DIR)
+        initrd_for_each_child(dir, ls_line, NULL);
+    else
+        ls_line(dir, NULL);
+    terminal_write("\n");
+    return 0;
+}
+DSH_COMMAND(ls, cmd_ls, 0, 1, "[path]", "list an initrd directory");
+
+static int cmd_cat(int argc, char **argv) {
+    size_t len;
+    const char *input = dsh_input(&len);
+    if (argc == 1 && !input) {
+        dsh_error("cat: no file given and nothing piped in");
+        return 1;
+    }
+    for (int i = 1; i < argc; i++) {
+        const struct initrd_file *file = initrd_path("cat", argv[i]);
+        if (!file)
+            return 1;
+        if (file->type == INITRD_DIR) {
+            struct dsh_stream *out = dsh_console_begin();
+            terminal_write("\ncat: is a directory: ");
+            terminal_write(argv[i]);
+            terminal_write("\n\n");
+            dsh_console_end(out);
+            return 1;
+        }
+    }
+    output_begin();
+    if (argc == 1)
+        terminal_write_n(input, len);
+    // Straight out of the module, no copy
+    for (int i = 1; i < argc; i++) {
+        const struct initrd_file *file = initrd_lookup(argv[i]);
+        terminal_write_n(file->data, file->size);
+    }
+    output_end();
+    return 0;
+}
+DSH_COMMAND(cat, cmd_cat, 0, DSH_MAX_ARGS - 1, "[file...]", "print initrd files, or what is piped in");
+
+static void write_octal(uint32_t value) {
+    char buf[12];
+    size_t i = sizeof(buf);
+    do {
+        buf[--i] = '0' + (value & 7);
+        value >>= 3;
+    } while (value);
+    terminal_write_n(&buf[i], sizeof(buf) - i);
+}
+
+static int cmd_stat(int argc, char **argv) {
+    (void)argc;
+    const struct initrd_file *file = initrd_path("stat", argv[1]);
+    if (!file)
+        return 1;
+    terminal_write("\n  path: /");
+    terminal_write_n(file->path, file->path_len);
+    terminal_write(file->type == INITRD_DIR ? "\n  type: directory" : "\n  type: file");
+    terminal_write("\n  size: ");
+    terminal_write_dec(file->size);
+    terminal_write("\n  mode: 0");
+    write_octal(file->mode);
+    terminal_write("\n  mtime: ");
+    terminal_write_dec(file->mtime);
+    if (file->type == INITRD_FILE) {
+        terminal_write("\n  data: ");
+        terminal_write_ptr((uintptr_t)file->data);
+    }
+    terminal_write("\n\n");
+    return 0;
+}
+DSH_COMMAND(stat, cmd_stat, 1, 1, "path", "initrd file details");
+
+static int cmd_run(int argc, char **argv) {
+    (void)argc;
+    const struct initrd_file *file = initrd_path("run", argv[1]);
+    if (!file)
+        return 1;
+    if (file->type == INITRD_DIR) {
+        struct dsh_stream *out = dsh_console_begin();
+        terminal_write("\nrun: is a directory: ");
+        terminal_write(argv[1]);
+        terminal_write("\n\n");
+        dsh_console_end(out);
+        return 1;
+    }
+    return dsh_execute_script(file->data, file->size);
+}
+DSH_COMMAND(run, cmd_run, 1, 1, "script", "run the command lines of an initrd file");
+
+static int cmd_keymap(int argc, char **argv) {
+    if (argc == 2) {
+        if (!keymap_use(argv[1])) {
+            struct dsh_stream *out = dsh_console_begin();
+            terminal_write("\nkeymap: no keymap ");
+            terminal_write(argv[1]);
+            terminal_write(" (looked for /etc/keymaps/");
+            terminal_write(argv[1]);
+            terminal_write(".map)\n\n");
+            dsh_console_end(out);
+            return 1;
+        }
+        terminal_write("\n");
+        return 0;
+    }
+    output_begin();
+    const char *name;
+    for (uint32_t i = 0; (name = keymap_name(i)); i++) {
+        terminal_write(strcmp(name, keymap_active()) == 0 ? "* " : "  ");
+        terminal_write(name);
+        terminal_write("\n");
+    }
+    output_end();
+    return 0;
+}
+DSH_COMMAND(keymap, cmd_keymap, 0, 1, "[name]", "list keyboard layouts or switch to one");
+
+/* Filters, for the reading end of a pipeline */
+
+// Piped input for a filter, complains if there is none
+static const char *filter_input(const char *cmd, size_t *len) {
+    const char *input = dsh_input(len);
+    if (!input) {
+        struct dsh_stream *out = dsh_console_begin();
+        terminal_write("\n");
+        terminal_write(cmd);
+        terminal_write(": reads a pipe, as in: help | ");
+        terminal_write(cmd);
+        terminal_write("\n\n");
+        dsh_console_end(out);
+    }
+    return input;
+}
+
+// Length of the line at text, without its '\n'
+static size_t line_length(const char *text, size_t left) {
+    size_t n = 0;
+    while (n < left && text[n] != '\n')
+        n++;
+    return n;
+}
+
+static int contains(const char *text, size_t len, const char *pattern, size_t pattern_len) {
+    for (size_t i = 0; i + pattern_len <= len; i++) {
+        if (memcmp(text + i, pattern, pattern_len) == 0)
+            return 1;
+    }
+    return 0;
+}
+
+static int cmd_grep(int argc, char **argv) {
+    (void)argc;
+    size_t len, pattern_len = strlen(argv[1]);
+    const char *text = filter_input("grep", &len);
+    int matched = 0;
+    if (!text)
+        return 2;
+    output_begin();
+    for (size_t pos = 0; pos < len; ) {
+        size_t n = line_length(text + pos, len - pos);
+        if (contains(text + pos, n, argv[1], pattern_len)) {
+            terminal_write_n(text + pos, n);
+            terminal_putchar('\n');
+            matched = 1;
+        }
+        pos += n + 1;
+    }
+    output_end();
+    return !matched;
+}
+DSH_COMMAND(grep, cmd_grep, 1, 1, "text", "piped lines that contain text");
+
+static int cmd_wc(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    size_t len;
+    const char *text = filter_input("wc", &len);
+    uint32_t lines = 0, words = 0;
+    int in_word = 0;
+    if (!text)
+        return 1;
+    for (size_t i = 0; i < len; i++) {
+        char c = text[i];
+        if (c == '\n')
+            lines++;
+        if (c == ' ' || c == '\n' || c == '\t') {
+            in_word = 0;
+        } else if (!in_word) {
+            in_word = 1;
+            words++;
+        }
+    }
+    output_begin();
+    terminal_write_dec(lines);
+    terminal_putchar(' ');
+    terminal_write_dec(words);
+    terminal_putchar(' ');
+    terminal_write_dec((uint32_t)len);
+    terminal_putchar('\n');
+    output_end();
+    return 0;
+}
+DSH_COMMAND(wc, cmd_wc, 0, 0, "", "lines, words and bytes piped in");
+
+static int cmd_head(int argc, char **argv) {
+    size_t len;
+    uint32_t count = 10;
+    if (argc > 1) {
+        int ok;
+        count = parse_dec(argv[1], &ok);
+        if (!ok) {
+            dsh_error("head: bad line count");
+            return 1;
+        }
+    }
+    const char *text = filter_input("head", &len);
+    if (!text)
+        return 1;
+    size_t end = 0;
+    for (uint32_t i = 0; i < count && end < len; i++)
+        end += line_length(text + end, len - end) + 1;
+    output_begin();
+    terminal_write_n(text, end < len ? end : len);
+    output_end();
+    return 0;
+}
+DSH_COMMAND(head, cmd_head, 0, 1, "[lines]", "first lines piped in (10)");
+
+static void help_line(const struct dsh_command *cmd, void *ctx) {
+    (void)ctx;
+    terminal_write(cmd->name);
+    if (cmd->usage[0]) {
+        terminal_putchar(' ');
+        terminal_write(cmd->usage);
+    }
+    terminal_write(" - ");
+    terminal_write(cmd->help);
+    terminal_write("\n");
+}
+
+static int cmd_help(int argc, char **argv) {
+    (void)argc;
+    (void)argv;
+    terminal_write("\nAvailable commands:\n");
+    terminal_setcolor(VGA_COLOR_LIGHT_GREEN);
+    terminal_write("==============\n");
+    terminal_setcolor(VGA_COLOR_WHITE);
+    dsh_for_each_command(help_line, NULL);
+    terminal_setcolor(VGA_COLOR_LIGHT_GREEN);
+    terminal_write("==============\n\n");
+    terminal_setcolor(VGA_COLOR_WHITE);
+    return 0;
+}
+DSH_COMMAND(help, cmd_help, 0, 0, "", "available commands list");
@@ -0,0 +1,306 @@
+#include <kernel/dsh_history.h>
+#include <kernel/slab.h>
+#include <kernel/klib.h>
+#include <kernel/bench.h>
+#include <kernel/selftest.h>
+#include <stdint.h>
+#include <stddef.h>
+
+#if DSH_HISTORY_SIZE & (DSH_HISTORY_SIZE - 1)
+#error "DSH_HISTORY_SIZE must be a power of two"
+#endif
+
+#define HISTORY_MASK (DSH_HISTORY_SIZE - 1)
+
+struct history_entry {
+    struct history_entry* hash_next;  // Next entry in the same bucket
+    uint32_t hash;
+    uint32_t seq;
+    char text[];
+};
+
+// Insertion overwrites the oldest slot, so adding is O(1) at any size;
+// the hash buckets find an earlier copy of the same command
+struct history {
+    struct history_entry* ring[DSH_HISTORY_SIZE];
+    struct history_entry* buckets[DSH_HISTORY_SIZE];
+    uint32_t next_seq;
+};
+
+static struct history shell_history;
+static struct history* hist = &shell_history;  // Tests swap in their own
+
+// FNV-1a
+static uint32_t history_hash(const char* s) {
+    uint32_t hash = 2166136261u;
+    while (*s) {
+        hash ^= (uint8_t)*s++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static void remove_entry(struct history_entry* entry) {
+    struct history_entry** link = &hist->buckets[entry->hash & HISTORY_MASK];
+    while (*link != entry)
+        link = &(*link)->hash_next;
+    *link = entry->hash_next;
+    hist->ring[entry->seq & HISTORY_MASK] = NULL;
+    kfree(entry);
+}
+
+void history_add(const char* line) {
+    if (!line || line[0] == '\0')
+        return;
+
+    uint32_t hash = history_hash(line);
+    for (struct history_entry* e = hist->buckets[hash & HISTORY_MASK]; e; e = e->hash_next) {
+        if (e->hash != hash || strcmp(e->text, line) != 0)
+            continue;
+        if (e->seq == hist->next_seq - 1)
+            return;  // Already the newest
+        remove_entry(e);
+        break;
+    }
+
+    size_t len = strlen(line);
+    struct history_entry* entry = kmalloc(sizeof(*entry) + len + 1);
+    if (!entry)
+        return;
+    memcpy(entry->text, line, len + 1);
+    entry->hash = hash;
+    entry->seq = hist->next_seq;
+
+    struct history_entry** slot = &hist->ring[hist->next_seq & HISTORY_MASK];
+    if (*slot)
+        remove_entry(*slot);  // Drop the oldest
+    *slot = entry;
+    entry->hash_next = hist->buckets[hash & HISTORY_MASK];
+    hist->buckets[hash & HISTORY_MASK] = entry;
+    hist->next_seq++;
+}
+
+uint32_t history_end(void) {
+    return hist->next_seq;
+}
+
+static uint32_t history_begin(void) {
+    return hist->next_seq > DSH_HISTORY_SIZE ? hist->next_seq - DSH_HISTORY_SIZE : 0;
+}
+
+const char* history_get(uint32_t seq) {
+    if (seq < history_begin() || seq >= hist->next_seq)
+        return NULL;
+    struct history_entry* entry = hist->ring[seq & HISTORY_MASK];
+    return entry ? entry->text : NULL;
+}
+
+int history_prev(uint32_t* seq) {
+    for (uint32_t s = *seq; s > history_begin();) {
+        s--;
+        if (hist->ring[s & HISTORY_MASK]) {
+            *seq = s;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int history_next(uint32_t* seq) {
+    for (uint32_t s = *seq + 1; s < hist->next_seq; s++) {
+        if (hist->ring[s & HISTORY_MASK]) {
+            *seq = s;
+            return 1;
+        }
+    }
+    *seq = hist->next_seq;
+    return 0;
+}
+
+// Match lists for each length of the query, level 0 holds every entry.
+// Nothing is added to the history while a search runs, so sequence
+// numbers stay valid
+static struct {
+    uint32_t* matches[HISTORY_QUERY_MAX + 1];
+    uint32_t count[HISTORY_QUERY_MAX + 1];
+    char query[HISTORY_QUERY_MAX + 1];
+    size_t len;
+    uint32_t pos;  // Current match in the newest level
+} search;
+
+static int text_contains(const char* text, const char* query, size_t len) {
+    for (; *text; text++) {
+        size_t i = 0;
+        while (i < len && text[i] == query[i])
+            i++;
+        if (i == len)
+            return 1;
+    }
+    return 0;
+}
+
+static const char* search_current(void) {
+    if (search.len == 0 || search.pos >= search.count[search.len])
+        return NULL;
+    return history_get(search.matches[search.len][search.pos]);
+}
+
+void history_search_begin(void) {
+    uint32_t live = 0;
+    for (uint32_t s = history_begin(); s < hist->next_seq; s++)
+        if (hist->ring[s & HISTORY_MASK])
+            live++;
+
+    search.len = 0;
+    search.pos = 0;
+    search.query[0] = '\0';
+    search.count[0] = 0;
+    search.matches[0] = live ? kmalloc(live * sizeof(uint32_t)) : NULL;
+    if (!search.matches[0])
+        return;
+    for (uint32_t s = hist->next_seq; s > history_begin();) {
+        s--;
+        if (hist->ring[s & HISTORY_MASK])
+            search.matches[0][search.count[0]++] = s;
+    }
+}
+
+const char* history_search_push(char c) {
+    if (search.len == HISTORY_QUERY_MAX)
+        return search_current();
+
+    uint32_t prev = search.count[search.len];
+    uint32_t* list = prev ? kmalloc(prev * sizeof(uint32_t)) : NULL;
+    if (prev && !list)
+        return search_current();
+
+    search.query[search.len] = c;
+    search.query[search.len + 1] = '\0';
+    // Only entries that matched the shorter query can match this one
+    uint32_t count = 0;
+    for (uint32_t i = 0; i < prev; i++) {
+        uint32_t seq = search.matches[search.len][i];
+        if (text_contains(history_get(seq), search.query, search.len + 1))
+            list[count++] = seq;
+    }
+    search.len++;
+    search.matches[search.len] = list;
+    search.count[search.len] = count;
+    search.pos = 0;
+    return search_current();
+}
+
+const char* history_search_pop(void) {
+    if (search.len > 0) {
+        kfree(search.matches[search.len]);
+        search.len--;
+        search.query[search.len] = '\0';
+        search.pos = 0;
+    }
+    return search_current();
+}
+
+const char* history_search_next(void) {
+    if (search.pos + 1 < search.count[search.len])
+        search.pos++;
+    return search_current();
+}
+
+const char* history_search_query(void) {
+    return search.query;
+}
+
+void history_search_end(void) {
+    for (size_t level = 0; level <= search.len; level++)
+        kfree(search.matches[level]);
+    search.len = 0;
+    search.query[0] = '\0';
+}
+
+/* Benchmarks and the self-test, they run on a private history */
+static struct history* saved_history;
+
+static int private_history_setup(void) {
+    struct history* h = kmalloc(sizeof(*h));
+    if (!h)
+        return -1;
+    memset(h, 0, sizeof(*h));
+    saved_history = hist;
+    hist = h;
+    return 0;
+}
+
+static void private_history_teardown(void) {
+    for (uint32_t s = history_begin(); s < hist->next_seq; s++)
+        if (hist->ring[s & HISTORY_MASK])
+            remove_entry(hist->ring[s & HISTORY_MASK]);
+    kfree(hist);
+    hist = saved_history;
+}
+
+// Distinct commands, once the ring is full every insert also evicts
+static void bench_history_add(void) {
+    static uint32_t n = 0;
+    char line[16] = "cmd ";
+    size_t len = 4;
+    for (uint32_t v = n++; v; v /= 10)
+        line[len++] = '0' + v % 10;
+    line[len] = '\0';
+    history_add(line);
+}
+BENCH(history_add, bench_history_add, private_history_setup, private_history_teardown, 2000);
+
+static const char* history_check(void) {
+    history_add("make");
+    history_add("ls");
+    history_add("make test");
+    history_add("make");
+    history_add("make");
+    history_add("");
+
+    uint32_t seq = history_end();
+    static const char* const expect[] = { "make", "make test", "ls" };
+    for (size_t i = 0; i < 3; i++) {
+        if (!history_prev(&seq) || strcmp(history_get(seq), expect[i]) != 0)
+            return "wrong order after re-running a command";
+    }
+    if (history_prev(&seq))
+        return "duplicate kept";
+
+    history_search_begin();
+    const char* match = history_search_push('m');
+    match = history_search_push('a');
+    if (!match || strcmp(match, "make") != 0)
+        return "search: newest match";
+    match = history_search_next();
+    if (!match || strcmp(match, "make test") != 0)
+        return "search: older match";
+    if (history_search_push('x'))
+        return "search: narrowing";
+    match = history_search_pop();
+    if (!match || strcmp(history_search_query(), "ma") != 0)
+        return "search: pop";
+    history_search_end();
+
+    // Fill the ring: the oldest entries are evicted, the newest are kept
+    for (uint32_t i = 0; i < DSH_HISTORY_SIZE + 8; i++)
+        bench_history_add();
+    uint32_t live = 0;
+    for (seq = history_end(); history_prev(&seq);)
+        live++;
+    if (live != DSH_HISTORY_SIZE)
+        return "ring does not hold DSH_HISTORY_SIZE entries";
+    for (uint32_t s = history_end() - DSH_HISTORY_SIZE; s < history_end(); s++)
+        if (!history_get(s))
+            return "hole left after eviction";
+    return NULL;
+}
+
+static const char* history_selftest(void) {
+    if (private_history_setup() != 0)
+        return "out of memory";
+    const char* error = history_check();
+    private_history_teardown();
+    return error;
+}
+SELFTEST(history, history_selftest);
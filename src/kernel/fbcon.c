@@ -0,0 +1,204 @@
+#include <kernel/fbcon.h>
+#include <kernel/vga.h>
+#include <kernel/font.h>
+#include <kernel/multiboot.h>
+#include <kernel/paging.h>
+#include <kernel/pmm.h>
+#include <kernel/klib.h>
+
+#define BYTES_PER_PIXEL 4
+#define CELL_BYTES (FONT_WIDTH * BYTES_PER_PIXEL)  // One glyph row
+#define GLYPH_CACHE_SLOTS 4
+#define CURSOR_FIRST_ROW 14                        // Underline cursor, two rows
+#define CURSOR_XOR 0x00FFFFFF
+
+static uint8_t* framebuffer;  // Write-combining, never read
+static uint8_t* back;         // RAM copy the cells are drawn into, NULL to draw straight to video memory
+static uint8_t* target;       // back, or framebuffer without one
+static uint32_t pitch;        // Bytes per pixel line, the same in both
+static size_t cols, rows;
+
+// VGA's 16 colours in the framebuffer's pixel format
+static uint32_t palette[16];
+
+static size_t cursor_x, cursor_y;
+static int cursor_shown = 0;
+
+// Cell span of each text row that differs between back and framebuffer
+static uint16_t dirty_start[TERMINAL_MAX_HEIGHT];
+static uint16_t dirty_end[TERMINAL_MAX_HEIGHT];  // 0 = clean
+
+/*
+ * Glyph rows expanded to pixels for one colour pair: rows[bits] is the
+ * 8-pixel line for a font byte, so a cell is 16 copies of 32 bytes. The
+ * few pairs on screen at a time get a slot each, a new pair refills the
+ * oldest slot.
+ */
+struct glyph_cache {
+    int attr;  // Colour pair (VGA attribute), -1 for an empty slot
+    uint32_t rows[256][FONT_WIDTH];
+};
+
+static struct glyph_cache glyph_cache[GLYPH_CACHE_SLOTS];
+static unsigned int cache_victim = 0;
+
+static const struct glyph_cache* glyph_cache_get(uint8_t attr) {
+    for (int i = 0; i < GLYPH_CACHE_SLOTS; i++)
+        if (glyph_cache[i].attr == attr)
+            return &glyph_cache[i];
+
+    struct glyph_cache* slot = &glyph_cache[cache_victim];
+    cache_victim = (cache_victim + 1) % GLYPH_CACHE_SLOTS;
+    uint32_t fg = palette[attr & 0x0F], bg = palette[attr >> 4];
+    for (int bits = 0; bits < 256; bits++)
+        for (int px = 0; px < FONT_WIDTH; px++)
+            slot->rows[bits][px] = (bits & (0x80 >> px)) ? fg : bg;
+    slot->attr = attr;
+    return slot;
+}
+
+static inline uint8_t* cell_address(size_t x, size_t y) {
+    return target + y * FONT_HEIGHT * pitch + x * CELL_BYTES;
+}
+
+static inline void mark_dirty(size_t x, size_t y) {
+    if (dirty_end[y] == 0) {
+        dirty_start[y] = x;
+        dirty_end[y] = x + 1;
+        return;
+    }
+    if (x < dirty_start[y])
+        dirty_start[y] = x;
+    if (x + 1 > dirty_end[y])
+        dirty_end[y] = x + 1;
+}
+
+// XOR is its own inverse: the same call draws and erases the cursor
+static void cursor_toggle(size_t x, size_t y) {
+    uint8_t* line = cell_address(x, y) + CURSOR_FIRST_ROW * pitch;
+    for (int r = CURSOR_FIRST_ROW; r < FONT_HEIGHT; r++, line += pitch) {
+        uint32_t* px = (uint32_t*)line;
+        for (int i = 0; i < FONT_WIDTH; i++)
+            px[i] ^= CURSOR_XOR;
+    }
+    mark_dirty(x, y);
+}
+
+static void fbcon_draw(size_t x, size_t y, uint16_t entry) {
+    const uint32_t (*expanded)[FONT_WIDTH] = glyph_cache_get(entry >> 8)->rows;
+    const uint8_t* glyph = font_glyph(entry & 0xFF);
+    uint8_t* line = cell_address(x, y);
+
+    for (int r = 0; r < FONT_HEIGHT; r++, line += pitch) {
+        const uint32_t* src = expanded[glyph[r]];
+        uint32_t* dst = (uint32_t*)line;
+        for (int i = 0; i < FONT_WIDTH; i++)
+            dst[i] = src[i];
+    }
+    mark_dirty(x, y);
+    // The cell under the cursor was just overwritten, put the cursor back
+    if (cursor_shown && x == cursor_x && y == cursor_y)
+        cursor_toggle(x, y);
+}
+
+static void fbcon_cursor(size_t x, size_t y) {
+    if (x >= cols || y >= rows)
+        return;
+    if (cursor_shown)
+        cursor_toggle(cursor_x, cursor_y);
+    cursor_x = x;
+    cursor_y = y;
+    cursor_toggle(x, y);
+    cursor_shown = 1;
+}
+
+// Only with a back buffer: moving pixels in RAM is one memmove, in video
+// memory it would mean reading it back
+static void fbcon_scroll(size_t lines) {
+    if (cursor_shown) {
+        cursor_toggle(cursor_x, cursor_y);
+        cursor_shown = 0;
+    }
+    size_t shift = lines * FONT_HEIGHT * pitch;
+    memmove(back, back + shift, (rows - lines) * FONT_HEIGHT * pitch);
+    for (size_t y = 0; y < rows; y++) {
+        dirty_start[y] = 0;
+        dirty_end[y] = cols;
+    }
+}
+
+// Copy the dirty spans of the back buffer to the framebuffer
+static void fbcon_present(void) {
+    for (size_t y = 0; y < rows; y++) {
+        if (dirty_end[y] == 0)
+            continue;
+        size_t offset = y * FONT_HEIGHT * pitch + dirty_start[y] * CELL_BYTES;
+        size_t bytes = (dirty_end[y] - dirty_start[y]) * CELL_BYTES;
+        for (int r = 0; r < FONT_HEIGHT; r++, offset += pitch)
+            memcpy(framebuffer + offset, back + offset, bytes);
+        dirty_end[y] = 0;
+    }
+}
+
+static const struct terminal_backend fbcon_backend = {
+    .name = "framebuffer",
+    .draw = fbcon_draw,
+    .cursor = fbcon_cursor,
+    .scroll = fbcon_scroll,
+    .present = fbcon_present,
+};
+
+// No memory for a back buffer: draw into video memory, scrolling redraws
+static const struct terminal_backend fbcon_direct_backend = {
+    .name = "framebuffer-direct",
+    .draw = fbcon_draw,
+    .cursor = fbcon_cursor,
+};
+
+static uint32_t pack_color(const struct multiboot_tag_framebuffer* fb, uint32_t rgb) {
+    uint32_t r = (rgb >> 16) & 0xFF, g = (rgb >> 8) & 0xFF, b = rgb & 0xFF;
+    return (r >> (8 - fb->red_size)) << fb->red_position |
+           (g >> (8 - fb->green_size)) << fb->green_position |
+           (b >> (8 - fb->blue_size)) << fb->blue_position;
+}
+
+int fbcon_init(void) {
+    static const uint32_t vga_rgb[16] = {
+        0x000000, 0x0000AA, 0x00AA00, 0x00AAAA, 0xAA0000, 0xAA00AA, 0xAA5500, 0xAAAAAA,
+        0x555555, 0x5555FF, 0x55FF55, 0x55FFFF, 0xFF5555, 0xFF55FF, 0xFFFF55, 0xFFFFFF,
+    };
+    const struct multiboot_tag_framebuffer* fb =
+        (const struct multiboot_tag_framebuffer*)multiboot_find_tag(MULTIBOOT_TAG_FRAMEBUFFER, NULL);
+
+    // GRUB reports VGA text mode with this tag too (EGA text type)
+    if (!fb || fb->fb_type != MULTIBOOT_FRAMEBUFFER_TYPE_RGB || fb->bpp != 32 || fb->addr >> 32 ||
+        fb->width < FONT_WIDTH || fb->height < FONT_HEIGHT || fb->red_size > 8 ||
+        fb->green_size > 8 || fb->blue_size > 8)
+        return 0;
+
+    framebuffer = (uint8_t*)(uintptr_t)fb->addr;
+    pitch = fb->pitch;
+    cols = fb->width / FONT_WIDTH;
+    rows = fb->height / FONT_HEIGHT;
+    if (cols > TERMINAL_MAX_WIDTH)
+        cols = TERMINAL_MAX_WIDTH;
+    if (rows > TERMINAL_MAX_HEIGHT)
+        rows = TERMINAL_MAX_HEIGHT;
+    for (int i = 0; i < 16; i++)
+        palette[i] = pack_color(fb, vga_rgb[i]);
+    for (int i = 0; i < GLYPH_CACHE_SLOTS; i++)
+        glyph_cache[i].attr = -1;
+
+    size_t size = (size_t)pitch * fb->height;
+    paging_set_cache((uintptr_t)framebuffer, size, PAGE_CACHE_WC);
+    back = (uint8_t*)pmm_alloc(pmm_order_for(size));  // 0 above 4 MiB
+    target = back ? back : framebuffer;
+
+    // Black is 0 in any RGB layout; this also clears the margin the cells
+    // do not cover
+    memset(framebuffer, 0, size);
+    if (back)
+        memset(back, 0, size);
+    terminal_set_backend(back ? &fbcon_backend : &fbcon_direct_backend, cols, rows);
+    return 1;
+}
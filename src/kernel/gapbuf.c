@@ -0,0 +1,159 @@
+#include <kernel/gapbuf.h>
+#include <kernel/slab.h>
+#include <kernel/klib.h>
+#include <kernel/selftest.h>
+
+int gap_buffer_init(struct gap_buffer* gb, size_t size) {
+    gb->data = kmalloc(size);
+    if (!gb->data)
+        return 0;
+    gb->size = size;
+    gb->gap_start = 0;
+    gb->gap_end = size;
+    return 1;
+}
+
+void gap_buffer_release(struct gap_buffer* gb) {
+    kfree(gb->data);
+    gb->data = NULL;
+    gb->size = gb->gap_start = gb->gap_end = 0;
+}
+
+// Make the gap hold at least need bytes plus one, which gap_buffer_text()
+// uses for the terminating NUL
+static int gap_buffer_reserve(struct gap_buffer* gb, size_t need) {
+    if (gb->gap_end - gb->gap_start > need)
+        return 1;
+
+    size_t tail = gb->size - gb->gap_end;
+    size_t size = gb->size ? gb->size : 16;
+    while (size - gap_buffer_length(gb) <= need)
+        size *= 2;
+
+    char* data = kmalloc(size);
+    if (!data)
+        return 0;
+    memcpy(data, gb->data, gb->gap_start);
+    memcpy(data + size - tail, gb->data + gb->gap_end, tail);
+    kfree(gb->data);
+    gb->data = data;
+    gb->gap_end = size - tail;
+    gb->size = size;
+    return 1;
+}
+
+int gap_buffer_insert(struct gap_buffer* gb, const char* text, size_t len) {
+    if (!gap_buffer_reserve(gb, len))
+        return 0;
+    memcpy(gb->data + gb->gap_start, text, len);
+    gb->gap_start += len;
+    return 1;
+}
+
+void gap_buffer_delete_before(struct gap_buffer* gb, size_t count) {
+    gb->gap_start -= count < gb->gap_start ? count : gb->gap_start;
+}
+
+void gap_buffer_truncate(struct gap_buffer* gb) {
+    gb->gap_end = gb->size;
+}
+
+void gap_buffer_move(struct gap_buffer* gb, size_t pos) {
+    size_t len = gap_buffer_length(gb);
+    if (pos > len)
+        pos = len;
+    if (pos < gb->gap_start) {
+        size_t n = gb->gap_start - pos;
+        memmove(gb->data + gb->gap_end - n, gb->data + pos, n);
+        gb->gap_start -= n;
+        gb->gap_end -= n;
+    } else if (pos > gb->gap_start) {
+        size_t n = pos - gb->gap_start;
+        memmove(gb->data + gb->gap_start, gb->data + gb->gap_end, n);
+        gb->gap_start += n;
+        gb->gap_end += n;
+    }
+}
+
+void gap_buffer_clear(struct gap_buffer* gb) {
+    gb->gap_start = 0;
+    gb->gap_end = gb->size;
+}
+
+const char* gap_buffer_text(struct gap_buffer* gb) {
+    gap_buffer_move(gb, gap_buffer_length(gb));
+    if (!gap_buffer_reserve(gb, 0))
+        return "";
+    gb->data[gb->gap_start] = '\0';
+    return gb->data;
+}
+
+/* Self-test, see selftest.h: random edits against a flat copy of the text */
+#define GAPBUF_TEST_OPS 4000
+#define GAPBUF_TEST_MAX 300
+
+static const char* gap_buffer_selftest(void) {
+    static char ref[GAPBUF_TEST_MAX];
+    size_t len = 0, cursor = 0;
+    uint32_t seed = 12345;
+    struct gap_buffer gb;
+    const char* error = NULL;
+
+    if (!gap_buffer_init(&gb, 4))
+        return "out of memory";
+    for (int op = 0; op < GAPBUF_TEST_OPS && !error; op++) {
+        seed = seed * 1103515245 + 12345;
+        uint32_t r = seed >> 16;
+        size_t n = r % 4;
+        switch ((r >> 8) % 5) {
+        case 0:
+        case 1:
+            if (len + n > GAPBUF_TEST_MAX)
+                break;
+            char text[4] = { 'a' + r % 26, 'b', 'c', 'd' };
+            if (!gap_buffer_insert(&gb, text, n)) {
+                error = "out of memory";
+                break;
+            }
+            memmove(ref + cursor + n, ref + cursor, len - cursor);
+            memcpy(ref + cursor, text, n);
+            cursor += n;
+            len += n;
+            break;
+        case 2:
+            gap_buffer_delete_before(&gb, n);
+            if (n > cursor)
+                n = cursor;
+            memmove(ref + cursor - n, ref + cursor, len - cursor);
+            cursor -= n;
+            len -= n;
+            break;
+        case 3:
+            cursor = r % (len + 4);
+            gap_buffer_move(&gb, cursor);
+            if (cursor > len)
+                cursor = len;
+            break;
+        default:
+            if (r & 1) {
+                gap_buffer_truncate(&gb);
+                len = cursor;
+            } else if (memcmp(gap_buffer_text(&gb), ref, len) != 0 || gb.data[len] != '\0') {
+                error = "gap_buffer_text() differs";
+            } else {
+                cursor = len;
+            }
+            break;
+        }
+        if (gap_buffer_length(&gb) != len || gb.gap_start != cursor) {
+            error = "length or cursor differs";
+            break;
+        }
+        for (size_t i = 0; i < len && !error; i++)
+            if (gap_buffer_at(&gb, i) != ref[i])
+                error = "text differs";
+    }
+    gap_buffer_release(&gb);
+    return error;
+}
+SELFTEST(gapbuf, gap_buffer_selftest);
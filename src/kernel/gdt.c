@@ -0,0 +1,48 @@
+#include <kernel/gdt.h>
+#include <kernel/smp.h>
+#include <kernel/cpu.h>
+
+#define GDT_CPU_FIRST 3 // One gs segment per CPU after the flat ones
+#define GDT_ENTRIES (GDT_CPU_FIRST + SMP_MAX_CPUS)
+
+static struct gdt_entry gdt[GDT_ENTRIES];
+static struct gdt_ptr gdt_pointer;
+
+static void gdt_set_entry(int i, uint32_t base, uint32_t limit, uint8_t access, uint8_t gran) {
+    gdt[i].base_low = base & 0xFFFF;
+    gdt[i].base_mid = (base >> 16) & 0xFF;
+    gdt[i].base_high = (base >> 24) & 0xFF;
+    gdt[i].limit_low = limit & 0xFFFF;
+    gdt[i].granularity = ((limit >> 16) & 0x0F) | (gran & 0xF0);
+    gdt[i].access = access;
+}
+
+void gdt_init(void) {
+    gdt_set_entry(0, 0, 0, 0, 0);                // Null descriptor
+#ifdef __x86_64__
+    gdt_set_entry(1, 0, 0xFFFFFFFF, 0x9A, 0xAF); // Kernel code, 64-bit (L set, D clear)
+#else
+    gdt_set_entry(1, 0, 0xFFFFFFFF, 0x9A, 0xCF); // Kernel code, 4 GiB flat
+#endif
+    gdt_set_entry(2, 0, 0xFFFFFFFF, 0x92, 0xCF); // Kernel data, 4 GiB flat
+
+    gdt_pointer.limit = sizeof(gdt) - 1;
+    gdt_pointer.base = (uintptr_t)&gdt;
+    gdt_flush(&gdt_pointer);
+}
+
+void gdt_init_ap(void) {
+    gdt_flush(&gdt_pointer);
+}
+
+void gdt_load_cpu_segment(uint32_t cpu, const void* base, uint32_t size) {
+#ifdef __x86_64__
+    (void)cpu;
+    (void)size;
+    wrmsr(MSR_GS_BASE, (uintptr_t)base); // gdt_flush() leaves gs alone, loading it would reset the base
+#else
+    uint16_t selector = (GDT_CPU_FIRST + cpu) * sizeof(struct gdt_entry);
+    gdt_set_entry(GDT_CPU_FIRST + cpu, (uint32_t)base, size - 1, 0x92, 0x40); // Data, byte granular
+    __asm__ volatile ("mov %0, %%gs" : : "r"(selector) : "memory");
+#endif
+}
@@ -0,0 +1,124 @@
+#include <kernel/idt.h>
+#include <kernel/gdt.h>
+#include <kernel/pic.h>
+#include <kernel/apic.h>
+#include <kernel/vga.h>
+#include <kernel/cpu.h>
+#include <kernel/sched.h>
+
+#define IDT_INTERRUPT_GATE 0x8E // Present, ring 0, 32-bit (64-bit in long mode) interrupt gate
+
+static struct idt_entry idt[IDT_ENTRIES];
+static struct idt_ptr idt_pointer;
+static interrupt_handler_t handlers[IDT_ENTRIES];
+
+static const char* exception_names[32] = {
+    "Divide error", "Debug", "NMI", "Breakpoint",
+    "Overflow", "Bound range exceeded", "Invalid opcode", "Device not available",
+    "Double fault", "Coprocessor segment overrun", "Invalid TSS", "Segment not present",
+    "Stack fault", "General protection fault", "Page fault", "Reserved",
+    "x87 FPU error", "Alignment check", "Machine check", "SIMD exception",
+    "Virtualization exception", "Control protection", "Reserved", "Reserved",
+    "Reserved", "Reserved", "Reserved", "Reserved",
+    "Hypervisor injection", "VMM communication", "Security exception", "Reserved",
+};
+
+static void idt_set_gate(uint8_t vector, uintptr_t base) {
+    idt[vector].base_low = base & 0xFFFF;
+    idt[vector].base_high = (base >> 16) & 0xFFFF;
+#ifdef __x86_64__
+    idt[vector].base_upper = base >> 32;
+#endif
+    idt[vector].selector = GDT_KERNEL_CODE;
+    idt[vector].zero = 0;
+    idt[vector].flags = IDT_INTERRUPT_GATE;
+}
+
+static void exception_panic(struct interrupt_frame* frame) {
+    terminal_setcolor(vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_RED));
+    terminal_write("\nKERNEL PANIC: ");
+    terminal_write(exception_names[frame->int_no]);
+    terminal_write("\nerr=");
+    terminal_write_hex(frame->err_code);
+#ifdef __x86_64__
+    terminal_write(" rip=");
+#else
+    terminal_write(" eip=");
+#endif
+    terminal_write_ptr(interrupt_frame_ip(frame));
+    terminal_write(" eflags=");
+    terminal_write_hex(interrupt_frame_flags(frame));
+    if (frame->int_no == 14) {
+        terminal_write(" addr=");
+        terminal_write_ptr(read_cr2());
+    }
+    terminal_write("\n");
+    terminal_flush(); // We may have interrupted a batched write
+    while (1) {
+        __asm__ volatile("cli; hlt");
+    }
+}
+
+void idt_init(void) {
+    for (int i = 0; i < IDT_ENTRIES; i++)
+        idt_set_gate(i, isr_stub_table[i]);
+
+    idt_pointer.limit = sizeof(idt) - 1;
+    idt_pointer.base = (uintptr_t)&idt;
+    idt_load(&idt_pointer);
+
+    pic_remap();
+}
+
+void idt_init_ap(void) {
+    idt_load(&idt_pointer);
+}
+
+void idt_set_handler(uint8_t vector, interrupt_handler_t handler) {
+    handlers[vector] = handler;
+}
+
+void irq_register_handler(uint8_t irq, interrupt_handler_t handler) {
+    idt_set_handler(IRQ_BASE + irq, handler);
+    if (apic_enabled())
+        ioapic_unmask_irq(irq);
+    else
+        pic_unmask_irq(irq);
+}
+
+// Called from isr_common with interrupts disabled
+void isr_dispatch(struct interrupt_frame* frame) {
+    uint32_t vector = frame->int_no;
+
+    if (vector < IRQ_BASE) {
+        if (handlers[vector])
+            handlers[vector](frame);
+        else
+            exception_panic(frame);
+        return;
+    }
+
+    if (vector < IRQ_BASE + 16) {
+        uint8_t irq = vector - IRQ_BASE;
+        if (!apic_enabled() && pic_is_spurious(irq))
+            return;
+        if (handlers[vector])
+            handlers[vector](frame);
+        if (apic_enabled())
+            lapic_eoi();
+        else
+            pic_send_eoi(irq);
+        // The handler may have woken a thread or ended a time slice. We
+        // come back here when this thread is picked again and iret as usual.
+        sched_preempt();
+        return;
+    }
+
+    if (handlers[vector])
+        handlers[vector](frame);
+    // Local APIC timer and IPIs, the spurious vector must not be acknowledged
+    if (vector >= APIC_TIMER_VECTOR && vector != APIC_SPURIOUS_VECTOR && apic_enabled()) {
+        lapic_eoi();
+        sched_preempt();
+    }
+}
@@ -0,0 +1,387 @@
+#include <kernel/initrd.h>
+#include <kernel/multiboot.h>
+#include <kernel/slab.h>
+#include <kernel/klib.h>
+#include <kernel/vga.h>
+#include <kernel/selftest.h>
+#include <kernel/bench.h>
+
+/* ustar header, one 512-byte block before each member's data */
+#define TAR_BLOCK 512
+#define TAR_NAME 0
+#define TAR_NAME_LEN 100
+#define TAR_MODE 100
+#define TAR_SIZE 124
+#define TAR_MTIME 136
+#define TAR_CHECKSUM 148
+#define TAR_TYPE 156
+#define TAR_MAGIC 257
+#define TAR_PREFIX 345
+#define TAR_PREFIX_LEN 155
+
+#define TAR_TYPE_FILE '0'
+#define TAR_TYPE_FILE_OLD '\0'
+#define TAR_TYPE_DIR '5'
+
+static struct initrd_index initrd;
+static int initrd_loaded = 0;
+
+static uint32_t parse_octal(const uint8_t* field, size_t len) {
+    uint32_t value = 0;
+    size_t i = 0;
+    while (i < len && field[i] == ' ')
+        i++;
+    for (; i < len && field[i] >= '0' && field[i] <= '7'; i++)
+        value = value * 8 + (field[i] - '0');
+    return value;
+}
+
+static size_t field_len(const uint8_t* field, size_t max) {
+    size_t n = 0;
+    while (n < max && field[n])
+        n++;
+    return n;
+}
+
+// The checksum counts its own field as spaces
+static int header_valid(const uint8_t* h) {
+    uint32_t sum = 0;
+    for (int i = 0; i < TAR_BLOCK; i++)
+        sum += (i >= TAR_CHECKSUM && i < TAR_CHECKSUM + 8) ? ' ' : h[i];
+    return memcmp(h + TAR_MAGIC, "ustar", 5) == 0 && sum == parse_octal(h + TAR_CHECKSUM, 8);
+}
+
+static int header_is_end(const uint8_t* h) {
+    for (int i = 0; i < TAR_BLOCK; i++) {
+        if (h[i])
+            return 0;
+    }
+    return 1;
+}
+
+// FNV-1a
+static uint32_t path_hash(const char* path, size_t len) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (uint8_t)path[i];
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Drop leading "./" and '/' and trailing '/'
+static const char* normalize(const char* path, size_t* len) {
+    while (*len) {
+        if (path[0] == '/') {
+            path++;
+            (*len)--;
+        } else if (path[0] == '.' && (*len == 1 || path[1] == '/')) {
+            path++;
+            (*len)--;
+        } else {
+            break;
+        }
+    }
+    while (*len && path[*len - 1] == '/')
+        (*len)--;
+    return path;
+}
+
+static int32_t index_find(const struct initrd_index* index, const char* path, size_t len, uint32_t hash) {
+    for (uint32_t slot = hash & index->table_mask; ; slot = (slot + 1) & index->table_mask) {
+        int32_t i = index->table[slot];
+        if (i < 0)
+            return -1;
+        const struct initrd_file* f = &index->files[i];
+        if (f->hash == hash && f->path_len == len && memcmp(f->path, path, len) == 0)
+            return i;
+    }
+}
+
+// Append an entry under its parent directory, adding the directories
+// above it that the archive left out. path is already normalized.
+static int32_t index_add(struct initrd_index* index, const char* path, size_t len, uint32_t type) {
+    uint32_t hash = path_hash(path, len);
+    int32_t existing = index_find(index, path, len, hash);
+    if (existing >= 0)
+        return existing; // A later copy in the archive overrides, the caller fills it in
+
+    size_t parent_len = len;
+    while (parent_len && path[parent_len - 1] != '/')
+        parent_len--;
+    int32_t parent = 0;
+    if (parent_len) {
+        parent = index_add(index, path, parent_len - 1, INITRD_DIR);
+        if (parent < 0)
+            return -1;
+    }
+    if (index->count == index->capacity || index->files[parent].type != INITRD_DIR)
+        return -1;
+
+    int32_t i = (int32_t)index->count++;
+    struct initrd_file* f = &index->files[i];
+    memset(f, 0, sizeof(*f));
+    f->path = path;
+    f->path_len = (uint32_t)len;
+    f->type = type;
+    f->mode = type == INITRD_DIR ? 0755 : 0644;
+    f->hash = hash;
+    f->parent = parent;
+    f->first_child = -1;
+    f->last_child = -1;
+    f->next_sibling = -1;
+
+    struct initrd_file* dir = &index->files[parent];
+    if (dir->last_child >= 0)
+        index->files[dir->last_child].next_sibling = i;
+    else
+        dir->first_child = i;
+    dir->last_child = i;
+
+    uint32_t slot = hash & index->table_mask;
+    while (index->table[slot] >= 0)
+        slot = (slot + 1) & index->table_mask;
+    index->table[slot] = i;
+    return i;
+}
+
+int initrd_index_build(struct initrd_index* index, const void* archive, size_t size) {
+    const uint8_t* base = archive;
+    uint32_t members = 0, slashes = 0, names_size = 0;
+    size_t offset;
+
+    // First pass: how much room the index needs
+    memset(index, 0, sizeof(*index));
+    for (offset = 0; offset + TAR_BLOCK <= size; ) {
+        const uint8_t* h = base + offset;
+        if (header_is_end(h))
+            break;
+        if (!header_valid(h))
+            return 0;
+        size_t name_len = field_len(h + TAR_NAME, TAR_NAME_LEN);
+        size_t prefix_len = field_len(h + TAR_PREFIX, TAR_PREFIX_LEN);
+        for (size_t i = 0; i < name_len; i++)
+            slashes += h[TAR_NAME + i] == '/';
+        for (size_t i = 0; i < prefix_len; i++)
+            slashes += h[TAR_PREFIX + i] == '/';
+        if (prefix_len) {
+            names_size += prefix_len + 1 + name_len;
+            slashes++;
+        }
+        members++;
+        offset += TAR_BLOCK + ((parse_octal(h + TAR_SIZE, 12) + TAR_BLOCK - 1) & ~(TAR_BLOCK - 1));
+    }
+    if (offset > size)
+        return 0; // Last member cut short
+
+    uint32_t table_size = 1;
+    index->capacity = 1 + members + slashes;
+    while (table_size < 2 * index->capacity)
+        table_size <<= 1;
+    index->files = kmalloc(index->capacity * sizeof(struct initrd_file));
+    index->table = kmalloc(table_size * sizeof(int32_t));
+    index->names = names_size ? kmalloc(names_size) : NULL;
+    if (!index->files || !index->table || (names_size && !index->names)) {
+        initrd_index_free(index);
+        return 0;
+    }
+    memset(index->table, 0xFF, table_size * sizeof(int32_t));
+    index->table_mask = table_size - 1;
+    index->archive_size = (uint32_t)offset;
+
+    // The root
+    struct initrd_file* root = &index->files[index->count++];
+    memset(root, 0, sizeof(*root));
+    root->path = "";
+    root->type = INITRD_DIR;
+    root->mode = 0755;
+    root->hash = path_hash("", 0);
+    root->parent = -1;
+    root->first_child = -1;
+    root->last_child = -1;
+    root->next_sibling = -1;
+    index->table[root->hash & index->table_mask] = 0;
+
+    // Second pass: index the members, names point into the headers
+    char* names = index->names;
+    for (offset = 0; offset < index->archive_size; ) {
+        const uint8_t* h = base + offset;
+        uint32_t file_size = parse_octal(h + TAR_SIZE, 12);
+        uint8_t type = h[TAR_TYPE];
+        size_t len = field_len(h + TAR_NAME, TAR_NAME_LEN);
+        size_t prefix_len = field_len(h + TAR_PREFIX, TAR_PREFIX_LEN);
+        const char* path = (const char*)h + TAR_NAME;
+
+        offset += TAR_BLOCK + ((file_size + TAR_BLOCK - 1) & ~(TAR_BLOCK - 1));
+        if (type != TAR_TYPE_FILE && type != TAR_TYPE_FILE_OLD && type != TAR_TYPE_DIR)
+            continue; // Links, devices and extension headers
+        if (prefix_len) {
+            memcpy(names, h + TAR_PREFIX, prefix_len);
+            names[prefix_len] = '/';
+            memcpy(names + prefix_len + 1, path, len);
+            path = names;
+            len += prefix_len + 1;
+            names += len;
+        }
+        path = normalize(path, &len);
+
+        int32_t i = len ? index_add(index, path, len, type == TAR_TYPE_DIR ? INITRD_DIR : INITRD_FILE) : 0;
+        if (i < 0 || (index->files[i].type == INITRD_DIR) != (type == TAR_TYPE_DIR)) {
+            initrd_index_free(index);
+            return 0; // Out of room, or a path that is a file and a directory
+        }
+        struct initrd_file* f = &index->files[i];
+        f->mode = parse_octal(h + TAR_MODE, 8) & 07777;
+        f->mtime = parse_octal(h + TAR_MTIME, 12);
+        if (f->type == INITRD_FILE) {
+            f->data = h + TAR_BLOCK;
+            f->size = file_size;
+        }
+    }
+    return 1;
+}
+
+void initrd_index_free(struct initrd_index* index) {
+    if (index->files)
+        kfree(index->files);
+    if (index->table)
+        kfree(index->table);
+    if (index->names)
+        kfree(index->names);
+    memset(index, 0, sizeof(*index));
+}
+
+const struct initrd_file* initrd_index_lookup(const struct initrd_index* index, const char* path, size_t len) {
+    if (!index->files)
+        return NULL;
+    path = normalize(path, &len);
+    int32_t i = index_find(index, path, len, path_hash(path, len));
+    return i < 0 ? NULL : &index->files[i];
+}
+
+void initrd_init(void) {
+    const struct multiboot_tag_module* module = NULL;
+    for (const struct multiboot_tag* tag = multiboot_find_tag(MULTIBOOT_TAG_MODULE, NULL); tag;
+         tag = multiboot_find_tag(MULTIBOOT_TAG_MODULE, tag)) {
+        const struct multiboot_tag_module* m = (const struct multiboot_tag_module*)tag;
+        if (!module || strcmp(m->cmdline, "initrd") == 0)
+            module = m;
+    }
+    if (!module)
+        return;
+
+    if (!initrd_index_build(&initrd, (const void*)(uintptr_t)module->mod_start, module->mod_end - module->mod_start)) {
+        terminal_write("initrd: not a ustar archive\n");
+        return;
+    }
+    initrd_loaded = 1;
+    terminal_write("initrd: ");
+    terminal_write_dec(initrd.count - 1);
+    terminal_write(" files and directories, ");
+    terminal_write_dec(initrd.archive_size / 1024);
+    terminal_write(" KiB\n");
+}
+
+const struct initrd_file* initrd_lookup(const char* path) {
+    return initrd_loaded ? initrd_index_lookup(&initrd, path, strlen(path)) : NULL;
+}
+
+void initrd_for_each_child(const struct initrd_file* dir, void (*fn)(const struct initrd_file* file, void* ctx),
+                           void* ctx) {
+    const struct initrd_index* index = &initrd;
+    if (!initrd_loaded || dir < index->files || dir >= index->files + index->count)
+        return;
+    for (int32_t i = dir->first_child; i >= 0; i = index->files[i].next_sibling)
+        fn(&index->files[i], ctx);
+}
+
+const struct initrd_index* initrd_get_index(void) {
+    return initrd_loaded ? &initrd : NULL;
+}
+
+/* Self-test, see selftest.h: a small archive put together here */
+static void tar_header(uint8_t* h, const char* prefix, const char* name, uint32_t size, char type) {
+    memset(h, 0, TAR_BLOCK);
+    strncpy((char*)h + TAR_NAME, name, TAR_NAME_LEN);
+    strncpy((char*)h + TAR_PREFIX, prefix, TAR_PREFIX_LEN);
+    memcpy(h + TAR_MODE, "0000644", 8);
+    memcpy(h + TAR_MTIME, "00000000001", 12);
+    for (int i = 10; i >= 0; i--, size >>= 3)
+        h[TAR_SIZE + i] = '0' + (size & 7);
+    h[TAR_TYPE] = (uint8_t)type;
+    memcpy(h + TAR_MAGIC, "ustar", 6);
+    memcpy(h + TAR_MAGIC + 6, "00", 2);
+
+    uint32_t sum = 0;
+    memset(h + TAR_CHECKSUM, ' ', 8);
+    for (int i = 0; i < TAR_BLOCK; i++)
+        sum += h[i];
+    for (int i = 5; i >= 0; i--, sum >>= 3)
+        h[TAR_CHECKSUM + i] = '0' + (sum & 7);
+    h[TAR_CHECKSUM + 6] = '\0';
+}
+
+static const char* initrd_selftest(void) {
+    static uint8_t archive[9 * TAR_BLOCK];
+    struct initrd_index index;
+    const char* error = NULL;
+
+    // ./etc/ ./etc/motd (600 bytes) deep/er/file (directories implied)
+    // long/prefix + name, then the end
+    memset(archive, 0, sizeof(archive));
+    tar_header(archive, "", "./etc/", 0, TAR_TYPE_DIR);
+    tar_header(archive + TAR_BLOCK, "", "./etc/motd", 600, TAR_TYPE_FILE);
+    memset(archive + 2 * TAR_BLOCK, 'm', 600);
+    tar_header(archive + 4 * TAR_BLOCK, "", "deep/er/file", 1, TAR_TYPE_FILE);
+    archive[5 * TAR_BLOCK] = 'x';
+    tar_header(archive + 6 * TAR_BLOCK, "long/prefix", "name", 0, TAR_TYPE_FILE);
+
+    if (!initrd_index_build(&index, archive, sizeof(archive)))
+        return "archive not indexed";
+
+    const struct initrd_file* motd = initrd_index_lookup(&index, "/etc/motd", 9);
+    const struct initrd_file* deep = initrd_index_lookup(&index, "deep/er/file", 12);
+    const struct initrd_file* implied = initrd_index_lookup(&index, "deep/er/", 8);
+    const struct initrd_file* joined = initrd_index_lookup(&index, "long/prefix/name", 16);
+    const struct initrd_file* root = initrd_index_lookup(&index, "/", 1);
+    if (!motd || motd->size != 600 || motd->data != archive + 2 * TAR_BLOCK)
+        error = "file not a view into the archive";
+    else if (!deep || ((const char*)deep->data)[0] != 'x' || !implied || implied->type != INITRD_DIR)
+        error = "implied directories missing";
+    else if (!joined || joined->size != 0)
+        error = "prefix not joined";
+    else if (!root || root != &index.files[0] || index.files[root->first_child].type != INITRD_DIR)
+        error = "root wrong";
+    else if (initrd_index_lookup(&index, "etc/mot", 7) || initrd_index_lookup(&index, "nothing", 7))
+        error = "lookup found a missing path";
+    else if (&index.files[motd->parent] != initrd_index_lookup(&index, "etc", 3))
+        error = "parent wrong";
+
+    archive[TAR_BLOCK + TAR_NAME] = 'X'; // Checksum no longer matches
+    struct initrd_index broken;
+    if (!error && initrd_index_build(&broken, archive, sizeof(archive))) {
+        initrd_index_free(&broken);
+        error = "bad checksum accepted";
+    }
+    initrd_index_free(&index);
+    return error;
+}
+SELFTEST(initrd, initrd_selftest);
+
+/* Benchmark, see bench.h: lookup of the last file of the loaded initrd */
+static const char* bench_path;
+static size_t bench_path_len;
+static const struct initrd_file* volatile bench_sink;
+
+static int bench_lookup_setup(void) {
+    if (!initrd_loaded || initrd.count < 2)
+        return 1;
+    bench_path = initrd.files[initrd.count - 1].path;
+    bench_path_len = initrd.files[initrd.count - 1].path_len;
+    return 0;
+}
+
+static void bench_lookup(void) {
+    bench_sink = initrd_index_lookup(&initrd, bench_path, bench_path_len);
+}
+BENCH(initrd_lookup, bench_lookup, bench_lookup_setup, NULL, 2000);
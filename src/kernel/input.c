@@ -0,0 +1,69 @@
+#include <kernel/input.h>
+#include <kernel/io.h>
+#include <kernel/timer.h>
+#include <kernel/sched.h>
+#include <kernel/ring.h>
+
+// Must be a power of two. 256 entries is plenty even for pasted input,
+// the reader drains it on every wakeup.
+#define INPUT_QUEUE_SIZE 256
+
+/*
+ * MPSC ring (see ring.h): the serial IRQ and the keyboard's deferred work
+ * push from whichever CPU they run on, the shell is the one reader.
+ */
+static struct mpsc_slot input_slots[INPUT_QUEUE_SIZE];
+static struct mpsc_ring input_queue = MPSC_RING_INIT(input_slots);
+static volatile uint32_t input_overflows = 0;
+static struct wait_queue input_waiters = WAIT_QUEUE_INIT;
+
+void input_push(uint16_t event) {
+    if (!mpsc_push(&input_queue, event)) {
+        atomic_inc(&input_overflows);
+        return;
+    }
+    wait_queue_wake_all(&input_waiters);
+}
+
+int input_read(uint16_t* event) {
+    uintptr_t value;
+    if (!mpsc_pop(&input_queue, &value))
+        return 0;
+    *event = (uint16_t)value;
+    return 1;
+}
+
+int input_pending(void) {
+    return !mpsc_empty(&input_queue);
+}
+
+uint16_t input_wait(void) {
+    uint16_t event;
+    while (!input_read(&event)) {
+        // Re-check under the wait queue lock so an IRQ between the check
+        // and the sleep cannot leave us waiting on a non-empty queue
+        uint32_t flags = wait_queue_lock(&input_waiters);
+        if (mpsc_empty(&input_queue))
+            wait_queue_sleep(&input_waiters, flags, 0);
+        else
+            wait_queue_unlock(&input_waiters, flags);
+    }
+    return event;
+}
+
+int input_wait_until(uint64_t deadline, uint16_t* event) {
+    while (!input_read(event)) {
+        if (deadline && ktime_ns() >= deadline)
+            return 0;
+        uint32_t flags = wait_queue_lock(&input_waiters);
+        if (mpsc_empty(&input_queue))
+            wait_queue_sleep(&input_waiters, flags, deadline);
+        else
+            wait_queue_unlock(&input_waiters, flags);
+    }
+    return 1;
+}
+
+uint32_t input_dropped(void) {
+    return input_overflows;
+}
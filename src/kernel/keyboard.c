@@ -0,0 +1,45 @@
+#include <kernel/keyboard.h>
+#include <kernel/input.h>
+#include <kernel/idt.h>
+#include <kernel/io.h>
+#include <kernel/ring.h>
+#include <kernel/workqueue.h>
+
+#define KBD_DATA_PORT 0x60
+#define KBD_STATUS_PORT 0x64
+
+// Must be a power of two. Scancodes only wait here until the worker runs
+#define KBD_BUFFER_SIZE 64
+
+/*
+ * The IRQ handler only reads the scancode into an SPSC ring (it is the
+ * one producer, the work item the one consumer) and schedules the work
+ * item, which moves the codes on to the input queue and wakes the reader
+ * from thread context.
+ */
+static uintptr_t scancode_slots[KBD_BUFFER_SIZE];
+static struct spsc_ring scancodes = SPSC_RING_INIT(scancode_slots);
+
+static void keyboard_work_func(void* arg) {
+    (void)arg;
+    uintptr_t code;
+    while (spsc_pop(&scancodes, &code))
+        input_push(INPUT_KEYBOARD | code);
+}
+
+static struct work keyboard_work = WORK_INIT(keyboard_work_func, NULL);
+
+static void keyboard_irq(struct interrupt_frame* frame) {
+    (void)frame;
+    // Read it even when the ring is full, or the controller stalls. 64
+    // keys before the worker gets to run means it is stuck anyway.
+    spsc_push(&scancodes, inb(KBD_DATA_PORT));
+    work_schedule(&keyboard_work);
+}
+
+void keyboard_init(void) {
+    // Drop anything the controller buffered before we were ready
+    while (inb(KBD_STATUS_PORT) & 0x01)
+        inb(KBD_DATA_PORT);
+    irq_register_handler(1, keyboard_irq);
+}
@@ -0,0 +1,423 @@
+#include <kernel/keymap.h>
+#include <kernel/input.h>
+#include <kernel/initrd.h>
+#include <kernel/cmdline.h>
+#include <kernel/slab.h>
+#include <kernel/klib.h>
+#include <kernel/vga.h>
+#include <kernel/selftest.h>
+#include <kernel/bench.h>
+
+#define KEYMAP_MAX 8
+#define KEYMAP_NAME_LEN 16
+#define KEYMAP_DIR "/etc/keymaps/"
+
+// Layer index bits
+#define LAYER_SHIFT 1
+#define LAYER_CAPS 2
+#define LAYER_NUM 4
+
+/*
+ * Every layer is worked out when the keymap is loaded, so decoding a key
+ * is one lookup: keys[layer][code]. 4 KiB a keymap.
+ */
+struct keymap {
+    char name[KEYMAP_NAME_LEN];
+    uint16_t keys[KBD_LAYERS][256];
+};
+
+/* The typing keys of a US keyboard, the base every keymap starts from */
+static const uint8_t us_plain[128] = {
+    [0x02] = '1', [0x03] = '2', [0x04] = '3', [0x05] = '4', [0x06] = '5',
+    [0x07] = '6', [0x08] = '7', [0x09] = '8', [0x0A] = '9', [0x0B] = '0',
+    [0x0C] = '-', [0x0D] = '=', [0x0E] = '\b', [0x0F] = '\t',
+    [0x10] = 'q', [0x11] = 'w', [0x12] = 'e', [0x13] = 'r', [0x14] = 't',
+    [0x15] = 'y', [0x16] = 'u', [0x17] = 'i', [0x18] = 'o', [0x19] = 'p',
+    [0x1A] = '[', [0x1B] = ']', [0x1C] = '\n',
+    [0x1E] = 'a', [0x1F] = 's', [0x20] = 'd', [0x21] = 'f', [0x22] = 'g',
+    [0x23] = 'h', [0x24] = 'j', [0x25] = 'k', [0x26] = 'l', [0x27] = ';',
+    [0x28] = '\'', [0x29] = '`', [0x2B] = '\\',
+    [0x2C] = 'z', [0x2D] = 'x', [0x2E] = 'c', [0x2F] = 'v', [0x30] = 'b',
+    [0x31] = 'n', [0x32] = 'm', [0x33] = ',', [0x34] = '.', [0x35] = '/',
+    [0x39] = ' ',
+};
+
+static const uint8_t us_shift[128] = {
+    [0x02] = '!', [0x03] = '@', [0x04] = '#', [0x05] = '$', [0x06] = '%',
+    [0x07] = '^', [0x08] = '&', [0x09] = '*', [0x0A] = '(', [0x0B] = ')',
+    [0x0C] = '_', [0x0D] = '+', [0x0E] = '\b', [0x0F] = '\t',
+    [0x10] = 'Q', [0x11] = 'W', [0x12] = 'E', [0x13] = 'R', [0x14] = 'T',
+    [0x15] = 'Y', [0x16] = 'U', [0x17] = 'I', [0x18] = 'O', [0x19] = 'P',
+    [0x1A] = '{', [0x1B] = '}', [0x1C] = '\n',
+    [0x1E] = 'A', [0x1F] = 'S', [0x20] = 'D', [0x21] = 'F', [0x22] = 'G',
+    [0x23] = 'H', [0x24] = 'J', [0x25] = 'K', [0x26] = 'L', [0x27] = ':',
+    [0x28] = '"', [0x29] = '~', [0x2B] = '|',
+    [0x2C] = 'Z', [0x2D] = 'X', [0x2E] = 'C', [0x2F] = 'V', [0x30] = 'B',
+    [0x31] = 'N', [0x32] = 'M', [0x33] = '<', [0x34] = '>', [0x35] = '?',
+    [0x39] = ' ',
+};
+
+/* The keypad: digits with Num Lock, editing keys without (or with Shift) */
+static const uint16_t keypad_num[128] = {
+    [0x47] = '7', [0x48] = '8', [0x49] = '9', [0x4B] = '4', [0x4C] = '5',
+    [0x4D] = '6', [0x4F] = '1', [0x50] = '2', [0x51] = '3', [0x52] = '0',
+    [0x53] = '.',
+};
+
+static const uint16_t keypad_edit[128] = {
+    [0x47] = KEY_HOME, [0x48] = KEY_UP, [0x49] = KEY_PAGE_UP,
+    [0x4B] = KEY_LEFT, [0x4D] = KEY_RIGHT,
+    [0x4F] = KEY_END, [0x50] = KEY_DOWN, [0x51] = KEY_PAGE_DOWN,
+    [0x52] = KEY_INSERT, [0x53] = KEY_DELETE,
+};
+
+/* Keys after E0, indexed without the KBD_E0 bit */
+static const uint16_t extended_keys[128] = {
+    [0x1C] = '\n', [0x35] = '/',
+    [0x47] = KEY_HOME, [0x48] = KEY_UP, [0x49] = KEY_PAGE_UP,
+    [0x4B] = KEY_LEFT, [0x4D] = KEY_RIGHT,
+    [0x4F] = KEY_END, [0x50] = KEY_DOWN, [0x51] = KEY_PAGE_DOWN,
+    [0x52] = KEY_INSERT, [0x53] = KEY_DELETE,
+};
+
+static const uint8_t modifier_bits[256] = {
+    [0x2A] = KBD_SHIFT_L, [0x36] = KBD_SHIFT_R,
+    [0x1D] = KBD_CTRL_L, [KBD_E0 | 0x1D] = KBD_CTRL_R,
+    [0x38] = KBD_ALT_L, [KBD_E0 | 0x38] = KBD_ALT_R,
+};
+
+static const uint8_t lock_bits[256] = {
+    [0x3A] = KBD_CAPS_LOCK, [0x45] = KBD_NUM_LOCK, [0x46] = KBD_SCROLL_LOCK,
+};
+
+static struct keymap us_keymap = { .name = "us" };
+static struct keymap* keymaps[KEYMAP_MAX] = { &us_keymap };
+static uint32_t keymap_count = 1;
+static const struct keymap* active = &us_keymap;
+
+int kbd_decode(struct kbd_decoder* dec, uint8_t byte, struct kbd_event* ev) {
+    if (dec->skip) {
+        dec->skip--;
+        return 0;
+    }
+    switch (byte) {
+    case 0xE0:
+        dec->prefix = KBD_E0;
+        return 0;
+    case 0xE1:  // Pause: E1 1D 45 E1 9D C5, the second half counts as a new E1
+        dec->skip = 2;
+        return 0;
+    case 0x00: case 0xFA: case 0xFE: case 0xFF:  // Overrun, ACK, resend
+        dec->prefix = 0;
+        return 0;
+    }
+
+    uint8_t code = (byte & 0x7F) | dec->prefix;
+    dec->prefix = 0;
+    // Keyboards send E0 2A/E0 36 around the editing keys so that an old
+    // decoder sees Shift released; the real Shift state has not changed
+    if (code == (KBD_E0 | 0x2A) || code == (KBD_E0 | 0x36))
+        return 0;
+
+    uint32_t bit = 1u << (code & 31);
+    uint32_t* down = &dec->down[code >> 5];
+    ev->code = code;
+    ev->pressed = !(byte & 0x80);
+    ev->repeat = ev->pressed && (*down & bit);
+    if (ev->pressed)
+        *down |= bit;
+    else
+        *down &= ~bit;
+
+    if (modifier_bits[code]) {
+        if (ev->pressed)
+            dec->mods |= modifier_bits[code];
+        else
+            dec->mods &= ~modifier_bits[code];
+    } else if (lock_bits[code] && ev->pressed && !ev->repeat) {
+        dec->locks ^= lock_bits[code];
+    } else {
+        return 1;
+    }
+    // Only worked out when a modifier changes, kbd_key() just indexes
+    dec->layer = ((dec->mods & KBD_SHIFT) ? LAYER_SHIFT : 0) | ((dec->locks & KBD_CAPS_LOCK) ? LAYER_CAPS : 0)
+                 | ((dec->locks & KBD_NUM_LOCK) ? LAYER_NUM : 0);
+    return 1;
+}
+
+static int keymap_key(const struct keymap* map, const struct kbd_decoder* dec, uint8_t code) {
+    // Shortcuts stay where they are on any layout
+    if (dec->mods & KBD_CTRL) {
+        int c = us_keymap.keys[0][code];
+        if (c >= 'a' && c <= 'z')
+            return c & 0x1F;
+    }
+    return map->keys[dec->layer][code];
+}
+
+int kbd_key(const struct kbd_decoder* dec, uint8_t code) {
+    return keymap_key(active, dec, code);
+}
+
+static int is_letter(uint8_t plain, uint8_t shifted) {
+    if (plain == shifted)
+        return 0;
+    return (plain >= 'a' && plain <= 'z') || plain >= 0x80;
+}
+
+// Fill in every layer from the typing keys
+static void keymap_build(struct keymap* map, const uint8_t* plain, const uint8_t* shifted) {
+    for (uint32_t layer = 0; layer < KBD_LAYERS; layer++) {
+        uint16_t* keys = map->keys[layer];
+        int shift = (layer & LAYER_SHIFT) != 0;
+        int caps = (layer & LAYER_CAPS) != 0;
+        for (uint32_t code = 0; code < 128; code++) {
+            if (keypad_num[code] || keypad_edit[code])
+                keys[code] = ((layer & LAYER_NUM) && !shift) ? keypad_num[code] : keypad_edit[code];
+            else if (shift ^ (caps && is_letter(plain[code], shifted[code])))
+                keys[code] = shifted[code];
+            else
+                keys[code] = plain[code];
+            keys[KBD_E0 | code] = extended_keys[code];
+        }
+        keys[0x37] = '*';
+        keys[0x4A] = '-';
+        keys[0x4E] = '+';
+    }
+}
+
+// A character or a number, NULL if the field is neither
+static const char* parse_key(const char* p, const char* end, uint32_t* value) {
+    const char* start = p;
+    while (p < end && *p != ' ' && *p != '\t' && *p != '\r')
+        p++;
+    if (p - start == 1) {
+        *value = (uint8_t)*start;
+        return p;
+    }
+    uint32_t base = 10;
+    if (p - start > 2 && start[0] == '0' && (start[1] == 'x' || start[1] == 'X')) {
+        base = 16;
+        start += 2;
+    }
+    if (start == p)
+        return NULL;
+    *value = 0;
+    for (const char* q = start; q < p; q++) {
+        uint32_t digit;
+        if (*q >= '0' && *q <= '9')
+            digit = *q - '0';
+        else if (base == 16 && *q >= 'a' && *q <= 'f')
+            digit = *q - 'a' + 10;
+        else if (base == 16 && *q >= 'A' && *q <= 'F')
+            digit = *q - 'A' + 10;
+        else
+            return NULL;
+        *value = *value * base + digit;
+        if (*value > 0xFF)
+            return NULL;
+    }
+    return p;
+}
+
+static const char* skip_blanks(const char* p, const char* end) {
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+        p++;
+    return p;
+}
+
+static struct keymap* keymap_find(const char* name) {
+    for (uint32_t i = 0; i < keymap_count; i++)
+        if (strcmp(keymaps[i]->name, name) == 0)
+            return keymaps[i];
+    return NULL;
+}
+
+static int keymap_parse(struct keymap* map, const char* text, size_t len) {
+    uint8_t plain[128], shifted[128];
+    memcpy(plain, us_plain, sizeof(plain));
+    memcpy(shifted, us_shift, sizeof(shifted));
+    const char* end = text + len;
+    for (const char* line = text; line < end; ) {
+        const char* eol = line;
+        while (eol < end && *eol != '\n')
+            eol++;
+        const char* p = skip_blanks(line, eol);
+        if (p < eol && *p != '#') {
+            uint32_t code, key, key_shifted;
+            if (!(p = parse_key(p, eol, &code)) || !(p = parse_key(skip_blanks(p, eol), eol, &key))
+                || !(p = parse_key(skip_blanks(p, eol), eol, &key_shifted)))
+                return 0;
+            if (code == 0 || code >= 128)
+                return 0;
+            plain[code] = key;
+            shifted[code] = key_shifted;
+        }
+        line = eol + 1;
+    }
+    keymap_build(map, plain, shifted);
+    return 1;
+}
+
+int keymap_load(const char* name, const char* text, size_t len) {
+    size_t name_len = strlen(name);
+    if (name_len == 0 || name_len >= KEYMAP_NAME_LEN)
+        return 0;
+
+    // Parsed aside, a bad file leaves the loaded keymap of that name alone
+    struct keymap* parsed = kmalloc(sizeof(*parsed));
+    if (!parsed)
+        return 0;
+    if (!keymap_parse(parsed, text, len)) {
+        kfree(parsed);
+        return 0;
+    }
+    struct keymap* map = keymap_find(name);
+    if (map) {
+        memcpy(map->keys, parsed->keys, sizeof(map->keys));
+        kfree(parsed);
+        return 1;
+    }
+    if (keymap_count == KEYMAP_MAX) {
+        kfree(parsed);
+        return 0;
+    }
+    memcpy(parsed->name, name, name_len + 1);
+    keymaps[keymap_count++] = parsed;
+    return 1;
+}
+
+int keymap_use(const char* name) {
+    const struct keymap* map = keymap_find(name);
+    if (!map) {
+        char path[sizeof(KEYMAP_DIR) + KEYMAP_NAME_LEN + 4];
+        size_t name_len = strlen(name);
+        if (name_len >= KEYMAP_NAME_LEN)
+            return 0;
+        memcpy(path, KEYMAP_DIR, sizeof(KEYMAP_DIR) - 1);
+        memcpy(path + sizeof(KEYMAP_DIR) - 1, name, name_len);
+        memcpy(path + sizeof(KEYMAP_DIR) - 1 + name_len, ".map", 5);
+        const struct initrd_file* file = initrd_lookup(path);
+        if (!file || file->type != INITRD_FILE || !keymap_load(name, file->data, file->size))
+            return 0;
+        map = keymap_find(name);
+    }
+    active = map;
+    return 1;
+}
+
+const char* keymap_name(uint32_t index) {
+    return index < keymap_count ? keymaps[index]->name : NULL;
+}
+
+const char* keymap_active(void) {
+    return active->name;
+}
+
+void keymap_init(void) {
+    char name[KEYMAP_NAME_LEN];
+
+    keymap_build(&us_keymap, us_plain, us_shift);
+    if (cmdline_get("dexis.keymap", name, sizeof(name)) && !keymap_use(name)) {
+        terminal_write("No keymap ");
+        terminal_write(name);
+        terminal_write(" in the initrd, keeping us\n");
+    }
+}
+
+/* Self-test, see selftest.h */
+static int feed(struct kbd_decoder* dec, const uint8_t* bytes, size_t n, struct kbd_event* ev) {
+    int got = 0;
+    for (size_t i = 0; i < n; i++)
+        got = kbd_decode(dec, bytes[i], ev);
+    return got;
+}
+
+#define FEED(dec, ev, ...) \
+    feed(dec, (const uint8_t[]){ __VA_ARGS__ }, sizeof((const uint8_t[]){ __VA_ARGS__ }), ev)
+
+// Decoding, under the US keymap. The tests look keys up in the map they
+// are given, the keyboard keeps decoding against the active one meanwhile
+static const char* decoder_selftest(const struct keymap* map) {
+    struct kbd_decoder dec = KBD_DECODER_INIT;
+    struct kbd_event ev;
+
+    if (!FEED(&dec, &ev, 0x1E) || keymap_key(map, &dec, ev.code) != 'a')
+        return "plain key wrong";
+    if (!FEED(&dec, &ev, 0x1E) || !ev.repeat)
+        return "repeat not detected";
+    if (!FEED(&dec, &ev, 0x9E) || ev.pressed || ev.code != 0x1E)
+        return "release not decoded";
+    if (!FEED(&dec, &ev, 0xE0, 0x48) || ev.code != (KBD_E0 | 0x48) || keymap_key(map, &dec, ev.code) != KEY_UP)
+        return "E0 arrow wrong";
+    if (!FEED(&dec, &ev, 0x48) || keymap_key(map, &dec, ev.code) != KEY_UP)
+        return "keypad without Num Lock wrong";
+    FEED(&dec, &ev, 0x45, 0xC5, 0x48);
+    if (keymap_key(map, &dec, ev.code) != '8' || keymap_key(map, &dec, KBD_E0 | 0x48) != KEY_UP)
+        return "Num Lock does not split keypad from arrows";
+    FEED(&dec, &ev, 0x45, 0xC5, 0xC8, 0xE0, 0xC8);
+
+    // Shift with Caps Lock gives lowercase letters but still shifts digits
+    FEED(&dec, &ev, 0x3A, 0xBA, 0x2A);
+    if (keymap_key(map, &dec, 0x1E) != 'a' || keymap_key(map, &dec, 0x02) != '!')
+        return "Shift with Caps Lock wrong";
+    // The fake Shift release around extended keys must not count
+    FEED(&dec, &ev, 0xE0, 0xAA, 0xE0, 0x52);
+    if (keymap_key(map, &dec, 0x02) != '!')
+        return "fake Shift release taken";
+    FEED(&dec, &ev, 0xAA, 0x3A, 0xBA);
+    if (keymap_key(map, &dec, 0x1E) != 'a' || keymap_key(map, &dec, 0x02) != '1')
+        return "Shift release lost";
+
+    // Pause is swallowed whole
+    if (FEED(&dec, &ev, 0xE1, 0x1D, 0x45, 0xE1, 0x9D, 0xC5) || (dec.mods | dec.locks))
+        return "Pause changed state";
+    return NULL;
+}
+
+// A parsed layout
+static const char* layout_selftest(struct keymap* map) {
+    static const char text[] = "# test\n0x1E 0xA0 0x80\n0x10 x X trailing\n";
+    struct kbd_decoder dec = KBD_DECODER_INIT;
+    struct kbd_event ev;
+
+    if (keymap_parse(map, "0x1E", 4))
+        return "short line accepted";
+    if (!keymap_parse(map, text, sizeof(text) - 1))
+        return "keymap did not parse";
+    if (keymap_key(map, &dec, 0x1E) != 0xA0 || keymap_key(map, &dec, 0x10) != 'x' || keymap_key(map, &dec, 0x30) != 'b')
+        return "parsed keymap wrong";
+    FEED(&dec, &ev, 0x3A, 0xBA);
+    if (keymap_key(map, &dec, 0x1E) != 0x80)
+        return "Caps Lock on a non-ASCII letter";
+    FEED(&dec, &ev, 0x3A, 0xBA, 0xE0, 0x1D);
+    if (keymap_key(map, &dec, 0x2E) != 0x03)
+        return "Ctrl+C not taken from the US position";
+    return NULL;
+}
+
+static const char* keymap_selftest(void) {
+    struct keymap* map = kmalloc(sizeof(*map));
+    if (!map)
+        return "out of memory";
+    const char* error = decoder_selftest(&us_keymap);
+    if (!error)
+        error = layout_selftest(map);
+    kfree(map);
+    return error;
+}
+SELFTEST(keymap, keymap_selftest);
+
+/* Benchmark, see bench.h: decode and translate a typing stream */
+static struct kbd_decoder bench_decoder;
+static volatile int bench_sink;
+
+static void bench_decode(void) {
+    // Letters, Space and Enter with a Shift press and release in between
+    static const uint8_t codes[] = { 0x1E, 0x9E, 0x30, 0xB0, 0x2A, 0x2E, 0xAE, 0xAA, 0xE0, 0x48, 0xE0, 0xC8, 0x39, 0xB9 };
+    static size_t next = 0;
+    struct kbd_event ev;
+    if (kbd_decode(&bench_decoder, codes[next++ % sizeof(codes)], &ev))
+        bench_sink = kbd_key(&bench_decoder, ev.code);
+}
+BENCH(kbd_decode, bench_decode, NULL, NULL, 4000);
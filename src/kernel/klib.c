@@ -0,0 +1,335 @@
+#include <kernel/klib.h>
+#include <kernel/cpu.h>
+#include <kernel/io.h>
+#include <kernel/slab.h>
+#include <kernel/bench.h>
+
+/*
+ * Copies and fills of at least KLIB_SSE_MIN bytes use 16-byte SSE2 moves,
+ * from KLIB_NT_MIN on with non-temporal stores that bypass the cache.
+ * The kernel is built with -mno-sse and never saves XMM state, so the
+ * SSE2 loops run with interrupts off, KLIB_SSE_CHUNK bytes at a time:
+ * no interrupt handler or context switch can ever see live XMM registers.
+ */
+#define KLIB_SSE_MIN 512
+#define KLIB_NT_MIN (256 * 1024)
+#define KLIB_SSE_CHUNK 4096
+
+#define ONES 0x01010101u
+#define HIGHS 0x80808080u
+#define HAS_ZERO(w) (((w) - ONES) & ~(w) & HIGHS)
+
+static int have_sse2 = 0;
+static int use_sse2 = 0;
+
+void klib_init(void) {
+    uint32_t features = cpuid_features_edx();
+    if (!(features & CPUID_FEAT_SSE2) || !(features & CPUID_FEAT_FXSR))
+        return;
+    have_sse2 = use_sse2 = 1;
+    klib_init_ap();
+}
+
+void klib_init_ap(void) {
+    if (!have_sse2)
+        return;
+    write_cr0((read_cr0() & ~CR0_EM) | CR0_MP);
+    write_cr4(read_cr4() | CR4_OSFXSR | CR4_OSXMMEXCPT);
+}
+
+int klib_sse2_enabled(void) {
+    return use_sse2;
+}
+
+void klib_use_sse2(int enable) {
+    use_sse2 = enable && have_sse2;
+}
+
+static inline void copy_forward(char* d, const char* s, size_t n) {
+    size_t words = n >> 2;
+    __asm__ volatile ("rep movsl\n\t"
+                      "movl %k3, %%ecx\n\t"
+                      "rep movsb"
+                      : "+D"(d), "+S"(s), "+c"(words)
+                      : "r"(n & 3)
+                      : "memory");
+}
+
+// Highest bytes first, so an overlapping source is read before it is overwritten
+static inline void copy_backward(char* d, const char* s, size_t n) {
+    char* dl = d + n - 1;
+    const char* sl = s + n - 1;
+    size_t tail = n & 3;
+    __asm__ volatile ("std\n\t"
+                      "rep movsb\n\t"
+                      "sub $3, %1\n\t"
+                      "sub $3, %0\n\t"
+                      "movl %k3, %%ecx\n\t"
+                      "rep movsl\n\t"
+                      "cld"
+                      : "+D"(dl), "+S"(sl), "+c"(tail)
+                      : "r"(n >> 2)
+                      : "memory");
+}
+
+static inline void fill_forward(char* d, uint32_t pattern, size_t n) {
+    size_t words = n >> 2;
+    __asm__ volatile ("rep stosl\n\t"
+                      "movl %k3, %%ecx\n\t"
+                      "rep stosb"
+                      : "+D"(d), "+c"(words)
+                      : "a"(pattern), "r"(n & 3)
+                      : "memory");
+}
+
+// Align the destination with a short rep movsb, then move 64 bytes per
+// iteration. Returns how many bytes were copied (a multiple of 64)
+static size_t copy_sse2(char* d, const char* s, size_t n) {
+    size_t head = (16 - ((uintptr_t)d & 15)) & 15;
+    size_t done = head;
+    copy_forward(d, s, head);
+    d += head;
+    s += head;
+    n -= head;
+
+    int stream = n >= KLIB_NT_MIN;
+    while (n >= 64) {
+        size_t chunk = n < KLIB_SSE_CHUNK ? n & ~(size_t)63 : KLIB_SSE_CHUNK;
+        uint32_t flags = irq_save();
+        if (stream) {
+            for (size_t i = 0; i < chunk; i += 64)
+                __asm__ volatile ("movdqu (%1), %%xmm0\n\t"
+                                  "movdqu 16(%1), %%xmm1\n\t"
+                                  "movdqu 32(%1), %%xmm2\n\t"
+                                  "movdqu 48(%1), %%xmm3\n\t"
+                                  "movntdq %%xmm0, (%0)\n\t"
+                                  "movntdq %%xmm1, 16(%0)\n\t"
+                                  "movntdq %%xmm2, 32(%0)\n\t"
+                                  "movntdq %%xmm3, 48(%0)"
+                                  : : "r"(d + i), "r"(s + i) : "memory");
+            __asm__ volatile ("sfence" : : : "memory");
+        } else {
+            for (size_t i = 0; i < chunk; i += 64)
+                __asm__ volatile ("movdqu (%1), %%xmm0\n\t"
+                                  "movdqu 16(%1), %%xmm1\n\t"
+                                  "movdqu 32(%1), %%xmm2\n\t"
+                                  "movdqu 48(%1), %%xmm3\n\t"
+                                  "movdqa %%xmm0, (%0)\n\t"
+                                  "movdqa %%xmm1, 16(%0)\n\t"
+                                  "movdqa %%xmm2, 32(%0)\n\t"
+                                  "movdqa %%xmm3, 48(%0)"
+                                  : : "r"(d + i), "r"(s + i) : "memory");
+        }
+        irq_restore(flags);
+        d += chunk;
+        s += chunk;
+        n -= chunk;
+        done += chunk;
+    }
+    return done;
+}
+
+static size_t fill_sse2(char* d, uint32_t pattern, size_t n) {
+    size_t head = (16 - ((uintptr_t)d & 15)) & 15;
+    size_t done = head;
+    fill_forward(d, pattern, head);
+    d += head;
+    n -= head;
+
+    int stream = n >= KLIB_NT_MIN;
+    while (n >= 64) {
+        size_t chunk = n < KLIB_SSE_CHUNK ? n & ~(size_t)63 : KLIB_SSE_CHUNK;
+        uint32_t flags = irq_save();
+        __asm__ volatile ("movd %0, %%xmm0\n\t"
+                          "pshufd $0, %%xmm0, %%xmm0" : : "r"(pattern));
+        if (stream) {
+            for (size_t i = 0; i < chunk; i += 64)
+                __asm__ volatile ("movntdq %%xmm0, (%0)\n\t"
+                                  "movntdq %%xmm0, 16(%0)\n\t"
+                                  "movntdq %%xmm0, 32(%0)\n\t"
+                                  "movntdq %%xmm0, 48(%0)"
+                                  : : "r"(d + i) : "memory");
+            __asm__ volatile ("sfence" : : : "memory");
+        } else {
+            for (size_t i = 0; i < chunk; i += 64)
+                __asm__ volatile ("movdqa %%xmm0, (%0)\n\t"
+                                  "movdqa %%xmm0, 16(%0)\n\t"
+                                  "movdqa %%xmm0, 32(%0)\n\t"
+                                  "movdqa %%xmm0, 48(%0)"
+                                  : : "r"(d + i) : "memory");
+        }
+        irq_restore(flags);
+        d += chunk;
+        n -= chunk;
+        done += chunk;
+    }
+    return done;
+}
+
+void* memcpy(void* dst, const void* src, size_t n) {
+    char* d = dst;
+    const char* s = src;
+    if (use_sse2 && n >= KLIB_SSE_MIN) {
+        size_t done = copy_sse2(d, s, n);
+        d += done;
+        s += done;
+        n -= done;
+    }
+    copy_forward(d, s, n);
+    return dst;
+}
+
+void* memmove(void* dst, const void* src, size_t n) {
+    char* d = dst;
+    const char* s = src;
+    if (d == s || n == 0)
+        return dst;
+    // Forward is safe unless the destination starts inside the source
+    if (d < s || d >= s + n)
+        return memcpy(dst, src, n);
+    copy_backward(d, s, n);
+    return dst;
+}
+
+void* memset(void* dst, int c, size_t n) {
+    char* d = dst;
+    uint32_t pattern = (uint8_t)c * ONES;
+    if (use_sse2 && n >= KLIB_SSE_MIN) {
+        size_t done = fill_sse2(d, pattern, n);
+        d += done;
+        n -= done;
+    }
+    fill_forward(d, pattern, n);
+    return dst;
+}
+
+void memsetw(uint16_t* dst, uint16_t value, size_t count) {
+    uint32_t pattern = value | (uint32_t)value << 16;
+    if (((uintptr_t)dst & 2) && count) {  // Word-align for the dword stores
+        *dst++ = value;
+        count--;
+    }
+    if (use_sse2 && count * 2 >= KLIB_SSE_MIN) {
+        size_t done = fill_sse2((char*)dst, pattern, count * 2) / 2;
+        dst += done;
+        count -= done;
+    }
+    size_t words = count >> 1;
+    __asm__ volatile ("rep stosl\n\t"
+                      "movl %k3, %%ecx\n\t"
+                      "rep stosw"
+                      : "+D"(dst), "+c"(words)
+                      : "a"(pattern), "r"(count & 1)
+                      : "memory");
+}
+
+int memcmp(const void* a, const void* b, size_t n) {
+    const uint8_t* p = a;
+    const uint8_t* q = b;
+    // Skip the equal prefix a word at a time, the first difference is
+    // then found byte by byte
+    while (n >= 4 && *(const uint32_t*)p == *(const uint32_t*)q) {
+        p += 4;
+        q += 4;
+        n -= 4;
+    }
+    for (; n; n--, p++, q++)
+        if (*p != *q)
+            return *p - *q;
+    return 0;
+}
+
+size_t strlen(const char* s) {
+    const char* p = s;
+    while ((uintptr_t)p & 3) {
+        if (*p == '\0')
+            return p - s;
+        p++;
+    }
+    // An aligned word never crosses a page, so reading past the
+    // terminator inside it is safe
+    const uint32_t* w = (const uint32_t*)p;
+    while (!HAS_ZERO(*w))
+        w++;
+    p = (const char*)w;
+    while (*p)
+        p++;
+    return p - s;
+}
+
+int strcmp(const char* a, const char* b) {
+    // With equal alignment compare whole words until one differs or holds the end
+    if (((uintptr_t)a & 3) == ((uintptr_t)b & 3)) {
+        while ((uintptr_t)a & 3) {
+            if (*a != *b || *a == '\0')
+                return (uint8_t)*a - (uint8_t)*b;
+            a++;
+            b++;
+        }
+        const uint32_t* wa = (const uint32_t*)a;
+        const uint32_t* wb = (const uint32_t*)b;
+        while (*wa == *wb && !HAS_ZERO(*wa)) {
+            wa++;
+            wb++;
+        }
+        a = (const char*)wa;
+        b = (const char*)wb;
+    }
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return (uint8_t)*a - (uint8_t)*b;
+}
+
+int strncmp(const char* a, const char* b, size_t n) {
+    for (; n; n--, a++, b++) {
+        if (*a != *b || *a == '\0')
+            return (uint8_t)*a - (uint8_t)*b;
+    }
+    return 0;
+}
+
+char* strncpy(char* dst, const char* src, size_t n) {
+    size_t len = 0;
+    while (len < n && src[len])
+        len++;
+    memcpy(dst, src, len);
+    memset(dst + len, 0, n - len);
+    return dst;
+}
+
+/* Benchmarks, see bench.h */
+#define BENCH_BUF_HALF (64 * 1024)
+
+static char* bench_buf;
+
+static int bench_buf_setup(void) {
+    bench_buf = kmalloc(2 * BENCH_BUF_HALF);
+    if (!bench_buf)
+        return -1;
+    // Sources live in the upper half, a 256 byte string at its start
+    memset(bench_buf, 0, 2 * BENCH_BUF_HALF);
+    memset(bench_buf + BENCH_BUF_HALF, 'a', 255);
+    return 0;
+}
+
+static void bench_buf_teardown(void) {
+    kfree(bench_buf);
+}
+
+static void bench_memcpy_64(void) { memcpy(bench_buf, bench_buf + BENCH_BUF_HALF, 64); }
+static void bench_memcpy_4k(void) { memcpy(bench_buf, bench_buf + BENCH_BUF_HALF, 4096); }
+static void bench_memcpy_64k(void) { memcpy(bench_buf, bench_buf + BENCH_BUF_HALF, BENCH_BUF_HALF); }
+static void bench_memmove_4k(void) { memmove(bench_buf + 1, bench_buf, 4096); }
+static void bench_memset_4k(void) { memset(bench_buf, 0x5A, 4096); }
+static void bench_memsetw_screen(void) { memsetw((uint16_t*)bench_buf, 0x0F20, 80 * 25); }
+static void bench_strlen_256(void) { strlen(bench_buf + BENCH_BUF_HALF); }
+
+BENCH(memcpy_64, bench_memcpy_64, bench_buf_setup, bench_buf_teardown, 2000);
+BENCH(memcpy_4k, bench_memcpy_4k, bench_buf_setup, bench_buf_teardown, 2000);
+BENCH(memcpy_64k, bench_memcpy_64k, bench_buf_setup, bench_buf_teardown, 200);
+BENCH(memmove_4k, bench_memmove_4k, bench_buf_setup, bench_buf_teardown, 2000);
+BENCH(memset_4k, bench_memset_4k, bench_buf_setup, bench_buf_teardown, 2000);
+BENCH(memsetw_screen, bench_memsetw_screen, bench_buf_setup, bench_buf_teardown, 2000);
+BENCH(strlen_256, bench_strlen_256, bench_buf_setup, bench_buf_teardown, 2000);
@@ -0,0 +1,49 @@
+#include <kernel/ksyms.h>
+#include <stddef.h>
+
+/*
+ * Generated into build/ksyms.c. The first link has no table yet, so the
+ * references are weak and resolve to NULL there.
+ */
+extern const uint32_t ksym_table_count __attribute__((weak));
+extern const uint32_t ksym_table_addrs[] __attribute__((weak));
+extern const uint32_t ksym_table_names[] __attribute__((weak));
+extern const char ksym_table_strings[] __attribute__((weak));
+
+/* Symbol from scripts/linker.ld */
+extern char _text_end[];
+
+uint32_t ksym_count(void) {
+    return &ksym_table_count ? ksym_table_count : 0;
+}
+
+// Binary search for the last symbol at or below addr, cheap enough for
+// the timer interrupt. The table holds 32-bit addresses, the kernel is
+// linked below 4 GiB on x86_64 too
+int ksym_index(uintptr_t addr) {
+    uint32_t count = ksym_count();
+    if (!count || addr < ksym_table_addrs[0] || addr >= (uintptr_t)_text_end)
+        return -1;
+
+    uint32_t lo = 0, hi = count;
+    while (hi - lo > 1) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (ksym_table_addrs[mid] <= addr)
+            lo = mid;
+        else
+            hi = mid;
+    }
+    return (int)lo;
+}
+
+const char* ksym_name(int index) {
+    if (index < 0 || (uint32_t)index >= ksym_count())
+        return "?";
+    return &ksym_table_strings[ksym_table_names[index]];
+}
+
+uint32_t ksym_address(int index) {
+    if (index < 0 || (uint32_t)index >= ksym_count())
+        return 0;
+    return ksym_table_addrs[index];
+}
@@ -1,20 +1,125 @@
 #include <kernel/vga.h>
 #include <kernel/io.h>
 #include <kernel/dsh.h>
+#include <kernel/gdt.h>
+#include <kernel/idt.h>
+#include <kernel/keyboard.h>
+#include <kernel/serial.h>
+#include <kernel/timer.h>
+#include <kernel/multiboot.h>
+#include <kernel/pmm.h>
+#include <kernel/paging.h>
+#include <kernel/fbcon.h>
+#include <kernel/klib.h>
+#include <kernel/cmdline.h>
+#include <kernel/selftest.h>
+#include <kernel/bench.h>
+#include <kernel/trace.h>
+#include <kernel/sched.h>
+#include <kernel/smp.h>
+#include <kernel/workqueue.h>
+#include <kernel/ata.h>
+#include <kernel/blk.h>
+#include <kernel/initrd.h>
+#include <kernel/keymap.h>
+#include <kernel/cpu.h>
 
-static void serial_write(const char* str) {
-    while (*str) {
-        outb(0x3F8, *str++);  // COM1 port
+#define QEMU_EXIT_PORT 0xF4     // -device isa-debug-exit,iobase=0xf4
+#define ACPI_SHUTDOWN_PORT 0x604 // QEMU's PIIX4 power management
+
+/*
+ * Batch modes, picked on the kernel command line:
+ *   dexis.mode=test          run the self-tests
+ *   dexis.mode=bench         run the benchmarks
+ *   dexis.script="command"   run a shell command line, "a; b | c" or
+ *                            "run /scripts/file" work as at the prompt
+ * Results go to the serial port, then the machine exits instead of
+ * starting the shell. Returns only when no batch mode was asked for.
+ */
+static void batch_mode(void) {
+    char mode[16], script[256];
+    int status;
+
+    if (cmdline_get("dexis.script", script, sizeof(script))) {
+        terminal_batch_begin(); // The console is drawn once, at the end
+        status = dsh_execute(script) != 0;
+        terminal_batch_end();
+    } else if (cmdline_get("dexis.mode", mode, sizeof(mode))) {
+        if (strcmp(mode, "test") == 0) {
+            status = selftest_run_all("") != 0;
+        } else if (strcmp(mode, "bench") == 0) {
+            status = bench_run_all("") == 0 || !smp_bench(0) || (blk_get(0) && !blk_bench(blk_get(0), 0));
+        } else {
+            terminal_write("Unknown dexis.mode, starting the shell\n");
+            return;
+        }
+    } else {
+        return;
     }
+
+    terminal_flush();
+    serial_write(status ? "\r\nBATCH_RESULT fail\r\n" : "\r\nBATCH_RESULT pass\r\n");
+    serial_flush();
+    outb(QEMU_EXIT_PORT, status);          // QEMU exits with (status << 1) | 1
+    outw(ACPI_SHUTDOWN_PORT, 0x2000);      // No debug exit device: power off
+    cli();
+    while (1)
+        hlt();
 }
 
-void kmain(void) {
+// The shell is a thread like any other, so background threads get the
+// CPU while it waits for a key
+static void shell_thread(void* arg) {
+    (void)arg;
+    batch_mode();
+    dsh_run();
+}
+
+void kmain(uint32_t magic, uint32_t multiboot_info) {
+    TRACE_BEGIN(TRACE_KMAIN, "early");
+    klib_init();  // Picks the SSE2 copy paths before anything uses them
     terminal_initialize(); // Initialize terminal
     terminal_setcolor(VGA_COLOR_LIGHT_BLUE);
     terminal_write("*DexisCore v0.1*\n");
     terminal_setcolor(VGA_COLOR_WHITE);
-    terminal_write("Architecture: x86 (32bit)\n");
+    terminal_write("Architecture: " ARCH_NAME "\n");
+    TRACE_END(TRACE_KMAIN, "early");
+    TRACE_BEGIN(TRACE_KMAIN, "memory");
+    if (multiboot_init(magic, multiboot_info)) {
+        struct pmm_stats mem;
+        pmm_init();
+        pmm_get_stats(&mem);
+        terminal_write("Memory: ");
+        terminal_write_dec(mem.free_pages / (1024 * 1024 / PAGE_SIZE));
+        terminal_write(" MiB available\n");
+    } else {
+        terminal_write("Not booted by a multiboot2 loader, no memory map\n");
+    }
+    paging_init();
+    fbcon_init(); // Console moves to the framebuffer if GRUB set one up
+    initrd_init();
+    keymap_init(); // dexis.keymap= may name a layout in the initrd
+    TRACE_END(TRACE_KMAIN, "memory");
+    TRACE_BEGIN(TRACE_KMAIN, "cpu_tables");
+    gdt_init();
+    smp_early_init(); // Per-CPU data, before anything asks which CPU it is on
+    idt_init();
+    TRACE_END(TRACE_KMAIN, "cpu_tables");
+    TRACE_BEGIN(TRACE_KMAIN, "timer");
+    timer_init();
+    TRACE_END(TRACE_KMAIN, "timer");
+    TRACE_BEGIN(TRACE_KMAIN, "devices");
+    keyboard_init();
+    if (serial_init(SERIAL_BAUD_115200))
+        terminal_set_mirror(serial_console_write); // dsh is usable over the serial line too
+    ata_init();
+    TRACE_END(TRACE_KMAIN, "devices");
     serial_write("\nKernel loaded and running\n");
-    dsh_run(); // Run the dsh shell
-    while (1) {} // Loop forever
+    sti();
+    sched_init(); // From here on kmain is the idle thread
+    smp_init();
+    workqueue_init(); // IRQ bottom halves move to a thread
+    if (!thread_create("dsh", shell_thread, NULL, THREAD_PRIORITY_SHELL))
+        shell_thread(NULL); // No memory for a thread, run it on the boot stack
+    sched_idle();
 }
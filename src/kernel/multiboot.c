@@ -0,0 +1,48 @@
+#include <kernel/multiboot.h>
+#include <stddef.h>
+
+static uint32_t info_addr = 0;
+static uint32_t info_size = 0;
+
+int multiboot_init(uint32_t magic, uint32_t addr) {
+    if (magic != MULTIBOOT2_BOOTLOADER_MAGIC || addr == 0)
+        return 0;
+    info_addr = addr;
+    info_size = *(const uint32_t*)(uintptr_t)addr; // total_size, followed by a reserved word
+    return 1;
+}
+
+static const struct multiboot_tag* multiboot_next_tag(const struct multiboot_tag* tag) {
+    // Tags are padded to 8 bytes
+    return (const struct multiboot_tag*)((const uint8_t*)tag + ((tag->size + 7) & ~7u));
+}
+
+const struct multiboot_tag* multiboot_find_tag(uint32_t type, const struct multiboot_tag* prev) {
+    if (!info_addr)
+        return NULL;
+
+    const struct multiboot_tag* tag = prev ? multiboot_next_tag(prev)
+                                           : (const struct multiboot_tag*)(uintptr_t)(info_addr + 8);
+    const uint8_t* end = (const uint8_t*)(uintptr_t)info_addr + info_size;
+
+    while ((const uint8_t*)tag < end && tag->type != MULTIBOOT_TAG_END) {
+        if (tag->type == type)
+            return tag;
+        tag = multiboot_next_tag(tag);
+    }
+    return NULL;
+}
+
+uint32_t multiboot_info_addr(void) {
+    return info_addr;
+}
+
+uint32_t multiboot_info_size(void) {
+    return info_size;
+}
+
+const char* multiboot_cmdline(void) {
+    const struct multiboot_tag_string* tag =
+        (const struct multiboot_tag_string*)multiboot_find_tag(MULTIBOOT_TAG_CMDLINE, NULL);
+    return tag ? tag->string : "";
+}
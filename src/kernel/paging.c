@@ -0,0 +1,161 @@
+#include <kernel/paging.h>
+#include <kernel/multiboot.h>
+#include <kernel/cpu.h>
+#include <kernel/io.h>
+
+#define PAGE_SIZE_4K 0x1000
+
+#ifdef __x86_64__
+typedef uint64_t page_entry_t;
+#define ENTRIES 512
+#define DIRECTORIES 4   // Page directories under the one PDPT, 1 GiB each
+#else
+typedef uint32_t page_entry_t;
+#define ENTRIES 1024
+#define DIRECTORIES 1
+#endif
+
+/*
+ * PAT layout. The PAT/PCD/PWT bits of an entry pick one of eight slots,
+ * we keep the power-on meaning of 0 and 3 and turn slot 1 (PWT only)
+ * into write-combining:
+ *   0 WB   1 WC   2 UC-   3 UC   4 WB   5 WT   6 UC-   7 UC
+ */
+#define PAT_VALUE 0x0007040600070106ULL
+
+#define VGA_WINDOW_START 0xA0000
+#define VGA_WINDOW_END 0xC0000
+
+/*
+ * Everything is identity mapped and belongs to the kernel, so every entry
+ * is global. Large pages cover the address space; only the first one
+ * uses a page table, so the VGA window can get its own memory type
+ * without dragging the kernel image (at 1 MiB) along. Long mode adds two
+ * levels on top: one PML4 entry, one PDPT entry per page directory, and
+ * the directories sit back to back so one index covers all 4 GiB.
+ */
+static page_entry_t page_directory[DIRECTORIES * ENTRIES] __attribute__((aligned(PAGE_SIZE_4K)));
+static page_entry_t low_table[ENTRIES] __attribute__((aligned(PAGE_SIZE_4K)));
+#ifdef __x86_64__
+static page_entry_t pml4[ENTRIES] __attribute__((aligned(PAGE_SIZE_4K)));
+static page_entry_t pdpt[ENTRIES] __attribute__((aligned(PAGE_SIZE_4K)));
+#endif
+static int has_pat = 0;
+static uint32_t cr4_bits = 0; // What paging_init() set in CR4, 0 if paging is off
+
+// Slots 0-3 only need PCD/PWT, which sit at the same place in both entry kinds
+static uint32_t cache_bits(enum page_cache type) {
+    switch (type) {
+    case PAGE_CACHE_WC:
+        return PAGE_PWT;
+    case PAGE_CACHE_UC:
+        return PAGE_PCD | PAGE_PWT;
+    default:
+        return 0;
+    }
+}
+
+// 1 if some usable RAM lies in [start, end)
+static int range_has_ram(uint64_t start, uint64_t end) {
+    const struct multiboot_tag_mmap* mmap =
+        (const struct multiboot_tag_mmap*)multiboot_find_tag(MULTIBOOT_TAG_MMAP, NULL);
+    if (!mmap)
+        return start < 0x1000000; // No map: assume the first 16 MiB
+
+    const uint8_t* end_of_map = (const uint8_t*)mmap + mmap->size;
+    for (const uint8_t* p = (const uint8_t*)mmap->entries; p < end_of_map; p += mmap->entry_size) {
+        const struct multiboot_mmap_entry* e = (const struct multiboot_mmap_entry*)p;
+        if ((e->type == MULTIBOOT_MEMORY_AVAILABLE || e->type == MULTIBOOT_MEMORY_ACPI_RECLAIMABLE) &&
+            e->addr < end && e->addr + e->len > start)
+            return 1;
+    }
+    return 0;
+}
+
+void paging_init(void) {
+    uint32_t features = cpuid_features_edx();
+    if (!(features & CPUID_FEAT_PSE))
+        return; // Stay unpaged rather than build 1024 page tables
+
+    // On i386 paging is off, so there are no stale TLB entries to worry
+    // about. The x86_64 boot tables only use slot 0, which keeps its meaning.
+    has_pat = (features & CPUID_FEAT_PAT) && (features & CPUID_FEAT_MSR);
+    if (has_pat)
+        wrmsr(MSR_IA32_PAT, PAT_VALUE);
+
+    uint32_t global = (features & CPUID_FEAT_PGE) ? PAGE_GLOBAL : 0;
+
+    for (uint32_t i = 0; i < ENTRIES; i++) {
+        uint32_t addr = i * PAGE_SIZE_4K;
+        uint32_t bits = PAGE_PRESENT | PAGE_WRITE | global;
+        if (addr >= VGA_WINDOW_START && addr < VGA_WINDOW_END)
+            bits |= cache_bits(PAGE_CACHE_WC);
+        low_table[i] = addr | bits;
+    }
+    page_directory[0] = (uintptr_t)low_table | PAGE_PRESENT | PAGE_WRITE;
+
+    // RAM is write-back, holes (device memory) are uncached until a
+    // driver asks for something else
+    for (uint32_t i = 1; i < DIRECTORIES * ENTRIES; i++) {
+        uint64_t start = (uint64_t)i * LARGE_PAGE_SIZE;
+        uint32_t bits = PAGE_PRESENT | PAGE_WRITE | PAGE_PSE | global;
+        if (!range_has_ram(start, start + LARGE_PAGE_SIZE))
+            bits |= cache_bits(PAGE_CACHE_UC);
+        page_directory[i] = start | bits;
+    }
+
+    cr4_bits = CR4_PSE | (global ? CR4_PGE : 0);
+    write_cr4(read_cr4() | cr4_bits);
+#ifdef __x86_64__
+    for (uint32_t i = 0; i < DIRECTORIES; i++)
+        pdpt[i] = (uintptr_t)&page_directory[i * ENTRIES] | PAGE_PRESENT | PAGE_WRITE;
+    pml4[0] = (uintptr_t)pdpt | PAGE_PRESENT | PAGE_WRITE;
+    write_cr3((uintptr_t)pml4);
+#else
+    write_cr3((uintptr_t)page_directory);
+    write_cr0(read_cr0() | CR0_PG);
+#endif
+}
+
+void paging_init_ap(void) {
+    if (!cr4_bits)
+        return; // The boot CPU stayed unpaged too
+    if (has_pat)
+        wrmsr(MSR_IA32_PAT, PAT_VALUE); // The PAT is per CPU
+    write_cr4(read_cr4() | cr4_bits);
+#ifndef __x86_64__
+    // In long mode the trampoline has loaded our tables already
+    write_cr3((uintptr_t)page_directory);
+    write_cr0(read_cr0() | CR0_PG);
+#endif
+}
+
+void paging_set_cache(uintptr_t addr, size_t size, enum page_cache type) {
+    if (!(read_cr0() & CR0_PG) || size == 0)
+        return;
+
+    const page_entry_t mask = PAGE_PAT_4M | PAGE_PCD | PAGE_PWT;
+    uint64_t end = (uint64_t)addr + size;
+    uint32_t flags = irq_save();
+
+    if (end > (uint64_t)DIRECTORIES * ENTRIES * LARGE_PAGE_SIZE)
+        end = (uint64_t)DIRECTORIES * ENTRIES * LARGE_PAGE_SIZE; // Not mapped at all
+    for (uint64_t a = addr & ~(uint64_t)(PAGE_SIZE_4K - 1); a < end;) {
+        uint32_t pde = (uint32_t)(a / LARGE_PAGE_SIZE);
+        if (pde == 0) {
+            uint32_t pte = (uint32_t)(a / PAGE_SIZE_4K);
+            low_table[pte] = (low_table[pte] & ~(PAGE_PAT_4K | PAGE_PCD | PAGE_PWT)) | cache_bits(type);
+            invlpg((uintptr_t)a);
+            a += PAGE_SIZE_4K;
+        } else {
+            page_directory[pde] = (page_directory[pde] & ~mask) | cache_bits(type);
+            invlpg((uintptr_t)a);
+            a = (uint64_t)(pde + 1) * LARGE_PAGE_SIZE;
+        }
+    }
+    irq_restore(flags);
+}
+
+int paging_has_pat(void) {
+    return has_pat;
+}
@@ -0,0 +1,104 @@
+#include <kernel/pci.h>
+#include <kernel/io.h>
+#include <kernel/spinlock.h>
+
+#define PCI_CONFIG_ADDRESS 0xCF8
+#define PCI_CONFIG_DATA 0xCFC
+
+static spinlock_t config_lock = SPINLOCK_INIT; // Address and data are one access
+
+static uint32_t config_address(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset) {
+    return 0x80000000u | ((uint32_t)bus << 16) | ((uint32_t)slot << 11) | ((uint32_t)function << 8) |
+           (offset & 0xFC);
+}
+
+static uint32_t config_read(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset) {
+    uint32_t flags = spin_lock_irqsave(&config_lock);
+    outl(PCI_CONFIG_ADDRESS, config_address(bus, slot, function, offset));
+    uint32_t value = inl(PCI_CONFIG_DATA);
+    spin_unlock_irqrestore(&config_lock, flags);
+    return value;
+}
+
+static void config_write(uint8_t bus, uint8_t slot, uint8_t function, uint8_t offset, uint32_t value) {
+    uint32_t flags = spin_lock_irqsave(&config_lock);
+    outl(PCI_CONFIG_ADDRESS, config_address(bus, slot, function, offset));
+    outl(PCI_CONFIG_DATA, value);
+    spin_unlock_irqrestore(&config_lock, flags);
+}
+
+uint32_t pci_read32(const struct pci_device* dev, uint8_t offset) {
+    return config_read(dev->bus, dev->slot, dev->function, offset);
+}
+
+uint16_t pci_read16(const struct pci_device* dev, uint8_t offset) {
+    return (uint16_t)(pci_read32(dev, offset) >> ((offset & 2) * 8));
+}
+
+uint8_t pci_read8(const struct pci_device* dev, uint8_t offset) {
+    return (uint8_t)(pci_read32(dev, offset) >> ((offset & 3) * 8));
+}
+
+void pci_write32(const struct pci_device* dev, uint8_t offset, uint32_t value) {
+    config_write(dev->bus, dev->slot, dev->function, offset, value);
+}
+
+void pci_write16(const struct pci_device* dev, uint8_t offset, uint16_t value) {
+    // Read-modify-write of the whole dword, the other half keeps its value
+    uint32_t shift = (offset & 2) * 8;
+    uint32_t old = pci_read32(dev, offset);
+    pci_write32(dev, offset, (old & ~(0xFFFFu << shift)) | ((uint32_t)value << shift));
+}
+
+void pci_scan(int (*fn)(const struct pci_device* dev, void* ctx), void* ctx) {
+    for (uint32_t bus = 0; bus < 256; bus++) {
+        for (uint8_t slot = 0; slot < 32; slot++) {
+            struct pci_device dev = { (uint8_t)bus, slot, 0, 0, 0, 0, 0, 0 };
+            if ((uint16_t)pci_read32(&dev, PCI_VENDOR_ID) == 0xFFFF)
+                continue;
+            // Functions 1-7 only exist on multi-function devices
+            uint8_t functions = (pci_read8(&dev, PCI_HEADER_TYPE) & 0x80) ? 8 : 1;
+            for (uint8_t function = 0; function < functions; function++) {
+                dev.function = function;
+                uint32_t id = pci_read32(&dev, PCI_VENDOR_ID);
+                if ((uint16_t)id == 0xFFFF)
+                    continue;
+                uint32_t class_reg = pci_read32(&dev, 0x08);
+                dev.vendor = (uint16_t)id;
+                dev.device = (uint16_t)(id >> 16);
+                dev.class_code = (uint8_t)(class_reg >> 24);
+                dev.subclass = (uint8_t)(class_reg >> 16);
+                dev.prog_if = (uint8_t)(class_reg >> 8);
+                if (fn(&dev, ctx))
+                    return;
+            }
+        }
+    }
+}
+
+struct class_match {
+    uint8_t class_code;
+    uint8_t subclass;
+    struct pci_device* out;
+    int found;
+};
+
+static int match_class(const struct pci_device* dev, void* ctx) {
+    struct class_match* m = ctx;
+    if (dev->class_code != m->class_code || dev->subclass != m->subclass)
+        return 0;
+    *m->out = *dev;
+    m->found = 1;
+    return 1;
+}
+
+int pci_find_class(uint8_t class_code, uint8_t subclass, struct pci_device* out) {
+    struct class_match m = { class_code, subclass, out, 0 };
+    pci_scan(match_class, &m);
+    return m.found;
+}
+
+uint32_t pci_bar(const struct pci_device* dev, int n) {
+    uint32_t bar = pci_read32(dev, PCI_BAR0 + 4 * n);
+    return (bar & PCI_BAR_IO) ? (bar & ~0x3u) : (bar & ~0xFu);
+}
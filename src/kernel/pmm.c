@@ -0,0 +1,264 @@
+#include <kernel/pmm.h>
+#include <kernel/multiboot.h>
+#include <kernel/spinlock.h>
+#include <kernel/klib.h>
+#include <kernel/selftest.h>
+
+#define PMM_FREE 0x80        // page_info flag: head of a free block
+#define PMM_ORDER_MASK 0x0F
+
+#define PMM_MAX_RANGES 64
+#define PMM_LOW_LIMIT 0x100000 // Leave real-mode memory, BIOS and VGA alone
+
+/* Symbols from scripts/linker.ld */
+extern char _kernel_start[];
+extern char _kernel_end[];
+
+/* Free blocks keep their list links in the block itself */
+struct free_block {
+    struct free_block* next;
+    struct free_block* prev;
+};
+
+struct mem_range {
+    uint32_t start;
+    uint32_t end;
+};
+
+static struct free_block* free_lists[PMM_MAX_ORDER + 1];
+static uint32_t free_counts[PMM_MAX_ORDER + 1];
+
+/*
+ * One byte per page frame. For the first page of a free block it holds
+ * PMM_FREE | order, everything else is 0. That is all the buddy check
+ * needs: a buddy can be merged iff its first page says "free, same order".
+ */
+static uint8_t* page_info = NULL;
+static uint32_t max_pfn = 0;
+static uint32_t total_pages = 0;
+static uint32_t free_pages = 0;
+static spinlock_t pmm_lock = SPINLOCK_INIT;
+
+static inline void free_list_push(unsigned int order, uint32_t pfn) {
+    struct free_block* block = (struct free_block*)((uintptr_t)pfn << PAGE_SHIFT);
+    block->prev = NULL;
+    block->next = free_lists[order];
+    if (block->next)
+        block->next->prev = block;
+    free_lists[order] = block;
+    free_counts[order]++;
+    page_info[pfn] = PMM_FREE | order;
+}
+
+static inline void free_list_remove(unsigned int order, uint32_t pfn) {
+    struct free_block* block = (struct free_block*)((uintptr_t)pfn << PAGE_SHIFT);
+    if (block->prev)
+        block->prev->next = block->next;
+    else
+        free_lists[order] = block->next;
+    if (block->next)
+        block->next->prev = block->prev;
+    free_counts[order]--;
+    page_info[pfn] = 0;
+}
+
+// Insert a block and merge it with its buddies as far as possible
+static void pmm_free_block(uint32_t pfn, unsigned int order) {
+    while (order < PMM_MAX_ORDER) {
+        uint32_t buddy = pfn ^ (1u << order);
+        if (buddy >= max_pfn || page_info[buddy] != (PMM_FREE | order))
+            break;
+        free_list_remove(order, buddy);
+        pfn &= ~(1u << order);
+        order++;
+    }
+    free_list_push(order, pfn);
+}
+
+uintptr_t pmm_alloc(unsigned int order) {
+    if (order > PMM_MAX_ORDER)
+        return 0;
+
+    uint32_t flags = spin_lock_irqsave(&pmm_lock);
+    unsigned int k = order;
+    while (k <= PMM_MAX_ORDER && !free_lists[k])
+        k++;
+    if (k > PMM_MAX_ORDER) {
+        spin_unlock_irqrestore(&pmm_lock, flags);
+        return 0;
+    }
+
+    uint32_t pfn = (uintptr_t)free_lists[k] >> PAGE_SHIFT;
+    free_list_remove(k, pfn);
+    // Split, handing the upper halves back to the smaller lists
+    while (k > order) {
+        k--;
+        free_list_push(k, pfn + (1u << k));
+    }
+    free_pages -= 1u << order;
+    spin_unlock_irqrestore(&pmm_lock, flags);
+    return (uintptr_t)pfn << PAGE_SHIFT;
+}
+
+void pmm_free(uintptr_t addr, unsigned int order) {
+    if (!addr || order > PMM_MAX_ORDER)
+        return;
+
+    uint32_t flags = spin_lock_irqsave(&pmm_lock);
+    pmm_free_block(addr >> PAGE_SHIFT, order);
+    free_pages += 1u << order;
+    spin_unlock_irqrestore(&pmm_lock, flags);
+}
+
+unsigned int pmm_order_for(size_t size) {
+    unsigned int order = 0;
+    while (((size_t)PAGE_SIZE << order) < size)
+        order++;
+    return order;
+}
+
+// Cut [start, end) out of every range in the list
+static void ranges_subtract(struct mem_range* ranges, int* count, uint32_t start, uint32_t end) {
+    for (int i = 0; i < *count; i++) {
+        struct mem_range* r = &ranges[i];
+        if (end <= r->start || start >= r->end)
+            continue;
+        if (start > r->start && end < r->end && *count < PMM_MAX_RANGES) {
+            // Hole in the middle: split in two
+            ranges[*count].start = end;
+            ranges[*count].end = r->end;
+            (*count)++;
+            r->end = start;
+        } else if (start > r->start) {
+            r->end = start;
+        } else {
+            r->start = end < r->end ? end : r->end;
+        }
+    }
+}
+
+void pmm_init(void) {
+    struct mem_range ranges[PMM_MAX_RANGES];
+    int count = 0;
+
+    const struct multiboot_tag_mmap* mmap =
+        (const struct multiboot_tag_mmap*)multiboot_find_tag(MULTIBOOT_TAG_MMAP, NULL);
+    if (!mmap)
+        return;
+
+    // Usable RAM below 4 GiB, trimmed to whole pages
+    const uint8_t* end = (const uint8_t*)mmap + mmap->size;
+    for (const uint8_t* p = (const uint8_t*)mmap->entries; p < end; p += mmap->entry_size) {
+        const struct multiboot_mmap_entry* e = (const struct multiboot_mmap_entry*)p;
+        if (e->type != MULTIBOOT_MEMORY_AVAILABLE || e->addr >= 0x100000000ULL)
+            continue;
+        uint64_t top = e->addr + e->len;
+        if (top > 0xFFFFF000ULL)
+            top = 0xFFFFF000ULL;
+        uint32_t start = ((uint32_t)e->addr + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+        uint32_t stop = (uint32_t)top & ~(PAGE_SIZE - 1);
+        if (start < stop && count < PMM_MAX_RANGES) {
+            ranges[count].start = start;
+            ranges[count].end = stop;
+            count++;
+        }
+    }
+
+    // Things that live in RAM already
+    ranges_subtract(ranges, &count, 0, PMM_LOW_LIMIT);
+    ranges_subtract(ranges, &count, (uintptr_t)_kernel_start, (uintptr_t)_kernel_end);
+    ranges_subtract(ranges, &count, multiboot_info_addr(),
+                    multiboot_info_addr() + multiboot_info_size());
+    for (const struct multiboot_tag* tag = multiboot_find_tag(MULTIBOOT_TAG_MODULE, NULL); tag;
+         tag = multiboot_find_tag(MULTIBOOT_TAG_MODULE, tag)) {
+        const struct multiboot_tag_module* mod = (const struct multiboot_tag_module*)tag;
+        ranges_subtract(ranges, &count, mod->mod_start, mod->mod_end);
+    }
+
+    for (int i = 0; i < count; i++) {
+        // Page-align again, reservations may end mid-page
+        ranges[i].start = (ranges[i].start + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+        ranges[i].end &= ~(PAGE_SIZE - 1);
+        if (ranges[i].end >> PAGE_SHIFT > max_pfn)
+            max_pfn = ranges[i].end >> PAGE_SHIFT;
+    }
+
+    // The page_info array is carved from the first range large enough
+    uint32_t info_size = (max_pfn + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    for (int i = 0; i < count; i++) {
+        if (ranges[i].start < ranges[i].end && ranges[i].end - ranges[i].start >= info_size) {
+            page_info = (uint8_t*)(uintptr_t)ranges[i].start;
+            ranges[i].start += info_size;
+            break;
+        }
+    }
+    if (!page_info)
+        return;
+    memset(page_info, 0, max_pfn);
+
+    // Hand out each range as the largest naturally aligned blocks that fit,
+    // so a 3 GiB machine takes ~800 insertions rather than 800k
+    for (int i = 0; i < count; i++) {
+        uint32_t pfn = ranges[i].start >> PAGE_SHIFT;
+        uint32_t last = ranges[i].end >> PAGE_SHIFT;
+        while (pfn < last) {
+            unsigned int order = PMM_MAX_ORDER;
+            while (order > 0 && ((pfn & ((1u << order) - 1)) || pfn + (1u << order) > last))
+                order--;
+            pmm_free_block(pfn, order);
+            pfn += 1u << order;
+            total_pages += 1u << order;
+        }
+    }
+    free_pages = total_pages;
+}
+
+void pmm_get_stats(struct pmm_stats* out) {
+    uint32_t flags = spin_lock_irqsave(&pmm_lock);
+    out->total_pages = total_pages;
+    out->free_pages = free_pages;
+    for (int i = 0; i <= PMM_MAX_ORDER; i++)
+        out->free_blocks[i] = free_counts[i];
+    spin_unlock_irqrestore(&pmm_lock, flags);
+}
+
+/* Self-test, see selftest.h */
+#define PMM_TEST_ORDER 6  // Blocks of 4 KiB up to 256 KiB
+
+static const char* pmm_selftest(void) {
+    uintptr_t blocks[PMM_TEST_ORDER + 1];
+    struct pmm_stats before, after;
+    const char* error = NULL;
+
+    pmm_get_stats(&before);
+    if (!before.total_pages)
+        return "no memory map";
+    for (unsigned int order = 0; order <= PMM_TEST_ORDER; order++) {
+        blocks[order] = pmm_alloc(order);
+        if (!blocks[order]) {
+            error = "out of memory";
+        } else if (blocks[order] & (((uintptr_t)PAGE_SIZE << order) - 1)) {
+            error = "block not naturally aligned";
+        } else {
+            memset((void*)blocks[order], order + 1, (size_t)PAGE_SIZE << order);
+        }
+    }
+    // Every block still holds its own fill if none of them overlap
+    for (unsigned int order = 0; order <= PMM_TEST_ORDER && !error; order++) {
+        const uint8_t* b = (const uint8_t*)blocks[order];
+        if (b[0] != order + 1 || b[((size_t)PAGE_SIZE << order) - 1] != order + 1)
+            error = "blocks overlap";
+    }
+    for (unsigned int order = 0; order <= PMM_TEST_ORDER; order++)
+        pmm_free(blocks[order], order);
+
+    // Buddies merge back to the same free blocks as before
+    pmm_get_stats(&after);
+    if (!error && after.free_pages != before.free_pages)
+        error = "free page count changed";
+    for (unsigned int order = 0; order <= PMM_MAX_ORDER && !error; order++)
+        if (after.free_blocks[order] != before.free_blocks[order])
+            error = "buddies not merged back";
+    return error;
+}
+SELFTEST(pmm, pmm_selftest);
@@ -0,0 +1,136 @@
+#include <kernel/prof.h>
+#include <kernel/ksyms.h>
+#include <kernel/slab.h>
+#include <kernel/vga.h>
+#include <kernel/spinlock.h>
+#include <kernel/atomic.h>
+#include <kernel/klib.h>
+
+#define PROF_MAX_TOP 32
+
+/*
+ * hits[i] for function i, hits[count] for code outside the symbol table.
+ * Every CPU samples from its own timer without a lock, so the counters
+ * are bumped with locked increments, and the histogram is never freed
+ * once allocated: prof_reset() zeroes it instead. A sample already past
+ * the running check when that happens may still land in it.
+ */
+static volatile uint32_t* hits = NULL;
+static volatile uint32_t total = 0;
+static volatile int running = 0;
+static spinlock_t prof_lock = SPINLOCK_INIT; // Installing hits
+
+int prof_start(void) {
+    if (!hits) {
+        size_t size = (ksym_count() + 1) * sizeof(uint32_t);
+        uint32_t* table = kmalloc(size);
+        if (!table)
+            return 0;
+        memset(table, 0, size);
+        uint32_t flags = spin_lock_irqsave(&prof_lock);
+        if (!hits) {
+            hits = table;
+            table = NULL;
+        }
+        spin_unlock_irqrestore(&prof_lock, flags);
+        kfree(table); // Someone else got there first
+    }
+    barrier(); // The table is in place before any CPU sees running
+    running = 1;
+    return 1;
+}
+
+void prof_stop(void) {
+    running = 0;
+}
+
+int prof_running(void) {
+    return running;
+}
+
+void prof_reset(void) {
+    running = 0;
+    if (hits) {
+        for (uint32_t i = 0; i <= ksym_count(); i++)
+            hits[i] = 0;
+    }
+    total = 0;
+}
+
+void prof_sample(uintptr_t ip) {
+    if (!running)
+        return;
+    barrier(); // Read hits after running, see prof_start()
+    int index = ksym_index(ip);
+    atomic_inc(&hits[index < 0 ? ksym_count() : (uint32_t)index]);
+    atomic_inc(&total);
+}
+
+static void write_padded(uint32_t value, size_t width) {
+    size_t digits = 1;
+    for (uint32_t v = value; v >= 10; v /= 10)
+        digits++;
+    while (width-- > digits)
+        terminal_putchar(' ');
+    terminal_write_dec(value);
+}
+
+void prof_report(uint32_t top) {
+    uint32_t best[PROF_MAX_TOP];
+    uint32_t count = ksym_count();
+    uint32_t shown = 0;
+
+    if (!hits || !total) {
+        terminal_write("No samples\n");
+        return;
+    }
+    if (!count)
+        terminal_write("No symbol table in this kernel image\n");
+    if (top > PROF_MAX_TOP)
+        top = PROF_MAX_TOP;
+
+    // Sampling may still be running, so each counter is read once and
+    // the list is sorted by those readings
+    uint32_t best_hits[PROF_MAX_TOP];
+    // Insertion into a short sorted list, the table has a few hundred entries
+    for (uint32_t i = 0; i <= count; i++) {
+        uint32_t n = hits[i];
+        if (!n)
+            continue;
+        uint32_t pos = shown < top ? shown++ : top;
+        while (pos > 0 && best_hits[pos - 1] < n) {
+            if (pos < top) {
+                best[pos] = best[pos - 1];
+                best_hits[pos] = best_hits[pos - 1];
+            }
+            pos--;
+        }
+        if (pos < top) {
+            best[pos] = i;
+            best_hits[pos] = n;
+        }
+    }
+    // A sample counts its function before total, so a reset or a sample
+    // in flight can leave total short of what was read above
+    uint32_t samples = total;
+    if (shown && samples < best_hits[0])
+        samples = best_hits[0];
+    if (!samples) {
+        terminal_write("No samples\n");
+        return;
+    }
+
+    terminal_write_dec(samples);
+    terminal_write(running ? " samples, still running\n" : " samples\n");
+    terminal_write("  samples   share  function\n");
+    for (uint32_t i = 0; i < shown; i++) {
+        uint32_t permille = (uint32_t)((uint64_t)best_hits[i] * 1000 / samples);
+        write_padded(best_hits[i], 9);
+        write_padded(permille / 10, 6);
+        terminal_putchar('.');
+        terminal_putchar('0' + permille % 10);
+        terminal_write("%  ");
+        terminal_write(best[i] == count ? "(outside the kernel text)" : ksym_name((int)best[i]));
+        terminal_write("\n");
+    }
+}
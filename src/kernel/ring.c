@@ -0,0 +1,236 @@
+/*
+ * Stress tests and benchmarks for the lock-free rings (ring.h) and the
+ * locks (spinlock.h). The tests run their producers as threads of the
+ * caller's priority, spread over the CPUs; with one CPU they still
+ * interleave at every time slice.
+ */
+#include <kernel/ring.h>
+#include <kernel/spinlock.h>
+#include <kernel/sched.h>
+#include <kernel/timer.h>
+#include <kernel/klib.h>
+#include <kernel/selftest.h>
+#include <kernel/bench.h>
+
+#define STRESS_THREADS 3
+#define STRESS_COUNT 100000      // Values per producer
+#define STRESS_LOCK_ROUNDS 20000 // Lock round trips per thread
+#define STRESS_TIMEOUT_MS 5000
+#define STRESS_RING_SIZE 64      // Small, so the rings run full and wrap a lot
+
+static uintptr_t spsc_slots[STRESS_RING_SIZE];
+static struct mpsc_slot mpsc_slots[STRESS_RING_SIZE];
+
+static struct {
+    struct spsc_ring spsc;
+    struct mpsc_ring mpsc;
+    ticketlock_t ticket;
+    spinlock_t spin;
+    uint32_t counter;            // Only touched under the lock being tested
+    int use_ticket;              // Which lock lock_worker() takes
+    volatile int abort;
+    volatile uint32_t finished;
+} stress;
+
+static void stress_reset(void) {
+    memset(spsc_slots, 0, sizeof(spsc_slots));
+    memset(mpsc_slots, 0, sizeof(mpsc_slots));
+    stress.spsc = (struct spsc_ring)SPSC_RING_INIT(spsc_slots);
+    stress.mpsc = (struct mpsc_ring)MPSC_RING_INIT(mpsc_slots);
+    stress.ticket = (ticketlock_t)TICKETLOCK_INIT;
+    stress.spin = (spinlock_t)SPINLOCK_INIT;
+    stress.counter = 0;
+    stress.abort = 0;
+    stress.finished = 0;
+}
+
+// Start count threads, returns how many could be started
+static uint32_t stress_start(void (*entry)(void* arg), uint32_t count) {
+    uint32_t priority = thread_current()->priority;
+    uint32_t started = 0;
+    for (; started < count; started++) {
+        if (!thread_create("stress", entry, (void*)(uintptr_t)started, priority))
+            break;
+    }
+    return started;
+}
+
+// Wait for the threads, they see stress.abort if we give up on them
+static void stress_join(uint32_t threads) {
+    while (stress.finished < threads)
+        ksleep_ms(1);
+}
+
+static void spsc_producer(void* arg) {
+    (void)arg;
+    for (uint32_t i = 1; i <= STRESS_COUNT && !stress.abort; ) {
+        if (spsc_push(&stress.spsc, i))
+            i++;
+        else
+            thread_yield();
+    }
+    atomic_inc(&stress.finished);
+}
+
+static const char* spsc_selftest(void) {
+    if (!thread_current())
+        return NULL; // Batch mode before threads, nothing to test
+
+    stress_reset();
+    if (!stress_start(spsc_producer, 1))
+        return "thread_create failed";
+
+    const char* error = NULL;
+    uint64_t deadline = ktime_ns() + STRESS_TIMEOUT_MS * NS_PER_MS;
+    for (uint32_t expect = 1; expect <= STRESS_COUNT && !error; ) {
+        uintptr_t value;
+        if (spsc_pop(&stress.spsc, &value)) {
+            if (value != expect)
+                error = "values out of order";
+            expect++;
+        } else if (ktime_ns() > deadline) {
+            error = "timeout";
+        } else {
+            thread_yield();
+        }
+    }
+    stress.abort = 1;
+    stress_join(1);
+    if (!error && !spsc_empty(&stress.spsc))
+        error = "values left over";
+    return error;
+}
+SELFTEST(spsc_ring, spsc_selftest);
+
+// Values carry the producer in the top byte and a sequence number below
+static void mpsc_producer(void* arg) {
+    uintptr_t id = (uintptr_t)arg << 24;
+    for (uint32_t i = 1; i <= STRESS_COUNT && !stress.abort; ) {
+        if (mpsc_push(&stress.mpsc, id | i))
+            i++;
+        else
+            thread_yield();
+    }
+    atomic_inc(&stress.finished);
+}
+
+static const char* mpsc_selftest(void) {
+    uint32_t last[STRESS_THREADS] = { 0 };
+
+    if (!thread_current())
+        return NULL;
+
+    stress_reset();
+    uint32_t threads = stress_start(mpsc_producer, STRESS_THREADS);
+    if (!threads)
+        return "thread_create failed";
+
+    const char* error = NULL;
+    uint64_t deadline = ktime_ns() + STRESS_TIMEOUT_MS * NS_PER_MS;
+    for (uint32_t received = 0; received < threads * STRESS_COUNT && !error; ) {
+        uintptr_t value;
+        if (mpsc_pop(&stress.mpsc, &value)) {
+            uint32_t id = value >> 24;
+            if (id >= threads || (value & 0xFFFFFF) != last[id] + 1)
+                error = "values lost or out of order";
+            else
+                last[id]++;
+            received++;
+        } else if (ktime_ns() > deadline) {
+            error = "timeout";
+        } else {
+            thread_yield();
+        }
+    }
+    stress.abort = 1;
+    stress_join(threads);
+    if (!error && threads < STRESS_THREADS)
+        error = "thread_create failed";
+    if (!error && !mpsc_empty(&stress.mpsc))
+        error = "values left over";
+    return error;
+}
+SELFTEST(mpsc_ring, mpsc_selftest);
+
+// A read-modify-write the lock has to keep whole, with a pause in the
+// middle to widen the window
+static void lock_worker(void* arg) {
+    (void)arg;
+    int ticket = stress.use_ticket;
+    for (uint32_t i = 0; i < STRESS_LOCK_ROUNDS && !stress.abort; i++) {
+        uint32_t flags = ticket ? ticket_lock_irqsave(&stress.ticket) : spin_lock_irqsave(&stress.spin);
+        uint32_t value = stress.counter;
+        cpu_relax();
+        stress.counter = value + 1;
+        if (ticket)
+            ticket_unlock_irqrestore(&stress.ticket, flags);
+        else
+            spin_unlock_irqrestore(&stress.spin, flags);
+    }
+    atomic_inc(&stress.finished);
+}
+
+static const char* lock_stress(int ticket) {
+    if (!thread_current())
+        return NULL;
+
+    stress_reset();
+    stress.use_ticket = ticket;
+    uint32_t threads = stress_start(lock_worker, STRESS_THREADS);
+    uint64_t deadline = ktime_ns() + STRESS_TIMEOUT_MS * NS_PER_MS;
+    while (stress.finished < threads && ktime_ns() < deadline)
+        ksleep_ms(1);
+    if (stress.finished < threads) {
+        stress.abort = 1;
+        stress_join(threads);
+        return "timeout";
+    }
+    if (threads < STRESS_THREADS)
+        return "thread_create failed";
+    if (stress.counter != threads * STRESS_LOCK_ROUNDS)
+        return "updates lost";
+    return NULL;
+}
+
+static const char* spinlock_selftest(void) {
+    return lock_stress(0);
+}
+SELFTEST(spinlock, spinlock_selftest);
+
+static const char* ticketlock_selftest(void) {
+    return lock_stress(1);
+}
+SELFTEST(ticketlock, ticketlock_selftest);
+
+/* Benchmarks, see bench.h. Uncontended, one push and pop or one lock and
+ * unlock per call */
+static uintptr_t bench_sink;
+
+static int bench_setup(void) {
+    stress_reset();
+    return 0;
+}
+
+static void bench_spsc(void) {
+    spsc_push(&stress.spsc, 1);
+    spsc_pop(&stress.spsc, &bench_sink);
+}
+BENCH(spsc_push_pop, bench_spsc, bench_setup, NULL, 4000);
+
+static void bench_mpsc(void) {
+    mpsc_push(&stress.mpsc, 1);
+    mpsc_pop(&stress.mpsc, &bench_sink);
+}
+BENCH(mpsc_push_pop, bench_mpsc, bench_setup, NULL, 4000);
+
+static void bench_spin_lock(void) {
+    spin_lock(&stress.spin);
+    spin_unlock(&stress.spin);
+}
+BENCH(spin_lock_unlock, bench_spin_lock, bench_setup, NULL, 4000);
+
+static void bench_ticket_lock(void) {
+    ticket_lock(&stress.ticket);
+    ticket_unlock(&stress.ticket);
+}
+BENCH(ticket_lock_unlock, bench_ticket_lock, bench_setup, NULL, 4000);
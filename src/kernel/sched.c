@@ -0,0 +1,615 @@
+#include <kernel/sched.h>
+#include <kernel/apic.h>
+#include <kernel/pmm.h>
+#include <kernel/slab.h>
+#include <kernel/klib.h>
+#include <kernel/vga.h>
+#include <kernel/io.h>
+#include <kernel/selftest.h>
+#include <kernel/trace.h>
+
+#define STACK_SIZE (PAGE_SIZE << THREAD_STACK_ORDER)
+#define STACK_CANARY 0x57AC4ED5u // At the lowest stack word, checked on every switch
+#define EFLAGS_IF (1 << 9)
+
+// switch.asm: save the callee-saved registers on the current stack, store
+// the stack pointer in *save_sp, then load load_sp and pop the next
+// thread's registers
+extern void switch_context(uintptr_t* save_sp, uintptr_t load_sp);
+
+// Callee-saved registers switch_context() keeps on the stack: ebp, ebx,
+// esi, edi, or rbp, rbx and r12-r15 in long mode
+#ifdef __x86_64__
+#define SWITCH_SAVED_REGS 6
+#else
+#define SWITCH_SAVED_REGS 4
+#endif
+
+// One FIFO per priority
+struct run_queue {
+    struct thread* head;
+    struct thread* tail;
+};
+
+struct sched_cpu {
+    spinlock_t lock;                            // The run queues and ready
+    struct run_queue queues[THREAD_PRIORITIES];
+    volatile uint32_t ready;                    // Threads in the queues
+    struct thread* idle;
+    struct thread* prev;                        // Switched away from, see finish_switch()
+    volatile int need_resched;
+    uint64_t idle_ticks;
+    uint32_t steals;
+} __attribute__((aligned(64)));
+
+/*
+ * Locking: a run queue lock is never held while taking another one. Wait
+ * queue locks come before run queue locks (waking a thread queues it),
+ * threads_lock is only nested around pmm/kmalloc calls. All of them are
+ * taken with interrupts off.
+ */
+static struct sched_cpu sched_cpus[SMP_MAX_CPUS];
+static spinlock_t threads_lock = SPINLOCK_INIT; // all_threads, zombies, next_id
+static struct thread* all_threads = NULL;
+static struct thread* zombies = NULL;           // Exited, an idle thread frees them
+static uint32_t next_id = 0;
+static volatile int started = 0;
+
+static inline struct sched_cpu* this_sched(void) {
+    return &sched_cpus[this_cpu()->id];
+}
+
+static void run_queue_push(struct sched_cpu* sc, struct thread* t) {
+    struct run_queue* q = &sc->queues[t->priority];
+    t->next = NULL;
+    if (q->tail)
+        q->tail->next = t;
+    else
+        q->head = t;
+    q->tail = t;
+    sc->ready++;
+}
+
+// Highest priority thread, skipping pinned ones when another CPU steals
+static struct thread* run_queue_pop(struct sched_cpu* sc, int stealing) {
+    for (int p = 0; p < THREAD_PRIORITIES; p++) {
+        struct run_queue* q = &sc->queues[p];
+        struct thread* prev = NULL;
+        for (struct thread* t = q->head; t; prev = t, t = t->next) {
+            if (stealing && t->pinned)
+                continue;
+            if (prev)
+                prev->next = t->next;
+            else
+                q->head = t->next;
+            if (q->tail == t)
+                q->tail = prev;
+            t->next = NULL;
+            sc->ready--;
+            return t;
+        }
+    }
+    return NULL;
+}
+
+// Anything ready at this priority or a better one. Unlocked, a hint
+static int run_queue_ready(struct sched_cpu* sc, uint32_t priority) {
+    for (uint32_t p = 0; p <= priority && p < THREAD_PRIORITIES; p++) {
+        if (sc->queues[p].head)
+            return 1;
+    }
+    return 0;
+}
+
+static int cpu_is_idle(uint32_t cpu) {
+    return smp_cpu(cpu)->current == sched_cpus[cpu].idle && !sched_cpus[cpu].ready;
+}
+
+// Where a woken thread should run: where it ran before if that CPU is
+// idle, else any idle CPU, else where it ran before
+static uint32_t select_cpu(const struct thread* t) {
+    if (t->pinned || cpu_is_idle(t->cpu))
+        return t->cpu;
+    for (uint32_t cpu = 0; cpu < smp_cpu_count(); cpu++) {
+        if (cpu_is_idle(cpu))
+            return cpu;
+    }
+    return t->cpu;
+}
+
+// Interrupts off. Idle threads are never queued, they have the lowest
+// priority of all so any wakeup preempts them.
+static void make_ready(struct thread* t) {
+    uint32_t cpu = select_cpu(t);
+    struct sched_cpu* sc = &sched_cpus[cpu];
+
+    spin_lock(&sc->lock);
+    t->cpu = cpu;
+    t->state = THREAD_READY;
+    run_queue_push(sc, t);
+    spin_unlock(&sc->lock);
+
+    struct cpu* target = smp_cpu(cpu);
+    struct thread* running = target->current;
+    if (running && t->priority < running->priority) {
+        sc->need_resched = 1;
+        if (target != this_cpu())
+            lapic_send_ipi(target->apic_id, APIC_RESCHEDULE_VECTOR);
+    }
+}
+
+// Take a thread from the CPU with the most waiting, NULL if none has any
+static struct thread* steal(uint32_t self) {
+    uint32_t victim = self, most = 0;
+    for (uint32_t cpu = 0; cpu < smp_cpu_count(); cpu++) {
+        if (cpu != self && sched_cpus[cpu].ready > most) {
+            most = sched_cpus[cpu].ready;
+            victim = cpu;
+        }
+    }
+    if (victim == self)
+        return NULL;
+
+    struct sched_cpu* sc = &sched_cpus[victim];
+    spin_lock(&sc->lock);
+    struct thread* t = run_queue_pop(sc, 1);
+    spin_unlock(&sc->lock);
+    if (t)
+        sched_cpus[self].steals++;
+    return t;
+}
+
+static void check_stack(struct thread* t) {
+    if (t->stack && *(uint32_t*)t->stack != STACK_CANARY) {
+        terminal_write("\nKERNEL PANIC: stack overflow in thread ");
+        terminal_write(t->name);
+        terminal_write("\n");
+        terminal_flush();
+        while (1)
+            __asm__ volatile ("cli; hlt");
+    }
+}
+
+// Runs first thing on the new thread's stack: the old one's registers are
+// saved now, another CPU may pick it up
+static void finish_switch(void) {
+    struct sched_cpu* sc = this_sched();
+    __asm__ volatile ("" : : : "memory");
+    sc->prev->on_cpu = 0;
+}
+
+// Interrupts off. Picks the next thread, the current one goes back to its
+// run queue unless it blocked or exited.
+static void schedule(void) {
+    struct cpu* cpu = this_cpu();
+    struct sched_cpu* sc = &sched_cpus[cpu->id];
+    struct thread* prev = cpu->current;
+
+    check_stack(prev);
+    sc->need_resched = 0;
+    spin_lock(&sc->lock);
+    if (prev->state == THREAD_RUNNING && prev != sc->idle) {
+        prev->state = THREAD_READY;
+        run_queue_push(sc, prev);
+    }
+    struct thread* next = run_queue_pop(sc, 0);
+    spin_unlock(&sc->lock);
+    if (!next)
+        next = steal(cpu->id);
+    if (!next)
+        next = sc->idle;
+    if (next == prev) {
+        prev->state = THREAD_RUNNING;
+        return;
+    }
+
+    // Woken right after it blocked: its CPU may still be switching away
+    while (next->on_cpu)
+        cpu_relax();
+
+    if (prev == sc->idle)
+        prev->state = THREAD_READY;
+    next->on_cpu = 1;
+    next->cpu = cpu->id;
+    next->state = THREAD_RUNNING;
+    next->slice = SCHED_SLICE_TICKS;
+    next->switches++;
+    sc->prev = prev;
+    cpu->current = next;
+    TRACE_INSTANT(TRACE_SCHED_SWITCH, next->id);
+    switch_context(&prev->sp, next->sp);
+    finish_switch();
+}
+
+// First code a new thread runs, switch_context() returns here
+static void thread_bootstrap(void) {
+    finish_switch();
+    struct thread* self = this_cpu_current();
+    sti();
+    self->entry(self->arg);
+    thread_exit();
+}
+
+static void add_thread(struct thread* t) {
+    uint32_t flags = spin_lock_irqsave(&threads_lock);
+    t->id = next_id++;
+    t->all_next = all_threads;
+    all_threads = t;
+    spin_unlock_irqrestore(&threads_lock, flags);
+}
+
+// Make the context we run in this CPU's idle thread
+static void idle_thread_init(struct thread* idle, uintptr_t stack) {
+    struct cpu* cpu = this_cpu();
+    struct sched_cpu* sc = &sched_cpus[cpu->id];
+
+    memset(idle, 0, sizeof(*idle));
+    strncpy(idle->name, "idle", THREAD_NAME_LEN - 1);
+    if (cpu->id) {
+        idle->name[4] = '0' + cpu->id;  // idle1, idle2 ...
+        idle->name[5] = '\0';
+    }
+    idle->state = THREAD_RUNNING;
+    idle->priority = THREAD_PRIORITIES; // Below every run queue
+    idle->cpu = cpu->id;
+    idle->pinned = 1;
+    idle->on_cpu = 1;
+    idle->stack = stack;
+    if (stack)
+        *(uint32_t*)stack = STACK_CANARY;
+    add_thread(idle);
+
+    sc->idle = idle;
+    cpu->current = idle;
+}
+
+void sched_init(void) {
+    static struct thread boot_thread;
+    idle_thread_init(&boot_thread, 0);
+    started = 1;
+}
+
+void sched_init_ap(uintptr_t stack) {
+    struct thread* idle = kmalloc(sizeof(*idle));
+    if (!idle) {
+        while (1) // The CPU stays offline
+            __asm__ volatile ("cli; hlt");
+    }
+    idle_thread_init(idle, stack);
+}
+
+int sched_running(void) {
+    return started;
+}
+
+struct thread* thread_create(const char* name, void (*entry)(void* arg), void* arg, uint32_t priority) {
+    return thread_create_on(name, entry, arg, priority, SCHED_ANY_CPU);
+}
+
+struct thread* thread_create_on(const char* name, void (*entry)(void* arg), void* arg, uint32_t priority,
+                                uint32_t cpu) {
+    if (!started || priority >= THREAD_PRIORITIES)
+        return NULL;
+    if (cpu != SCHED_ANY_CPU && cpu >= smp_cpu_count())
+        return NULL;
+
+    struct thread* t = kmalloc(sizeof(*t));
+    if (!t)
+        return NULL;
+    uintptr_t stack = pmm_alloc(THREAD_STACK_ORDER);
+    if (!stack) {
+        kfree(t);
+        return NULL;
+    }
+
+    memset(t, 0, sizeof(*t));
+    strncpy(t->name, name, THREAD_NAME_LEN - 1);
+    t->priority = priority;
+    t->pinned = cpu != SCHED_ANY_CPU;
+    t->cpu = t->pinned ? cpu : smp_cpu_id();
+    t->stack = stack;
+    t->entry = entry;
+    t->arg = arg;
+    *(uint32_t*)stack = STACK_CANARY;
+
+    // What switch_context() pops: the saved registers, then the return
+    // address, with a dummy return address for thread_bootstrap() above.
+    // That leaves the stack as a call would, 16-byte aligned for x86_64.
+    uintptr_t* sp = (uintptr_t*)(stack + STACK_SIZE);
+    *--sp = 0;
+    *--sp = (uintptr_t)thread_bootstrap;
+    for (int i = 0; i < SWITCH_SAVED_REGS; i++)
+        *--sp = 0;
+    t->sp = (uintptr_t)sp;
+
+    add_thread(t);
+    uint32_t flags = irq_save();
+    make_ready(t);
+    irq_restore(flags);
+    return t;
+}
+
+struct thread* thread_current(void) {
+    return started ? this_cpu_current() : NULL;
+}
+
+void thread_yield(void) {
+    if (!started)
+        return;
+    uint32_t flags = irq_save();
+    schedule();
+    irq_restore(flags);
+}
+
+void thread_exit(void) {
+    cli();
+    struct thread* self = this_cpu_current();
+    spin_lock(&threads_lock);
+    self->state = THREAD_DEAD;
+    self->next = zombies;
+    zombies = self;
+    spin_unlock(&threads_lock);
+    schedule();
+    while (1) // Not reached, nothing switches back to a dead thread
+        hlt();
+}
+
+int thread_stop(uint32_t id) {
+    int found = 0;
+    uint32_t flags = spin_lock_irqsave(&threads_lock);
+    for (struct thread* t = all_threads; t; t = t->all_next) {
+        if (t->id == id && t->stack && t->entry && t->state != THREAD_DEAD) {
+            t->stop = 1;
+            found = 1;
+            break;
+        }
+    }
+    spin_unlock_irqrestore(&threads_lock, flags);
+    return found;
+}
+
+int thread_should_stop(void) {
+    struct thread* self = thread_current();
+    return self && self->stop;
+}
+
+size_t sched_snapshot(struct thread_info* out, size_t max) {
+    size_t n = 0;
+    uint32_t flags = spin_lock_irqsave(&threads_lock);
+    for (struct thread* t = all_threads; t; t = t->all_next) {
+        if (n < max) {
+            out[n].id = t->id;
+            memcpy(out[n].name, t->name, THREAD_NAME_LEN);
+            out[n].state = t->state;
+            out[n].priority = t->priority;
+            out[n].cpu = t->cpu;
+            out[n].ticks = t->ticks;
+            out[n].switches = t->switches;
+        }
+        n++;
+    }
+    spin_unlock_irqrestore(&threads_lock, flags);
+    return n;
+}
+
+const char* thread_state_name(enum thread_state state) {
+    switch (state) {
+        case THREAD_RUNNING: return "running";
+        case THREAD_READY: return "ready";
+        case THREAD_BLOCKED: return "blocked";
+        case THREAD_DEAD: return "dead";
+    }
+    return "?";
+}
+
+void sched_cpu_stats(uint32_t cpu, struct sched_cpu_stats* out) {
+    struct sched_cpu* sc = &sched_cpus[cpu];
+    out->idle_ticks = sc->idle_ticks;
+    out->ready = sc->ready;
+    out->steals = sc->steals;
+}
+
+uint32_t wait_queue_lock(struct wait_queue* wq) {
+    return spin_lock_irqsave(&wq->lock);
+}
+
+void wait_queue_unlock(struct wait_queue* wq, uint32_t flags) {
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+// ktimer callback, from the timer IRQ. The waker changes the state with
+// the queue's lock held, so checking it under that lock is enough.
+static void wait_timeout(void* arg) {
+    struct thread* t = arg;
+    struct wait_queue* wq = t->waiting_on;
+
+    if (wq)
+        spin_lock(&wq->lock);
+    if (t->state == THREAD_BLOCKED) {
+        if (wq) {
+            struct thread* prev = NULL;
+            for (struct thread* w = wq->head; w; prev = w, w = w->next) {
+                if (w != t)
+                    continue;
+                if (prev)
+                    prev->next = t->next;
+                else
+                    wq->head = t->next;
+                if (wq->tail == t)
+                    wq->tail = prev;
+                break;
+            }
+        }
+        t->timed_out = 1;
+        make_ready(t);
+    }
+    if (wq)
+        spin_unlock(&wq->lock);
+}
+
+int wait_queue_sleep(struct wait_queue* wq, uint32_t flags, uint64_t deadline) {
+    struct thread* self = thread_current();
+
+    if (!self || self == this_sched()->idle) {
+        // Nobody to switch to, any interrupt ends the wait
+        if (wq)
+            spin_unlock(&wq->lock);
+        if (flags & EFLAGS_IF)
+            sti_hlt();
+        return 1;
+    }
+
+    self->state = THREAD_BLOCKED;
+    self->waiting_on = wq;
+    self->timed_out = 0;
+    if (wq) {
+        self->next = NULL;
+        if (wq->tail)
+            wq->tail->next = self;
+        else
+            wq->head = self;
+        wq->tail = self;
+    }
+    if (deadline)
+        ktimer_arm(&self->timeout, deadline, wait_timeout, self);
+    if (wq)
+        spin_unlock(&wq->lock);
+    schedule();
+    if (deadline)
+        ktimer_cancel(&self->timeout);
+    irq_restore(flags);
+    return !self->timed_out;
+}
+
+void wait_queue_wake_all(struct wait_queue* wq) {
+    uint32_t flags = spin_lock_irqsave(&wq->lock);
+    struct thread* t = wq->head;
+    wq->head = wq->tail = NULL;
+    while (t) {
+        struct thread* next = t->next;
+        make_ready(t);
+        t = next;
+    }
+    spin_unlock_irqrestore(&wq->lock, flags);
+}
+
+// Free the threads that exited once no CPU is still on their stack
+static void reap_zombies(void) {
+    uint32_t flags = spin_lock_irqsave(&threads_lock);
+    struct thread** link = &zombies;
+    while (*link) {
+        struct thread* t = *link;
+        if (t->on_cpu) {
+            link = &t->next;
+            continue;
+        }
+        *link = t->next;
+        for (struct thread** all = &all_threads; *all; all = &(*all)->all_next) {
+            if (*all == t) {
+                *all = t->all_next;
+                break;
+            }
+        }
+        pmm_free(t->stack, THREAD_STACK_ORDER);
+        kfree(t);
+    }
+    spin_unlock_irqrestore(&threads_lock, flags);
+}
+
+void sched_idle(void) {
+    while (1) {
+        reap_zombies();
+        cli();
+        schedule(); // Whatever is queued here or can be stolen
+        sti_hlt();
+    }
+}
+
+void sched_tick(void) {
+    if (!started)
+        return;
+    struct cpu* cpu = this_cpu();
+    struct sched_cpu* sc = &sched_cpus[cpu->id];
+    struct thread* t = cpu->current;
+
+    cpu->timer_ticks++;
+    t->ticks++;
+    if (t == sc->idle) {
+        sc->idle_ticks++;
+        return; // The idle loop looks for work after every interrupt
+    }
+    if (t->slice)
+        t->slice--;
+    if (!t->slice && run_queue_ready(sc, t->priority))
+        sc->need_resched = 1;
+}
+
+void sched_preempt(void) {
+    if (started && this_sched()->need_resched)
+        schedule();
+}
+
+/* Self-test, see selftest.h. Runs in a thread with interrupts enabled */
+struct selftest_sched {
+    struct wait_queue wq;
+    volatile int flag;
+    volatile int woken;
+    volatile uint32_t spins;
+    volatile int done;
+};
+
+static void selftest_waiter(void* arg) {
+    struct selftest_sched* s = arg;
+    uint32_t flags = wait_queue_lock(&s->wq);
+    while (!s->flag) {
+        wait_queue_sleep(&s->wq, flags, 0);
+        flags = wait_queue_lock(&s->wq);
+    }
+    wait_queue_unlock(&s->wq, flags);
+    s->woken = 1;
+}
+
+static void selftest_spinner(void* arg) {
+    struct selftest_sched* s = arg;
+    while (!thread_should_stop())
+        s->spins++;
+    s->done = 1;
+}
+
+static const char* sched_selftest(void) {
+    static struct selftest_sched s;
+    struct thread* self = thread_current();
+
+    if (!self || self == this_sched()->idle)
+        return NULL; // Batch mode before threads, nothing to test
+
+    memset(&s, 0, sizeof(s));
+    struct thread* waiter = thread_create("selftest_wait", selftest_waiter, &s, self->priority);
+    if (!waiter)
+        return "thread_create failed";
+    ksleep_ms(5);
+    if (waiter->state != THREAD_BLOCKED)
+        return "waiter did not block";
+    s.flag = 1;
+    wait_queue_wake_all(&s.wq);
+    ksleep_ms(5);
+    if (!s.woken)
+        return "wake_all did not wake the waiter";
+
+    // A thread of our own priority must get the CPU while we spin, on
+    // our CPU if no other one is free
+    struct thread* spinner = thread_create("selftest_spin", selftest_spinner, &s, self->priority);
+    if (!spinner)
+        return "thread_create failed";
+    uint32_t id = spinner->id;
+    kdelay_us(4 * SCHED_SLICE_TICKS * 1000000 / TIMER_HZ);
+    uint32_t spins = s.spins;
+    thread_stop(id);
+    while (!s.done)
+        ksleep_ms(1);
+    if (spins == 0)
+        return "no preemption";
+    return NULL;
+}
+
+SELFTEST(sched, sched_selftest);
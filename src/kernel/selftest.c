@@ -0,0 +1,62 @@
+#include <kernel/selftest.h>
+#include <kernel/vga.h>
+#include <kernel/serial.h>
+#include <kernel/timer.h>
+#include <kernel/klib.h>
+
+/* Symbols from scripts/linker.ld */
+extern const struct selftest __selftests_start[];
+extern const struct selftest __selftests_end[];
+
+const struct selftest* selftest_next(const struct selftest* prev) {
+    const struct selftest* t = prev ? prev + 1 : __selftests_start;
+    return t < __selftests_end ? t : NULL;
+}
+
+int selftest_run_all(const char* filter) {
+    size_t filter_len = strlen(filter);
+    int ran = 0, failed = 0;
+
+    serial_write("\r\n");
+    for (const struct selftest* t = selftest_next(NULL); t; t = selftest_next(t)) {
+        if (strncmp(t->name, filter, filter_len) != 0)
+            continue;
+        uint64_t start = ktime_ns();
+        const char* error = t->run();
+        uint32_t us = (uint32_t)((ktime_ns() - start) / NS_PER_US);
+        ran++;
+
+        terminal_write(t->name);
+        for (size_t len = strlen(t->name); len < 18; len++)
+            terminal_putchar(' ');
+        if (error) {
+            failed++;
+            terminal_setcolor(VGA_COLOR_LIGHT_RED);
+            terminal_write("FAIL ");
+            terminal_write(error);
+            terminal_setcolor(VGA_COLOR_WHITE);
+        } else {
+            terminal_write("ok");
+        }
+        terminal_write("\n");
+        terminal_flush();  // Show progress, some tests run for a while
+
+        serial_write("SELFTEST name=");
+        serial_write(t->name);
+        serial_write(error ? " result=fail us=" : " result=pass us=");
+        serial_write_dec(us);
+        if (error) {
+            serial_write(" error=\"");
+            serial_write(error);
+            serial_write("\"");
+        }
+        serial_write("\r\n");
+    }
+
+    serial_write("SELFTEST_SUMMARY ran=");
+    serial_write_dec(ran);
+    serial_write(" failed=");
+    serial_write_dec(failed);
+    serial_write("\r\n");
+    return ran ? failed : -1;
+}
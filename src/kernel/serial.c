@@ -0,0 +1,211 @@
+#include <kernel/serial.h>
+#include <kernel/input.h>
+#include <kernel/idt.h>
+#include <kernel/io.h>
+#include <kernel/spinlock.h>
+#include <kernel/ring.h>
+
+/* 16550 registers, relative to the base port */
+#define UART_DATA 0        // RBR/THR, divisor low byte when DLAB=1
+#define UART_IER 1         // Interrupt enable, divisor high byte when DLAB=1
+#define UART_IIR 2         // Interrupt identification (read)
+#define UART_FCR 2         // FIFO control (write)
+#define UART_LCR 3
+#define UART_MCR 4
+#define UART_LSR 5
+
+#define IER_RX_AVAILABLE 0x01
+#define IER_TX_EMPTY 0x02
+
+#define IIR_NO_INTERRUPT 0x01
+#define IIR_ID_MASK 0x0E
+#define IIR_TX_EMPTY 0x02
+#define IIR_RX_AVAILABLE 0x04
+#define IIR_RX_TIMEOUT 0x0C
+
+#define LSR_DATA_READY 0x01
+#define LSR_TX_EMPTY 0x20
+
+#define UART_FIFO_SIZE 16
+
+// Must be a power of two
+#define SERIAL_TX_SIZE 4096
+
+/*
+ * Writers append to tx_ring and make sure the THRE interrupt is enabled;
+ * the IRQ handler refills the 16-byte FIFO from the ring each time it runs
+ * dry and switches THRE off again once the ring is empty. So a write costs
+ * one port access at most, not one per byte.
+ *
+ * The ring is SPSC (see ring.h): writers on any CPU take turns on the
+ * ticket lock tx_lock and are its one producer, whoever holds fifo_lock
+ * (the IRQ handler, or a writer draining by polling) is its one consumer.
+ * So the IRQ never waits for a writer copying a long string. fifo_lock
+ * also covers IER, so THRE cannot be switched off after a writer queued
+ * more bytes.
+ */
+static uintptr_t tx_slots[SERIAL_TX_SIZE];
+static struct spsc_ring tx_ring = SPSC_RING_INIT(tx_slots);
+static ticketlock_t tx_lock = TICKETLOCK_INIT;
+static spinlock_t fifo_lock = SPINLOCK_INIT;
+static uint8_t ier = 0;
+static int serial_present = 0;
+static struct serial_stats stats;
+
+static void serial_set_ier(uint8_t value) {
+    if (ier != value) {
+        ier = value;
+        outb(SERIAL_COM1 + UART_IER, value);
+    }
+}
+
+// Move up to one FIFO worth of bytes from the ring to the UART.
+// Must be called holding fifo_lock and with the transmitter empty.
+static void serial_fill_fifo(void) {
+    uintptr_t c;
+    for (int i = 0; i < UART_FIFO_SIZE && spsc_pop(&tx_ring, &c); i++) {
+        outb(SERIAL_COM1 + UART_DATA, (uint8_t)c);
+        stats.tx_bytes++;
+    }
+}
+
+static void serial_wait_tx_empty(void) {
+    while (!(inb(SERIAL_COM1 + UART_LSR) & LSR_TX_EMPTY))
+        ;
+}
+
+// Drain the ring by polling, for when interrupts cannot do it for us.
+// Holding fifo_lock.
+static void serial_drain_polled(void) {
+    while (!spsc_empty(&tx_ring)) {
+        serial_wait_tx_empty();
+        serial_fill_fifo();
+    }
+}
+
+static void serial_irq(struct interrupt_frame* frame) {
+    (void)frame;
+    uint8_t iir;
+
+    while (!((iir = inb(SERIAL_COM1 + UART_IIR)) & IIR_NO_INTERRUPT)) {
+        switch (iir & IIR_ID_MASK) {
+        case IIR_TX_EMPTY:
+            spin_lock(&fifo_lock);
+            stats.tx_irqs++;
+            serial_fill_fifo();
+            if (spsc_empty(&tx_ring))
+                serial_set_ier(IER_RX_AVAILABLE);
+            spin_unlock(&fifo_lock);
+            break;
+        case IIR_RX_AVAILABLE:
+        case IIR_RX_TIMEOUT:
+            while (inb(SERIAL_COM1 + UART_LSR) & LSR_DATA_READY) {
+                input_push(INPUT_SERIAL | inb(SERIAL_COM1 + UART_DATA));
+                stats.rx_bytes++;
+            }
+            break;
+        default:
+            // Line or modem status change, reading LSR clears both cases we enable
+            inb(SERIAL_COM1 + UART_LSR);
+            return;
+        }
+    }
+}
+
+int serial_init(uint16_t divisor) {
+    outb(SERIAL_COM1 + UART_IER, 0x00);                  // No interrupts while configuring
+    outb(SERIAL_COM1 + UART_LCR, 0x80);                  // DLAB on
+    outb(SERIAL_COM1 + UART_DATA, divisor & 0xFF);
+    outb(SERIAL_COM1 + UART_IER, (divisor >> 8) & 0xFF);
+    outb(SERIAL_COM1 + UART_LCR, 0x03);                  // 8N1, DLAB off
+    outb(SERIAL_COM1 + UART_FCR, 0xC7);                  // FIFOs on and cleared, RX trigger at 14 bytes
+
+    // Loopback self-test, a missing UART reads back 0xFF
+    outb(SERIAL_COM1 + UART_MCR, 0x1E);
+    outb(SERIAL_COM1 + UART_DATA, 0xAE);
+    if (inb(SERIAL_COM1 + UART_DATA) != 0xAE)
+        return 0;
+
+    outb(SERIAL_COM1 + UART_MCR, 0x0B);                  // DTR, RTS and OUT2 (IRQ line enable)
+    serial_present = 1;
+    ier = 0;
+    serial_set_ier(IER_RX_AVAILABLE);
+    irq_register_handler(SERIAL_COM1_IRQ, serial_irq);
+    return 1;
+}
+
+void serial_write_n(const char* str, size_t len) {
+    if (!serial_present)
+        return;
+
+    uint32_t flags = ticket_lock_irqsave(&tx_lock);
+    for (size_t i = 0; i < len; i++) {
+        if (!spsc_push(&tx_ring, (uint8_t)str[i])) {
+            // Ring full: make room ourselves rather than drop log output
+            stats.tx_stalls++;
+            spin_lock(&fifo_lock);
+            serial_wait_tx_empty();
+            serial_fill_fifo();
+            spin_unlock(&fifo_lock);
+            spsc_push(&tx_ring, (uint8_t)str[i]);
+        }
+    }
+
+    spin_lock(&fifo_lock);
+    if (flags & (1 << 9))
+        serial_set_ier(IER_RX_AVAILABLE | IER_TX_EMPTY); // The IRQ fires as soon as THR is empty
+    else
+        serial_drain_polled(); // Called with interrupts off (early boot, panic)
+    spin_unlock(&fifo_lock);
+    ticket_unlock_irqrestore(&tx_lock, flags);
+}
+
+void serial_write(const char* str) {
+    size_t len = 0;
+    while (str[len])
+        len++;
+    serial_write_n(str, len);
+}
+
+void serial_putchar(char c) {
+    serial_write_n(&c, 1);
+}
+
+void serial_write_dec(uint64_t value) {
+    char buf[20];
+    size_t i = sizeof(buf);
+    do {
+        buf[--i] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    serial_write_n(&buf[i], sizeof(buf) - i);
+}
+
+void serial_flush(void) {
+    if (!serial_present)
+        return;
+
+    uint32_t flags = ticket_lock_irqsave(&tx_lock);
+    spin_lock(&fifo_lock);
+    serial_drain_polled();
+    while (!(inb(SERIAL_COM1 + UART_LSR) & 0x40)) // Wait for the shift register too
+        ;
+    spin_unlock(&fifo_lock);
+    ticket_unlock_irqrestore(&tx_lock, flags);
+}
+
+void serial_console_write(const char* str, size_t len) {
+    size_t start = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (str[i] != '\n' && str[i] != '\b')
+            continue;
+        serial_write_n(str + start, i - start);
+        serial_write_n(str[i] == '\n' ? "\r\n" : "\b \b", str[i] == '\n' ? 2 : 3);
+        start = i + 1;
+    }
+    serial_write_n(str + start, len - start);
+}
+
+void serial_get_stats(struct serial_stats* out) {
+    *out = stats;
+}
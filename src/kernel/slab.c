@@ -0,0 +1,353 @@
+#include <kernel/slab.h>
+#include <kernel/pmm.h>
+#include <kernel/spinlock.h>
+#include <kernel/klib.h>
+#include <kernel/bench.h>
+#include <kernel/selftest.h>
+
+#define SLAB_MAGIC 0x534C4142  // "SLAB"
+#define LARGE_MAGIC 0x4C524745 // "LRGE"
+
+#define KMALLOC_CLASSES 7      // 16 .. 1024
+
+/*
+ * Every slab is one page with this header in its first cache line, so the
+ * owner of any object is found by masking the pointer: kfree() is O(1)
+ * and needs no size. Page-backed kmalloc() blocks start with a
+ * large_header instead and hand out the memory right after it.
+ */
+struct slab {
+    uint32_t magic;
+    struct kmem_cache* cache;
+    struct slab* next;
+    struct slab* prev;
+    void* free_list;
+    uint32_t inuse;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+struct large_header {
+    uint32_t magic;
+    uint32_t order;
+} __attribute__((aligned(CACHE_LINE_SIZE)));
+
+static struct kmem_cache cache_cache;  // Holds the kmem_cache structs themselves
+static struct kmem_cache kmalloc_caches[KMALLOC_CLASSES];
+static struct kmem_cache* cache_list = NULL;
+static struct kmalloc_stats large_stats;
+static int slab_ready = 0;
+static spinlock_t slab_lock = SPINLOCK_INIT; // All caches, allocations are short
+
+static void slab_list_remove(struct slab** list, struct slab* slab) {
+    if (slab->prev)
+        slab->prev->next = slab->next;
+    else
+        *list = slab->next;
+    if (slab->next)
+        slab->next->prev = slab->prev;
+    slab->next = slab->prev = NULL;
+}
+
+static void slab_list_push(struct slab** list, struct slab* slab) {
+    slab->prev = NULL;
+    slab->next = *list;
+    if (*list)
+        (*list)->prev = slab;
+    *list = slab;
+}
+
+static inline void** object_link(struct kmem_cache* cache, void* object) {
+    return (void**)((uint8_t*)object + cache->link_offset);
+}
+
+static void kmem_cache_setup(struct kmem_cache* cache, const char* name, size_t size,
+                             void (*ctor)(void* object)) {
+    size_t i = 0;
+    for (; name[i] && i < KMEM_CACHE_NAME_LEN - 1; i++)
+        cache->name[i] = name[i];
+    cache->name[i] = '\0';
+
+    // A constructed object must survive being free, so its link goes
+    // after the object instead of over its first word
+    cache->object_size = size;
+    cache->link_offset = ctor ? (size + sizeof(void*) - 1) & ~(sizeof(void*) - 1) : 0;
+    size_t need = ctor ? cache->link_offset + sizeof(void*) : size;
+    if (need < sizeof(void*))
+        need = sizeof(void*);
+
+    // Small objects get a power-of-two stride so none straddles a cache
+    // line, larger ones start on a cache line boundary
+    if (need <= CACHE_LINE_SIZE / 2) {
+        size_t stride = sizeof(void*);
+        while (stride < need)
+            stride <<= 1;
+        cache->stride = stride;
+    } else {
+        cache->stride = (need + CACHE_LINE_SIZE - 1) & ~(size_t)(CACHE_LINE_SIZE - 1);
+    }
+    cache->objects_per_slab = (PAGE_SIZE - sizeof(struct slab)) / cache->stride;
+    cache->ctor = ctor;
+    cache->partial = cache->full = cache->empty = NULL;
+    cache->slabs = cache->active_objects = cache->total_objects = 0;
+    cache->allocs = cache->frees = 0;
+    cache->next = cache_list;
+    cache_list = cache;
+}
+
+static struct slab* slab_create(struct kmem_cache* cache) {
+    struct slab* slab = (struct slab*)pmm_alloc(0);
+    if (!slab)
+        return NULL;
+
+    slab->magic = SLAB_MAGIC;
+    slab->cache = cache;
+    slab->next = slab->prev = NULL;
+    slab->inuse = 0;
+    slab->free_list = NULL;
+
+    // Thread the free list back to front so allocation walks the page upwards
+    uint8_t* base = (uint8_t*)slab + sizeof(struct slab);
+    for (uint32_t i = cache->objects_per_slab; i > 0; i--) {
+        void* object = base + (i - 1) * cache->stride;
+        if (cache->ctor)
+            cache->ctor(object);
+        *object_link(cache, object) = slab->free_list;
+        slab->free_list = object;
+    }
+    cache->slabs++;
+    cache->total_objects += cache->objects_per_slab;
+    return slab;
+}
+
+static void slab_destroy(struct kmem_cache* cache, struct slab* slab) {
+    cache->slabs--;
+    cache->total_objects -= cache->objects_per_slab;
+    slab->magic = 0;
+    pmm_free((uintptr_t)slab, 0);
+}
+
+void* kmem_cache_alloc(struct kmem_cache* cache) {
+    uint32_t flags = spin_lock_irqsave(&slab_lock);
+    struct slab* slab = cache->partial;
+
+    if (!slab) {
+        slab = cache->empty;
+        if (slab)
+            cache->empty = NULL;
+        else
+            slab = slab_create(cache);
+        if (!slab) {
+            spin_unlock_irqrestore(&slab_lock, flags);
+            return NULL;
+        }
+        slab_list_push(&cache->partial, slab);
+    }
+
+    void* object = slab->free_list;
+    slab->free_list = *object_link(cache, object);
+    if (++slab->inuse == cache->objects_per_slab) {
+        slab_list_remove(&cache->partial, slab);
+        slab_list_push(&cache->full, slab);
+    }
+    cache->active_objects++;
+    cache->allocs++;
+    spin_unlock_irqrestore(&slab_lock, flags);
+    return object;
+}
+
+void kmem_cache_free(struct kmem_cache* cache, void* object) {
+    struct slab* slab = (struct slab*)((uintptr_t)object & ~(uintptr_t)(PAGE_SIZE - 1));
+    uint32_t flags = spin_lock_irqsave(&slab_lock);
+
+    *object_link(cache, object) = slab->free_list;
+    slab->free_list = object;
+    if (slab->inuse-- == cache->objects_per_slab) {
+        slab_list_remove(&cache->full, slab);
+        slab_list_push(&cache->partial, slab);
+    }
+    if (slab->inuse == 0) {
+        slab_list_remove(&cache->partial, slab);
+        if (cache->empty)
+            slab_destroy(cache, slab);
+        else
+            cache->empty = slab;
+    }
+    cache->active_objects--;
+    cache->frees++;
+    spin_unlock_irqrestore(&slab_lock, flags);
+}
+
+static void slab_init(void) {
+    static const char* names[KMALLOC_CLASSES] = {
+        "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+        "kmalloc-256", "kmalloc-512", "kmalloc-1024",
+    };
+
+    kmem_cache_setup(&cache_cache, "kmem_cache", sizeof(struct kmem_cache), NULL);
+    for (int i = 0; i < KMALLOC_CLASSES; i++)
+        kmem_cache_setup(&kmalloc_caches[i], names[i], KMALLOC_MIN_SIZE << i, NULL);
+    slab_ready = 1;
+}
+
+struct kmem_cache* kmem_cache_create(const char* name, size_t size, void (*ctor)(void* object)) {
+    if (!slab_ready)
+        slab_init();
+    if (size == 0 || size > KMALLOC_MAX_SLAB_SIZE)
+        return NULL;
+
+    struct kmem_cache* cache = kmem_cache_alloc(&cache_cache);
+    if (!cache)
+        return NULL;
+    uint32_t flags = spin_lock_irqsave(&slab_lock);
+    kmem_cache_setup(cache, name, size, ctor);
+    spin_unlock_irqrestore(&slab_lock, flags);
+    return cache;
+}
+
+void* kmalloc(size_t size) {
+    if (!slab_ready)
+        slab_init();
+    if (size == 0)
+        return NULL;
+
+    if (size <= KMALLOC_MAX_SLAB_SIZE) {
+        int index = 0;
+        while ((size_t)(KMALLOC_MIN_SIZE << index) < size)
+            index++;
+        return kmem_cache_alloc(&kmalloc_caches[index]);
+    }
+
+    unsigned int order = pmm_order_for(size + sizeof(struct large_header));
+    struct large_header* header = (struct large_header*)pmm_alloc(order);
+    if (!header)
+        return NULL;
+    header->magic = LARGE_MAGIC;
+    header->order = order;
+
+    uint32_t flags = spin_lock_irqsave(&slab_lock);
+    large_stats.large_allocs++;
+    large_stats.large_pages += 1u << order;
+    spin_unlock_irqrestore(&slab_lock, flags);
+    return header + 1;
+}
+
+void kfree(void* ptr) {
+    if (!ptr)
+        return;
+
+    uintptr_t page = (uintptr_t)ptr & ~(uintptr_t)(PAGE_SIZE - 1);
+    const struct slab* slab = (const struct slab*)page;
+    if (slab->magic == SLAB_MAGIC && (uintptr_t)ptr >= page + sizeof(struct slab)) {
+        kmem_cache_free(slab->cache, ptr);
+        return;
+    }
+
+    struct large_header* header = (struct large_header*)page;
+    uint32_t flags = spin_lock_irqsave(&slab_lock);
+    if (header->magic != LARGE_MAGIC || ptr != header + 1) {
+        large_stats.bad_frees++;
+        spin_unlock_irqrestore(&slab_lock, flags);
+        return;
+    }
+    header->magic = 0;
+    large_stats.large_allocs--;
+    large_stats.large_pages -= 1u << header->order;
+    spin_unlock_irqrestore(&slab_lock, flags);
+    pmm_free(page, header->order);
+}
+
+const struct kmem_cache* kmem_cache_next(const struct kmem_cache* prev) {
+    if (!slab_ready)
+        slab_init();
+    return prev ? prev->next : cache_list;
+}
+
+void kmalloc_get_stats(struct kmalloc_stats* out) {
+    uint32_t flags = spin_lock_irqsave(&slab_lock);
+    *out = large_stats;
+    spin_unlock_irqrestore(&slab_lock, flags);
+}
+
+/* Benchmarks, see bench.h */
+static void bench_kmalloc_64(void) {
+    kfree(kmalloc(64));
+}
+BENCH(kmalloc_kfree_64, bench_kmalloc_64, NULL, NULL, 4000);
+
+static void bench_kmalloc_large(void) {
+    kfree(kmalloc(2 * PAGE_SIZE));
+}
+BENCH(kmalloc_kfree_8k, bench_kmalloc_large, NULL, NULL, 1000);
+
+/* Self-test, see selftest.h */
+#define SLAB_TEST_OBJECTS 300      // Several slabs of the test cache
+#define SLAB_TEST_PATTERN 0x5AB5AB5Au
+
+static void selftest_ctor(void* object) {
+    *(uint32_t*)object = SLAB_TEST_PATTERN;
+}
+
+static const char* slab_check_cache(void) {
+    static struct kmem_cache* cache;  // Caches live forever, make it once
+    void* objects[SLAB_TEST_OBJECTS];
+    const char* error = NULL;
+    int count = 0;
+
+    if (!cache)
+        cache = kmem_cache_create("selftest", 40, selftest_ctor);
+    if (!cache)
+        return "kmem_cache_create failed";
+    uint32_t active = cache->active_objects;
+
+    for (; count < SLAB_TEST_OBJECTS; count++) {
+        uint32_t* object = kmem_cache_alloc(cache);
+        if (!object) {
+            error = "out of memory";
+            break;
+        }
+        objects[count] = object;
+        if ((uintptr_t)object % sizeof(void*))
+            error = "object misaligned";
+        else if (object[0] != SLAB_TEST_PATTERN)
+            error = "constructor did not run";
+        for (int i = 1; i < 10; i++)
+            object[i] = count;
+    }
+    for (int n = 0; n < count && !error; n++)
+        for (int i = 1; i < 10; i++)
+            if (((uint32_t*)objects[n])[i] != (uint32_t)n)
+                error = "objects overlap";
+    for (int n = 0; n < count; n++)
+        kmem_cache_free(cache, objects[n]);
+    if (!error && cache->active_objects != active)
+        error = "active object count changed";
+    return error;
+}
+
+static const char* slab_selftest(void) {
+    static const size_t sizes[] = { 1, 16, 17, 64, 100, 512, 1024, 1025, 4096, 3 * PAGE_SIZE };
+    void* blocks[sizeof(sizes) / sizeof(sizes[0])];
+    struct kmalloc_stats before, after;
+    const char* error = slab_check_cache();
+    if (error)
+        return error;
+
+    kmalloc_get_stats(&before);
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+        blocks[i] = kmalloc(sizes[i]);
+        if (!blocks[i])
+            return "kmalloc out of memory";
+        memset(blocks[i], (int)i + 1, sizes[i]);
+    }
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]) && !error; i++) {
+        const uint8_t* b = blocks[i];
+        if (b[0] != i + 1 || b[sizes[i] - 1] != i + 1)
+            error = "kmalloc blocks overlap";
+    }
+    for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+        kfree(blocks[i]);
+    kmalloc_get_stats(&after);
+    if (!error && (after.large_allocs != before.large_allocs || after.bad_frees != before.bad_frees))
+        error = "large block accounting";
+    return error;
+}
+SELFTEST(slab, slab_selftest);
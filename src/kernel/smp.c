@@ -0,0 +1,321 @@
+#include <kernel/smp.h>
+#include <kernel/acpi.h>
+#include <kernel/apic.h>
+#include <kernel/gdt.h>
+#include <kernel/idt.h>
+#include <kernel/paging.h>
+#include <kernel/klib.h>
+#include <kernel/pmm.h>
+#include <kernel/sched.h>
+#include <kernel/timer.h>
+#include <kernel/prof.h>
+#include <kernel/cmdline.h>
+#include <kernel/serial.h>
+#include <kernel/vga.h>
+#include <kernel/io.h>
+#include <kernel/cpu.h>
+
+#define AP_STARTUP_TIMEOUT_MS 100
+
+/* trampoline.asm (trampoline64.asm on x86_64) */
+extern const char trampoline_start[];
+extern const char trampoline_end[];
+extern const char trampoline_params[];
+
+// Filled in, in the copy at SMP_TRAMPOLINE_BASE, before each start
+struct trampoline_params {
+    uintptr_t stack;
+    uintptr_t entry;
+    uintptr_t arg;
+#ifdef __x86_64__
+    uint32_t cr3;              // Long mode needs paging before any C code runs
+#endif
+};
+
+static struct cpu cpus[SMP_MAX_CPUS];
+static uintptr_t ap_stacks[SMP_MAX_CPUS];
+static volatile uint32_t cpu_count = 1;
+static int percpu_ready = 0;
+
+void smp_early_init(void) {
+    cpus[0].self = &cpus[0];
+    cpus[0].id = 0;
+    cpus[0].online = 1;
+    gdt_load_cpu_segment(0, &cpus[0], sizeof(cpus[0]));
+    percpu_ready = 1;
+}
+
+uint32_t smp_cpu_count(void) {
+    return cpu_count;
+}
+
+struct cpu* smp_cpu(uint32_t id) {
+    return &cpus[id];
+}
+
+uint32_t smp_cpu_id(void) {
+    return percpu_ready ? this_cpu()->id : 0;
+}
+
+// The other CPUs tick off their local APIC timer, CPU 0 off the PIT
+static void ap_timer_irq(struct interrupt_frame* frame) {
+    prof_sample(interrupt_frame_ip(frame));
+    sched_tick();
+}
+
+// Nothing to do here: isr_dispatch() acknowledges it and calls
+// sched_preempt(), which picks up the thread that was queued for us
+static void reschedule_ipi(struct interrupt_frame* frame) {
+    (void)frame;
+}
+
+// First C code on another CPU, on its idle stack with paging still off
+// (on x86_64 the trampoline had to turn it on to reach long mode)
+static void ap_main(struct cpu* cpu) {
+    paging_init_ap();
+    gdt_init_ap();
+    gdt_load_cpu_segment(cpu->id, cpu, sizeof(*cpu));
+    idt_init_ap();
+    klib_init_ap();
+    apic_init_ap();
+    sched_init_ap(ap_stacks[cpu->id]);
+    lapic_timer_start(TIMER_HZ);
+    cpu->online = 1;
+    sched_idle();
+}
+
+static int start_cpu(uint32_t id, uint8_t apic_id) {
+    struct cpu* cpu = &cpus[id];
+    uintptr_t stack = pmm_alloc(THREAD_STACK_ORDER);
+    if (!stack)
+        return 0;
+
+    memset(cpu, 0, sizeof(*cpu));
+    cpu->self = cpu;
+    cpu->id = id;
+    cpu->apic_id = apic_id;
+    ap_stacks[id] = stack;
+
+    struct trampoline_params* params =
+        (struct trampoline_params*)(SMP_TRAMPOLINE_BASE + (trampoline_params - trampoline_start));
+    params->stack = stack + (PAGE_SIZE << THREAD_STACK_ORDER);
+    params->entry = (uintptr_t)ap_main;
+    params->arg = (uintptr_t)cpu;
+#ifdef __x86_64__
+    params->cr3 = read_cr3(); // The tables paging_init() built, all below 4 GiB
+#endif
+
+    // INIT, then two STARTUPs as the MP specification asks
+    lapic_send_init(apic_id);
+    ksleep_ms(10);
+    lapic_send_startup(apic_id, SMP_TRAMPOLINE_BASE);
+    kdelay_us(200);
+    lapic_send_startup(apic_id, SMP_TRAMPOLINE_BASE);
+
+    uint64_t deadline = ktime_ns() + AP_STARTUP_TIMEOUT_MS * 1000000ULL;
+    while (!cpu->online && ktime_ns() < deadline)
+        ksleep_ms(1);
+    if (cpu->online)
+        return 1;
+
+    // Park it in wait-for-SIPI, so it cannot turn up later on a stack and
+    // a slot that go to someone else
+    lapic_send_init(apic_id);
+    ksleep_ms(10);
+    pmm_free(stack, THREAD_STACK_ORDER);
+    ap_stacks[id] = 0;
+    return 0;
+}
+
+void smp_init(void) {
+    static struct acpi_madt_info madt; // apic.c keeps a pointer to it
+    uint32_t limit = SMP_MAX_CPUS;
+    char value[4];
+
+    if (cmdline_get("dexis.smp", value, sizeof(value)) && value[0] >= '1' && value[0] <= '9' && !value[1])
+        limit = (uint32_t)(value[0] - '0');
+    if (!acpi_parse_madt(&madt))
+        return;
+
+    uint32_t flags = irq_save();
+    int ok = apic_init(&madt);
+    if (ok)
+        cpus[0].apic_id = lapic_id();
+    irq_restore(flags);
+    if (!ok)
+        return;
+    idt_set_handler(APIC_TIMER_VECTOR, ap_timer_irq);
+    idt_set_handler(APIC_RESCHEDULE_VECTOR, reschedule_ipi);
+
+    // The page is below PMM_LOW_LIMIT and never handed out, so the
+    // trampoline stays there for good
+    size_t size = (size_t)(trampoline_end - trampoline_start);
+    memcpy((void*)SMP_TRAMPOLINE_BASE, trampoline_start, size);
+
+    for (uint32_t i = 0; i < madt.cpu_count && cpu_count < limit; i++) {
+        if (madt.cpu_apic_ids[i] == cpus[0].apic_id)
+            continue;
+        // start_cpu() parks a CPU that did not come up, its slot is free
+        // for the next one
+        if (!start_cpu(cpu_count, madt.cpu_apic_ids[i])) {
+            terminal_write("SMP: CPU with APIC id ");
+            terminal_write_dec(madt.cpu_apic_ids[i]);
+            terminal_write(" did not start\n");
+            continue;
+        }
+        cpu_count++;
+    }
+
+    terminal_write("CPUs: ");
+    terminal_write_dec(cpu_count);
+    terminal_write("\n");
+}
+
+/* ---- Parallel benchmark ---- */
+
+#define PBENCH_MIN_ORDER 6  // 256 KiB, if there is no 4 MiB block left
+#define PBENCH_PASSES 4
+
+static struct {
+    const uint32_t* words;
+    uint32_t count;
+    uint32_t threads;
+    uint32_t sums[SMP_MAX_CPUS];
+    uint32_t running;        // Workers not finished, under the done lock
+    struct wait_queue done;
+} pbench = { .done = WAIT_QUEUE_INIT };
+
+static void pbench_worker(void* arg) {
+    uint32_t index = (uint32_t)(uintptr_t)arg;
+    // [count * index / threads, count * (index + 1) / threads), so every
+    // word is summed whatever the thread count
+    uint32_t first = (uint32_t)((uint64_t)pbench.count * index / pbench.threads);
+    uint32_t per = (uint32_t)((uint64_t)pbench.count * (index + 1) / pbench.threads) - first;
+    const uint32_t* words = pbench.words + first;
+    uint32_t sum = 0;
+
+    for (int pass = 0; pass < PBENCH_PASSES; pass++) {
+        for (uint32_t i = 0; i < per; i++)
+            sum += (words[i] * 0x9E3779B1u) ^ (words[i] >> 15);
+    }
+    pbench.sums[index] = sum;
+
+    uint32_t flags = wait_queue_lock(&pbench.done);
+    uint32_t left = --pbench.running;
+    wait_queue_unlock(&pbench.done, flags);
+    if (!left)
+        wait_queue_wake_all(&pbench.done);
+}
+
+// One run with the given number of threads, returns its time in ns (0 if
+// a thread could not be started) and the checksum in sum
+static uint64_t pbench_run(uint32_t threads, uint32_t* sum) {
+    pbench.threads = threads;
+    pbench.running = threads;
+    uint64_t start = ktime_ns();
+    for (uint32_t i = 0; i < threads; i++) {
+        if (!thread_create_on("pbench", pbench_worker, (void*)(uintptr_t)i, THREAD_PRIORITY_DEFAULT,
+                              i % smp_cpu_count())) {
+            // Let the ones already started finish before the buffer goes
+            uint32_t flags = wait_queue_lock(&pbench.done);
+            pbench.running -= threads - i;
+            wait_queue_unlock(&pbench.done, flags);
+            threads = 0;
+            break;
+        }
+    }
+
+    uint32_t flags = wait_queue_lock(&pbench.done);
+    while (pbench.running) {
+        wait_queue_sleep(&pbench.done, flags, 0);
+        flags = wait_queue_lock(&pbench.done);
+    }
+    wait_queue_unlock(&pbench.done, flags);
+    uint64_t ns = ktime_ns() - start;
+    if (!threads)
+        return 0;
+
+    *sum = 0;
+    for (uint32_t i = 0; i < threads; i++)
+        *sum += pbench.sums[i];
+    return ns ? ns : 1;
+}
+
+int smp_bench(uint32_t max_threads) {
+    uint32_t order = PMM_MAX_ORDER;
+    uintptr_t buffer = 0;
+    while (!(buffer = pmm_alloc(order)) && order > PBENCH_MIN_ORDER)
+        order--;
+    if (!buffer) {
+        terminal_write("pbench: out of memory\n");
+        return 0;
+    }
+
+    if (!max_threads)
+        max_threads = smp_cpu_count();
+    if (max_threads > SMP_MAX_CPUS)
+        max_threads = SMP_MAX_CPUS;
+
+    pbench.words = (const uint32_t*)buffer;
+    pbench.count = (PAGE_SIZE << order) / sizeof(uint32_t);
+    uint32_t seed = 12345;
+    for (uint32_t i = 0; i < pbench.count; i++) {
+        seed = seed * 1103515245u + 12345u;
+        ((uint32_t*)buffer)[i] = seed;
+    }
+
+    terminal_write("Checksum over ");
+    terminal_write_dec((PAGE_SIZE << order) / 1024);
+    terminal_write(" KiB x ");
+    terminal_write_dec(PBENCH_PASSES);
+    terminal_write(", ");
+    terminal_write_dec(smp_cpu_count());
+    terminal_write(" CPUs\n");
+
+    int ok = 1;
+    uint64_t base_ns = 0;
+    uint32_t base_sum = 0;
+    for (uint32_t threads = 1; threads <= max_threads; ) {
+        uint32_t sum;
+        uint64_t ns = pbench_run(threads, &sum);
+        if (!ns) {
+            terminal_write("pbench: thread_create failed\n");
+            ok = 0;
+            break;
+        }
+        if (threads == 1) {
+            base_ns = ns;
+            base_sum = sum;
+        } else if (sum != base_sum) {
+            ok = 0;
+        }
+        uint32_t speedup = (uint32_t)(base_ns * 100 / ns);
+
+        terminal_write("  ");
+        terminal_write_dec(threads);
+        terminal_write(threads == 1 ? " thread:  " : " threads: ");
+        terminal_write_dec((uint32_t)(ns / 1000));
+        terminal_write(" us, x");
+        terminal_write_dec(speedup / 100);
+        terminal_write(".");
+        terminal_putchar('0' + speedup / 10 % 10);
+        terminal_putchar('0' + speedup % 10);
+        terminal_write(sum == base_sum ? "\n" : ", checksum mismatch\n");
+
+        serial_write("PBENCH threads=");
+        serial_write_dec(threads);
+        serial_write(" ns=");
+        serial_write_dec((uint32_t)ns);
+        serial_write(" speedup_x100=");
+        serial_write_dec(speedup);
+        serial_write("\r\n");
+
+        // 1, 2, 4 ... and max_threads itself when it is not a power of two
+        if (threads == max_threads)
+            break;
+        threads = threads * 2 > max_threads ? max_threads : threads * 2;
+    }
+
+    pmm_free(buffer, order);
+    return ok;
+}
@@ -0,0 +1,224 @@
+#include <kernel/timer.h>
+#include <kernel/cpu.h>
+#include <kernel/idt.h>
+#include <kernel/io.h>
+#include <kernel/spinlock.h>
+#include <kernel/selftest.h>
+#include <kernel/prof.h>
+#include <kernel/sched.h>
+#include <stddef.h>
+
+#define PIT_FREQUENCY 1193182
+#define PIT_CHANNEL0 0x40
+#define PIT_CHANNEL2 0x42
+#define PIT_COMMAND 0x43
+#define PIT_GATE_PORT 0x61
+
+#define CALIBRATE_MS 10
+#define CALIBRATE_RUNS 3
+
+static volatile uint64_t ticks = 0;
+static uint32_t tsc_khz = 0;
+static uint64_t tsc_base = 0;
+
+/*
+ * TSC to nanoseconds: ns = (cycles * tsc_mult) >> tsc_shift, with the
+ * shift picked at calibration so the multiplier fits in 32 bits.
+ */
+static uint32_t tsc_mult = 0;
+static uint32_t tsc_shift = 0;
+
+static struct ktimer* timer_list = NULL; // Sorted by expiry, soonest first
+static struct ktimer* volatile timer_running = NULL; // Callback in progress
+static spinlock_t timer_lock = SPINLOCK_INIT;    // The list, ticks and timer_running
+
+static inline uint64_t mul_u64_u32_shr(uint64_t a, uint32_t mul, uint32_t shift) {
+    uint32_t ah = a >> 32, al = (uint32_t)a;
+    uint64_t ret = ((uint64_t)al * mul) >> shift;
+    if (ah)
+        ret += ((uint64_t)ah * mul) << (32 - shift);
+    return ret;
+}
+
+// Count TSC cycles over CALIBRATE_MS using PIT channel 2 in one-shot mode
+static uint64_t timer_calibrate_once(void) {
+    uint16_t count = PIT_FREQUENCY / (1000 / CALIBRATE_MS);
+
+    outb(PIT_GATE_PORT, (inb(PIT_GATE_PORT) & ~0x02) | 0x01); // Gate on, speaker off
+    outb(PIT_COMMAND, 0xB0);                                   // Channel 2, lo/hi, mode 0
+    outb(PIT_CHANNEL2, count & 0xFF);
+    outb(PIT_CHANNEL2, count >> 8);
+
+    uint64_t start = rdtsc();
+    while (!(inb(PIT_GATE_PORT) & 0x20)) // OUT2 goes high at terminal count
+        ;
+    return rdtsc() - start;
+}
+
+static void timer_calibrate_tsc(void) {
+    if (!(cpuid_features_edx() & CPUID_FEAT_TSC))
+        return;
+
+    // Every run can only overshoot (port I/O, VM exits), keep the shortest
+    uint64_t best = ~0ULL;
+    for (int i = 0; i < CALIBRATE_RUNS; i++) {
+        uint64_t cycles = timer_calibrate_once();
+        if (cycles < best)
+            best = cycles;
+    }
+    tsc_khz = (uint32_t)(best / CALIBRATE_MS);
+    if (tsc_khz == 0)
+        return;
+
+    tsc_shift = 32;
+    while (tsc_shift > 0 && (NS_PER_MS << tsc_shift) / tsc_khz > 0xFFFFFFFFULL)
+        tsc_shift--;
+    tsc_mult = (uint32_t)((NS_PER_MS << tsc_shift) / tsc_khz);
+    tsc_base = rdtsc();
+}
+
+static void timer_irq(struct interrupt_frame* frame) {
+    spin_lock(&timer_lock);
+    ticks++;
+    spin_unlock(&timer_lock);
+    prof_sample(interrupt_frame_ip(frame));
+    sched_tick();
+
+    if (!timer_list)
+        return;
+    uint64_t now = ktime_ns();
+    spin_lock(&timer_lock);
+    while (timer_list && timer_list->expires <= now) {
+        struct ktimer* t = timer_list;
+        timer_list = t->next;
+        t->next = NULL;
+        // Callbacks may take other locks (the scheduler's), so they run
+        // without ours; ktimer_cancel() waits for a running one to finish
+        timer_running = t;
+        spin_unlock(&timer_lock);
+        t->callback(t->arg);
+        spin_lock(&timer_lock);
+        timer_running = NULL;
+    }
+    spin_unlock(&timer_lock);
+}
+
+void timer_init(void) {
+    uint16_t divisor = PIT_FREQUENCY / TIMER_HZ;
+
+    timer_calibrate_tsc();
+
+    outb(PIT_COMMAND, 0x34); // Channel 0, lo/hi, mode 2 (rate generator)
+    outb(PIT_CHANNEL0, divisor & 0xFF);
+    outb(PIT_CHANNEL0, divisor >> 8);
+    irq_register_handler(0, timer_irq);
+}
+
+uint64_t timer_ticks(void) {
+    uint32_t flags = spin_lock_irqsave(&timer_lock);
+    uint64_t value = ticks;
+    spin_unlock_irqrestore(&timer_lock, flags);
+    return value;
+}
+
+uint32_t timer_tsc_khz(void) {
+    return tsc_khz;
+}
+
+uint64_t timer_cycles_to_ns(uint64_t cycles) {
+    if (!tsc_mult)
+        return 0;
+    return mul_u64_u32_shr(cycles, tsc_mult, tsc_shift);
+}
+
+uint64_t ktime_ns(void) {
+    if (tsc_mult)
+        return mul_u64_u32_shr(rdtsc() - tsc_base, tsc_mult, tsc_shift);
+    return timer_ticks() * (NS_PER_SEC / TIMER_HZ);
+}
+
+void ksleep_ns(uint64_t ns) {
+    uint64_t deadline = ktime_ns() + ns;
+    while (ktime_ns() < deadline) {
+        // Other threads run meanwhile. Without any, this is a hlt and the
+        // next PIT tick is at most 1 ms away.
+        wait_queue_sleep(NULL, irq_save(), deadline);
+    }
+}
+
+void ksleep_ms(uint32_t ms) {
+    ksleep_ns(ms * NS_PER_MS);
+}
+
+void kdelay_us(uint32_t us) {
+    uint64_t deadline = ktime_ns() + us * NS_PER_US;
+    while (ktime_ns() < deadline)
+        __asm__ volatile ("pause");
+}
+
+void ktimer_arm(struct ktimer* timer, uint64_t deadline, void (*callback)(void* arg), void* arg) {
+    uint32_t flags = spin_lock_irqsave(&timer_lock);
+    struct ktimer** link = &timer_list;
+
+    timer->expires = deadline;
+    timer->callback = callback;
+    timer->arg = arg;
+    while (*link && (*link)->expires <= deadline)
+        link = &(*link)->next;
+    timer->next = *link;
+    *link = timer;
+    spin_unlock_irqrestore(&timer_lock, flags);
+}
+
+void ktimer_cancel(struct ktimer* timer) {
+    uint32_t flags = spin_lock_irqsave(&timer_lock);
+    for (struct ktimer** link = &timer_list; *link; link = &(*link)->next) {
+        if (*link == timer) {
+            *link = timer->next;
+            timer->next = NULL;
+            break;
+        }
+    }
+    // Another CPU may be in its callback, the caller is about to reuse or
+    // free the timer
+    while (timer_running == timer) {
+        spin_unlock(&timer_lock);
+        cpu_relax();
+        spin_lock(&timer_lock);
+    }
+    spin_unlock_irqrestore(&timer_lock, flags);
+}
+
+/* Self-test, see selftest.h. Needs interrupts enabled */
+static void selftest_timer_fired(void* arg) {
+    *(volatile int*)arg = 1;
+}
+
+static const char* timer_selftest(void) {
+    static volatile int fired;
+    static struct ktimer timer;
+
+    uint64_t last = ktime_ns();
+    for (int i = 0; i < 10000; i++) {
+        uint64_t now = ktime_ns();
+        if (now < last)
+            return "ktime_ns went backwards";
+        last = now;
+    }
+
+    fired = 0;
+    uint64_t start = ktime_ns();
+    ktimer_arm(&timer, start + 5 * NS_PER_MS, selftest_timer_fired, (void*)&fired);
+    ksleep_ms(20);
+    uint64_t elapsed = ktime_ns() - start;
+    if (!fired) {
+        ktimer_cancel(&timer);
+        return "ktimer did not fire";
+    }
+    if (elapsed < 20 * NS_PER_MS)
+        return "ksleep_ms returned early";
+    if (elapsed > NS_PER_SEC)
+        return "ksleep_ms overslept";
+    return NULL;
+}
+SELFTEST(timer, timer_selftest);
@@ -0,0 +1,160 @@
+#include <kernel/trace.h>
+#include <kernel/vga.h>
+#include <kernel/serial.h>
+#include <kernel/timer.h>
+#include <kernel/cpu.h>
+#include <kernel/klib.h>
+#include <kernel/atomic.h>
+
+#if TRACE_RING_SIZE & (TRACE_RING_SIZE - 1)
+#error "TRACE_RING_SIZE must be a power of two"
+#endif
+
+struct trace_type {
+    const char* name;
+    int arg_is_string;
+};
+
+static const struct trace_type trace_types[TRACE_ID_COUNT] = {
+    [TRACE_KMAIN] = { "kmain", 1 },
+    [TRACE_TERMINAL_INIT] = { "terminal_init", 0 },
+    [TRACE_KEY] = { "key", 0 },
+    [TRACE_DSH_EXEC] = { "dsh_exec", 1 },
+    [TRACE_SCHED_SWITCH] = { "sched_switch", 0 },
+};
+
+/*
+ * One ring per CPU, so recording needs no lock: a locked xadd claims a
+ * slot. It has to be locked even though a ring is its CPU's own, a thread
+ * can be moved to another CPU between picking the ring and the xadd.
+ * The oldest events are overwritten once a ring is full.
+ */
+struct trace_ring {
+    uint32_t head;  // Events written, the next slot is head % TRACE_RING_SIZE
+    struct trace_record records[TRACE_RING_SIZE];
+} __attribute__((aligned(64)));
+
+static struct trace_ring trace_rings[TRACE_MAX_CPUS];
+static volatile int recording = 1;
+
+static inline struct trace_ring* this_cpu_ring(void) {
+    return &trace_rings[smp_cpu_id()];
+}
+
+void trace_event(uint16_t id, uint8_t phase, uint32_t arg) {
+    if (!recording)
+        return;
+    struct trace_ring* ring = this_cpu_ring();
+    uint32_t slot = atomic_fetch_add(&ring->head, 1);
+
+    struct trace_record* r = &ring->records[slot & (TRACE_RING_SIZE - 1)];
+    r->tsc = rdtsc();
+    r->id = id;
+    r->phase = phase;
+    r->arg = arg;
+}
+
+int trace_compiled_in(void) {
+#ifdef CONFIG_TRACE
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+void trace_set_enabled(int enabled) {
+    recording = enabled;
+}
+
+int trace_enabled(void) {
+    return recording;
+}
+
+void trace_reset(void) {
+    int was = recording;
+    recording = 0;
+    for (int cpu = 0; cpu < TRACE_MAX_CPUS; cpu++)
+        trace_rings[cpu].head = 0;
+    recording = was;
+}
+
+uint32_t trace_count(void) {
+    uint32_t count = 0;
+    for (int cpu = 0; cpu < TRACE_MAX_CPUS; cpu++)
+        count += trace_rings[cpu].head;
+    return count;
+}
+
+static void serial_record(int cpu, const struct trace_record* r) {
+    const struct trace_type* type = &trace_types[r->id];
+    char phase = (char)r->phase;
+
+    serial_write("TRACE cpu=");
+    serial_write_dec(cpu);
+    serial_write(" tsc=");
+    serial_write_dec(r->tsc);
+    serial_write(" ph=");
+    serial_write_n(&phase, 1);
+    serial_write(" name=");
+    serial_write(type->name);
+    serial_write(" arg=");
+    if (type->arg_is_string)
+        serial_write(r->arg ? (const char*)(uintptr_t)r->arg : "");
+    else
+        serial_write_dec(r->arg);
+    serial_write("\r\n");
+}
+
+static void terminal_record(const struct trace_record* r, uint64_t first_tsc) {
+    const struct trace_type* type = &trace_types[r->id];
+    char phase[4] = { ' ', (char)r->phase, ' ', '\0' };
+
+    terminal_write_dec((uint32_t)(timer_cycles_to_ns(r->tsc - first_tsc) / NS_PER_US));
+    terminal_write(" us");
+    terminal_write(phase);
+    terminal_write(type->name);
+    terminal_write(" ");
+    if (type->arg_is_string)
+        terminal_write(r->arg ? (const char*)(uintptr_t)r->arg : "");
+    else
+        terminal_write_dec(r->arg);
+    terminal_write("\n");
+}
+
+uint32_t trace_dump(const char* filter, int serial) {
+    size_t filter_len = strlen(filter);
+    uint32_t printed = 0;
+    int was = recording;
+    recording = 0;
+
+    if (serial) {
+        serial_write("\r\nTRACE_BEGIN tsc_khz=");
+        serial_write_dec(timer_tsc_khz());
+        serial_write(" cpus=");
+        serial_write_dec(TRACE_MAX_CPUS);
+        serial_write("\r\n");
+    }
+    for (int cpu = 0; cpu < TRACE_MAX_CPUS; cpu++) {
+        const struct trace_ring* ring = &trace_rings[cpu];
+        uint32_t first = ring->head > TRACE_RING_SIZE ? ring->head - TRACE_RING_SIZE : 0;
+        uint64_t first_tsc = ring->records[first & (TRACE_RING_SIZE - 1)].tsc;
+
+        for (uint32_t i = first; i < ring->head; i++) {
+            const struct trace_record* r = &ring->records[i & (TRACE_RING_SIZE - 1)];
+            if (r->id >= TRACE_ID_COUNT || strncmp(trace_types[r->id].name, filter, filter_len) != 0)
+                continue;
+            if (serial)
+                serial_record(cpu, r);
+            else
+                terminal_record(r, first_tsc);
+            printed++;
+        }
+    }
+    if (serial) {
+        serial_write("TRACE_END count=");
+        serial_write_dec(printed);
+        serial_write("\r\n");
+    }
+    recording = was;
+    return printed;
+}
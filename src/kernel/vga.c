@@ -1,61 +1,299 @@
 #include <kernel/vga.h>
 #include <kernel/io.h>
+#include <kernel/klib.h>
+#include <kernel/bench.h>
+#include <kernel/trace.h>
+#include <kernel/spinlock.h>
+#include <kernel/smp.h>
 
-// Constants VGA
-#define VGA_WIDTH 80
-#define VGA_HEIGHT 25
-
-volatile uint16_t* vga_buffer = (uint16_t*)0xB8000; // Video memory address
+static volatile uint16_t* const vga_buffer = (uint16_t*)0xB8000; // Video memory address
 uint8_t terminal_color; // Color of the text
 size_t terminal_row = 0;
 size_t terminal_column = 0;
 
-/* Blinking cursor */
-void terminal_update_cursor(void) {
-    uint16_t pos = terminal_row * VGA_WIDTH + terminal_column;
+// Current geometry, VGA text mode until a framebuffer console takes over
+static size_t term_width = VGA_WIDTH;
+static size_t term_height = VGA_HEIGHT;
+
+/*
+ * All drawing goes to a RAM shadow copy of the screen. Its rows form a
+ * ring (screen line y lives in shadow[(shadow_top + y) % term_height]) so
+ * scrolling only moves shadow_top. terminal_flush() then hands the dirty
+ * span of each line to the backend, skipping cells that already show the
+ * same value (front[] mirrors what the backend shows, for the lines marked
+ * in front_valid[]). Video memory is never read back.
+ */
+static uint16_t shadow[TERMINAL_MAX_HEIGHT][TERMINAL_MAX_WIDTH];
+static uint16_t front[TERMINAL_MAX_HEIGHT * TERMINAL_MAX_WIDTH];
+static uint8_t front_valid[TERMINAL_MAX_HEIGHT];
+static size_t shadow_top = 0;
+static uint8_t dirty_start[TERMINAL_MAX_HEIGHT]; // First dirty column of a screen line
+static uint8_t dirty_end[TERMINAL_MAX_HEIGHT];   // One past the last dirty column, 0 = clean
+
+// Lines scrolled since the last flush, for backends that can move what
+// they show instead of redrawing it
+static size_t pending_scroll = 0;
+
+static struct terminal_stats stats;
+
+/*
+ * Output is batched: terminal_write_n() only touches the shadow buffer,
+ * video memory and the hardware cursor are updated at the next
+ * terminal_flush(). Outside of terminal_batch_begin()/terminal_batch_end()
+ * every write flushes on its own, so plain callers see output immediately.
+ */
+static unsigned int batch_depth = 0;
+static uint16_t cursor_committed = 0xFFFF; // Position last sent to the CRTC
+
+// Optional second output (the serial console) that gets every byte we print
+static terminal_mirror_t volatile terminal_mirror = NULL;
+
+// Optional diversion ahead of both (dsh pipelines)
+static terminal_capture_t volatile terminal_capture = NULL;
+
+/*
+ * Every thread, IRQ handler and CPU prints through here, so the state
+ * above (and the backend, which runs inside) is under one lock, held
+ * with interrupts off. The mirror and capture hooks run outside it, with
+ * interrupts as the caller had them: the serial mirror only queues bytes
+ * for its IRQ when interrupts are on, and the capture hook allocates.
+ * The CPU holding the lock can take it again: the entry points call each
+ * other, and an exception or panic in the middle of a write still gets
+ * its message out.
+ */
+#define CONSOLE_NO_OWNER 0xFFFFFFFF
+static spinlock_t console_lock = SPINLOCK_INIT;
+static volatile uint32_t console_owner = CONSOLE_NO_OWNER;
+static uint32_t console_depth;
+
+static uint32_t console_lock_irqsave(void) {
+    uint32_t flags = irq_save();
+    uint32_t cpu = smp_cpu_id();
+    if (console_owner != cpu) {
+        spin_lock(&console_lock);
+        console_owner = cpu;
+    }
+    console_depth++;
+    return flags;
+}
+
+static void console_unlock_irqrestore(uint32_t flags) {
+    if (--console_depth == 0) {
+        console_owner = CONSOLE_NO_OWNER;
+        spin_unlock(&console_lock);
+    }
+    irq_restore(flags);
+}
+
+/* VGA text mode backend: cells are stored as they are */
+static void vga_text_draw(size_t x, size_t y, uint16_t entry) {
+    vga_buffer[y * VGA_WIDTH + x] = entry;
+}
+
+static void vga_text_cursor(size_t x, size_t y) {
+    uint16_t pos = y * VGA_WIDTH + x;
     outb(0x3D4, 0x0F);
     outb(0x3D5, (uint8_t)(pos & 0xFF));
     outb(0x3D4, 0x0E);
     outb(0x3D5, (uint8_t)((pos >> 8) & 0xFF));
+    stats.port_writes += 4;
 }
 
-// Scroll the terminal up by one line
-static void terminal_scroll(void) {
-    // Moving strings up
-    for (size_t y = 1; y < VGA_HEIGHT; y++) {
-        for (size_t x = 0; x < VGA_WIDTH; x++) {
-            vga_buffer[(y - 1) * VGA_WIDTH + x] = vga_buffer[y * VGA_WIDTH + x];
+const struct terminal_backend vga_text_backend = {
+    .name = "vga-text",
+    .draw = vga_text_draw,
+    .cursor = vga_text_cursor,
+};
+
+static const struct terminal_backend* backend = &vga_text_backend;
+
+static inline uint16_t* terminal_line(size_t y) {
+    size_t r = shadow_top + y;
+    if (r >= term_height)
+        r -= term_height;
+    return shadow[r];
+}
+
+static inline void terminal_mark_dirty(size_t y, size_t x0, size_t x1) {
+    if (dirty_end[y] == 0) {
+        dirty_start[y] = x0;
+        dirty_end[y] = x1;
+        return;
+    }
+    if (x0 < dirty_start[y])
+        dirty_start[y] = x0;
+    if (x1 > dirty_end[y])
+        dirty_end[y] = x1;
+}
+
+static void terminal_mark_all_dirty(void) {
+    for (size_t y = 0; y < term_height; y++) {
+        dirty_start[y] = 0;
+        dirty_end[y] = term_width;
+    }
+}
+
+static inline void terminal_store(size_t x, size_t y, uint16_t entry) {
+    terminal_line(y)[x] = entry;
+    terminal_mark_dirty(y, x, x + 1);
+    stats.cell_stores++;
+}
+
+// Let the backend move what it shows by the lines scrolled since the last
+// flush; front[] moves along and the new bottom lines count as unknown
+static void terminal_flush_scroll(void) {
+    size_t lines = pending_scroll;
+    pending_scroll = 0;
+    if (!backend->scroll || lines >= term_height)
+        return;
+
+    backend->scroll(lines);
+    cursor_committed = 0xFFFF;  // The backend took its cursor down
+    memmove(front, front + lines * term_width, (term_height - lines) * term_width * sizeof(uint16_t));
+    memmove(front_valid, front_valid + lines, term_height - lines);
+    memset(front_valid + term_height - lines, 0, lines);
+}
+
+void terminal_flush(void) {
+    uint32_t flags = console_lock_irqsave();
+    stats.flushes++;
+    if (pending_scroll)
+        terminal_flush_scroll();
+    for (size_t y = 0; y < term_height; y++) {
+        if (dirty_end[y] == 0)
+            continue;
+        const uint16_t* line = terminal_line(y);
+        uint16_t* shown = &front[y * term_width];
+        for (size_t x = dirty_start[y]; x < dirty_end[y]; x++) {
+            uint16_t entry = line[x];
+            if (front_valid[y] && shown[x] == entry)
+                continue;
+            shown[x] = entry;
+            backend->draw(x, y, entry);
+            stats.mmio_writes++;
         }
+        dirty_end[y] = 0;
+        front_valid[y] = 1;
     }
-    // Clear the bottom line
-    for (size_t x = 0; x < VGA_WIDTH; x++) {
-        vga_buffer[(VGA_HEIGHT - 1) * VGA_WIDTH + x] = vga_entry(' ', terminal_color);
+    // After the cells: a framebuffer draws its cursor over them
+    terminal_update_cursor();
+    if (backend->present)
+        backend->present();
+    console_unlock_irqrestore(flags);
+}
+
+// Forget what video memory holds, the next flush repaints every cell
+void terminal_invalidate(void) {
+    uint32_t flags = console_lock_irqsave();
+    memset(front_valid, 0, sizeof(front_valid));
+    pending_scroll = 0;
+    cursor_committed = 0xFFFF;
+    terminal_mark_all_dirty();
+    console_unlock_irqrestore(flags);
+}
+
+/* Blinking cursor, only reprogrammed when it actually moved */
+void terminal_update_cursor(void) {
+    uint32_t flags = console_lock_irqsave();
+    uint16_t pos = terminal_row * term_width + terminal_column;
+    if (pos != cursor_committed) {
+        cursor_committed = pos;
+        backend->cursor(terminal_column, terminal_row);
     }
-    terminal_row = VGA_HEIGHT - 1;
+    console_unlock_irqrestore(flags);
+}
+
+// Scroll the terminal up by one line
+void terminal_scroll(void) {
+    uint32_t flags = console_lock_irqsave();
+    // The old top line becomes the new bottom line
+    if (++shadow_top == term_height)
+        shadow_top = 0;
+    memsetw(terminal_line(term_height - 1), vga_entry(' ', terminal_color), term_width);
+    terminal_mark_all_dirty();
+    terminal_row = term_height - 1;
+    if (pending_scroll < term_height)
+        pending_scroll++;
+    stats.scrolls++;
+    console_unlock_irqrestore(flags);
+}
+
+void terminal_set_backend(const struct terminal_backend* next, size_t width, size_t height) {
+    uint32_t flags = console_lock_irqsave();
+    if (width > TERMINAL_MAX_WIDTH)
+        width = TERMINAL_MAX_WIDTH;
+    if (height > TERMINAL_MAX_HEIGHT)
+        height = TERMINAL_MAX_HEIGHT;
+
+    // Keep the text: the lines up to the cursor that fit, top-aligned.
+    // front[] is repainted anyway, so it holds them in the meantime
+    size_t first = terminal_row + 1 > height ? terminal_row + 1 - height : 0;
+    size_t lines = term_height - first, cols = term_width < width ? term_width : width;
+    if (lines > height)
+        lines = height;
+    for (size_t y = 0; y < lines; y++)
+        memcpy(&front[y * cols], terminal_line(first + y), cols * sizeof(uint16_t));
+
+    backend = next;
+    term_width = width;
+    term_height = height;
+    shadow_top = 0;
+    memsetw(&shadow[0][0], vga_entry(' ', terminal_color), TERMINAL_MAX_WIDTH * TERMINAL_MAX_HEIGHT);
+    for (size_t y = 0; y < lines; y++)
+        memcpy(shadow[y], &front[y * cols], cols * sizeof(uint16_t));
+    terminal_row -= first;
+    if (terminal_column >= width)
+        terminal_column = width - 1;
+
+    terminal_invalidate();
+    if (batch_depth == 0)
+        terminal_flush();
+    console_unlock_irqrestore(flags);
+}
+
+const struct terminal_backend* terminal_get_backend(void) {
+    return backend;
+}
+
+size_t terminal_width(void) {
+    return term_width;
+}
+
+size_t terminal_height(void) {
+    return term_height;
 }
 
 void terminal_initialize(void) {
+    TRACE_BEGIN(TRACE_TERMINAL_INIT, 0);
+    uint32_t flags = console_lock_irqsave();
     terminal_color = vga_entry_color(VGA_COLOR_WHITE, VGA_COLOR_BLACK);
     terminal_row = 0;
     terminal_column = 0;
-    for (size_t y = 0; y < VGA_HEIGHT; y++) {
-        for (size_t x = 0; x < VGA_WIDTH; x++) {
-            const size_t index = y * VGA_WIDTH + x;
-            vga_buffer[index] = vga_entry(' ', terminal_color);
-        }
-    }
-    terminal_update_cursor();
+    shadow_top = 0;
+    memsetw(&shadow[0][0], vga_entry(' ', terminal_color), TERMINAL_MAX_WIDTH * TERMINAL_MAX_HEIGHT);
+    terminal_invalidate(); // Screen and hardware cursor are unknown
+    terminal_flush();
     terminal_enable_cursor();
+    console_unlock_irqrestore(flags);
+    TRACE_END(TRACE_TERMINAL_INIT, 0);
 }
 
-void terminal_putchar(char c) {
+void terminal_putentryat(char c, uint8_t color, size_t x, size_t y) {
+    uint32_t flags = console_lock_irqsave();
+    if (x < term_width && y < term_height)
+        terminal_store(x, y, vga_entry(c, color));
+    console_unlock_irqrestore(flags);
+}
+
+// Put one character into the shadow buffer, no hardware access
+static void terminal_emit(char c) {
+    stats.bytes++;
     if (c == '\n') {
         terminal_column = 0;
         terminal_row++;
-        if (terminal_row >= VGA_HEIGHT) {
+        if (terminal_row >= term_height) {
             terminal_scroll();
         }
-        terminal_update_cursor();
         return;
     }
     
@@ -65,37 +303,145 @@ void terminal_putchar(char c) {
             terminal_column--;
         } else if (terminal_row > 0) { 
             terminal_row--;
-            terminal_column = VGA_WIDTH - 1;
+            terminal_column = term_width - 1;
         }
-        const size_t index = terminal_row * VGA_WIDTH + terminal_column;
-        vga_buffer[index] = vga_entry(' ', terminal_color);
-        terminal_update_cursor();
+        terminal_store(terminal_column, terminal_row, vga_entry(' ', terminal_color));
         return;
     }
 
-    const size_t index = terminal_row * VGA_WIDTH + terminal_column;
-    vga_buffer[index] = vga_entry(c, terminal_color);
+    terminal_store(terminal_column, terminal_row, vga_entry(c, terminal_color));
 
-    if (++terminal_column == VGA_WIDTH) {
+    if (++terminal_column == term_width) {
         terminal_column = 0;
         terminal_row++;
-        if (terminal_row >= VGA_HEIGHT) {
+        if (terminal_row >= term_height) {
             terminal_scroll();
         }
     }
-    terminal_update_cursor();
 }
 
-void terminal_write(const char* str) {
-    for (size_t i = 0; str[i] != '\0'; i++) {
-        terminal_putchar(str[i]);
+void terminal_putchar(char c) {
+    terminal_write_n(&c, 1);
+}
+
+void terminal_write_n(const char* str, size_t len) {
+    terminal_capture_t capture = terminal_capture;
+    if (capture && capture(str, len))
+        return;
+
+    uint32_t flags = console_lock_irqsave();
+    for (size_t i = 0; i < len; i++) {
+        terminal_emit(str[i]);
     }
+    if (batch_depth == 0)
+        terminal_flush();
+    terminal_mirror_t mirror = terminal_mirror;
+    console_unlock_irqrestore(flags);
+
+    if (mirror)
+        mirror(str, len);
+}
+
+void terminal_write(const char* str) {
+    size_t len = 0;
+    while (str[len] != '\0')
+        len++;
+    terminal_write_n(str, len);
+}
+
+terminal_mirror_t terminal_set_mirror(terminal_mirror_t mirror) {
+    uint32_t flags = console_lock_irqsave();
+    terminal_mirror_t prev = terminal_mirror;
+    terminal_mirror = mirror;
+    console_unlock_irqrestore(flags);
+    return prev;
+}
+
+terminal_capture_t terminal_set_capture(terminal_capture_t capture) {
+    uint32_t flags = console_lock_irqsave();
+    terminal_capture_t prev = terminal_capture;
+    terminal_capture = capture;
+    console_unlock_irqrestore(flags);
+    return prev;
+}
+
+void terminal_batch_begin(void) {
+    uint32_t flags = console_lock_irqsave();
+    batch_depth++;
+    console_unlock_irqrestore(flags);
+}
+
+void terminal_batch_end(void) {
+    uint32_t flags = console_lock_irqsave();
+    if (batch_depth > 0 && --batch_depth == 0)
+        terminal_flush();
+    console_unlock_irqrestore(flags);
+}
+
+void terminal_write_dec(uint32_t value) {
+    char buf[11];
+    size_t i = sizeof(buf) - 1;
+    buf[i] = '\0';
+    do {
+        buf[--i] = '0' + value % 10;
+        value /= 10;
+    } while (value);
+    terminal_write(&buf[i]);
+}
+
+void terminal_write_hex(uint32_t value) {
+    static const char digits[] = "0123456789ABCDEF";
+    char buf[11] = "0x";
+    for (int i = 0; i < 8; i++)
+        buf[2 + i] = digits[(value >> (28 - i * 4)) & 0xF];
+    buf[10] = '\0';
+    terminal_write(buf);
+}
+
+void terminal_write_ptr(uintptr_t value) {
+    static const char digits[] = "0123456789ABCDEF";
+    char buf[2 + 2 * sizeof(uintptr_t) + 1] = "0x";
+    for (size_t i = 0; i < 2 * sizeof(uintptr_t); i++)
+        buf[2 + i] = digits[(value >> ((2 * sizeof(uintptr_t) - 1 - i) * 4)) & 0xF];
+    buf[sizeof(buf) - 1] = '\0';
+    terminal_write(buf);
 }
 
 void terminal_enable_cursor(void) {
-    // Set cursor start and end
-    outb(0x3D4, 0x0A);
-    outb(0x3D5, 0x00);  // Beginning of the scanline (for example, 0, eg 1 px high)
-    outb(0x3D4, 0x0B);
-    outb(0x3D5, 0x0F);  // End of the scanline (for example, 15, eg 16 px high)
+    uint32_t flags = console_lock_irqsave();
+    if (backend == &vga_text_backend) {  // Other backends draw their own cursor
+        // Set cursor start and end
+        outb(0x3D4, 0x0A);
+        outb(0x3D5, 0x00);  // Beginning of the scanline (for example, 0, eg 1 px high)
+        outb(0x3D4, 0x0B);
+        outb(0x3D5, 0x0F);  // End of the scanline (for example, 15, eg 16 px high)
+        stats.port_writes += 4;
+    }
+    console_unlock_irqrestore(flags);
+}
+
+void terminal_get_stats(struct terminal_stats* out) {
+    *out = stats;
+}
+
+void terminal_reset_stats(void) {
+    struct terminal_stats zero = {0};
+    stats = zero;
+}
+
+/* Benchmarks, see bench.h. Each call flushes like an unbatched caller */
+static void bench_putchar(void) {
+    terminal_putchar('x');
+}
+BENCH(terminal_putchar, bench_putchar, NULL, NULL, 4000);
+
+static void bench_write(void) {
+    terminal_write("The quick brown fox jumps over the lazy dog 0123456789\n");
+}
+BENCH(terminal_write, bench_write, NULL, NULL, 2000);
+
+static void bench_scroll(void) {
+    terminal_scroll();
+    terminal_flush();
 }
+BENCH(terminal_scroll, bench_scroll, NULL, NULL, 2000);
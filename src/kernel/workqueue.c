@@ -0,0 +1,131 @@
+#include <kernel/workqueue.h>
+#include <kernel/ring.h>
+#include <kernel/sched.h>
+#include <kernel/timer.h>
+#include <kernel/selftest.h>
+
+// Must be a power of two. An item is queued once at most, so this only
+// has to cover the distinct items pending at the same time.
+#define WORK_QUEUE_SIZE 256
+
+static struct mpsc_slot work_slots[WORK_QUEUE_SIZE];
+static struct mpsc_ring work_ring = MPSC_RING_INIT(work_slots);
+static struct wait_queue work_waiters = WAIT_QUEUE_INIT;
+static struct thread* worker = NULL;
+static struct workqueue_stats stats;
+
+static void work_run(struct work* work) {
+    work->pending = 0; // Scheduling it again from here on queues another run
+    barrier();
+    work->func(work->arg);
+}
+
+static void worker_thread(void* arg) {
+    (void)arg;
+    while (1) {
+        uintptr_t value;
+        while (mpsc_pop(&work_ring, &value)) {
+            work_run((struct work*)value);
+            stats.run++;
+        }
+        // A producer that claimed a slot but has not filled it yet makes
+        // the ring look non-empty, that only costs another pass
+        uint32_t flags = wait_queue_lock(&work_waiters);
+        if (mpsc_empty(&work_ring))
+            wait_queue_sleep(&work_waiters, flags, 0);
+        else
+            wait_queue_unlock(&work_waiters, flags);
+    }
+}
+
+void workqueue_init(void) {
+    // Above every other thread, deferred work is what IRQs would have
+    // done right away
+    worker = thread_create("kworker", worker_thread, NULL, 0);
+}
+
+int work_schedule(struct work* work) {
+    if (atomic_cmpxchg(&work->pending, 0, 1) != 0)
+        return 0;
+    if (!worker) {
+        atomic_inc(&stats.direct);
+        work_run(work);
+        return 1;
+    }
+    if (!mpsc_push(&work_ring, (uintptr_t)work)) {
+        work->pending = 0;
+        atomic_inc(&stats.dropped);
+        return 0;
+    }
+    atomic_inc(&stats.queued);
+    wait_queue_wake_all(&work_waiters);
+    return 1;
+}
+
+void workqueue_get_stats(struct workqueue_stats* out) {
+    *out = stats;
+}
+
+/* Self-test, see selftest.h */
+#define STRESS_THREADS 3
+#define STRESS_REQUESTS 20000
+#define STRESS_TIMEOUT_MS 5000
+
+static struct {
+    volatile uint32_t requested;  // Bumped before every work_schedule()
+    volatile uint32_t handled;    // requested as the last run saw it
+    volatile uint32_t finished;
+    uint32_t runs;
+} wq_stress;
+
+static void stress_work(void* arg) {
+    (void)arg;
+    wq_stress.handled = wq_stress.requested;
+    wq_stress.runs++;
+}
+
+static struct work stress_item = WORK_INIT(stress_work, NULL);
+
+static void stress_producer(void* arg) {
+    (void)arg;
+    for (uint32_t i = 0; i < STRESS_REQUESTS; i++) {
+        atomic_inc(&wq_stress.requested);
+        work_schedule(&stress_item);
+    }
+    atomic_inc(&wq_stress.finished);
+}
+
+// Producers on every CPU hammer one item: it must coalesce, and a request
+// made while it runs must never be lost
+static const char* workqueue_selftest(void) {
+    struct thread* self = thread_current();
+    if (!worker || !self)
+        return NULL; // No worker thread, items run at once anyway
+
+    wq_stress.requested = 0;
+    wq_stress.handled = 0;
+    wq_stress.finished = 0;
+    wq_stress.runs = 0;
+    uint32_t started = 0;
+    for (; started < STRESS_THREADS; started++) {
+        if (!thread_create("wq_stress", stress_producer, NULL, self->priority))
+            break;
+    }
+
+    uint64_t deadline = 0; // Counted from when the producers are done
+    while (wq_stress.finished < started || wq_stress.handled != started * STRESS_REQUESTS) {
+        if (wq_stress.finished == started) {
+            if (!deadline)
+                deadline = ktime_ns() + STRESS_TIMEOUT_MS * NS_PER_MS;
+            else if (ktime_ns() > deadline)
+                return "request lost";
+        }
+        ksleep_ms(1);
+    }
+    if (started < STRESS_THREADS)
+        return "thread_create failed";
+    if (wq_stress.runs == 0 || wq_stress.runs > started * STRESS_REQUESTS)
+        return "bad run count";
+    return NULL;
+}
+SELFTEST(workqueue, workqueue_selftest);